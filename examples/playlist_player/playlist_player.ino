@@ -0,0 +1,135 @@
+/**
+ * @file playlist_player.ino
+ * @brief Gapless playlist demo - plays every tune on LittleFS back to back
+ * 
+ * Builds a playlist from the tune index and plays it without gaps: while
+ * one deck plays, the other gets the next tune ready. A change between a
+ * SID and a YM tune crossfades through the mixer.
+ * 
+ * To upload tunes to the filesystem:
+ * 1. Place .sid, .ym or .ymd files in the 'data' folder in your project root
+ * 2. Run: pio run -t uploadfs
+ * 
+ * NOTE: This requires gateware with the SID, YM2149 and mixer cores.
+ */
+
+#include <SPI.h>
+#include <LittleFS.h>
+#include <PapilioAudio.h>
+
+// SPI pins for ESP32-S3
+#define SPI_SCK   12
+#define SPI_MISO  13
+#define SPI_MOSI  11
+#define SPI_CS    10
+
+// Two decks per chip: one plays, the other loads the next tune
+SID6581 sid(WB_AUDIO_SID_BASE);
+SIDPlayer sidA(&sid);
+SIDPlayer sidB(&sid);
+YM2149 ym(WB_AUDIO_YM2149_BASE);
+YMPlayer ymA(ym);
+YMPlayer ymB(ym);
+AudioMixer mixer(WB_AUDIO_MIXER_BASE);
+
+Playlist playlist(&sidA, &sidB, &ymA, &ymB, &mixer);
+TuneLibrary library;
+
+void fillPlaylist() {
+    TuneFilter all = { TUNE_TYPE_ALL, 0, NULL };
+    TuneEntry entry;
+    uint32_t cursor = 0;
+    char path[TUNE_LIBRARY_PATH_MAX];
+    
+    playlist.clear();
+    while (playlist.count() < PLAYLIST_MAX_ENTRIES && library.find(all, cursor, &entry, 1)) {
+        if (!library.getPath(entry, path, sizeof(path))) continue;
+        
+        // SID tunes play their default song for the default length
+        playlist.add(path, entry.startSong);
+    }
+    
+    Serial.print("Playlist: ");
+    Serial.print(playlist.count());
+    Serial.println(" tunes");
+}
+
+void printCurrent() {
+    const PlaylistEntry* entry = playlist.getEntry(playlist.getCurrent());
+    if (!entry) return;
+    Serial.print("Now playing: ");
+    Serial.println(entry->path);
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+    Serial.println("Gapless Playlist Demo");
+    
+    if (!LittleFS.begin(true)) {
+        Serial.println("LittleFS mount failed!");
+        while (1) delay(100);
+    }
+    
+    SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI, SPI_CS);
+    wishboneInit(&SPI, SPI_CS);
+    
+    // Chips and mixer, with the channel levels the fades return to
+    sidA.begin();
+    sidB.begin();
+    ym.begin();
+    mixer.begin();
+    mixer.setSIDVolume(200);
+    mixer.setYM2149Volume(200);
+    
+    // The background SID init runs on core 0
+    sidA.startTask();
+    sidB.startTask();
+    
+    if (!library.begin()) {
+        library.update("/");
+    }
+    fillPlaylist();
+    
+    playlist.begin();
+    playlist.setDefaultLength(120000);     // Two minutes per SID tune
+    playlist.setCrossfade(2000);
+    if (!playlist.play()) {
+        Serial.println("Nothing to play!");
+        return;
+    }
+    printCurrent();
+    
+    Serial.println("\nCommands:");
+    Serial.println("  s     - Skip to the next tune");
+    Serial.println("  x     - Stop/Start");
+}
+
+void loop() {
+    if (Serial.available()) {
+        char cmd = Serial.read();
+        switch (cmd) {
+            case 's':
+            case 'S':
+                playlist.skip();
+                break;
+            case 'x':
+            case 'X':
+                if (playlist.isPlaying()) {
+                    playlist.stop();
+                    Serial.println("Stopped");
+                } else if (playlist.play()) {
+                    printCurrent();
+                }
+                break;
+        }
+    }
+    
+    // Plays the decks and gets the next tune ready
+    static uint8_t current = PLAYLIST_NO_ENTRY;
+    playlist.update();
+    if (playlist.getCurrent() != current) {
+        current = playlist.getCurrent();
+        printCurrent();
+    }
+}
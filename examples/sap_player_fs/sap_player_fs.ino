@@ -0,0 +1,111 @@
+/**
+ * @file sap_player_fs.ino
+ * @brief SAP Player demo - plays an Atari .sap file from LittleFS
+ * 
+ * To upload SAP files to the filesystem:
+ * 1. Place music.sap in the 'data' folder in your project root
+ * 2. Run: pio run -t uploadfs -e sap_player_fs
+ * 
+ * NOTE: This requires the POKEY gateware to be loaded into the FPGA.
+ * 
+ * Hardware:
+ *   - Papilio Arcade board with POKEY gateware
+ *   - Audio output on audio_left/audio_right pins
+ */
+
+#include <SPI.h>
+#include <LittleFS.h>
+#include <PapilioAudio.h>
+
+// SPI pins for ESP32-S3
+#define SPI_SCK   12
+#define SPI_MISO  13
+#define SPI_MOSI  11
+#define SPI_CS    10
+
+POKEY pokey(WB_AUDIO_POKEY_BASE);
+SAPPlayer player(&pokey);
+
+void printSong() {
+    Serial.print("Sub-song: ");
+    Serial.print(player.getCurrentSong() + 1);
+    Serial.print("/");
+    Serial.println(player.getNumSongs());
+    
+    uint32_t ms = player.getSongDuration(player.getCurrentSong());
+    if (ms) {
+        Serial.print("Length: ");
+        Serial.print(ms / 1000);
+        Serial.println("s");
+    }
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+    
+    Serial.println("=================================");
+    Serial.println("  SAP Player - Filesystem Demo");
+    Serial.println("  Atari 8-bit Music Player");
+    Serial.println("=================================");
+    
+    if (!LittleFS.begin(true)) {
+        Serial.println("LittleFS mount failed!");
+        while(1) delay(100);
+    }
+    
+    // Initialize SPI for FPGA communication
+    SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI, SPI_CS);
+    wishboneInit(&SPI, SPI_CS);
+    
+    player.begin();
+    
+    // Only send the POKEY registers that changed in each play call
+    player.setWriteMode(SAP_WRITE_COALESCED);
+    
+    if (!player.loadFile("/music.sap")) {
+        Serial.println("Failed to load /music.sap");
+        while(1) delay(100);
+    }
+    
+    Serial.print("Title: ");
+    Serial.println(player.getTitle());
+    Serial.print("Author: ");
+    Serial.println(player.getAuthor());
+    Serial.print("Date: ");
+    Serial.println(player.getDate());
+    printSong();
+    
+    // Play rate from the tune's FASTPLAY tag
+    player.startTimer();
+    player.play(true);
+    
+    Serial.println("\nCommands:");
+    Serial.println("  p     - Play/Pause");
+    Serial.println("  n     - Next sub-song");
+    Serial.println("  b     - Previous sub-song");
+}
+
+void loop() {
+    if (Serial.available()) {
+        char cmd = Serial.read();
+        switch (cmd) {
+            case 'p':
+            case 'P':
+                player.play(!player.isPlaying());
+                Serial.println(player.isPlaying() ? "Playing" : "Paused");
+                break;
+            case 'n':
+                player.nextSong();
+                printSong();
+                break;
+            case 'b':
+                player.prevSong();
+                printSong();
+                break;
+        }
+    }
+    
+    // Update player (runs 6502 emulator)
+    player.update();
+}
@@ -14,7 +14,6 @@
 
 #include <SPI.h>
 #include <PapilioAudio.h>
-#include <Ticker.h>
 
 // SPI pins for ESP32-S3
 #define SPI_SCK   12
@@ -30,16 +29,6 @@
 SID6581 sid(WB_AUDIO_SID_BASE);
 SIDPlayer player(&sid);
 
-// Timer for 50Hz playback interrupt
-Ticker playTimer;
-
-// Flag for timer callback
-volatile bool timerFlag = false;
-
-void IRAM_ATTR onTimer() {
-    timerFlag = true;
-}
-
 void setup() {
     Serial.begin(115200);
     delay(1000);
@@ -71,8 +60,8 @@ void setup() {
         Serial.print("Sub-songs: ");
         Serial.println(player.getNumSongs());
         
-        // Start 50Hz timer (PAL timing)
-        playTimer.attach_ms(20, onTimer);  // 50Hz = 20ms period
+        // Start the play call timer (rate taken from the tune)
+        player.startTimer();
         
         // Start playback
         player.play(true);
@@ -90,12 +79,6 @@ void setup() {
 }
 
 void loop() {
-    // Process timer callback
-    if (timerFlag) {
-        timerFlag = false;
-        player.timerCallback();
-    }
-    
     // Update player (runs 6502 emulator)
     player.update();
     
@@ -131,7 +114,7 @@ void loop() {
                 
             case 'r':
             case 'R':
-                player.loadFromMemory(sidtune_Layla_Mix, sizeof(sidtune_Layla_Mix));
+                player.restart();
                 player.play(true);
                 Serial.println("Restarted");
                 break;
@@ -8,6 +8,7 @@
  * To upload SID files to the filesystem:
  * 1. Place .sid files in the 'data' folder in your project root
  * 2. Run: pio run -t uploadfs -e sid_player_fs
+ * 3. Send 'u' to re-index them (the index is built on the first boot)
  * 
  * NOTE: This requires the SID gateware to be loaded into the FPGA.
  * 
@@ -19,7 +20,6 @@
 #include <SPI.h>
 #include <LittleFS.h>
 #include <PapilioAudio.h>
-#include <Ticker.h>
 
 // SPI pins for ESP32-S3
 #define SPI_SCK   12
@@ -27,60 +27,57 @@
 #define SPI_MOSI  11
 #define SPI_CS    10
 
+// Uncomment to run the 6502 emulator on core 0 instead of inside loop()
+// #define SID_EMULATION_TASK
+
+// Uncomment to take play ticks from the SID slave's frame_irq on this GPIO
+// #define FRAME_TICK_PIN 9
+
 // Create SID and player instances
 SID6581 sid(WB_AUDIO_SID_BASE);
 SIDPlayer player(&sid);
 
-// Timer for 50Hz playback interrupt
-Ticker playTimer;
-
-// Flag for timer callback
-volatile bool timerFlag = false;
-
-// List of SID files found
-#define MAX_SID_FILES 20
-String sidFiles[MAX_SID_FILES];
-int numSidFiles = 0;
-int currentFileIndex = 0;
+// Index of the tunes on the filesystem, so startup does not open every file
+TuneLibrary library;
+TuneFilter sidFilter = { TUNE_TYPE_SID, 0, NULL };
+uint32_t numSidFiles = 0;
+uint32_t currentEntry = 0;     // Library entry of the loaded file
 
-void IRAM_ATTR onTimer() {
-    timerFlag = true;
-}
-
-void listSidFiles() {
-    numSidFiles = 0;
-    File root = LittleFS.open("/");
-    if (!root) {
-        Serial.println("Failed to open root directory");
+void indexFiles() {
+    Serial.println("Indexing tunes...");
+    if (!library.update("/")) {
+        Serial.println("Failed to write the tune index");
         return;
     }
-    
-    File file = root.openNextFile();
-    while (file && numSidFiles < MAX_SID_FILES) {
-        String name = file.name();
-        if (name.endsWith(".sid") || name.endsWith(".SID")) {
-            sidFiles[numSidFiles] = "/" + name;
-            Serial.print("Found: ");
-            Serial.println(sidFiles[numSidFiles]);
-            numSidFiles++;
-        }
-        file = root.openNextFile();
-    }
-    
-    Serial.print("Total SID files found: ");
-    Serial.println(numSidFiles);
+    Serial.print("Indexed ");
+    Serial.print(library.count());
+    Serial.print(" tunes (");
+    Serial.print(library.getParsed());
+    Serial.println(" new or changed)");
 }
 
-bool loadCurrentFile() {
-    if (numSidFiles == 0) {
+// First SID entry at or after from, wrapping around
+bool findSidEntry(uint32_t from, uint32_t& index) {
+    TuneEntry entry;
+    uint32_t cursor = from;
+    if (library.find(sidFilter, cursor, &entry, 1, &index)) return true;
+    cursor = 0;
+    return library.find(sidFilter, cursor, &entry, 1, &index) > 0;
+}
+
+bool loadEntry(uint32_t index) {
+    TuneEntry entry;
+    char path[TUNE_LIBRARY_PATH_MAX];
+    if (!library.getEntry(index, entry) || !library.getPath(entry, path, sizeof(path))) {
         Serial.println("No SID files found!");
         return false;
     }
+    currentEntry = index;
     
     Serial.print("Loading: ");
-    Serial.println(sidFiles[currentFileIndex]);
+    Serial.println(path);
     
-    if (!player.loadFile(sidFiles[currentFileIndex].c_str())) {
+    if (!player.loadFile(path)) {
         Serial.println("Failed to load SID file!");
         return false;
     }
@@ -99,21 +96,56 @@ bool loadCurrentFile() {
 }
 
 void nextFile() {
+    uint32_t index;
     player.play(false);
-    currentFileIndex = (currentFileIndex + 1) % numSidFiles;
-    if (loadCurrentFile()) {
+    if (findSidEntry(currentEntry + 1, index) && loadEntry(index)) {
         player.play(true);
     }
 }
 
 void prevFile() {
+    // The SID entry before the current one, or the last one
+    TuneEntry entry;
+    uint32_t cursor = 0;
+    uint32_t index;
+    uint32_t prev = currentEntry;
+    while (library.find(sidFilter, cursor, &entry, 1, &index)) {
+        if (index >= currentEntry && prev != currentEntry) break;
+        prev = index;
+    }
     player.play(false);
-    currentFileIndex = (currentFileIndex - 1 + numSidFiles) % numSidFiles;
-    if (loadCurrentFile()) {
+    if (loadEntry(prev)) {
         player.play(true);
     }
 }
 
+void listFiles() {
+    TuneEntry page[8];
+    uint32_t indices[8];
+    uint32_t cursor = 0;
+    uint16_t n;
+    
+    Serial.println("\nSID Files:");
+    while ((n = library.find(sidFilter, cursor, page, 8, indices)) > 0) {
+        for (uint16_t i = 0; i < n; i++) {
+            Serial.print(indices[i] == currentEntry ? "> " : "  ");
+            Serial.print(page[i].title);
+            Serial.print(" - ");
+            Serial.print(page[i].author);
+            Serial.print(" (");
+            Serial.print(page[i].numSongs);
+            Serial.println(page[i].numSongs == 1 ? " song)" : " songs)");
+        }
+    }
+}
+
+void printFilePosition() {
+    Serial.print("File: ");
+    Serial.print(currentEntry + 1);
+    Serial.print("/");
+    Serial.println(library.count());
+}
+
 void setup() {
     Serial.begin(115200);
     delay(1000);
@@ -138,11 +170,18 @@ void setup() {
     
     // Initialize SID and player
     player.begin();
+#ifdef SID_EMULATION_TASK
+    player.startTask();
+#endif
     
-    // List all SID files
-    listSidFiles();
+    // Open the tune index, building it on the first run
+    if (!library.begin()) {
+        indexFiles();
+    }
+    numSidFiles = library.countMatches(sidFilter);
     
-    if (numSidFiles == 0) {
+    uint32_t first;
+    if (numSidFiles == 0 || !findSidEntry(0, first)) {
         Serial.println("No SID files found in filesystem!");
         Serial.println("Place .sid files in 'data' folder and run:");
         Serial.println("  pio run -t uploadfs -e sid_player_fs");
@@ -150,9 +189,13 @@ void setup() {
     }
     
     // Load first file
-    if (loadCurrentFile()) {
-        // Start 50Hz timer for PAL playback
-        playTimer.attach(0.02, onTimer);  // 50Hz = 20ms
+    if (loadEntry(first)) {
+        // Start the play call timer (rate taken from the tune)
+#ifdef FRAME_TICK_PIN
+        player.attachFrameTick(FRAME_TICK_PIN);
+#else
+        player.startTimer();
+#endif
         
         Serial.println("\nPlaying...");
         player.play(true);
@@ -166,6 +209,7 @@ void setup() {
     Serial.println("  B     - Previous file");
     Serial.println("  r     - Restart current song");
     Serial.println("  l     - List all files");
+    Serial.println("  u     - Re-index the filesystem");
 }
 
 void loop() {
@@ -194,43 +238,35 @@ void loop() {
                 break;
             case 'N':
                 nextFile();
-                Serial.print("File: ");
-                Serial.print(currentFileIndex + 1);
-                Serial.print("/");
-                Serial.println(numSidFiles);
+                printFilePosition();
                 break;
             case 'B':
                 prevFile();
-                Serial.print("File: ");
-                Serial.print(currentFileIndex + 1);
-                Serial.print("/");
-                Serial.println(numSidFiles);
+                printFilePosition();
                 break;
             case 'r':
             case 'R':
-                loadCurrentFile();
+                player.restart();
                 player.play(true);
                 Serial.println("Restarted");
                 break;
             case 'l':
             case 'L':
-                Serial.println("\nSID Files:");
-                for (int i = 0; i < numSidFiles; i++) {
-                    Serial.print(i == currentFileIndex ? "> " : "  ");
-                    Serial.print(i + 1);
-                    Serial.print(". ");
-                    Serial.println(sidFiles[i]);
+                listFiles();
+                break;
+            case 'u':
+            case 'U':
+                // Entries move when files are added, so reload from the start
+                player.play(false);
+                indexFiles();
+                numSidFiles = library.countMatches(sidFilter);
+                if (findSidEntry(0, currentEntry) && loadEntry(currentEntry)) {
+                    player.play(true);
                 }
                 break;
         }
     }
     
-    // Process timer tick
-    if (timerFlag) {
-        player.timerCallback();
-        timerFlag = false;
-    }
-    
     // Update player (runs 6502 emulator)
     player.update();
 }
@@ -4,6 +4,7 @@
  * 
  * Plays music.ymd file from LittleFS filesystem.
  * Upload the music.ymd file to LittleFS using PlatformIO's data folder.
+ * YM5/YM6 .ym files (packed or not) play the same way, just change the path.
  * 
  * NOTE: This requires the YM2149 gateware to be loaded into the FPGA.
  */
@@ -63,13 +64,16 @@ void loop() {
     // Process MCP commands
     PapilioMCP.update();
     
-    // Update player at 50Hz (20ms)
+    // Update player at the tune's frame rate (20ms for 50Hz)
     static unsigned long lastUpdate = 0;
-    if (millis() - lastUpdate >= 20) {
-        lastUpdate = millis();
+    if (micros() - lastUpdate >= player.getFramePeriod()) {
+        lastUpdate = micros();
         player.update();
     }
     
+    // Read frames ahead while idle
+    player.prefetch();
+    
     // Show status every 5 seconds
     static unsigned long lastStatus = 0;
     if (millis() - lastStatus > 5000) {
@@ -34,6 +34,42 @@
 -- Changelog:
 --
 -- 0.1: First version
+-- 0.2: Inputs 4 and 5 for a second and third SID (default silent)
+-- 0.3: PCM sample channel fed from a FIFO on a Wishbone port
+-- 0.4: Control, volume and volume ramp registers
+--
+-- Control and volume (offsets in the 32-byte mixer window):
+--   0x00: R/W: bit 0 = enable, bits 1-3 = channel 1-3 enable, bit 7 = mute
+--   0x01: W: Master volume target, R: master volume now
+--   0x02: W: Channel 1 (SID, inputs 1, 4 and 5) volume target, R: volume now
+--   0x03: W: Channel 2 (YM2149) volume target, R: volume now
+--   0x04: W: Channel 3 (POKEY) volume target, R: volume now
+--   0x05: R: bits 0-3 = master, channel 1-3 volume at its target (ramp done)
+--   0x0B-0x0E: R/W: Ramp rate of the master and channels 1-3
+--
+-- Each volume moves to its target by rate 1/256 steps every ramp tick
+-- (clk / 2^RAMP_DIV_LOG2, 5859 Hz at 96 MHz), so one write starts a whole
+-- fade. Rate 0 (the reset value) makes a target write take effect at once.
+-- Volumes are applied to every sample and 255 is unity gain; the PCM
+-- channel has only the master volume. A disabled channel and a muted or
+-- disabled mixer are silent.
+--
+-- PCM sample channel (offsets in the 32-byte mixer window, one register
+-- per Wishbone word):
+--   0x06: W: bit 0 = PCM enable, bit 1 = clear FIFO and underrun flag
+--         R: bit 0 = enabled, bit 1 = empty, bit 2 = full, bit 3 = underrun
+--   0x07: R/W: Sample period Lo (clk cycles per sample, minus one)
+--   0x08: R/W: Sample period Hi
+--   0x09: R: FIFO fill level Lo
+--   0x0A: R: FIFO fill level Hi
+--   0x10-0x1F: W: Push a signed 8-bit sample
+--
+-- The data window spans 16 addresses so an incrementing burst can push
+-- 16 samples at a time. A push to a full FIFO is held off until the
+-- channel has taken the next sample. While enabled the channel takes one
+-- sample per period and repeats the last one when the FIFO runs dry
+-- (setting the underrun flag). A disabled channel is silent. The Wishbone
+-- port must be clocked by clk.
 --
 
 library ieee;
@@ -47,6 +83,10 @@ library board;
   use board.zpupkg.all;
   
 entity AUDIO_zpuino_sa_audiomixer is
+  generic (
+    PCM_DEPTH_LOG2: integer := 9;     -- 512 samples (8..15)
+    RAMP_DIV_LOG2: integer := 14      -- Volume ramp tick divider
+  );
 	port (
     clk:      	in std_logic;
     rst:      	in std_logic;
@@ -55,6 +95,11 @@ entity AUDIO_zpuino_sa_audiomixer is
     data_in1:  	in std_logic_vector(17 downto 0);
     data_in2:  	in std_logic_vector(17 downto 0);
     data_in3:  	in std_logic_vector(17 downto 0);
+    data_in4:  	in std_logic_vector(17 downto 0) := (others => '0');
+    data_in5:  	in std_logic_vector(17 downto 0) := (others => '0');
+    
+    wishbone_in:  in std_logic_vector(61 downto 0) := (others => '0');
+    wishbone_out: out std_logic_vector(33 downto 0);
     
     audio_out: 	out std_logic
     );
@@ -63,16 +108,62 @@ end entity AUDIO_zpuino_sa_audiomixer;
 architecture behave of AUDIO_zpuino_sa_audiomixer is
 
 -- divier per input
-signal cnt_div: 			std_logic_vector(1 downto 0) := (others => '0');
+signal cnt_div: 			std_logic_vector(2 downto 0) := (others => '0');
 
--- accumulator for each input, on 9 bits, enough for 3 inputs@8bits
-signal audio_mix: 		std_logic_vector(19 downto 0) := (others => '0'); 
+-- accumulator on 21 bits, enough for 6 inputs@18bits
+signal audio_mix: 		std_logic_vector(20 downto 0) := (others => '0'); 
 
 -- to store final accumulator value
-signal audio_final: 		std_logic_vector(19 downto 0) := (others => '0');
+signal audio_final: 		std_logic_vector(20 downto 0) := (others => '0');
 signal current_input:	std_logic_vector(17 downto 0) := (others => '0');
+signal current_gain:	std_logic_vector(8 downto 0) := (others => '0');
+signal scaled_input:	std_logic_vector(17 downto 0) := (others => '0');
+signal master_mix:		std_logic_vector(20 downto 0) := (others => '0');
 signal data_out:			std_logic_vector(17 downto 0) := (others => '0');
 
+-- Volumes: 0 = master, 1-3 = channels, levels in 1/256 steps
+type vol_array_t is array (0 to 3) of std_logic_vector(7 downto 0);
+type level_array_t is array (0 to 3) of std_logic_vector(15 downto 0);
+type gain_array_t is array (0 to 3) of std_logic_vector(8 downto 0);
+signal mix_control:		std_logic_vector(7 downto 0) := x"0F";
+signal vol_target:		vol_array_t := (others => x"FF");
+signal vol_rate:			vol_array_t := (others => x"00");
+signal vol_level:			level_array_t := (others => x"FF00");
+signal vol_gain:			gain_array_t;
+signal vol_done:			std_logic_vector(3 downto 0);
+signal ramp_cnt:			std_logic_vector(RAMP_DIV_LOG2-1 downto 0) := (others => '0');
+signal ramp_tick:			std_logic;
+
+-- Wishbone
+signal wb_dat_i:			std_logic_vector(31 downto 0);
+signal wb_adr_i:			std_logic_vector(26 downto 2);
+signal wb_we_i:				std_logic;
+signal wb_cyc_i:			std_logic;
+signal wb_stb_i:			std_logic;
+signal wb_dat_o:			std_logic_vector(31 downto 0) := (others => '0');
+signal wb_ack_o:			std_logic;
+signal reg_adr:				std_logic_vector(4 downto 0);
+
+-- PCM sample channel
+constant PCM_DEPTH: 		integer := 2**PCM_DEPTH_LOG2;
+type pcm_mem_t is array (0 to PCM_DEPTH-1) of std_logic_vector(7 downto 0);
+signal pcm_mem:				pcm_mem_t;
+signal pcm_wr_ptr:			std_logic_vector(PCM_DEPTH_LOG2-1 downto 0) := (others => '0');
+signal pcm_rd_ptr:			std_logic_vector(PCM_DEPTH_LOG2-1 downto 0) := (others => '0');
+signal pcm_level:			std_logic_vector(PCM_DEPTH_LOG2 downto 0) := (others => '0');
+signal pcm_level16:			std_logic_vector(15 downto 0);
+signal pcm_empty:			std_logic;
+signal pcm_full:			std_logic;
+signal pcm_push:			std_logic;
+signal pcm_pop:				std_logic;
+signal pcm_clear:			std_logic;
+signal pcm_enable:			std_logic := '0';
+signal pcm_underrun:		std_logic := '0';
+signal pcm_period:			std_logic_vector(15 downto 0) := x"2EDF";  -- 8 kHz at 96 MHz
+signal pcm_cnt:				std_logic_vector(15 downto 0) := (others => '0');
+signal pcm_sample:			std_logic_vector(7 downto 0) := (others => '0');
+signal pcm_data:			std_logic_vector(17 downto 0);
+
 -- DAC
 component AUDIO_zpuino_sa_sigmadeltaDAC is
   generic (
@@ -88,6 +179,19 @@ end component AUDIO_zpuino_sa_sigmadeltaDAC;
 
 begin
 
+	-- Unpack the wishbone array
+	wb_dat_i <= wishbone_in(59 downto 28);
+	wb_adr_i <= wishbone_in(27 downto 3);
+	wb_we_i  <= wishbone_in(2);
+	wb_cyc_i <= wishbone_in(1);
+	wb_stb_i <= wishbone_in(0);
+
+	wishbone_out(33 downto 2) <= wb_dat_o;
+	wishbone_out(1) <= wb_ack_o;
+	wishbone_out(0) <= '0';
+
+	reg_adr <= wb_adr_i(6 downto 2);
+
 	sdo: AUDIO_zpuino_sa_sigmadeltaDAC
 	generic map (
 		BITS =>  18
@@ -104,55 +208,262 @@ begin
 	begin
 		wait until rising_edge(clk);
 		if (ena = '1') then
-			if (cnt_div = "00") then
-				cnt_div <= "11";
+			if (cnt_div = "000") then
+				cnt_div <= "110";
 			else
 				cnt_div <= cnt_div - "1";
 			end if;
 		end if;
 	end process;	
 	
-	-- assign an input
-	p_chan_mixer : process(cnt_div, data_in1, data_in2, data_in3)
+	-- assign an input and the gain of its channel
+	p_chan_mixer : process(cnt_div, data_in1, data_in2, data_in3, data_in4, data_in5, pcm_data,
+	                       vol_gain, mix_control)
 	begin
 		current_input <= (others => DontCareValue);
-		case cnt_div(1 downto 0) is
-			when "11" =>
+		current_gain <= (others => '0');
+		case cnt_div(2 downto 0) is
+			when "110" =>
 				current_input <= data_in1;
-			when "10" =>
+				if (mix_control(1) = '1') then current_gain <= vol_gain(1); end if;
+			when "101" =>
 				current_input <= data_in2;
-			when "01" =>
+				if (mix_control(2) = '1') then current_gain <= vol_gain(2); end if;
+			when "100" =>
 				current_input <= data_in3;
-			when "00" => null; -- mix outputs become valid on this clock
+				if (mix_control(3) = '1') then current_gain <= vol_gain(3); end if;
+			when "011" =>
+				current_input <= data_in4;
+				if (mix_control(1) = '1') then current_gain <= vol_gain(1); end if;
+			when "010" =>
+				current_input <= data_in5;
+				if (mix_control(1) = '1') then current_gain <= vol_gain(1); end if;
+			when "001" =>
+				current_input <= pcm_data;
+				current_gain <= "100000000";
+			when "000" =>
+				current_input <= (others => '0'); -- mix outputs become valid on this clock
 			when others => null;
 		end case;
 	end process;	
 	
-	-- mixer process, input by input
+	-- mixer process, input by input: each input is scaled on its clock and
+	-- added on the next, so the sum of one round is complete on "110"
 	p_op_mixer : process
+		variable product: std_logic_vector(26 downto 0);
+		variable master: std_logic_vector(29 downto 0);
 	begin
 		wait until rising_edge(clk);
 
 		if (ena = '1') then	
+			product := current_input * current_gain;
+			scaled_input <= product(25 downto 8);
 	
-			if (cnt_div(1 downto 0) = "00") then
+			if (cnt_div(2 downto 0) = "110") then
 				audio_mix   <= (others => '0');
 				audio_final <= audio_mix;
 			else
-				audio_mix   <= audio_mix + ("00" & current_input);
+				audio_mix   <= audio_mix + ("000" & scaled_input);
 			end if;
 		end if;
 
+		if (mix_control(0) = '1' and mix_control(7) = '0') then
+			master := audio_final * vol_gain(0);
+			master_mix <= master(28 downto 8);
+		else
+			master_mix <= (others => '0');
+		end if;
+
 		if (rst='1') then
 			data_out(17 downto 0) <= (others => '0');
 		else
-			if (audio_final(19) = '0') then
-				data_out(17 downto 0) <= audio_final(18 downto 1);
+			if (master_mix(20 downto 19) = "00") then
+				data_out(17 downto 0) <= master_mix(18 downto 1);
 			else -- clip
 				data_out(17 downto 0) <= "111111111111111111";
 			end if;
 		end if;
   end process;	
 
+	-- Volumes and ramps -------------------------------------------------------
+
+	-- 255 is unity: gain = level + its top bit, 0..256
+	g_gain: for i in 0 to 3 generate
+		vol_gain(i) <= ('0' & vol_level(i)(15 downto 8)) + vol_level(i)(15);
+		vol_done(i) <= '1' when vol_level(i) = vol_target(i) & x"00" else '0';
+	end generate;
+
+	ramp_tick <= '1' when ramp_cnt = 0 else '0';
+
+	p_ramp_div : process
+	begin
+		wait until rising_edge(clk);
+		ramp_cnt <= ramp_cnt + 1;
+	end process;
+
+	p_vol_regs : process
+		variable target: std_logic_vector(15 downto 0);
+		variable rate: std_logic_vector(15 downto 0);
+	begin
+		wait until rising_edge(clk);
+		if (rst = '1') then
+			mix_control <= x"0F";
+			vol_target <= (others => x"FF");
+			vol_rate <= (others => x"00");
+			vol_level <= (others => x"FF00");
+		else
+			if (ramp_tick = '1') then
+				for i in 0 to 3 loop
+					target := vol_target(i) & x"00";
+					rate := x"00" & vol_rate(i);
+					if (vol_rate(i) = 0) then
+						vol_level(i) <= target;
+					elsif (vol_level(i) < target) then
+						if (target - vol_level(i) <= rate) then
+							vol_level(i) <= target;
+						else
+							vol_level(i) <= vol_level(i) + rate;
+						end if;
+					elsif (vol_level(i) > target) then
+						if (vol_level(i) - target <= rate) then
+							vol_level(i) <= target;
+						else
+							vol_level(i) <= vol_level(i) - rate;
+						end if;
+					end if;
+				end loop;
+			end if;
+
+			-- A write wins over the ramp tick on the same clock
+			if (wb_cyc_i = '1' and wb_stb_i = '1' and wb_we_i = '1') then
+				case reg_adr is
+					when "00000" =>
+						mix_control <= wb_dat_i(7 downto 0);
+					when "00001" | "00010" | "00011" | "00100" =>
+						vol_target(conv_integer(reg_adr) - 1) <= wb_dat_i(7 downto 0);
+						if (vol_rate(conv_integer(reg_adr) - 1) = 0) then
+							vol_level(conv_integer(reg_adr) - 1) <= wb_dat_i(7 downto 0) & x"00";
+						end if;
+					when "01011" | "01100" | "01101" | "01110" =>
+						vol_rate(conv_integer(reg_adr) - 11) <= wb_dat_i(7 downto 0);
+					when others => null;
+				end case;
+			end if;
+		end if;
+	end process;
+
+	-- PCM sample channel ------------------------------------------------------
+
+	pcm_empty <= '1' when pcm_level = 0 else '0';
+	pcm_full  <= pcm_level(PCM_DEPTH_LOG2);
+	pcm_level16 <= ext(pcm_level, 16);
+
+	-- A push to a full FIFO waits for the channel's next pop
+	wb_ack_o <= wb_cyc_i and wb_stb_i and
+	            not (wb_we_i and reg_adr(4) and pcm_full);
+
+	pcm_push  <= wb_cyc_i and wb_stb_i and wb_we_i and reg_adr(4) and not pcm_full;
+	pcm_clear <= '1' when (wb_cyc_i = '1' and wb_stb_i = '1' and wb_we_i = '1' and
+	                       reg_adr = "00110" and wb_dat_i(1) = '1') else '0';
+	pcm_pop   <= '1' when (pcm_enable = '1' and pcm_cnt = 0 and pcm_empty = '0') else '0';
+
+	-- Offset binary, silent while disabled
+	pcm_data <= (not pcm_sample(7)) & pcm_sample(6 downto 0) & "0000000000" when pcm_enable = '1'
+	            else (others => '0');
+
+	p_pcm_regs : process
+	begin
+		wait until rising_edge(clk);
+		if (rst = '1') then
+			pcm_enable <= '0';
+			pcm_period <= x"2EDF";
+		elsif (wb_cyc_i = '1' and wb_stb_i = '1' and wb_we_i = '1') then
+			case reg_adr is
+				when "00110" => pcm_enable <= wb_dat_i(0);
+				when "00111" => pcm_period(7 downto 0) <= wb_dat_i(7 downto 0);
+				when "01000" => pcm_period(15 downto 8) <= wb_dat_i(7 downto 0);
+				when others => null;
+			end case;
+		end if;
+	end process;
+
+	-- FIFO storage (no reset so it maps onto block RAM)
+	p_pcm_mem : process
+	begin
+		wait until rising_edge(clk);
+		if (pcm_push = '1') then
+			pcm_mem(conv_integer(pcm_wr_ptr)) <= wb_dat_i(7 downto 0);
+		end if;
+		if (pcm_pop = '1') then
+			pcm_sample <= pcm_mem(conv_integer(pcm_rd_ptr));
+		elsif (pcm_enable = '0') then
+			pcm_sample <= (others => '0');
+		end if;
+	end process;
+
+	p_pcm_fifo : process
+	begin
+		wait until rising_edge(clk);
+		if (rst = '1' or pcm_clear = '1') then
+			pcm_wr_ptr <= (others => '0');
+			pcm_rd_ptr <= (others => '0');
+			pcm_level <= (others => '0');
+			pcm_underrun <= '0';
+		else
+			if (pcm_push = '1') then
+				pcm_wr_ptr <= pcm_wr_ptr + 1;
+			end if;
+			if (pcm_pop = '1') then
+				pcm_rd_ptr <= pcm_rd_ptr + 1;
+			end if;
+			if (pcm_push = '1' and pcm_pop = '0') then
+				pcm_level <= pcm_level + 1;
+			elsif (pcm_push = '0' and pcm_pop = '1') then
+				pcm_level <= pcm_level - 1;
+			end if;
+			if (pcm_enable = '1' and pcm_cnt = 0 and pcm_empty = '1') then
+				pcm_underrun <= '1';
+			end if;
+		end if;
+	end process;
+
+	-- Sample-rate divider
+	p_pcm_rate : process
+	begin
+		wait until rising_edge(clk);
+		if (pcm_enable = '0' or pcm_cnt = 0) then
+			pcm_cnt <= pcm_period;
+		else
+			pcm_cnt <= pcm_cnt - 1;
+		end if;
+	end process;
+
+	p_rdata : process(reg_adr, pcm_enable, pcm_empty, pcm_full, pcm_underrun, pcm_period, pcm_level16,
+	                  mix_control, vol_level, vol_done, vol_rate)
+	begin
+		wb_dat_o <= (others => '0');
+		case reg_adr is
+			when "00000" =>
+				wb_dat_o(7 downto 0) <= mix_control;
+			when "00001" | "00010" | "00011" | "00100" =>
+				wb_dat_o(7 downto 0) <= vol_level(conv_integer(reg_adr) - 1)(15 downto 8);
+			when "00101" =>
+				wb_dat_o(3 downto 0) <= vol_done;
+			when "01011" | "01100" | "01101" | "01110" =>
+				wb_dat_o(7 downto 0) <= vol_rate(conv_integer(reg_adr) - 11);
+			when "00110" =>
+				wb_dat_o(3 downto 0) <= pcm_underrun & pcm_full & pcm_empty & pcm_enable;
+			when "00111" =>
+				wb_dat_o(7 downto 0) <= pcm_period(7 downto 0);
+			when "01000" =>
+				wb_dat_o(7 downto 0) <= pcm_period(15 downto 8);
+			when "01001" =>
+				wb_dat_o(7 downto 0) <= pcm_level16(7 downto 0);
+			when "01010" =>
+				wb_dat_o(7 downto 0) <= pcm_level16(15 downto 8);
+			when others => null;
+		end case;
+	end process;
+
 end behave;
 
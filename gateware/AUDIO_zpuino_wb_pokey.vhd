@@ -42,6 +42,14 @@
 -- version 001 initial release (this version should be considered Beta
 --   it seems to make all the right sort of sounds however ... )
 --
+-- Register bank (not part of the original chip), control at offset 0x10:
+--   W: bit 0 = stage writes to AUDF1-AUDCTL instead of applying them,
+--      bit 1 = commit the staged writes, bit 2 = apply the commit now
+--   R: bit 0 = staging enabled, bit 1 = commit pending
+-- A commit is applied in one clock on the next rising edge of frame_tick
+-- (the frame_irq of the SID slave), or at once with bit 2. Writes staged
+-- while it waits belong to the next commit.
+--
 library ieee;
   use ieee.std_logic_1164.all;
   use ieee.std_logic_arith.all;
@@ -58,7 +66,8 @@ entity AUDIO_zpuino_wb_pokey is
 	 wishbone_in : in std_logic_vector(61 downto 0);
 	 wishbone_out : out std_logic_vector(33 downto 0);
 
-	 data_out: 		out std_logic_vector(7 downto 0)  	--Digital data out - this should be fed into an audio mixer or Delta-Sigma DAC.
+	 data_out: 		out std_logic_vector(7 downto 0);  	--Digital data out - this should be fed into an audio mixer or Delta-Sigma DAC.
+	 frame_tick:	in std_logic := '0'					--Applies a committed register bank on its rising edge
   );
 end;
 
@@ -99,6 +108,21 @@ architecture RTL of AUDIO_zpuino_wb_pokey is
   signal skctls               : std_logic_vector(7 downto 0);
   --signal reset                : std_logic;
   --
+  -- register bank for AUDF1..AUDCTL
+  signal stage_regs           : array_8x8;
+  signal stage_audctl         : std_logic_vector(7 downto 0);
+  signal pend_regs            : array_8x8;
+  signal pend_audctl          : std_logic_vector(7 downto 0);
+  signal stage_dirty          : std_logic_vector(8 downto 0) := (others => '0');
+  signal pend_dirty           : std_logic_vector(8 downto 0) := (others => '0');
+  signal bank_stage           : std_logic := '0';
+  signal bank_now             : std_logic := '0';
+  signal bank_wr              : std_logic;
+  signal bank_ctrl            : std_logic;
+  signal bank_apply           : std_logic;
+  signal bank_pending         : std_logic;
+  signal frame_sync           : std_logic_vector(2 downto 0) := (others => '0');
+  --
   
   -- registers wb_dat_o
   --signal kbcode               : std_logic_vector(7 downto 0);
@@ -259,18 +283,86 @@ begin
     end if;
   end process;
 
+  -- register bank
+  bank_wr    <= wb_we_i and wb_cyc_i and wb_stb_i;
+  bank_ctrl  <= bank_wr and wb_adr_i(6) when wb_adr_i(5 downto 2) = x"0" else '0';
+  bank_pending <= '0' when pend_dirty = 0 else '1';
+  bank_apply <= bank_pending and (bank_now or (frame_sync(1) and not frame_sync(2)));
+
+  p_bank : process
+  begin
+    wait until rising_edge(wb_clk_i);
+    frame_sync <= frame_sync(1 downto 0) & frame_tick;
+    bank_now <= bank_ctrl and wb_dat_i(2);
+
+    if (wb_rst_i = '1') then
+      stage_dirty <= (others => '0');
+      pend_dirty <= (others => '0');
+      bank_stage <= '0';
+    elsif (bank_ctrl = '1') then
+      bank_stage <= wb_dat_i(0);
+      -- a commit merges into a pending bank that has not been applied
+      if (wb_dat_i(1) = '1') then
+        for i in 0 to 7 loop
+          if (stage_dirty(i) = '1') then
+            pend_regs(i) <= stage_regs(i);
+          end if;
+        end loop;
+        if (stage_dirty(8) = '1') then
+          pend_audctl <= stage_audctl;
+        end if;
+        if (bank_apply = '1') then
+          pend_dirty <= stage_dirty;
+        else
+          pend_dirty <= pend_dirty or stage_dirty;
+        end if;
+        stage_dirty <= (others => '0');
+      elsif (bank_apply = '1') then
+        pend_dirty <= (others => '0');
+      end if;
+    else
+      if (bank_stage = '1' and bank_wr = '1' and wb_adr_i(6) = '0') then
+        if (wb_adr_i(5 downto 2) < x"8") then
+          stage_regs(conv_integer(wb_adr_i(4 downto 2))) <= wb_dat_i(7 downto 0);
+          stage_dirty(conv_integer(wb_adr_i(4 downto 2))) <= '1';
+        elsif (wb_adr_i(5 downto 2) = x"8") then
+          stage_audctl <= wb_dat_i(7 downto 0);
+          stage_dirty(8) <= '1';
+        end if;
+      end if;
+      if (bank_apply = '1') then
+        pend_dirty <= (others => '0');
+      end if;
+    end if;
+  end process;
+
   p_wdata : process
   begin
     wait until rising_edge(wb_clk_i);
     potgo <= '0';
 
+    if (bank_apply = '1') then
+      for i in 1 to 4 loop
+        if (pend_dirty(2*i-2) = '1') then
+          audf(i) <= pend_regs(2*i-2);
+        end if;
+        if (pend_dirty(2*i-1) = '1') then
+          audc(i) <= pend_regs(2*i-1);
+        end if;
+      end loop;
+      if (pend_dirty(8) = '1') then
+        audctl <= pend_audctl;
+      end if;
+    end if;
+
     --if (reset = '1') then
       -- no idea what the reset state is
       --audf <= (others => (others => '0'));
       --audc <= (others => (others => '0'));
       --audctl <= x"00";
     --else
-      if (wb_we_i = '1' and wb_cyc_i='1' and wb_stb_i='1') then
+      if (wb_we_i = '1' and wb_cyc_i='1' and wb_stb_i='1' and wb_adr_i(6) = '0' and
+          (bank_stage = '0' or wb_adr_i(5 downto 2) > x"8")) then
         case wb_adr_i(5 downto 2) is
           when x"0" => audf(1)  <= wb_dat_i(7 downto 0);
           when x"1" => audc(1)  <= wb_dat_i(7 downto 0);
@@ -303,9 +395,14 @@ begin
     --end if;
   --end process;
 
-  p_rdata : process(wb_adr_i, random) --,pin_reg_gated, pot_val, kbcode, serin, irqst, skstat)
+  p_rdata : process(wb_adr_i, random, bank_stage, bank_pending) --,pin_reg_gated, pot_val, kbcode, serin, irqst, skstat)
   begin
     case wb_adr_i(5 downto 2) IS
+        when x"0" =>
+          wb_dat_o(7 downto 0) <= (others => DontCareValue);
+          if (wb_adr_i(6) = '1') then
+            wb_dat_o(7 downto 0) <= "000000" & bank_pending & bank_stage;
+          end if;
         when x"A" =>
           wb_dat_o(7 downto 0) <= random;
         when others =>
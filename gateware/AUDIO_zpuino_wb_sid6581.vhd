@@ -44,13 +44,46 @@ use board.zpuino_config.all;
 use board.zpu_config.all;
 use board.zpupkg.all;
 
+--
+-- Timed write FIFO (registers 0x1D-0x1F, see wb_sid6581.v for details):
+--   0x1D: W: Delay Lo    R: FIFO fill level Lo
+--   0x1E: W: Delay Hi    R: FIFO fill level Hi
+--   0x1F: W: FIFO control (bit 0 = queue enable, bit 1 = clear)
+--         R: FIFO status  (bit 0 = queue enabled, bit 1 = empty, bit 2 = full,
+--                          bit 3 = tick enabled, bit 4 = frame_irq,
+--                          bit 5 = staging enabled, bit 6 = commit pending)
+--
+-- While the queue is enabled, writes to 0x00-0x18 are pushed into the FIFO
+-- with the staged delay and applied once that many 1MHz SID cycles have
+-- passed since the previous entry was applied.
+--
+-- Frame tick (registers 0x19-0x1B, write only):
+--   0x19: W: Tick period Lo (SID cycles per tick, minus one)
+--   0x1A: W: Tick period Hi
+--   0x1B: W: Tick control (bit 0 = enable, bit 1 = restart the period now)
+--
+-- While enabled, frame_irq is high for the first TICK_PULSE SID cycles of
+-- every tick period.
+--
+-- Register bank (register 0x1C, write only):
+--   0x1C: W: bit 0 = stage writes to 0x00-0x18 instead of applying them,
+--            bit 1 = commit the staged writes, bit 2 = apply the commit now
+--
+-- A commit is copied into the SID at the next frame tick (or at once with
+-- bit 2), within one SID cycle. See wb_sid6581.v for details.
+--
+
 entity AUDIO_zpuino_wb_sid6581 is
+  generic (
+    FIFO_DEPTH_LOG2: integer := 8   -- 256 entries (8..14)
+  );
   port (
 	 wishbone_in : in std_logic_vector(61 downto 0);
 	 wishbone_out : out std_logic_vector(33 downto 0);
 
     clk_1MHZ: in std_logic;
-    audio_data: out std_logic_vector(17 downto 0)
+    audio_data: out std_logic_vector(17 downto 0);
+    frame_irq: out std_logic
 
   );
 end entity AUDIO_zpuino_wb_sid6581;
@@ -81,9 +114,75 @@ architecture rtl of AUDIO_zpuino_wb_sid6581 is
   signal cs:    std_logic;  
   signal addr:  std_logic_vector(4 downto 0);
   signal di:    std_logic_vector(7 downto 0);
-  signal do:    std_logic_vector(7 downto 0);
   signal ack_i: std_logic;
 
+  -- Timed write FIFO
+  constant FIFO_DEPTH: integer := 2**FIFO_DEPTH_LOG2;
+  type fifo_mem_type is array(0 to FIFO_DEPTH-1) of std_logic_vector(28 downto 0);
+  signal fifo_mem:      fifo_mem_type;
+  signal fifo_q:        std_logic_vector(28 downto 0);
+  signal fifo_wr_ptr:   std_logic_vector(FIFO_DEPTH_LOG2-1 downto 0) := (others => '0');
+  signal fifo_rd_ptr:   std_logic_vector(FIFO_DEPTH_LOG2-1 downto 0) := (others => '0');
+  signal fifo_level:    std_logic_vector(FIFO_DEPTH_LOG2 downto 0) := (others => '0');
+  signal fifo_full:     std_logic;
+  signal fifo_empty:    std_logic;
+  signal staged_delay:  std_logic_vector(15 downto 0) := (others => '0');
+  signal queue_en:      std_logic := '0';
+
+  signal reg_adr:       std_logic_vector(4 downto 0);
+  signal is_sid:        std_logic;
+  signal is_fifo:       std_logic;
+  signal want_push:     std_logic;
+  signal wb_beat:       std_logic;
+  signal fifo_push:     std_logic;
+  signal fifo_pop:      std_logic;
+  signal fifo_clear:    std_logic;
+  signal wb_to_sid:     std_logic;
+  signal fifo_apply:    std_logic;
+
+  signal tick_sync:     std_logic_vector(2 downto 0) := (others => '0');
+  signal tick_1mhz:     std_logic;
+
+  -- Frame tick
+  constant TICK_PULSE:  integer := 63;  -- frame_irq width in SID cycles
+  signal tick_period:   std_logic_vector(15 downto 0) := x"4DED";  -- PAL frame at 1 MHz
+  signal tick_count:    std_logic_vector(15 downto 0) := (others => '0');
+  signal tick_pulse:    integer range 0 to TICK_PULSE := 0;
+  signal tick_en:       std_logic := '0';
+  signal tick_ctrl:     std_logic;
+  signal tick_irq:      std_logic := '0';
+  signal tick_fire:     std_logic;
+
+  -- Register bank
+  type bank_type is array(0 to 24) of std_logic_vector(7 downto 0);
+  signal stage_regs:    bank_type;
+  signal pend_regs:     bank_type;
+  signal stage_dirty:   std_logic_vector(24 downto 0) := (others => '0');
+  signal pend_dirty:    std_logic_vector(24 downto 0) := (others => '0');
+  signal bank_stage:    std_logic := '0';
+  signal bank_now:      std_logic := '0';
+  signal bank_run:      std_logic := '0';
+  signal bank_idx:      std_logic_vector(4 downto 0) := (others => '0');
+  signal bank_pending:  std_logic;
+  signal bank_ctrl:     std_logic;
+  signal bank_commit:   std_logic;
+  signal want_bank:     std_logic;
+  signal to_stage:      std_logic;
+  signal bank_port:     std_logic;
+  signal bank_write:    std_logic;
+
+  signal head_valid:    std_logic := '0';
+  signal head_fetch:    std_logic := '0';
+  signal apply_req:     std_logic := '0';
+  signal head_delay:    std_logic_vector(15 downto 0) := (others => '0');
+  signal head_reg:      std_logic_vector(4 downto 0) := (others => '0');
+  signal head_val:      std_logic_vector(7 downto 0) := (others => '0');
+
+  signal fifo_rd_sel:   std_logic := '0';
+  signal fifo_rd_data:  std_logic_vector(7 downto 0) := (others => '0');
+  signal sid_do:        std_logic_vector(7 downto 0);
+  signal we:            std_logic;
+
   signal  wb_clk_i:    std_logic;                     -- Wishbone clock
   signal  wb_rst_i:    std_logic;                     -- Wishbone reset (synchronous)
   signal  wb_dat_i:    std_logic_vector(31 downto 0); -- Wishbone data input  (32 bits)
@@ -111,11 +210,40 @@ begin
   wishbone_out(0) <= wb_inta_o; 
 
   wb_dat_o(wordSize-1 downto 8) <= (others => '0');
-  wb_dat_o(7 downto 0) <= do;
+  wb_dat_o(7 downto 0) <= fifo_rd_data when fifo_rd_sel='1' else sid_do;
+
+  reg_adr   <= wb_adr_i(6 downto 2);
+  is_sid    <= '1' when reg_adr <= "11000" else '0';
+  is_fifo   <= '1' when reg_adr >= "11101" else '0';
+  fifo_full <= fifo_level(FIFO_DEPTH_LOG2);  -- level can only reach FIFO_DEPTH
+  fifo_empty<= '1' when fifo_level = 0 else '0';
+
+  want_push <= wb_we_i and queue_en and is_sid;
+  want_bank <= wb_we_i and bank_run when reg_adr = "11100" else '0';
+  wb_beat   <= (wb_stb_i and wb_cyc_i) and not ack_i and not (want_push and fifo_full) and not want_bank;
+  fifo_push <= wb_beat and want_push;
+  fifo_pop  <= head_fetch;
+  fifo_clear<= wb_beat and wb_we_i and wb_dat_i(1) when reg_adr = "11111" else '0';
+  to_stage  <= wb_beat and wb_we_i and bank_stage and is_sid and not queue_en;
+  wb_to_sid <= wb_beat and not is_fifo and not want_push and not to_stage;
+  fifo_apply<= apply_req and not wb_to_sid;
+
+  bank_ctrl    <= wb_beat and wb_we_i when reg_adr = "11100" else '0';
+  bank_commit  <= bank_ctrl and wb_dat_i(1);
+  bank_pending <= '0' when pend_dirty = 0 and bank_run = '0' else '1';
+  bank_port    <= bank_run and not wb_to_sid and not apply_req;  -- SID port free
+  bank_write   <= bank_port and pend_dirty(conv_integer(bank_idx));
 
-  cs        <= (wb_stb_i and wb_cyc_i) and not ack_i;
-  di        <= wb_dat_i(7 downto 0);
-  addr      <= wb_adr_i(6 downto 2);
+  -- SID core access: bus cycles first, FIFO entries and the bank copy in
+  -- the gaps
+  cs        <= wb_to_sid or fifo_apply or bank_write;
+  di        <= head_val when fifo_apply='1' else
+               pend_regs(conv_integer(bank_idx)) when bank_write='1' else
+               wb_dat_i(7 downto 0);
+  addr      <= head_reg when fifo_apply='1' else
+               bank_idx when bank_write='1' else
+               reg_adr;
+  we        <= '1' when fifo_apply='1' or bank_write='1' else wb_we_i;
   wb_ack_o  <= ack_i;
 
   process(wb_clk_i)
@@ -124,12 +252,225 @@ begin
       if wb_rst_i='1' then
         ack_i<='0';
       else
-        ack_i<='0';
-        if ack_i='0' then
-          if wb_stb_i='1' and wb_cyc_i='1' then
-            ack_i <= '1';
+        ack_i<=wb_beat;
+      end if;
+    end if;
+  end process;
+
+  -- 1MHz tick in the bus clock domain
+  tick_1mhz <= tick_sync(1) and not tick_sync(2);
+
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      tick_sync <= tick_sync(1 downto 0) & clk_1MHz;
+    end if;
+  end process;
+
+  -- Frame tick: counts the period down in SID cycles
+  tick_ctrl <= wb_beat and wb_we_i when reg_adr = "11011" else '0';
+  frame_irq <= tick_irq;
+  tick_fire <= '1' when tick_en='1' and tick_1mhz='1' and tick_count = 0 and
+                        not (tick_ctrl='1' and wb_dat_i(1)='1') else '0';
+
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if wb_rst_i='1' then
+        tick_period <= x"4DED";
+        tick_en <= '0';
+        tick_count <= (others => '0');
+        tick_pulse <= 0;
+        tick_irq <= '0';
+      else
+        if wb_beat='1' and wb_we_i='1' then
+          case reg_adr is
+            when "11001" => tick_period(7 downto 0) <= wb_dat_i(7 downto 0);
+            when "11010" => tick_period(15 downto 8) <= wb_dat_i(7 downto 0);
+            when "11011" => tick_en <= wb_dat_i(0);
+            when others => null;
+          end case;
+        end if;
+
+        if tick_en='0' or (tick_ctrl='1' and wb_dat_i(1)='1') then
+          tick_count <= tick_period;
+          tick_pulse <= 0;
+          tick_irq <= '0';
+        elsif tick_1mhz='1' then
+          if tick_count = 0 then
+            tick_count <= tick_period;
+            tick_pulse <= TICK_PULSE;
+            tick_irq <= '1';
+          else
+            tick_count <= tick_count - 1;
+            if tick_pulse /= 0 then
+              tick_pulse <= tick_pulse - 1;
+            else
+              tick_irq <= '0';
+            end if;
+          end if;
+        end if;
+      end if;
+    end if;
+  end process;
+
+  -- Register bank: stage, commit, then copy into the SID at the tick
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if to_stage='1' then
+        stage_regs(conv_integer(reg_adr)) <= wb_dat_i(7 downto 0);
+      end if;
+      if bank_commit='1' then
+        for i in 0 to 24 loop
+          if stage_dirty(i)='1' then
+            pend_regs(i) <= stage_regs(i);
+          end if;
+        end loop;
+      end if;
+    end if;
+  end process;
+
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if wb_rst_i='1' then
+        stage_dirty <= (others => '0');
+        pend_dirty <= (others => '0');
+        bank_stage <= '0';
+        bank_now <= '0';
+        bank_run <= '0';
+        bank_idx <= (others => '0');
+      else
+        bank_now <= bank_ctrl and wb_dat_i(2);
+        if bank_ctrl='1' then
+          bank_stage <= wb_dat_i(0);
+        end if;
+
+        if bank_commit='1' then
+          -- Merges into a pending bank that has not been copied yet
+          pend_dirty <= pend_dirty or stage_dirty;
+          stage_dirty <= (others => '0');
+        elsif to_stage='1' then
+          stage_dirty(conv_integer(reg_adr)) <= '1';
+        end if;
+
+        if bank_run='0' then
+          if (bank_now='1' or tick_fire='1') and pend_dirty /= 0 then
+            bank_run <= '1';
+            bank_idx <= (others => '0');
           end if;
+        elsif bank_port='1' then
+          pend_dirty(conv_integer(bank_idx)) <= '0';
+          bank_idx <= bank_idx + 1;
+          if bank_idx = "11000" then
+            bank_run <= '0';
+          end if;
+        end if;
+      end if;
+    end if;
+  end process;
+
+  -- FIFO storage (no reset so it maps onto block RAM)
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if fifo_push='1' then
+        fifo_mem(conv_integer(fifo_wr_ptr)) <= staged_delay & reg_adr & wb_dat_i(7 downto 0);
+      end if;
+      fifo_q <= fifo_mem(conv_integer(fifo_rd_ptr));
+    end if;
+  end process;
+
+  -- Control registers, pointers and level
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if wb_rst_i='1' then
+        fifo_wr_ptr <= (others => '0');
+        fifo_rd_ptr <= (others => '0');
+        fifo_level <= (others => '0');
+        staged_delay <= (others => '0');
+        queue_en <= '0';
+      elsif fifo_clear='1' then
+        fifo_wr_ptr <= (others => '0');
+        fifo_rd_ptr <= (others => '0');
+        fifo_level <= (others => '0');
+        staged_delay <= (others => '0');
+        queue_en <= wb_dat_i(0);
+      else
+        if wb_beat='1' and wb_we_i='1' then
+          case reg_adr is
+            when "11101" => staged_delay(7 downto 0) <= wb_dat_i(7 downto 0);
+            when "11110" => staged_delay(15 downto 8) <= wb_dat_i(7 downto 0);
+            when "11111" => queue_en <= wb_dat_i(0);
+            when others => null;
+          end case;
+        end if;
+        if fifo_push='1' then
+          fifo_wr_ptr <= fifo_wr_ptr + 1;
+          staged_delay <= (others => '0');
         end if;
+        if fifo_pop='1' then
+          fifo_rd_ptr <= fifo_rd_ptr + 1;
+        end if;
+        if fifo_push='1' and fifo_pop='0' then
+          fifo_level <= fifo_level + 1;
+        elsif fifo_push='0' and fifo_pop='1' then
+          fifo_level <= fifo_level - 1;
+        end if;
+      end if;
+    end if;
+  end process;
+
+  -- Drain: fetch the head, count its delay in SID cycles, then apply it
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if wb_rst_i='1' or fifo_clear='1' then
+        head_valid <= '0';
+        head_fetch <= '0';
+        apply_req <= '0';
+      elsif head_fetch='1' then
+        head_delay <= fifo_q(28 downto 13);
+        head_reg <= fifo_q(12 downto 8);
+        head_val <= fifo_q(7 downto 0);
+        head_fetch <= '0';
+        head_valid <= '1';
+      elsif head_valid='0' then
+        head_fetch <= not fifo_empty;
+      elsif apply_req='1' then
+        if fifo_apply='1' then
+          apply_req <= '0';
+          head_valid <= '0';
+        end if;
+      elsif head_delay = 0 then
+        apply_req <= '1';
+      elsif tick_1mhz='1' then
+        head_delay <= head_delay - 1;
+      end if;
+    end if;
+  end process;
+
+  -- Status read-back, latched on the bus beat
+  process(wb_clk_i)
+  begin
+    if rising_edge(wb_clk_i) then
+      if wb_rst_i='1' then
+        fifo_rd_sel <= '0';
+        fifo_rd_data <= (others => '0');
+      elsif wb_beat='1' then
+        fifo_rd_sel <= is_fifo;
+        fifo_rd_data <= (others => '0');
+        case reg_adr is
+          when "11101" =>
+            fifo_rd_data <= fifo_level(7 downto 0);
+          when "11110" =>
+            fifo_rd_data(FIFO_DEPTH_LOG2-8 downto 0) <= fifo_level(FIFO_DEPTH_LOG2 downto 8);
+          when others =>
+            fifo_rd_data(6 downto 0) <= bank_pending & bank_stage & tick_irq & tick_en &
+                                        fifo_full & fifo_empty & queue_en;
+        end case;
       end if;
     end if;
   end process;
@@ -142,11 +483,11 @@ begin
     clk_DAC      => '0',
     reset        => wb_rst_i,
     cs          => cs,
-    we          => wb_we_i,
+    we          => we,
 
     addr        => addr,
     di          => di,
-    do          => do,
+    do          => sid_do,
 
     pot_x        => 'X',
     pot_y        => 'X',
@@ -8,47 +8,359 @@
 //   0x0E-0x14: Voice 3 (Freq Lo/Hi, PW Lo/Hi, Control, AD, SR)
 //   0x15-0x18: Filter (FC Lo/Hi, Res/Filt, Mode/Vol)
 //   0x19-0x1C: Misc (Paddle X/Y, Osc3, Env3)
+//
+// Timed write FIFO (not part of the original SID):
+//   0x1D: W: Delay Lo    R: FIFO fill level Lo
+//   0x1E: W: Delay Hi    R: FIFO fill level Hi
+//   0x1F: W: FIFO control (bit 0 = queue enable, bit 1 = clear)
+//         R: FIFO status  (bit 0 = queue enabled, bit 1 = empty, bit 2 = full,
+//                          bit 3 = tick enabled, bit 4 = frame_irq,
+//                          bit 5 = staging enabled, bit 6 = commit pending)
+//
+// Frame tick (write only, reads return the SID's Misc registers):
+//   0x19: W: Tick period Lo (SID cycles per tick, minus one)
+//   0x1A: W: Tick period Hi
+//   0x1B: W: Tick control (bit 0 = enable, bit 1 = restart the period now)
+//
+// While enabled the slave raises frame_irq for TICK_PULSE SID cycles at the
+// start of every tick period, for an edge-triggered interrupt on the host.
+// A new period takes effect from the next tick. The tick runs on the SID
+// clock, so the play rate stays locked to the audio.
+//
+// Register bank (write only):
+//   0x1C: W: bit 0 = stage writes to 0x00-0x18 instead of applying them,
+//            bit 1 = commit the staged writes, bit 2 = apply the commit now
+//
+// A commit waits for the next frame tick (or bit 2), then the changed
+// registers are copied into the SID within one SID cycle. Writes staged
+// while it waits belong to the next commit, and a commit that arrives during
+// the copy is held off until the copy is done. While the FIFO queue is
+// enabled, writes are queued instead of staged.
+//
+// While the queue is enabled, writes to 0x00-0x18 are not applied at once.
+// They are pushed into the FIFO together with the delay held in 0x1D/0x1E,
+// and the delay goes back to zero after each push. An entry is applied to
+// the SID after its delay has run out, counted in 1MHz SID cycles from the
+// moment the previous entry was applied. When the FIFO is full the slave
+// holds off the acknowledge until an entry has been applied.
+//
+// Burst writes: during an incrementing Wishbone burst (wb_cti_i = 3'b010)
+// the register address auto-increments after every beat, so the SPI bridge
+// only needs to send the start address once for a block of registers.
+// Tie wb_cti_i to 3'b000 for classic single cycles.
+//
+// 2SID/3SID: instantiate this module again at 0x8280 and 0x82A0 and feed
+// the outputs to data_in4/data_in5 of AUDIO_zpuino_sa_audiomixer.
 
-module wb_sid6581 (
+module wb_sid6581 #(
+    parameter FIFO_DEPTH_LOG2 = 8   // 256 entries (8..14)
+) (
     input wire clk,
     input wire rst_n,
-    
+
     // 1MHz clock for SID core
     input wire clk_1mhz,
-    
+
     // Wishbone interface
     input wire [7:0] wb_adr_i,
     input wire [7:0] wb_dat_i,
     output wire [7:0] wb_dat_o,
+    input wire [2:0] wb_cti_i,      // Cycle type (3'b010 = incrementing burst)
     input wire wb_cyc_i,
     input wire wb_stb_i,
     input wire wb_we_i,
     output reg wb_ack_o,
-    
+
     // Audio output
     output wire audio_out,          // PWM audio output
-    output wire [17:0] audio_data   // Raw audio data for mixer
+    output wire [17:0] audio_data,  // Raw audio data for mixer
+
+    // Frame tick interrupt, to a host GPIO
+    output reg frame_irq
 );
 
-    // Wishbone bus handling
-    wire wb_valid = wb_cyc_i & wb_stb_i;
-    wire cs = wb_valid & ~wb_ack_o;
-    
+    localparam FIFO_DEPTH = 1 << FIFO_DEPTH_LOG2;
+    localparam TICK_PULSE = 6'd63;  // frame_irq width in SID cycles
+
     // Active high reset for SID core
     wire rst = ~rst_n;
-    
+
+    // Burst address counter: the first beat of a cycle uses wb_adr_i, every
+    // further beat of an incrementing burst uses the next register
+    reg burst_active;
+    reg [4:0] burst_adr;
+    wire [4:0] reg_adr = burst_active ? burst_adr : wb_adr_i[4:0];
+
+    // Register bank state
+    reg [7:0] stage_regs [0:24];
+    reg [7:0] pend_regs [0:24];
+    reg [24:0] stage_dirty;
+    reg [24:0] pend_dirty;
+    reg bank_stage;
+    reg bank_now;                   // Apply the pending bank on the next clock
+    reg bank_run;                   // Copying the pending bank into the SID
+    reg [4:0] bank_idx;
+
+    // FIFO state
+    reg [28:0] fifo_mem [0:FIFO_DEPTH-1];   // {delay[15:0], reg[4:0], value[7:0]}
+    reg [28:0] fifo_q;
+    reg [FIFO_DEPTH_LOG2-1:0] fifo_wr_ptr;
+    reg [FIFO_DEPTH_LOG2-1:0] fifo_rd_ptr;
+    reg [FIFO_DEPTH_LOG2:0] fifo_level;
+    reg [15:0] staged_delay;
+    reg queue_en;
+
+    wire fifo_full  = (fifo_level == FIFO_DEPTH);
+    wire fifo_empty = (fifo_level == 0);
+
+    // Wishbone bus handling
+    wire wb_valid  = wb_cyc_i & wb_stb_i;
+    wire is_sid    = (reg_adr <= 5'h18);
+    wire is_fifo   = (reg_adr >= 5'h1D);
+    wire want_push = wb_we_i & queue_en & is_sid;
+    wire want_bank = wb_we_i & (reg_adr == 5'h1C) & bank_run;
+    wire wb_beat   = wb_valid & ~wb_ack_o & ~(want_push & fifo_full) & ~want_bank;
+    wire fifo_push = wb_beat & want_push;
+    wire to_stage  = wb_beat & wb_we_i & bank_stage & is_sid & ~queue_en;
+    wire wb_to_sid = wb_beat & ~is_fifo & ~want_push & ~to_stage;
+
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            burst_active <= 1'b0;
+            burst_adr <= 5'd0;
+        end else if (!wb_cyc_i) begin
+            burst_active <= 1'b0;
+        end else if (wb_beat) begin
+            burst_active <= (wb_cti_i == 3'b010);
+            burst_adr <= reg_adr + 5'd1;
+        end
+    end
+
     // Generate ack
     always @(posedge clk or negedge rst_n) begin
         if (!rst_n) begin
             wb_ack_o <= 1'b0;
         end else begin
-            wb_ack_o <= 1'b0;
-            if (wb_valid && !wb_ack_o) begin
-                wb_ack_o <= 1'b1;
+            wb_ack_o <= wb_beat;
+        end
+    end
+
+    // 1MHz tick in the bus clock domain
+    reg [2:0] tick_sync;
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n)
+            tick_sync <= 3'b000;
+        else
+            tick_sync <= {tick_sync[1:0], clk_1mhz};
+    end
+    wire tick_1mhz = tick_sync[1] & ~tick_sync[2];
+
+    // FIFO storage (no reset so it maps onto block RAM)
+    always @(posedge clk) begin
+        if (fifo_push)
+            fifo_mem[fifo_wr_ptr] <= {staged_delay, reg_adr, wb_dat_i};
+        fifo_q <= fifo_mem[fifo_rd_ptr];
+    end
+
+    // Head entry, counting down towards its apply tick
+    reg head_valid;
+    reg head_fetch;
+    reg apply_req;
+    reg [15:0] head_delay;
+    reg [4:0] head_reg;
+    reg [7:0] head_val;
+
+    wire fifo_clear = wb_beat & wb_we_i & (reg_adr == 5'h1F) & wb_dat_i[1];
+    wire fifo_pop   = head_fetch;
+    wire fifo_apply = apply_req & ~wb_to_sid;
+
+    // Control registers, pointers and level
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            fifo_wr_ptr <= 0;
+            fifo_rd_ptr <= 0;
+            fifo_level <= 0;
+            staged_delay <= 16'd0;
+            queue_en <= 1'b0;
+        end else if (fifo_clear) begin
+            fifo_wr_ptr <= 0;
+            fifo_rd_ptr <= 0;
+            fifo_level <= 0;
+            staged_delay <= 16'd0;
+            queue_en <= wb_dat_i[0];
+        end else begin
+            if (wb_beat && wb_we_i) begin
+                case (reg_adr)
+                    5'h1D: staged_delay[7:0]  <= wb_dat_i;
+                    5'h1E: staged_delay[15:8] <= wb_dat_i;
+                    5'h1F: queue_en           <= wb_dat_i[0];
+                    default: ;
+                endcase
+            end
+            if (fifo_push) begin
+                fifo_wr_ptr <= fifo_wr_ptr + 1'b1;
+                staged_delay <= 16'd0;
+            end
+            if (fifo_pop)
+                fifo_rd_ptr <= fifo_rd_ptr + 1'b1;
+            fifo_level <= fifo_level + fifo_push - fifo_pop;
+        end
+    end
+
+    // Drain: fetch the head, count its delay in SID cycles, then apply it
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            head_valid <= 1'b0;
+            head_fetch <= 1'b0;
+            apply_req <= 1'b0;
+            head_delay <= 16'd0;
+            head_reg <= 5'd0;
+            head_val <= 8'd0;
+        end else if (fifo_clear) begin
+            head_valid <= 1'b0;
+            head_fetch <= 1'b0;
+            apply_req <= 1'b0;
+        end else if (head_fetch) begin
+            {head_delay, head_reg, head_val} <= fifo_q;
+            head_fetch <= 1'b0;
+            head_valid <= 1'b1;
+        end else if (!head_valid) begin
+            head_fetch <= ~fifo_empty;
+        end else if (apply_req) begin
+            if (fifo_apply) begin
+                apply_req <= 1'b0;
+                head_valid <= 1'b0;
+            end
+        end else if (head_delay == 16'd0) begin
+            apply_req <= 1'b1;
+        end else if (tick_1mhz) begin
+            head_delay <= head_delay - 1'b1;
+        end
+    end
+
+    // Frame tick: counts the period down in SID cycles
+    reg [15:0] tick_period;
+    reg [15:0] tick_count;
+    reg [5:0] tick_pulse;
+    reg tick_en;
+    wire tick_wr   = wb_beat & wb_we_i;
+    wire tick_ctrl = tick_wr & (reg_adr == 5'h1B);
+
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            tick_period <= 16'd19949;       // PAL frame at 1 MHz
+            tick_count <= 16'd0;
+            tick_pulse <= 6'd0;
+            tick_en <= 1'b0;
+            frame_irq <= 1'b0;
+        end else begin
+            if (tick_wr & (reg_adr == 5'h19))
+                tick_period[7:0] <= wb_dat_i;
+            if (tick_wr & (reg_adr == 5'h1A))
+                tick_period[15:8] <= wb_dat_i;
+            if (tick_ctrl)
+                tick_en <= wb_dat_i[0];
+
+            if (!tick_en | (tick_ctrl & wb_dat_i[1])) begin
+                tick_count <= tick_period;
+                tick_pulse <= 6'd0;
+                frame_irq <= 1'b0;
+            end else if (tick_1mhz) begin
+                if (tick_count == 16'd0) begin
+                    tick_count <= tick_period;
+                    tick_pulse <= TICK_PULSE;
+                    frame_irq <= 1'b1;
+                end else begin
+                    tick_count <= tick_count - 1'b1;
+                    if (tick_pulse != 6'd0)
+                        tick_pulse <= tick_pulse - 1'b1;
+                    else
+                        frame_irq <= 1'b0;
+                end
+            end
+        end
+    end
+
+    // Register bank: stage, commit, then copy into the SID at the tick
+    wire bank_ctrl  = wb_beat & wb_we_i & (reg_adr == 5'h1C);
+    wire tick_fire  = tick_en & tick_1mhz & (tick_count == 16'd0) & ~(tick_ctrl & wb_dat_i[1]);
+    wire bank_port  = bank_run & ~wb_to_sid & ~apply_req;  // SID port free
+    wire bank_write = bank_port & pend_dirty[bank_idx];
+    integer i;
+
+    always @(posedge clk) begin
+        if (to_stage)
+            stage_regs[reg_adr] <= wb_dat_i;
+        if (bank_ctrl & wb_dat_i[1]) begin
+            for (i = 0; i < 25; i = i + 1)
+                if (stage_dirty[i])
+                    pend_regs[i] <= stage_regs[i];
+        end
+    end
+
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            stage_dirty <= 25'd0;
+            pend_dirty <= 25'd0;
+            bank_stage <= 1'b0;
+            bank_now <= 1'b0;
+            bank_run <= 1'b0;
+            bank_idx <= 5'd0;
+        end else begin
+            bank_now <= bank_ctrl & wb_dat_i[2];
+            if (bank_ctrl)
+                bank_stage <= wb_dat_i[0];
+
+            if (bank_ctrl & wb_dat_i[1]) begin
+                // Merges into a pending bank that has not been copied yet
+                pend_dirty <= pend_dirty | stage_dirty;
+                stage_dirty <= 25'd0;
+            end else if (to_stage) begin
+                stage_dirty[reg_adr] <= 1'b1;
+            end
+
+            if (!bank_run) begin
+                if ((bank_now | tick_fire) && pend_dirty != 25'd0) begin
+                    bank_run <= 1'b1;
+                    bank_idx <= 5'd0;
+                end
+            end else if (bank_port) begin
+                pend_dirty[bank_idx] <= 1'b0;
+                bank_idx <= bank_idx + 1'b1;
+                if (bank_idx == 5'd24)
+                    bank_run <= 1'b0;
             end
         end
     end
 
+    // Status read-back, latched on the bus beat
+    reg fifo_rd_sel;
+    reg [7:0] fifo_rd_data;
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            fifo_rd_sel <= 1'b0;
+            fifo_rd_data <= 8'd0;
+        end else if (wb_beat) begin
+            fifo_rd_sel <= is_fifo;
+            case (reg_adr)
+                5'h1D: fifo_rd_data <= fifo_level[7:0];
+                5'h1E: fifo_rd_data <= {{(15-FIFO_DEPTH_LOG2){1'b0}}, fifo_level[FIFO_DEPTH_LOG2:8]};
+                default: fifo_rd_data <= {1'b0, (pend_dirty != 25'd0) | bank_run, bank_stage,
+                                          frame_irq, tick_en, fifo_full, fifo_empty, queue_en};
+            endcase
+        end
+    end
+
+    // SID core access: bus cycles first, FIFO entries and the bank copy in
+    // the gaps
+    wire sid_cs = wb_to_sid | fifo_apply | bank_write;
+    wire sid_we = (fifo_apply | bank_write) ? 1'b1 : wb_we_i;
+    wire [4:0] sid_addr = fifo_apply ? head_reg : bank_write ? bank_idx : reg_adr;
+    wire [7:0] sid_di = fifo_apply ? head_val : bank_write ? pend_regs[bank_idx] : wb_dat_i;
+    wire [7:0] sid_do;
+
+    assign wb_dat_o = fifo_rd_sel ? fifo_rd_data : sid_do;
+
     // Instantiate SID6581 core
     // Note: 'do' is a reserved word in Verilog, use escaped identifier
     sid6581 u_sid (
@@ -56,11 +368,11 @@ module wb_sid6581 (
         .clk32      (clk),
         .clk_DAC    (clk),          // Use main clock for DAC
         .reset      (rst),
-        .cs         (cs),
-        .we         (wb_we_i),
-        .addr       (wb_adr_i[4:0]),
-        .di         (wb_dat_i),
-        .\do        (wb_dat_o),     // Escaped identifier for VHDL port 'do'
+        .cs         (sid_cs),
+        .we         (sid_we),
+        .addr       (sid_addr),
+        .di         (sid_di),
+        .\do        (sid_do),       // Escaped identifier for VHDL port 'do'
         .pot_x      (1'b0),         // No paddle input
         .pot_y      (1'b0),         // No paddle input
         .audio_out  (audio_out),
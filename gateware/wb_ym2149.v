@@ -17,6 +17,21 @@
 //   0x0B: Envelope Fine Tune (8-bit)
 //   0x0C: Envelope Coarse Tune (8-bit)
 //   0x0D: Envelope Shape/Cycle (4-bit)
+//   0x0E: Register bank control / status (not part of the original chip)
+//
+// Register bank: with bit 0 of 0x0E set, writes to 0x00-0x0D go to a
+// staging bank instead of the chip. Writing bit 1 moves the staged writes
+// to the pending bank, which is applied in one clock on the next rising
+// edge of frame_tick (the frame_irq of the SID slave), or at once when
+// bit 2 is written as well. Writes staged meanwhile wait for the next
+// commit, so a frame can be streamed while the previous one waits for its
+// tick. Read 0x0E: bit 0 = staging enabled, bit 1 = commit pending.
+// Tie frame_tick to 1'b0 to use immediate commits only.
+//
+// Burst writes: during an incrementing Wishbone burst (wb_cti_i = 3'b010)
+// the register address auto-increments after every beat, so a full 14
+// register frame needs only one address phase on the SPI bridge.
+// Tie wb_cti_i to 3'b000 for classic single cycles.
 //
 // Based on YM2149 core by MikeJ (fpgaarcade.com)
 // Adapted for simple Wishbone interface by GadgetFactory
@@ -31,13 +46,17 @@ module wb_ym2149 #(
     input wire [7:0] wb_adr_i,
     input wire [7:0] wb_dat_i,
     output reg [7:0] wb_dat_o,
+    input wire [2:0] wb_cti_i,      // Cycle type (3'b010 = incrementing burst)
     input wire wb_cyc_i,
     input wire wb_stb_i,
     input wire wb_we_i,
     output reg wb_ack_o,
     
     // Audio output
-    output wire [17:0] audio_data   // 18-bit audio data for mixer/DAC
+    output wire [17:0] audio_data,  // 18-bit audio data for mixer/DAC
+    
+    // Frame tick, applies a pending register bank on its rising edge
+    input wire frame_tick
 );
 
     // Internal registers (14 registers, 8-bit each)
@@ -45,7 +64,49 @@ module wb_ym2149 #(
     
     // Wishbone bus handling
     wire wb_valid = wb_cyc_i & wb_stb_i;
-    wire [3:0] reg_addr = wb_adr_i[3:0];  // Register address (0x0-0xF)
+    
+    // Burst address counter: the first beat of a cycle uses wb_adr_i, every
+    // further beat of an incrementing burst uses the next register
+    reg burst_active;
+    reg [3:0] burst_adr;
+    wire [3:0] reg_addr = burst_active ? burst_adr : wb_adr_i[3:0];  // Register address (0x0-0xF)
+    
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            burst_active <= 1'b0;
+            burst_adr <= 4'd0;
+        end else if (!wb_cyc_i) begin
+            burst_active <= 1'b0;
+        end else if (wb_valid && !wb_ack_o) begin
+            burst_active <= (wb_cti_i == 3'b010);
+            burst_adr <= reg_addr + 4'd1;
+        end
+    end
+    
+    // Register bank: staged writes, then the commit waiting for its tick
+    localparam BANK_REGS = 14;
+    reg [7:0] stage_regs [0:BANK_REGS-1];
+    reg [7:0] pend_regs [0:BANK_REGS-1];
+    reg [BANK_REGS-1:0] stage_dirty;
+    reg [BANK_REGS-1:0] pend_dirty;
+    reg bank_stage;
+    reg bank_now;                   // Apply the pending bank on the next clock
+    reg [2:0] frame_sync;
+    
+    wire wb_write   = wb_valid && wb_we_i && !wb_ack_o;
+    wire bank_ctrl  = wb_write && (reg_addr == 4'hE);
+    wire bank_commit = bank_ctrl && wb_dat_i[1];
+    wire to_stage   = wb_write && bank_stage && (reg_addr < BANK_REGS);
+    wire to_chip    = wb_write && !bank_stage && (reg_addr < BANK_REGS);
+    wire frame_edge = frame_sync[1] & ~frame_sync[2];
+    wire bank_apply = (bank_now | frame_edge) && (pend_dirty != 0);
+    
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n)
+            frame_sync <= 3'b000;
+        else
+            frame_sync <= {frame_sync[1:0], frame_tick};
+    end
     
     // Clock divider for ~2MHz YM2149 clock from input clock
     // YM2149 needs ~2MHz, we divide by CLK_FREQ_MHZ/2
@@ -155,8 +216,44 @@ module wb_ym2149 #(
                 regs[i] <= 8'h00;
             // Default mixer: all disabled (bits are active low)
             regs[7] <= 8'h3F;
-        end else if (wb_valid && wb_we_i && !wb_ack_o) begin
-            regs[reg_addr] <= wb_dat_i;
+        end else begin
+            if (bank_apply) begin
+                for (i = 0; i < BANK_REGS; i = i + 1)
+                    if (pend_dirty[i])
+                        regs[i] <= pend_regs[i];
+            end
+            if (to_chip || (wb_write && reg_addr == 4'hF))
+                regs[reg_addr] <= wb_dat_i;
+        end
+    end
+    
+    // Staging and pending banks
+    always @(posedge clk or negedge rst_n) begin
+        if (!rst_n) begin
+            stage_dirty <= {BANK_REGS{1'b0}};
+            pend_dirty <= {BANK_REGS{1'b0}};
+            bank_stage <= 1'b0;
+            bank_now <= 1'b0;
+        end else begin
+            bank_now <= bank_ctrl && wb_dat_i[2];
+            if (bank_ctrl)
+                bank_stage <= wb_dat_i[0];
+            
+            if (to_stage) begin
+                stage_regs[reg_addr] <= wb_dat_i;
+                stage_dirty[reg_addr] <= 1'b1;
+            end
+            
+            // A commit merges into a pending bank that has not been applied
+            if (bank_commit) begin
+                for (i = 0; i < BANK_REGS; i = i + 1)
+                    if (stage_dirty[i])
+                        pend_regs[i] <= stage_regs[i];
+                pend_dirty <= (bank_apply ? {BANK_REGS{1'b0}} : pend_dirty) | stage_dirty;
+                stage_dirty <= {BANK_REGS{1'b0}};
+            end else if (bank_apply) begin
+                pend_dirty <= {BANK_REGS{1'b0}};
+            end
         end
     end
     
@@ -177,6 +274,7 @@ module wb_ym2149 #(
             4'hB: wb_dat_o = regs[11];
             4'hC: wb_dat_o = regs[12];
             4'hD: wb_dat_o = {4'b0, regs[13][3:0]};
+            4'hE: wb_dat_o = {6'b0, (pend_dirty != 0), bank_stage};
             default: wb_dat_o = 8'h00;
         endcase
     end
@@ -264,7 +362,11 @@ module wb_ym2149 #(
         end
     end
     
-    // Envelope generator
+    // Envelope generator, restarted by every R13 write reaching the chip
+    wire env_direct = to_chip && (reg_addr == 4'hD);
+    wire env_write = env_direct || (bank_apply && pend_dirty[13]);
+    wire [3:0] env_shape_in = env_direct ? wb_dat_i[3:0] : pend_regs[13][3:0];
+    
     always @(posedge clk or negedge rst_n) begin
         if (!rst_n) begin
             env_cnt <= 16'd0;
@@ -277,16 +379,16 @@ module wb_ym2149 #(
             env_continue <= 1'b0;
         end else begin
             // Detect envelope shape register write to reset envelope
-            if (wb_valid && wb_we_i && !wb_ack_o && reg_addr == 4'hD) begin
+            if (env_write) begin
                 env_cnt <= 16'd0;
                 env_holding <= 1'b0;
                 // Decode shape: CONT ATT ALT HOLD
-                env_continue <= wb_dat_i[3];
-                env_attack   <= wb_dat_i[2];
-                env_alt      <= wb_dat_i[1];
-                env_hold     <= wb_dat_i[0];
-                env_step_up  <= wb_dat_i[2];  // Start direction = attack bit
-                if (wb_dat_i[2])
+                env_continue <= env_shape_in[3];
+                env_attack   <= env_shape_in[2];
+                env_alt      <= env_shape_in[1];
+                env_hold     <= env_shape_in[0];
+                env_step_up  <= env_shape_in[2];  // Start direction = attack bit
+                if (env_shape_in[2])
                     env_vol <= 5'd0;
                 else
                     env_vol <= 5'd31;
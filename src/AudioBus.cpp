@@ -0,0 +1,311 @@
+/**
+ * @file AudioBus.cpp
+ * @brief Burst writes and the asynchronous transmit queue
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "AudioBus.h"
+#include "FrameRing.h"
+
+// ============================================================================
+// Blocking transfers
+// ============================================================================
+
+static void sendBurst16(uint16_t addr, const uint8_t* data, uint8_t count) {
+#ifdef AUDIO_BUS_BURST_WRITE16
+    if (count > 1) {
+        AUDIO_BUS_BURST_WRITE16(addr, data, count);
+        return;
+    }
+#endif
+    for (uint8_t i = 0; i < count; i++) {
+        wishboneWrite16(addr + i, data[i]);
+    }
+}
+
+static void sendBurst8(uint16_t addr, const uint8_t* data, uint8_t count) {
+#ifdef AUDIO_BUS_BURST_WRITE8
+    if (count > 1) {
+        AUDIO_BUS_BURST_WRITE8(addr, data, count);
+        return;
+    }
+#endif
+    for (uint8_t i = 0; i < count; i++) {
+        wishboneWrite8(addr + i, data[i]);
+    }
+}
+
+static void sendBatch16(const AudioBusWrite* writes, uint16_t count) {
+#ifdef AUDIO_BUS_WRITE_BATCH16
+    if (count > 1) {
+        AUDIO_BUS_WRITE_BATCH16(writes, count);
+        return;
+    }
+#endif
+    uint8_t run[32];
+    uint16_t runStart = 0;
+    uint8_t runLen = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (runLen && writes[i].addr == runStart + runLen && runLen < sizeof(run)) {
+            run[runLen++] = writes[i].value;
+            continue;
+        }
+        if (runLen) {
+            sendBurst16(runStart, run, runLen);
+        }
+        runStart = writes[i].addr;
+        run[0] = writes[i].value;
+        runLen = 1;
+    }
+
+    if (runLen) {
+        sendBurst16(runStart, run, runLen);
+    }
+}
+
+// ============================================================================
+// Transmit queue
+// ============================================================================
+
+#if defined(ESP32)
+struct QueuedWrite {
+    uint16_t addr;
+    uint8_t value;
+    uint8_t wide;               // 16-bit addressed peripheral
+};
+
+// Writes taken from the queue per transfer
+#define AUDIO_BUS_CHUNK     64
+
+static FrameRing<QueuedWrite, AUDIO_BUS_QUEUE_SIZE> txQueue;
+static TaskHandle_t txTask;
+static volatile bool txRun;
+static bool txIdle = true;      // The task waits for a notification
+static uint32_t overflows;
+
+// Runs on the transport task, the queue's only consumer
+static void drainQueue() {
+    AudioBusWrite batch[AUDIO_BUS_CHUNK];
+    uint8_t run[32];
+
+    const QueuedWrite* w;
+    while ((w = txQueue.peek()) != NULL) {
+        if (w->wide) {
+            // Neighbouring 16-bit writes go out as one batch
+            uint16_t count = 0;
+            do {
+                batch[count].addr = w->addr;
+                batch[count].value = w->value;
+                count++;
+                txQueue.release();
+            } while (count < AUDIO_BUS_CHUNK && (w = txQueue.peek()) != NULL && w->wide);
+            sendBatch16(batch, count);
+        } else {
+            uint16_t start = w->addr;
+            uint8_t count = 0;
+            do {
+                run[count++] = w->value;
+                txQueue.release();
+            } while (count < sizeof(run) && (w = txQueue.peek()) != NULL && !w->wide &&
+                     w->addr == start + count);
+            sendBurst8(start, run, count);
+        }
+    }
+}
+
+static void txTaskEntry(void* arg) {
+    (void)arg;
+    while (txRun) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        do {
+            drainQueue();
+            __atomic_store_n(&txIdle, true, __ATOMIC_RELEASE);
+            // A write queued during the drain may have seen the task busy
+        } while (!txQueue.empty() && __atomic_exchange_n(&txIdle, false, __ATOMIC_ACQ_REL));
+    }
+    txTask = NULL;
+    vTaskDelete(NULL);
+}
+
+static void kickSender() {
+    if (__atomic_exchange_n(&txIdle, false, __ATOMIC_ACQ_REL)) {
+        xTaskNotifyGive(txTask);
+    }
+}
+
+static void enqueue(uint16_t addr, uint8_t value, bool wide) {
+    QueuedWrite* slot = txQueue.writeSlot();
+    if (!slot) {
+        // Full: wait for room rather than drop or reorder the write
+        overflows++;
+        do {
+            kickSender();
+            taskYIELD();
+        } while ((slot = txQueue.writeSlot()) == NULL);
+    }
+    slot->addr = addr;
+    slot->value = value;
+    slot->wide = wide;
+    txQueue.commit();
+}
+
+static void enqueueRun(uint16_t addr, const uint8_t* data, uint8_t count, bool wide) {
+    for (uint8_t i = 0; i < count; i++) {
+        enqueue(addr + i, data[i], wide);
+    }
+    kickSender();
+}
+
+static bool queueing() {
+    return txTask != NULL;
+}
+#else
+// No transport task: every write blocks
+static bool queueing() {
+    return false;
+}
+
+static void enqueueRun(uint16_t addr, const uint8_t* data, uint8_t count, bool wide) {
+    (void)addr;
+    (void)data;
+    (void)count;
+    (void)wide;
+}
+#endif
+
+// ============================================================================
+// Public helpers
+// ============================================================================
+
+void audioBusBurstWrite16(uint16_t addr, const uint8_t* data, uint8_t count) {
+    if (queueing()) {
+        enqueueRun(addr, data, count, true);
+    } else {
+        sendBurst16(addr, data, count);
+    }
+}
+
+void audioBusBurstWrite8(uint16_t addr, const uint8_t* data, uint8_t count) {
+    if (queueing()) {
+        enqueueRun(addr, data, count, false);
+    } else {
+        sendBurst8(addr, data, count);
+    }
+}
+
+void audioBusWriteBatch16(const AudioBusWrite* writes, uint16_t count) {
+#if defined(ESP32)
+    if (queueing()) {
+        for (uint16_t i = 0; i < count; i++) {
+            enqueue(writes[i].addr, writes[i].value, true);
+        }
+        kickSender();
+        return;
+    }
+#endif
+    sendBatch16(writes, count);
+}
+
+void audioBusWrite16(uint16_t addr, uint8_t data) {
+    if (queueing()) {
+        enqueueRun(addr, &data, 1, true);
+    } else {
+        wishboneWrite16(addr, data);
+    }
+}
+
+void audioBusWrite8(uint16_t addr, uint8_t data) {
+    if (queueing()) {
+        enqueueRun(addr, &data, 1, false);
+    } else {
+        wishboneWrite8(addr, data);
+    }
+}
+
+uint16_t audioBusRead16(uint16_t addr) {
+    audioBusFence();
+    return wishboneRead16(addr);
+}
+
+uint8_t audioBusRead8(uint16_t addr) {
+    audioBusFence();
+    return wishboneRead8(addr);
+}
+
+// ============================================================================
+// Asynchronous mode
+// ============================================================================
+
+#if defined(ESP32)
+bool audioBusBeginAsync(BaseType_t core, UBaseType_t priority) {
+    if (txTask) return true;
+
+    txQueue.clear();
+    txIdle = true;
+    txRun = true;
+    overflows = 0;
+    if (xTaskCreatePinnedToCore(txTaskEntry, "AudioBus", AUDIO_BUS_TASK_STACK_SIZE,
+                                NULL, priority, &txTask, core) != pdPASS) {
+        txTask = NULL;
+        txRun = false;
+        return false;
+    }
+    return true;
+}
+
+void audioBusEndAsync() {
+    if (!txTask) return;
+
+    audioBusFence();
+    txRun = false;
+    TaskHandle_t task = txTask;
+    xTaskNotifyGive(task);
+    while (txTask) {
+        vTaskDelay(1);
+    }
+}
+
+void audioBusFence() {
+    if (!txTask) return;
+
+    // Done once the queue is empty and the task has finished the transfer
+    // it took the last writes for
+    if (!txQueue.empty()) kickSender();
+    while (!txQueue.empty() || !__atomic_load_n(&txIdle, __ATOMIC_ACQUIRE)) {
+        taskYIELD();
+    }
+}
+
+uint16_t audioBusQueued() {
+    return txQueue.count();
+}
+
+uint32_t audioBusOverflows() {
+    return overflows;
+}
+#else
+bool audioBusBeginAsync() {
+    return false;
+}
+
+void audioBusEndAsync() {
+}
+
+void audioBusFence() {
+}
+
+uint16_t audioBusQueued() {
+    return 0;
+}
+
+uint32_t audioBusOverflows() {
+    return 0;
+}
+#endif
+
+bool audioBusIsAsync() {
+    return queueing();
+}
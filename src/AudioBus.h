@@ -0,0 +1,151 @@
+/**
+ * @file AudioBus.h
+ * @brief Multi-register (burst) writes to the audio peripherals
+ * 
+ * The chip classes use these helpers whenever they update a run of
+ * consecutive registers. The gateware slaves auto-increment the register
+ * address during an incrementing Wishbone burst (CTI = 010), so a whole
+ * block can go out as a single address phase followed by the data.
+ * 
+ * If the SPI master library provides a burst primitive, point
+ * AUDIO_BUS_BURST_WRITE16 / AUDIO_BUS_BURST_WRITE8 at it from the build
+ * flags, e.g. -DAUDIO_BUS_BURST_WRITE16=wishboneBurstWrite16. Without it
+ * the helpers fall back to one single write per register.
+ * 
+ * Writes to several peripherals (the SIDs of a multi-SID tune, for
+ * example) can be collected into one list and sent with
+ * audioBusWriteBatch16(). An SPI master that can queue a whole list of
+ * transactions into one transfer is hooked in the same way with
+ * AUDIO_BUS_WRITE_BATCH16; otherwise the list goes out as bursts of
+ * consecutive addresses.
+ * 
+ * Every bus access of the chip classes goes through these helpers. In
+ * asynchronous mode writes are only appended to a transmit queue; on the
+ * ESP32 a transport task on the other core sends them while the caller
+ * goes on, so a 6502 store to the SID no longer waits for SPI. On other
+ * targets writes always block. audioBusFence() waits until everything
+ * queued is on the bus, and reads fence first so they see every write
+ * before them. A full queue makes the writer wait for room, so nothing
+ * is dropped. All chip writes must come from one task, and code that
+ * calls wishboneWrite/Read itself has to fence first.
+ * 
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef AUDIO_BUS_H
+#define AUDIO_BUS_H
+
+#include <Arduino.h>
+#include "WishboneSPI.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+// Writes the transmit queue holds (power of two)
+#ifndef AUDIO_BUS_QUEUE_SIZE
+#define AUDIO_BUS_QUEUE_SIZE        512
+#endif
+
+#define AUDIO_BUS_TASK_STACK_SIZE   3072
+
+/**
+ * @brief Write consecutive registers of a 16-bit addressed peripheral
+ * @param addr Wishbone address of the first register
+ * @param data Register values
+ * @param count Number of registers to write
+ */
+void audioBusBurstWrite16(uint16_t addr, const uint8_t* data, uint8_t count);
+
+/**
+ * @brief Write consecutive registers of an 8-bit bus peripheral
+ * @param addr Wishbone address of the first register
+ * @param data Register values
+ * @param count Number of registers to write
+ */
+void audioBusBurstWrite8(uint16_t addr, const uint8_t* data, uint8_t count);
+
+/**
+ * @brief One register write in a batch
+ */
+struct AudioBusWrite {
+    uint16_t addr;              // Wishbone address
+    uint8_t value;
+};
+
+/**
+ * @brief Send a list of register writes to 16-bit addressed peripherals
+ * 
+ * Writes go out in list order. Runs of consecutive addresses are merged
+ * into bursts when no batch primitive is configured.
+ * 
+ * @param writes Register writes
+ * @param count Number of writes
+ */
+void audioBusWriteBatch16(const AudioBusWrite* writes, uint16_t count);
+
+/**
+ * @brief Write one register of a 16-bit addressed peripheral
+ */
+void audioBusWrite16(uint16_t addr, uint8_t data);
+
+/**
+ * @brief Write one register of an 8-bit bus peripheral
+ */
+void audioBusWrite8(uint16_t addr, uint8_t data);
+
+/**
+ * @brief Read a register of a 16-bit addressed peripheral, after a fence
+ */
+uint16_t audioBusRead16(uint16_t addr);
+
+/**
+ * @brief Read a register of an 8-bit bus peripheral, after a fence
+ */
+uint8_t audioBusRead8(uint16_t addr);
+
+#if defined(ESP32)
+/**
+ * @brief Queue writes and send them from a transport task
+ * @param core Core to pin the task to (default 0; Arduino loop() runs on 1)
+ * @param priority FreeRTOS task priority
+ * @return true if writes are queued from now on
+ */
+bool audioBusBeginAsync(BaseType_t core = 0, UBaseType_t priority = 2);
+#else
+/**
+ * @brief Asynchronous mode needs FreeRTOS: writes keep blocking
+ * @return false
+ */
+bool audioBusBeginAsync();
+#endif
+
+/**
+ * @brief Fence, stop the transport task and write at once again
+ */
+void audioBusEndAsync();
+
+/**
+ * @brief Check whether writes are queued
+ */
+bool audioBusIsAsync();
+
+/**
+ * @brief Wait until every queued write has been sent
+ */
+void audioBusFence();
+
+/**
+ * @brief Get the number of writes waiting in the transmit queue
+ */
+uint16_t audioBusQueued();
+
+/**
+ * @brief Get the number of writes that found the queue full
+ * @return Writes that had to wait for room since audioBusBeginAsync()
+ */
+uint32_t audioBusOverflows();
+
+#endif // AUDIO_BUS_H
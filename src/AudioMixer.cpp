@@ -8,8 +8,9 @@
 
 #include "AudioMixer.h"
 
-AudioMixer::AudioMixer(uint16_t baseAddr)
-    : _baseAddr(baseAddr), _control(0), _masterVolume(255) {
+AudioMixer::AudioMixer(uint16_t baseAddr) : _baseAddr(baseAddr), _pcmRoom(0) {
+    _regs.begin(baseAddr);
+    memset(_rampRate, 0, sizeof(_rampRate));
 }
 
 void AudioMixer::begin() {
@@ -18,87 +19,202 @@ void AudioMixer::begin() {
 }
 
 void AudioMixer::writeReg(uint8_t addr, uint8_t data) {
-    wishboneWrite8(_baseAddr + addr, data);
+    if (addr < MIXER_NUM_REGS) {
+        _regs.write(addr, data);
+    } else {
+        audioBusWrite8(_baseAddr + addr, data);
+    }
+}
+
+void AudioMixer::writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count) {
+    if (startAddr + count <= MIXER_NUM_REGS) {
+        _regs.writeRegs(startAddr, data, count);
+    } else {
+        audioBusBurstWrite8(_baseAddr + startAddr, data, count);
+    }
 }
 
 uint8_t AudioMixer::readReg(uint8_t addr) {
-    return wishboneRead8(_baseAddr + addr);
+    return audioBusRead8(_baseAddr + addr);
 }
 
-void AudioMixer::enable(bool enable) {
+uint8_t AudioMixer::getReg(uint8_t addr) {
+    return _regs.get(addr);
+}
+
+uint32_t AudioMixer::getBusWriteCount() {
+    return _regs.sentCount();
+}
+
+void AudioMixer::setCommitMode(ShadowCommitMode mode) {
+    _regs.setMode(mode);
+}
+
+void AudioMixer::commit() {
+    _regs.commit();
+}
+
+void AudioMixer::setControlBit(uint8_t bit, bool enable) {
+    uint8_t control = _regs.get(MIXER_REG_CONTROL);
     if (enable) {
-        _control |= MIXER_CTRL_ENABLE;
+        control |= bit;
     } else {
-        _control &= ~MIXER_CTRL_ENABLE;
+        control &= ~bit;
     }
-    writeReg(MIXER_REG_CONTROL, _control);
+    writeReg(MIXER_REG_CONTROL, control);
+}
+
+void AudioMixer::enable(bool enable) {
+    setControlBit(MIXER_CTRL_ENABLE, enable);
 }
 
 void AudioMixer::mute(bool mute) {
-    if (mute) {
-        _control |= MIXER_CTRL_MUTE;
-    } else {
-        _control &= ~MIXER_CTRL_MUTE;
-    }
-    writeReg(MIXER_REG_CONTROL, _control);
+    setControlBit(MIXER_CTRL_MUTE, mute);
 }
 
 void AudioMixer::setMasterVolume(uint8_t volume) {
-    _masterVolume = volume;
-    writeReg(MIXER_REG_MASTER_VOL, volume);
+    setVolume(MIXER_CHANNEL_MASTER, volume, 0);
 }
 
 uint8_t AudioMixer::getMasterVolume() {
-    return _masterVolume;
+    return _regs.get(MIXER_REG_MASTER_VOL);
 }
 
 void AudioMixer::enableSID(bool enable) {
-    if (enable) {
-        _control |= MIXER_CTRL_CH1_ENABLE;
-    } else {
-        _control &= ~MIXER_CTRL_CH1_ENABLE;
-    }
-    writeReg(MIXER_REG_CONTROL, _control);
+    setControlBit(MIXER_CTRL_CH1_ENABLE, enable);
 }
 
 void AudioMixer::enableYM2149(bool enable) {
-    if (enable) {
-        _control |= MIXER_CTRL_CH2_ENABLE;
-    } else {
-        _control &= ~MIXER_CTRL_CH2_ENABLE;
-    }
-    writeReg(MIXER_REG_CONTROL, _control);
+    setControlBit(MIXER_CTRL_CH2_ENABLE, enable);
 }
 
 void AudioMixer::enablePOKEY(bool enable) {
-    if (enable) {
-        _control |= MIXER_CTRL_CH3_ENABLE;
-    } else {
-        _control &= ~MIXER_CTRL_CH3_ENABLE;
-    }
-    writeReg(MIXER_REG_CONTROL, _control);
+    setControlBit(MIXER_CTRL_CH3_ENABLE, enable);
 }
 
 void AudioMixer::setSIDVolume(uint8_t volume) {
-    writeReg(MIXER_REG_CH1_VOL, volume);
+    setVolume(MIXER_CHANNEL_SID, volume, 0);
 }
 
 void AudioMixer::setYM2149Volume(uint8_t volume) {
-    writeReg(MIXER_REG_CH2_VOL, volume);
+    setVolume(MIXER_CHANNEL_YM2149, volume, 0);
 }
 
 void AudioMixer::setPOKEYVolume(uint8_t volume) {
-    writeReg(MIXER_REG_CH3_VOL, volume);
+    setVolume(MIXER_CHANNEL_POKEY, volume, 0);
+}
+
+// ============================================================================
+// Volume ramps
+// ============================================================================
+
+void AudioMixer::setVolume(uint8_t channel, uint8_t volume, uint8_t rate) {
+    // The rate goes first so the target write starts the ramp at it
+    if (_rampRate[channel] != rate) {
+        audioBusWrite8(_baseAddr + MIXER_REG_MASTER_RATE + channel, rate);
+        _rampRate[channel] = rate;
+    }
+    writeReg(MIXER_REG_MASTER_VOL + channel, volume);
+}
+
+void AudioMixer::rampTo(uint8_t channel, uint8_t target, uint16_t ms) {
+    if (channel >= MIXER_NUM_CHANNELS) return;
+    
+    uint8_t from = _regs.get(MIXER_REG_MASTER_VOL + channel);
+    uint8_t span = target > from ? target - from : from - target;
+    if (!span && ms) return;    // Already there or on the way
+    
+    // Steps of 1/256 per tick to cover span in ms, rounded
+    uint32_t rate = 0;
+    if (span && ms) {
+        uint64_t steps = ((uint64_t)span * 256 * 1000) << MIXER_RAMP_DIV_LOG2;
+        uint64_t clocks = (uint64_t)ms * MIXER_CLOCK_HZ;
+        rate = (uint32_t)((steps + clocks / 2) / clocks);
+        if (rate < 1) rate = 1;
+        if (rate > 255) rate = 255;
+    }
+    setVolume(channel, target, rate);
+}
+
+uint8_t AudioMixer::getRampStatus() {
+    return readReg(MIXER_REG_STATUS) & MIXER_STATUS_RAMP_DONE;
+}
+
+bool AudioMixer::isRampDone(uint8_t channel) {
+    return channel < MIXER_NUM_CHANNELS && (getRampStatus() & (1 << channel));
+}
+
+// ============================================================================
+// PCM sample channel
+// ============================================================================
+
+void AudioMixer::setSampleRate(uint32_t rate) {
+    uint32_t period = rate ? MIXER_CLOCK_HZ / rate : 0;
+    if (period) period--;
+    if (period > 0xFFFF) period = 0xFFFF;
+    
+    uint8_t regs[2] = { (uint8_t)(period & 0xFF), (uint8_t)(period >> 8) };
+    audioBusBurstWrite8(_baseAddr + MIXER_REG_PCM_PERIOD_LO, regs, 2);
+}
+
+void AudioMixer::enableSamples(bool enable, bool clear) {
+    uint8_t control = enable ? MIXER_PCM_ENABLE : 0;
+    if (clear) {
+        control |= MIXER_PCM_CLEAR;
+        _pcmRoom = MIXER_PCM_FIFO_DEPTH;
+    }
+    audioBusWrite8(_baseAddr + MIXER_REG_PCM_CTRL, control);
+}
+
+uint16_t AudioMixer::queueSamples(const int8_t* samples, uint16_t count) {
+    // The FIFO only drains, so the room known from the last read is safe
+    if (count > _pcmRoom) {
+        _pcmRoom = MIXER_PCM_FIFO_DEPTH - getSampleLevel();
+    }
+    if (count > _pcmRoom) count = _pcmRoom;
+    
+    const uint8_t* data = (const uint8_t*)samples;
+    uint16_t left = count;
+    while (left) {
+        uint8_t n = left < MIXER_PCM_WINDOW ? left : MIXER_PCM_WINDOW;
+        audioBusBurstWrite8(_baseAddr + MIXER_REG_PCM_DATA, data, n);
+        data += n;
+        left -= n;
+    }
+    
+    _pcmRoom -= count;
+    return count;
+}
+
+uint16_t AudioMixer::getSampleLevel() {
+    // Re-read if the level crossed a multiple of 256 between the two bytes
+    uint8_t hi, lo;
+    do {
+        hi = audioBusRead8(_baseAddr + MIXER_REG_PCM_LEVEL_HI);
+        lo = audioBusRead8(_baseAddr + MIXER_REG_PCM_LEVEL_LO);
+    } while (audioBusRead8(_baseAddr + MIXER_REG_PCM_LEVEL_HI) != hi);
+    
+    uint16_t level = ((uint16_t)hi << 8) | lo;
+    return level > MIXER_PCM_FIFO_DEPTH ? MIXER_PCM_FIFO_DEPTH : level;
+}
+
+uint8_t AudioMixer::getSampleStatus() {
+    return audioBusRead8(_baseAddr + MIXER_REG_PCM_CTRL);
 }
 
 void AudioMixer::reset() {
-    _control = MIXER_CTRL_ENABLE | MIXER_CTRL_CH1_ENABLE | 
-               MIXER_CTRL_CH2_ENABLE | MIXER_CTRL_CH3_ENABLE;
-    _masterVolume = 255;
+    uint8_t regs[MIXER_NUM_REGS] = {
+        MIXER_CTRL_ENABLE | MIXER_CTRL_CH1_ENABLE |
+        MIXER_CTRL_CH2_ENABLE | MIXER_CTRL_CH3_ENABLE,
+        255,    // Master volume
+        255,    // SID default volume
+        255,    // YM2149 default volume
+        255     // POKEY default volume
+    };
     
-    writeReg(MIXER_REG_CONTROL, _control);
-    writeReg(MIXER_REG_MASTER_VOL, _masterVolume);
-    writeReg(MIXER_REG_CH1_VOL, 255);  // SID default volume
-    writeReg(MIXER_REG_CH2_VOL, 255);  // YM2149 default volume
-    writeReg(MIXER_REG_CH3_VOL, 255);  // POKEY default volume
+    // Rates first, so the volumes are set at once
+    memset(_rampRate, 0, sizeof(_rampRate));
+    audioBusBurstWrite8(_baseAddr + MIXER_REG_MASTER_RATE, _rampRate, MIXER_NUM_CHANNELS);
+    _regs.reset(regs);
+    enableSamples(false, true);
 }
@@ -14,6 +14,9 @@
 
 #include <Arduino.h>
 #include "WishboneSPI.h"
+#include "AudioBus.h"
+#include "ShadowRegisterFile.h"
+#include "ChipConfig.h"
 
 // Audio Mixer Register addresses
 #define MIXER_REG_CONTROL       0x00    // Control register
@@ -21,7 +24,24 @@
 #define MIXER_REG_CH1_VOL       0x02    // Channel 1 (SID) volume
 #define MIXER_REG_CH2_VOL       0x03    // Channel 2 (YM2149) volume
 #define MIXER_REG_CH3_VOL       0x04    // Channel 3 (POKEY) volume
-#define MIXER_REG_STATUS        0x05    // Status register
+#define MIXER_REG_STATUS        0x05    // Status register (read only)
+
+// Volume ramp rates (not shadowed): 1/256 volume steps per ramp tick
+#define MIXER_REG_MASTER_RATE   0x0B
+#define MIXER_REG_CH1_RATE      0x0C
+#define MIXER_REG_CH2_RATE      0x0D
+#define MIXER_REG_CH3_RATE      0x0E
+
+// PCM sample channel registers (not shadowed)
+#define MIXER_REG_PCM_CTRL      0x06    // W: PCM control, R: PCM status
+#define MIXER_REG_PCM_PERIOD_LO 0x07    // Sample period in mixer clocks, minus one
+#define MIXER_REG_PCM_PERIOD_HI 0x08
+#define MIXER_REG_PCM_LEVEL_LO  0x09    // Read: FIFO fill level
+#define MIXER_REG_PCM_LEVEL_HI  0x0A
+#define MIXER_REG_PCM_DATA      0x10    // 0x10-0x1F: each write pushes a sample
+
+// Number of writable mixer registers (CONTROL..CH3_VOL)
+#define MIXER_NUM_REGS          5
 
 // Control register bits
 #define MIXER_CTRL_ENABLE       0x01    // Enable mixer output
@@ -30,6 +50,43 @@
 #define MIXER_CTRL_CH3_ENABLE   0x08    // Enable channel 3 (POKEY)
 #define MIXER_CTRL_MUTE         0x80    // Mute all output
 
+// Volume channels for rampTo(), in register order from MIXER_REG_MASTER_VOL
+#define MIXER_CHANNEL_MASTER    0
+#define MIXER_CHANNEL_SID       1
+#define MIXER_CHANNEL_YM2149    2
+#define MIXER_CHANNEL_POKEY     3
+#define MIXER_NUM_CHANNELS      4
+
+// Status register bits: the volume has reached its target
+#define MIXER_STATUS_MASTER_DONE    0x01
+#define MIXER_STATUS_SID_DONE       0x02
+#define MIXER_STATUS_YM2149_DONE    0x04
+#define MIXER_STATUS_POKEY_DONE     0x08
+#define MIXER_STATUS_RAMP_DONE      0x0F    // All of them
+
+// PCM control bits
+#define MIXER_PCM_ENABLE        0x01    // Play samples from the FIFO
+#define MIXER_PCM_CLEAR         0x02    // Empty the FIFO, clear the underrun flag
+
+// PCM status bits
+#define MIXER_PCM_STATUS_ENABLED    0x01
+#define MIXER_PCM_STATUS_EMPTY      0x02
+#define MIXER_PCM_STATUS_FULL       0x04
+#define MIXER_PCM_STATUS_UNDERRUN   0x08    // The FIFO ran dry while enabled
+
+// Samples per burst: the data window is 16 registers wide
+#define MIXER_PCM_WINDOW        16
+
+// FIFO size of the gateware (2^PCM_DEPTH_LOG2)
+#ifndef MIXER_PCM_FIFO_DEPTH
+#define MIXER_PCM_FIFO_DEPTH    512
+#endif
+
+// Volume ramp tick of the gateware: MIXER_CLOCK_HZ / 2^RAMP_DIV_LOG2
+#ifndef MIXER_RAMP_DIV_LOG2
+#define MIXER_RAMP_DIV_LOG2     14
+#endif
+
 /**
  * @class AudioMixer
  * @brief Controls audio mixing from multiple sound sources
@@ -40,7 +97,7 @@ public:
      * @brief Constructor
      * @param baseAddr Base address for mixer (default 0x70)
      */
-    AudioMixer(uint16_t baseAddr = 0x70);
+    AudioMixer(uint16_t baseAddr = MixerConfig::baseAddr);
     
     /**
      * @brief Initialize the mixer
@@ -107,20 +164,141 @@ public:
      */
     void setPOKEYVolume(uint8_t volume);
     
+    // ========================================================================
+    // Volume ramps
+    // ========================================================================
+    
+    /**
+     * @brief Fade a volume to a new level in hardware
+     * 
+     * The gateware moves the volume a fraction of a step at a time, so a
+     * whole fade costs one register write (two when the rate differs from
+     * the channel's last one). The time is counted from the last target
+     * written, which is where the volume is once the previous ramp is done.
+     * At 96MHz a full-scale ramp takes 44ms to 11s; shorter or longer
+     * times are clamped. The set*Volume() calls change the volume at once
+     * again. In SHADOW_DEFERRED mode the target goes out with commit().
+     * 
+     * @param channel MIXER_CHANNEL_*
+     * @param target Volume to reach (0-255)
+     * @param ms Ramp time, 0 = at once
+     */
+    void rampTo(uint8_t channel, uint8_t target, uint16_t ms);
+    
+    /**
+     * @brief Read which volumes have reached their target
+     * @return MIXER_STATUS_*_DONE bits
+     */
+    uint8_t getRampStatus();
+    
+    /**
+     * @brief Check whether a volume has reached its target
+     * @param channel MIXER_CHANNEL_*
+     * @return true if the ramp is done
+     */
+    bool isRampDone(uint8_t channel);
+    
+    // ========================================================================
+    // PCM sample channel
+    // ========================================================================
+    
+    /**
+     * @brief Set the playback rate of the sample channel
+     * @param rate Samples per second (MIXER_CLOCK_HZ / 65536 and up)
+     */
+    void setSampleRate(uint32_t rate);
+    
+    /**
+     * @brief Start or stop sample playback
+     * 
+     * A stopped channel is silent and keeps its FIFO contents. Fill the
+     * FIFO before enabling it to avoid an underrun at the start.
+     * 
+     * @param enable True to play samples from the FIFO
+     * @param clear True to empty the FIFO and clear the underrun flag
+     */
+    void enableSamples(bool enable = true, bool clear = false);
+    
+    /**
+     * @brief Append samples to the FIFO, 16 per bus burst
+     * 
+     * Never blocks: only as many samples as the FIFO has room for are
+     * taken. The room is tracked in software and the fill level is read
+     * back only when a call needs more than is known to be free.
+     * 
+     * @param samples Signed 8-bit samples
+     * @param count Number of samples
+     * @return Number of samples queued
+     */
+    uint16_t queueSamples(const int8_t* samples, uint16_t count);
+    
+    /**
+     * @brief Read the number of samples waiting in the FIFO
+     * @return Fill level (0..MIXER_PCM_FIFO_DEPTH)
+     */
+    uint16_t getSampleLevel();
+    
+    /**
+     * @brief Read the sample channel status
+     * @return MIXER_PCM_STATUS_* bits
+     */
+    uint8_t getSampleStatus();
+    
     /**
      * @brief Write to a mixer register
+     * 
+     * Writes to CONTROL..CH3_VOL go through the register shadow and are
+     * dropped when they would not change the register.
+     * 
      * @param addr Register address
      * @param data Data to write
      */
     void writeReg(uint8_t addr, uint8_t data);
     
+    /**
+     * @brief Write a block of consecutive mixer registers in one burst
+     * @param startAddr Address of the first register
+     * @param data Register values
+     * @param count Number of registers to write
+     */
+    void writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count);
+    
     /**
      * @brief Read from a mixer register
+     * 
+     * The volume registers read back the volume now, part way through a
+     * ramp; getReg() returns their target.
+     * 
      * @param addr Register address
      * @return Register value
      */
     uint8_t readReg(uint8_t addr);
     
+    /**
+     * @brief Get the last value written to a register, without a bus access
+     * @param addr Register address (CONTROL..CH3_VOL)
+     * @return Register value
+     */
+    uint8_t getReg(uint8_t addr);
+    
+    /**
+     * @brief Get the number of shadowed register writes sent to the chip
+     * @return Register values put on the bus since the object was created,
+     *         not counting unchanged writes that were dropped
+     */
+    uint32_t getBusWriteCount();
+    
+    /**
+     * @brief Send writes at once or hold them until commit()
+     * @param mode SHADOW_WRITE_THROUGH (default) or SHADOW_DEFERRED
+     */
+    void setCommitMode(ShadowCommitMode mode);
+    
+    /**
+     * @brief Send the registers changed since the last commit
+     */
+    void commit();
+    
     /**
      * @brief Reset mixer to default state
      */
@@ -128,8 +306,12 @@ public:
     
 private:
     uint16_t _baseAddr;
-    uint8_t _control;
-    uint8_t _masterVolume;
+    ShadowRegisterFile<MIXER_NUM_REGS, MixerConfig::busWidth> _regs;
+    uint16_t _pcmRoom;          // FIFO entries known to be free
+    uint8_t _rampRate[MIXER_NUM_CHANNELS];  // Last rate sent per channel
+    
+    void setControlBit(uint8_t bit, bool enable);
+    void setVolume(uint8_t channel, uint8_t volume, uint8_t rate);
 };
 
 #endif // AUDIO_MIXER_H
@@ -0,0 +1,226 @@
+/**
+ * @file C64IO.cpp
+ * @brief CIA 6526 timers and VIC-II raster interrupt implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "C64IO.h"
+#include <string.h>
+
+// ============================================================================
+// CIA6526 Implementation
+// ============================================================================
+
+CIA6526::CIA6526() {
+    reset();
+}
+
+void CIA6526::reset() {
+    memset(_regs, 0, sizeof(_regs));
+    _regs[0x00] = 0xFF;     // Port pins float high
+    _regs[0x01] = 0xFF;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        _timers[i].latch = 0xFFFF;
+        _timers[i].counter = 0xFFFF;
+        _timers[i].control = 0;
+        _timers[i].underflow = C64_EVENT_NEVER;
+    }
+
+    _icrMask = 0;
+    _icrFlags = 0;
+    _irq = false;
+}
+
+uint16_t CIA6526::counterAt(const Timer& t, uint64_t now) const {
+    if (t.underflow == C64_EVENT_NEVER) return t.counter;
+
+    // Counts down once per cycle and underflows one cycle after reaching 0
+    return (uint16_t)(t.underflow - now - 1);
+}
+
+void CIA6526::updateTimer(Timer& t, uint8_t flag, uint64_t now) {
+    if (t.underflow > now) return;
+
+    _icrFlags |= flag;
+    if (t.control & CIA_CR_ONESHOT) {
+        t.control &= ~CIA_CR_START;
+        t.counter = t.latch;
+        t.underflow = C64_EVENT_NEVER;
+    } else {
+        // Skip every underflow since the last access in one step
+        uint32_t period = (uint32_t)t.latch + 1;
+        t.underflow += ((now - t.underflow) / period + 1) * period;
+    }
+}
+
+void CIA6526::update(uint64_t now) {
+    updateTimer(_timers[0], CIA_ICR_TA, now);
+    updateTimer(_timers[1], CIA_ICR_TB, now);
+    if (_icrFlags & _icrMask) _irq = true;
+}
+
+uint64_t CIA6526::nextEvent() const {
+    // The output stays active until acknowledged, later underflows only
+    // set flags that are picked up when the ICR is read
+    if (_irq) return C64_EVENT_NEVER;
+
+    uint64_t next = C64_EVENT_NEVER;
+    if ((_icrMask & CIA_ICR_TA) && _timers[0].underflow < next) next = _timers[0].underflow;
+    if ((_icrMask & CIA_ICR_TB) && _timers[1].underflow < next) next = _timers[1].underflow;
+    return next;
+}
+
+void CIA6526::writeControl(Timer& t, uint8_t value, uint64_t now) {
+    if (t.underflow != C64_EVENT_NEVER) t.counter = counterAt(t, now);
+
+    t.control = value & ~CIA_CR_LOAD;
+    if (value & CIA_CR_LOAD) t.counter = t.latch;
+
+    t.underflow = (t.control & CIA_CR_START) ? now + t.counter + 1 : C64_EVENT_NEVER;
+}
+
+uint8_t CIA6526::read(uint8_t reg, uint64_t now) {
+    reg &= 0x0F;
+    update(now);
+
+    uint8_t value;
+    switch (reg) {
+        case CIA_TA_LO: return counterAt(_timers[0], now) & 0xFF;
+        case CIA_TA_HI: return counterAt(_timers[0], now) >> 8;
+        case CIA_TB_LO: return counterAt(_timers[1], now) & 0xFF;
+        case CIA_TB_HI: return counterAt(_timers[1], now) >> 8;
+        case CIA_ICR:
+            value = _icrFlags | (_irq ? CIA_ICR_SET : 0);
+            _icrFlags = 0;
+            _irq = false;
+            return value;
+        case CIA_CRA: return _timers[0].control;
+        case CIA_CRB: return _timers[1].control;
+    }
+    return _regs[reg];
+}
+
+void CIA6526::write(uint8_t reg, uint8_t value, uint64_t now) {
+    reg &= 0x0F;
+    update(now);
+
+    Timer& t = _timers[(reg == CIA_TB_LO || reg == CIA_TB_HI || reg == CIA_CRB) ? 1 : 0];
+    switch (reg) {
+        case CIA_TA_LO:
+        case CIA_TB_LO:
+            t.latch = (t.latch & 0xFF00) | value;
+            break;
+        case CIA_TA_HI:
+        case CIA_TB_HI:
+            // A stopped timer loads the latch when its high byte is written
+            t.latch = (t.latch & 0x00FF) | (value << 8);
+            if (t.underflow == C64_EVENT_NEVER) t.counter = t.latch;
+            break;
+        case CIA_ICR:
+            if (value & CIA_ICR_SET) _icrMask |= value & 0x1F;
+            else _icrMask &= ~value;
+            if (_icrFlags & _icrMask) _irq = true;
+            break;
+        case CIA_CRA:
+        case CIA_CRB:
+            writeControl(t, value, now);
+            break;
+        default:
+            _regs[reg] = value;
+            break;
+    }
+}
+
+// ============================================================================
+// VICRaster Implementation
+// ============================================================================
+
+VICRaster::VICRaster() {
+    reset(312, 63);
+}
+
+void VICRaster::reset(uint16_t lines, uint8_t cyclesPerLine) {
+    memset(_regs, 0, sizeof(_regs));
+    _lines = lines;
+    _cyclesPerLine = cyclesPerLine;
+    _frameCycles = (uint32_t)lines * cyclesPerLine;
+    _compare = 0;
+    _irqFlags = 0;
+    _irqMask = 0;
+    _nextMatch = C64_EVENT_NEVER;
+}
+
+uint16_t VICRaster::lineAt(uint64_t now) const {
+    return (uint16_t)((now % _frameCycles) / _cyclesPerLine);
+}
+
+void VICRaster::scheduleMatch(uint64_t now) {
+    if (_compare >= _lines) {
+        // Line never reached, no interrupt
+        _nextMatch = C64_EVENT_NEVER;
+        return;
+    }
+
+    uint64_t match = now - now % _frameCycles + (uint32_t)_compare * _cyclesPerLine;
+    if (match <= now) match += _frameCycles;
+    _nextMatch = match;
+}
+
+void VICRaster::update(uint64_t now) {
+    if (_nextMatch > now) return;
+
+    _irqFlags |= VIC_IRQ_RASTER;
+    scheduleMatch(now);
+}
+
+uint64_t VICRaster::nextEvent() const {
+    if ((_irqMask & VIC_IRQ_RASTER) && !(_irqFlags & VIC_IRQ_RASTER)) return _nextMatch;
+    return C64_EVENT_NEVER;
+}
+
+uint8_t VICRaster::read(uint8_t reg, uint64_t now) {
+    reg &= VIC_NUM_REGS - 1;
+    update(now);
+
+    uint16_t line;
+    switch (reg) {
+        case VIC_CONTROL1:
+            line = lineAt(now);
+            return (_regs[reg] & 0x7F) | ((line >> 1) & 0x80);
+        case VIC_RASTER:
+            return lineAt(now) & 0xFF;
+        case VIC_IRQ_FLAGS:
+            return _irqFlags | 0x70 | (irq() ? 0x80 : 0);
+        case VIC_IRQ_MASK:
+            return _irqMask | 0xF0;
+    }
+    // $D02F-$D03F are unused
+    return reg < 0x2F ? _regs[reg] : 0xFF;
+}
+
+void VICRaster::write(uint8_t reg, uint8_t value, uint64_t now) {
+    reg &= VIC_NUM_REGS - 1;
+    update(now);
+
+    switch (reg) {
+        case VIC_CONTROL1:
+            _compare = (_compare & 0xFF) | ((value & 0x80) << 1);
+            scheduleMatch(now);
+            break;
+        case VIC_RASTER:
+            _compare = (_compare & 0x100) | value;
+            scheduleMatch(now);
+            break;
+        case VIC_IRQ_FLAGS:
+            // Writing a 1 acknowledges that interrupt
+            _irqFlags &= ~value & 0x0F;
+            break;
+        case VIC_IRQ_MASK:
+            _irqMask = value & 0x0F;
+            break;
+    }
+    _regs[reg] = value;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file C64IO.h
+ * @brief CIA 6526 timers and VIC-II raster interrupt for the 6502 emulator
+ *
+ * Just enough of the C64 chips around the SID for tunes that drive
+ * themselves from interrupts (RSID). Nothing is clocked per cycle: each
+ * chip computes its state from the cycle counter when it is accessed and
+ * reports the cycle of its next interrupt, so the CPU core only has to
+ * stop when that cycle is reached.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef C64_IO_H
+#define C64_IO_H
+
+#include <Arduino.h>
+
+// No event scheduled
+#define C64_EVENT_NEVER     0xFFFFFFFFFFFFFFFFULL
+
+// CIA registers
+#define CIA_TA_LO           0x04
+#define CIA_TA_HI           0x05
+#define CIA_TB_LO           0x06
+#define CIA_TB_HI           0x07
+#define CIA_ICR             0x0D
+#define CIA_CRA             0x0E
+#define CIA_CRB             0x0F
+
+// CIA interrupt control register bits
+#define CIA_ICR_TA          0x01
+#define CIA_ICR_TB          0x02
+#define CIA_ICR_SET         0x80    // Write: set mask bits, read: interrupt occurred
+
+// CIA timer control register bits
+#define CIA_CR_START        0x01
+#define CIA_CR_ONESHOT      0x08
+#define CIA_CR_LOAD         0x10    // Strobe, reads back as 0
+
+// VIC-II registers
+#define VIC_CONTROL1        0x11    // Bit 7: raster line bit 8
+#define VIC_RASTER          0x12
+#define VIC_IRQ_FLAGS       0x19
+#define VIC_IRQ_MASK        0x1A
+#define VIC_NUM_REGS        0x40    // Registers repeat every 64 bytes
+
+#define VIC_IRQ_RASTER      0x01
+
+/**
+ * @class CIA6526
+ * @brief CIA with its two interval timers and interrupt control
+ *
+ * Ports, TOD clock and serial register only store what is written.
+ * Timer B always counts clock cycles.
+ */
+class CIA6526 {
+public:
+    CIA6526();
+
+    /**
+     * @brief Power-on state: timers stopped, latches $FFFF, interrupts masked
+     */
+    void reset();
+
+    /**
+     * @brief Read a register
+     * @param reg Register number (0-15)
+     * @param now Cycle counter at the access
+     * @return Register value; reading the ICR acknowledges the interrupt
+     */
+    uint8_t read(uint8_t reg, uint64_t now);
+
+    /**
+     * @brief Write a register
+     * @param reg Register number (0-15)
+     * @param value Value to write
+     * @param now Cycle counter at the access
+     */
+    void write(uint8_t reg, uint8_t value, uint64_t now);
+
+    /**
+     * @brief Account for timer underflows up to a cycle
+     * @param now Cycle counter
+     */
+    void update(uint64_t now);
+
+    /**
+     * @brief Get the cycle at which the interrupt output goes active
+     * @return Cycle of the next unmasked underflow, or C64_EVENT_NEVER
+     */
+    uint64_t nextEvent() const;
+
+    /**
+     * @brief Check the interrupt output
+     * @return true until the ICR is read
+     */
+    bool irq() const { return _irq; }
+
+    /**
+     * @brief Get the timer A latch
+     * @return Value reloaded into timer A on each underflow
+     */
+    uint16_t getLatchA() const { return _timers[0].latch; }
+
+private:
+    struct Timer {
+        uint16_t latch;
+        uint16_t counter;       // Valid while stopped
+        uint8_t control;
+        uint64_t underflow;     // Next underflow while running
+    };
+
+    Timer _timers[2];
+    uint8_t _regs[16];          // Registers that only store their value
+    uint8_t _icrMask;
+    uint8_t _icrFlags;
+    bool _irq;
+
+    void updateTimer(Timer& t, uint8_t flag, uint64_t now);
+    uint16_t counterAt(const Timer& t, uint64_t now) const;
+    void writeControl(Timer& t, uint8_t value, uint64_t now);
+};
+
+/**
+ * @class VICRaster
+ * @brief VIC-II raster counter and raster compare interrupt
+ *
+ * The beam position follows the cycle counter. Other VIC registers
+ * only store what is written.
+ */
+class VICRaster {
+public:
+    VICRaster();
+
+    /**
+     * @brief Reset for a video standard
+     * @param lines Raster lines per frame (312 PAL, 263 NTSC)
+     * @param cyclesPerLine Cycles per raster line (63 PAL, 65 NTSC)
+     */
+    void reset(uint16_t lines, uint8_t cyclesPerLine);
+
+    /**
+     * @brief Read a register
+     * @param reg Register number (0-63)
+     * @param now Cycle counter at the access
+     * @return Register value
+     */
+    uint8_t read(uint8_t reg, uint64_t now);
+
+    /**
+     * @brief Write a register
+     * @param reg Register number (0-63)
+     * @param value Value to write
+     * @param now Cycle counter at the access
+     */
+    void write(uint8_t reg, uint8_t value, uint64_t now);
+
+    /**
+     * @brief Account for raster compare matches up to a cycle
+     * @param now Cycle counter
+     */
+    void update(uint64_t now);
+
+    /**
+     * @brief Get the cycle at which the interrupt output goes active
+     * @return Cycle of the next enabled raster match, or C64_EVENT_NEVER
+     */
+    uint64_t nextEvent() const;
+
+    /**
+     * @brief Check the interrupt output
+     * @return true while an enabled interrupt flag is not acknowledged
+     */
+    bool irq() const { return (_irqFlags & _irqMask) != 0; }
+
+private:
+    uint8_t _regs[VIC_NUM_REGS];
+    uint16_t _lines;
+    uint8_t _cyclesPerLine;
+    uint32_t _frameCycles;
+    uint16_t _compare;          // Raster compare line
+    uint8_t _irqFlags;
+    uint8_t _irqMask;
+    uint64_t _nextMatch;        // Next time the beam reaches the compare line
+
+    uint16_t lineAt(uint64_t now) const;
+    void scheduleMatch(uint64_t now);
+};
+
+#endif // C64_IO_H
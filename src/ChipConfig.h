@@ -0,0 +1,145 @@
+/**
+ * @file ChipConfig.h
+ * @brief Compile-time clocks, addresses and bus widths of the sound chips
+ *
+ * The gateware clocks each chip from a divider of the system clock, and
+ * the divider differs between board variants. The MIDI note tables of the
+ * voice classes are generated by the compiler for the clocks named here,
+ * so a board with another clock only needs a build flag, for example
+ * -DSID_CLOCK_HZ=985248UL for a PAL-clocked SID. Nothing is computed at
+ * run time; each table is a constant in flash.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef CHIP_CONFIG_H
+#define CHIP_CONFIG_H
+
+#include <Arduino.h>
+#include "ShadowRegisterFile.h"
+
+// Chip clocks of the gateware. A C64 SID runs at 985248 Hz (PAL) or
+// 1022727 Hz (NTSC); periods in YM files for other clocks are rescaled
+// to YM_CLOCK_HZ.
+#ifndef SID_CLOCK_HZ
+#define SID_CLOCK_HZ            1000000UL
+#endif
+
+#ifndef YM_CLOCK_HZ
+#define YM_CLOCK_HZ             2000000UL
+#endif
+
+#ifndef POKEY_CLOCK_HZ
+#define POKEY_CLOCK_HZ          1789773UL
+#endif
+
+// Mixer clock, which the sample period and the volume ramps count
+#ifndef MIXER_CLOCK_HZ
+#define MIXER_CLOCK_HZ          96000000UL
+#endif
+
+/**
+ * @brief Settings a chip class is built with
+ * @tparam ClockHz Chip clock in the gateware
+ * @tparam BaseAddr Default Wishbone base address
+ * @tparam Width Bus access of its shadowed registers
+ */
+template <uint32_t ClockHz, uint16_t BaseAddr, ShadowBusWidth Width>
+struct ChipConfig {
+    static const uint32_t clock = ClockHz;
+    static const uint16_t baseAddr = BaseAddr;
+    static const ShadowBusWidth busWidth = Width;
+};
+
+template <uint32_t ClockHz, uint16_t BaseAddr, ShadowBusWidth Width>
+const uint32_t ChipConfig<ClockHz, BaseAddr, Width>::clock;
+template <uint32_t ClockHz, uint16_t BaseAddr, ShadowBusWidth Width>
+const uint16_t ChipConfig<ClockHz, BaseAddr, Width>::baseAddr;
+template <uint32_t ClockHz, uint16_t BaseAddr, ShadowBusWidth Width>
+const ShadowBusWidth ChipConfig<ClockHz, BaseAddr, Width>::busWidth;
+
+typedef ChipConfig<SID_CLOCK_HZ, 0x30, SHADOW_BUS_16> SIDConfig;
+typedef ChipConfig<YM_CLOCK_HZ, 0x50, SHADOW_BUS_16> YMConfig;
+typedef ChipConfig<POKEY_CLOCK_HZ, 0x60, SHADOW_BUS_8> POKEYConfig;
+typedef ChipConfig<MIXER_CLOCK_HZ, 0x70, SHADOW_BUS_8> MixerConfig;
+
+// ============================================================================
+// MIDI note tables
+// ============================================================================
+
+#define PITCH_NUM_NOTES         129     // MIDI notes 0-127, 128 = note off
+#define PITCH_NOTE_OFF          128
+
+// Equal temperament with A4 (note 69) at 440 Hz; note 0 is 8.18 Hz. Each
+// entry is the exact register value rounded to nearest. At 1MHz/2MHz this
+// differs from the old hand-written tables in SID notes 0-12 (were clamped
+// to 291), 86 (19709, exactly 19707.51), 87 and 94 (typos), and YM notes
+// 0-22 (above 12 bits, now 4095); see tools/test/pitch_table_test.cpp.
+constexpr double pitchOctave(int octaves) {
+    return octaves ? 2.0 * pitchOctave(octaves - 1) : 1.0;
+}
+
+constexpr double pitchSemitones(int semitones) {
+    return semitones ? 1.0594630943592953 * pitchSemitones(semitones - 1) : 1.0;
+}
+
+constexpr double pitchNoteHz(int note) {
+    return 8.175798915643707 * pitchOctave(note / 12) * pitchSemitones(note % 12);
+}
+
+// Round to the nearest register value, saturating at max
+constexpr uint16_t pitchRound(double value, uint16_t max) {
+    return value + 0.5 >= max ? max : (uint16_t)(value + 0.5);
+}
+
+/**
+ * @brief SID frequency register of a note: Hz * 2^24 / clock
+ * @tparam ClockHz SID clock
+ */
+template <uint32_t ClockHz>
+struct SIDPitch {
+    static constexpr uint16_t value(int note) {
+        return note >= PITCH_NOTE_OFF ? 0 : pitchRound(pitchNoteHz(note) * 16777216.0 / ClockHz, 0xFFFF);
+    }
+};
+
+/**
+ * @brief YM2149 tone period of a note: clock / (16 * Hz), 12 bits
+ * @tparam ClockHz YM2149 clock
+ */
+template <uint32_t ClockHz>
+struct YMPitch {
+    static constexpr uint16_t value(int note) {
+        return note >= PITCH_NOTE_OFF ? 0 : pitchRound(ClockHz / (16.0 * pitchNoteHz(note)), 0x0FFF);
+    }
+};
+
+// Note numbers 0..N-1 as a parameter pack, to build a table in one initializer
+template <uint8_t... I>
+struct PitchIndex {};
+
+template <uint8_t N, uint8_t... I>
+struct MakePitchIndex : MakePitchIndex<N - 1, N - 1, I...> {};
+
+template <uint8_t... I>
+struct MakePitchIndex<0, I...> {
+    typedef PitchIndex<I...> type;
+};
+
+/**
+ * @brief Register value of every MIDI note, generated at compile time
+ * @tparam Pitch SIDPitch<clock> or YMPitch<clock>
+ */
+template <class Pitch, class Index = typename MakePitchIndex<PITCH_NUM_NOTES>::type>
+struct PitchTable;
+
+template <class Pitch, uint8_t... I>
+struct PitchTable<Pitch, PitchIndex<I...> > {
+    static constexpr uint16_t notes[PITCH_NUM_NOTES] = { Pitch::value(I)... };
+};
+
+template <class Pitch, uint8_t... I>
+constexpr uint16_t PitchTable<Pitch, PitchIndex<I...> >::notes[PITCH_NUM_NOTES];
+
+#endif // CHIP_CONFIG_H
@@ -0,0 +1,125 @@
+/**
+ * @file FrameRing.h
+ * @brief Lock-free single-producer / single-consumer ring of frames
+ *
+ * One side (for example an emulation task on the other core) writes
+ * frames, the other side reads them. Each index is only written by its
+ * own side, so no lock is needed as long as there is exactly one
+ * producer and one consumer.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <Arduino.h>
+
+/**
+ * @class FrameRing
+ * @brief Fixed-size SPSC ring buffer
+ * @tparam T Frame type
+ * @tparam N Number of slots (power of two)
+ */
+template <typename T, uint16_t N>
+class FrameRing {
+    static_assert(N && !(N & (N - 1)), "FrameRing size must be a power of two");
+
+public:
+    FrameRing() : _head(0), _tail(0) {}
+
+    /**
+     * @brief Discard all frames
+     * Only safe while neither side is accessing the ring
+     */
+    void clear() {
+        _head = 0;
+        _tail = 0;
+    }
+
+    /**
+     * @brief Get the slot for the next frame (producer)
+     * @return Slot to fill, or nullptr if the ring is full
+     */
+    T* writeSlot() {
+        uint16_t tail = _tail;
+        if ((uint16_t)(tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) >= N) return nullptr;
+        return &_slots[tail & (N - 1)];
+    }
+
+    /**
+     * @brief Publish the slot returned by writeSlot() (producer)
+     */
+    void commit() {
+        __atomic_store_n(&_tail, (uint16_t)(_tail + 1), __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Get the oldest frame without removing it (consumer)
+     * @return Oldest frame, or nullptr if the ring is empty
+     */
+    const T* peek() {
+        uint16_t head = _head;
+        if (head == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE)) return nullptr;
+        return &_slots[head & (N - 1)];
+    }
+
+    /**
+     * @brief Remove the frame returned by peek() (consumer)
+     */
+    void release() {
+        __atomic_store_n(&_head, (uint16_t)(_head + 1), __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Copy in a frame (producer)
+     * @param frame Frame to add
+     * @return false if the ring is full
+     */
+    bool push(const T& frame) {
+        T* slot = writeSlot();
+        if (!slot) return false;
+        *slot = frame;
+        commit();
+        return true;
+    }
+
+    /**
+     * @brief Copy out and remove the oldest frame (consumer)
+     * @param frame Destination
+     * @return false if the ring is empty
+     */
+    bool pop(T& frame) {
+        const T* slot = peek();
+        if (!slot) return false;
+        frame = *slot;
+        release();
+        return true;
+    }
+
+    /**
+     * @brief Get the number of frames waiting
+     * @return Frame count (either side)
+     */
+    uint16_t count() const {
+        return (uint16_t)(__atomic_load_n(&_tail, __ATOMIC_ACQUIRE) -
+                          __atomic_load_n(&_head, __ATOMIC_ACQUIRE));
+    }
+
+    bool empty() const { return count() == 0; }
+    bool full() const { return count() >= N; }
+
+    /**
+     * @brief Get the number of slots
+     * @return Ring capacity
+     */
+    static uint16_t capacity() { return N; }
+
+private:
+    T _slots[N];
+    uint16_t _head;     // Next frame to read, written by the consumer only
+    uint16_t _tail;     // Next slot to write, written by the producer only
+};
+
+#endif // FRAME_RING_H
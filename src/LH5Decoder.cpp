@@ -0,0 +1,238 @@
+/**
+ * @file LH5Decoder.cpp
+ * @brief Streaming LHA -lh5- decompressor implementation
+ *
+ * Follows the block layout of Okumura's ar002 decoder. The Huffman codes
+ * are canonical and decoded one bit at a time from the code counts, which
+ * needs no lookup tables; a YM tune only unpacks a few KB per second.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "LH5Decoder.h"
+#include <string.h>
+
+// Copy lengths start at 3, coded after the 256 literals
+#define LH5_THRESHOLD       3
+
+// ============================================================================
+// LH5Decoder Implementation
+// ============================================================================
+
+LH5Decoder::LH5Decoder() :
+    _window(NULL), _size(0), _pos(0), _winPos(0), _matchPos(0), _matchLen(0),
+    _blockSize(0), _failed(false), _inPos(0), _inLen(0), _bitBuf(0), _bitCount(0)
+{
+    _lit.symbol = _litSymbols;
+    _pt.symbol = _ptSymbols;
+}
+
+LH5Decoder::~LH5Decoder() {
+    end();
+}
+
+bool LH5Decoder::begin(uint32_t originalSize) {
+    if (!_window) {
+        _window = (uint8_t*)malloc(LH5_DICSIZ);
+        if (!_window) return false;
+    }
+    _size = originalSize;
+    reset();
+    return true;
+}
+
+void LH5Decoder::end() {
+    free(_window);
+    _window = NULL;
+}
+
+void LH5Decoder::reset() {
+    // Matches may reach back before the start, the window starts out as spaces
+    if (_window) memset(_window, ' ', LH5_DICSIZ);
+    _pos = 0;
+    _winPos = 0;
+    _matchLen = 0;
+    _blockSize = 0;
+    _failed = false;
+    _inPos = 0;
+    _inLen = 0;
+    _bitBuf = 0;
+    _bitCount = 0;
+}
+
+uint8_t LH5Decoder::nextByte() {
+    if (_inPos >= _inLen) {
+        _inLen = readInput(_in, sizeof(_in));
+        _inPos = 0;
+        // Past the end the stream reads as zeros, like ar002
+        if (!_inLen) return 0;
+    }
+    return _in[_inPos++];
+}
+
+uint16_t LH5Decoder::getBits(uint8_t n) {
+    while (_bitCount < n) {
+        _bitBuf = (_bitBuf << 8) | nextByte();
+        _bitCount += 8;
+    }
+    _bitCount -= n;
+    return (_bitBuf >> _bitCount) & ((1UL << n) - 1);
+}
+
+bool LH5Decoder::buildHuffman(Huffman& h, const uint8_t* lengths, uint16_t n) {
+    uint16_t offs[LH5_MAX_BITS + 1];
+
+    memset(h.count, 0, sizeof(h.count));
+    h.single = -1;
+    for (uint16_t sym = 0; sym < n; sym++) h.count[lengths[sym]]++;
+
+    // Reject an over-subscribed code
+    int32_t left = 1;
+    for (uint8_t len = 1; len <= LH5_MAX_BITS; len++) {
+        left = (left << 1) - h.count[len];
+        if (left < 0) return false;
+    }
+
+    offs[1] = 0;
+    for (uint8_t len = 1; len < LH5_MAX_BITS; len++) offs[len + 1] = offs[len] + h.count[len];
+    for (uint16_t sym = 0; sym < n; sym++) {
+        if (lengths[sym]) h.symbol[offs[lengths[sym]]++] = sym;
+    }
+    return true;
+}
+
+int LH5Decoder::decodeSymbol(const Huffman& h) {
+    if (h.single >= 0) return h.single;
+
+    // Canonical codes: shorter codes sort first, symbols in order within a length
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    for (uint8_t len = 1; len <= LH5_MAX_BITS; len++) {
+        code |= getBits(1);
+        int32_t count = h.count[len];
+        if (code - count < first) return h.symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool LH5Decoder::readPtLen(uint8_t nn, uint8_t nbit, int8_t special) {
+    uint8_t n = getBits(nbit);
+    if (n == 0) {
+        uint16_t c = getBits(nbit);
+        if (c >= nn) return false;
+        memset(_pt.count, 0, sizeof(_pt.count));
+        _pt.single = c;
+        return true;
+    }
+    if (n > nn) return false;
+
+    uint8_t i = 0;
+    while (i < n) {
+        // 0-6 in three bits, longer lengths continue in unary
+        uint8_t c = getBits(3);
+        if (c == 7) {
+            while (getBits(1)) {
+                if (++c > LH5_MAX_BITS) return false;
+            }
+        }
+        _lengths[i++] = c;
+
+        if (i == special) {
+            uint8_t zeros = getBits(2);
+            while (zeros-- && i < nn) _lengths[i++] = 0;
+        }
+    }
+    while (i < nn) _lengths[i++] = 0;
+
+    return buildHuffman(_pt, _lengths, nn);
+}
+
+bool LH5Decoder::readCLen() {
+    uint16_t n = getBits(9);
+    if (n == 0) {
+        uint16_t c = getBits(9);
+        if (c >= LH5_NC) return false;
+        memset(_lit.count, 0, sizeof(_lit.count));
+        _lit.single = c;
+        return true;
+    }
+    if (n > LH5_NC) return false;
+
+    uint16_t i = 0;
+    while (i < n) {
+        int c = decodeSymbol(_pt);
+        if (c < 0) return false;
+
+        if (c <= 2) {
+            // Runs of unused symbols
+            uint16_t zeros;
+            if (c == 0) zeros = 1;
+            else if (c == 1) zeros = getBits(4) + 3;
+            else zeros = getBits(9) + 20;
+            while (zeros-- && i < LH5_NC) _lengths[i++] = 0;
+        } else {
+            _lengths[i++] = c - 2;
+        }
+    }
+    while (i < LH5_NC) _lengths[i++] = 0;
+
+    return buildHuffman(_lit, _lengths, LH5_NC);
+}
+
+bool LH5Decoder::readBlockHeader() {
+    _blockSize = getBits(16);
+    return readPtLen(LH5_NT, 5, 3) && readCLen() && readPtLen(LH5_NP, 4, -1);
+}
+
+size_t LH5Decoder::read(uint8_t* out, size_t n) {
+    if (!_window) return 0;
+
+    size_t done = 0;
+    while (done < n && _pos < _size && !_failed) {
+        uint8_t value;
+
+        if (_matchLen) {
+            value = _window[_matchPos];
+            _matchPos = (_matchPos + 1) & (LH5_DICSIZ - 1);
+            _matchLen--;
+        } else {
+            if (_blockSize == 0 && !readBlockHeader()) {
+                _failed = true;
+                break;
+            }
+            _blockSize--;
+
+            int c = decodeSymbol(_lit);
+            if (c < 0) {
+                _failed = true;
+                break;
+            }
+
+            if (c > 0xFF) {
+                int p = decodeSymbol(_pt);
+                if (p < 0) {
+                    _failed = true;
+                    break;
+                }
+                uint16_t dist = p ? (1U << (p - 1)) + getBits(p - 1) : 0;
+
+                _matchLen = c - (0x100 - LH5_THRESHOLD);
+                _matchPos = (_winPos - dist - 1) & (LH5_DICSIZ - 1);
+                continue;
+            }
+            value = c;
+        }
+
+        _window[_winPos] = value;
+        _winPos = (_winPos + 1) & (LH5_DICSIZ - 1);
+        if (out) out[done] = value;
+        done++;
+        _pos++;
+    }
+    return done;
+}
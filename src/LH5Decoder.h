@@ -0,0 +1,124 @@
+/**
+ * @file LH5Decoder.h
+ * @brief Streaming LHA -lh5- decompressor
+ *
+ * Decodes the LZ77 + Huffman format used for YM5/YM6 files without ever
+ * holding more than the 8KB sliding window: compressed data is pulled in
+ * chunks of LH5_INPUT_SIZE bytes and output is produced on demand, so a
+ * tune never has to be unpacked in full.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef LH5_DECODER_H
+#define LH5_DECODER_H
+
+#include <Arduino.h>
+
+#define LH5_DICBIT          13
+#define LH5_DICSIZ          (1U << LH5_DICBIT)
+#define LH5_INPUT_SIZE      256     // Compressed bytes read at a time
+
+#define LH5_NC              510     // Literals and match lengths
+#define LH5_NP              (LH5_DICBIT + 1)
+#define LH5_NT              19      // Code length codes
+#define LH5_MAX_BITS        16
+
+/**
+ * @class LH5Decoder
+ * @brief Pull decoder for one -lh5- member
+ *
+ * A subclass supplies the compressed bytes through readInput().
+ */
+class LH5Decoder {
+public:
+    LH5Decoder();
+    virtual ~LH5Decoder();
+
+    /**
+     * @brief Allocate the window and start decoding
+     * @param originalSize Size of the unpacked data
+     * @return false if the window could not be allocated
+     */
+    bool begin(uint32_t originalSize);
+
+    /**
+     * @brief Release the window
+     */
+    void end();
+
+    /**
+     * @brief Start again from the first compressed byte
+     *
+     * The subclass must rewind its input before calling this.
+     */
+    void reset();
+
+    /**
+     * @brief Decode the next bytes
+     * @param out Destination, or NULL to skip
+     * @param n Number of bytes wanted
+     * @return Bytes decoded, less than n at the end or on corrupt data
+     */
+    size_t read(uint8_t* out, size_t n);
+
+    /**
+     * @brief Get the unpacked position
+     * @return Bytes decoded since the last reset
+     */
+    uint32_t position() const { return _pos; }
+
+    /**
+     * @brief Check for corrupt input
+     * @return true once an invalid code was found
+     */
+    bool failed() const { return _failed; }
+
+protected:
+    /**
+     * @brief Supply compressed data
+     * @param buf Destination
+     * @param n Bytes wanted
+     * @return Bytes read, 0 at the end of the input
+     */
+    virtual size_t readInput(uint8_t* buf, size_t n) = 0;
+
+private:
+    struct Huffman {
+        uint16_t count[LH5_MAX_BITS + 1];   // Codes of each length
+        uint16_t* symbol;                   // Symbols in canonical order
+        int16_t single;                     // Only symbol, sent with 0 bits
+    };
+
+    uint8_t* _window;
+    uint32_t _size;
+    uint32_t _pos;
+    uint16_t _winPos;
+    uint16_t _matchPos;
+    uint16_t _matchLen;
+    uint16_t _blockSize;
+    bool _failed;
+
+    uint8_t _in[LH5_INPUT_SIZE];
+    uint16_t _inPos;
+    uint16_t _inLen;
+    uint32_t _bitBuf;
+    uint8_t _bitCount;
+
+    Huffman _lit;
+    Huffman _pt;
+    uint16_t _litSymbols[LH5_NC];
+    uint16_t _ptSymbols[LH5_NT];
+    uint8_t _lengths[LH5_NC];
+
+    uint8_t nextByte();
+    uint16_t getBits(uint8_t n);
+    bool buildHuffman(Huffman& h, const uint8_t* lengths, uint16_t n);
+    int decodeSymbol(const Huffman& h);
+    bool readPtLen(uint8_t nn, uint8_t nbit, int8_t special);
+    bool readCLen();
+    bool readBlockHeader();
+};
+
+#endif // LH5_DECODER_H
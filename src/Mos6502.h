@@ -0,0 +1,739 @@
+/**
+ * @file Mos6502.h
+ * @brief 6502 core shared by the file players
+ *
+ * One handler per instruction, with the addressing mode as a template
+ * parameter so every mode switch folds away at compile time. The CPU
+ * registers live in a local copy for the duration of run(); on GCC the
+ * handlers are dispatched with computed gotos (threaded code), elsewhere
+ * through a 256-entry handler table built from the same opcode list.
+ *
+ * The machine around the CPU is a bus policy class given as the template
+ * parameter, so its memory map and I/O hooks are resolved at compile time:
+ *
+ *     PagedMemory& memory();              // RAM, ROM and I/O pages
+ *     uint8_t ioRead(uint16_t addr);      // Pages without a fast read pointer
+ *     void ioWrite(uint16_t addr, uint8_t value);  // ... or write pointer
+ *     uint64_t nextEvent();               // Cycle the bus needs service at
+ *     void serviceEvents(uint64_t now);   // Called once nextEvent() is reached
+ *     bool irqLine();                     // IRQ input level
+ *     bool takeNmi();                     // True once per NMI edge
+ *     bool idleUntilEvent();              // Keep running after a routine returned
+ *
+ * ioRead() and ioWrite() see the time of the access in now(). A bus that
+ * keeps these methods private befriends Mos6502<Bus>.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef MOS6502_H
+#define MOS6502_H
+
+#include <Arduino.h>
+#include "PagedMemory.h"
+
+// CPU Flags
+#define FLAG_N 128
+#define FLAG_V 64
+#define FLAG_B 16
+#define FLAG_D 8
+#define FLAG_I 4
+#define FLAG_Z 2
+#define FLAG_C 1
+
+// Addressing modes
+#define MOS6502_MODE_IMP  0
+#define MOS6502_MODE_IMM  1
+#define MOS6502_MODE_ABS  2
+#define MOS6502_MODE_ABSX 3
+#define MOS6502_MODE_ABSY 4
+#define MOS6502_MODE_ZP   6
+#define MOS6502_MODE_ZPX  7
+#define MOS6502_MODE_ZPY  8
+#define MOS6502_MODE_IND  9
+#define MOS6502_MODE_INDX 10
+#define MOS6502_MODE_INDY 11
+#define MOS6502_MODE_ACC  12
+#define MOS6502_MODE_REL  13
+#define MOS6502_MODE_XXX  14
+
+// nextEvent() of a bus with nothing scheduled
+#define MOS6502_EVENT_NEVER     UINT64_MAX
+
+#if defined(__GNUC__)
+#define MOS6502_INLINE inline __attribute__((always_inline))
+#define MOS6502_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define MOS6502_INLINE inline
+#define MOS6502_UNLIKELY(x) (x)
+#endif
+
+// The old name of the switch still turns threaded dispatch off
+#if defined(SID_CPU_NO_COMPUTED_GOTO) && !defined(MOS6502_NO_COMPUTED_GOTO)
+#define MOS6502_NO_COMPUTED_GOTO
+#endif
+
+#if defined(__GNUC__) && !defined(MOS6502_NO_COMPUTED_GOTO)
+#define MOS6502_THREADED 1
+#else
+#define MOS6502_THREADED 0
+#endif
+
+// Counting instructions costs a quarter of the emulation speed, so only
+// builds that report it (-DMOS6502_COUNT_INSTRUCTIONS) pay for it
+#ifdef MOS6502_COUNT_INSTRUCTIONS
+#define MOS6502_COUNT(c) ((c).instructions++)
+#else
+#define MOS6502_COUNT(c) ((void)0)
+#endif
+
+// ----------------------------------------------------------------------------
+// Opcode table: X(opcode, instruction, addressing mode)
+// ----------------------------------------------------------------------------
+
+#define MOS6502_OPCODES(X) \
+    X(00,BRK,IMP) X(01,ORA,INDX) X(02,XXX,IMP) X(03,XXX,IMP) X(04,XXX,IMP) X(05,ORA,ZP) X(06,ASL,ZP) X(07,XXX,IMP) \
+    X(08,PHP,IMP) X(09,ORA,IMM) X(0A,ASL,ACC) X(0B,XXX,IMP) X(0C,XXX,IMP) X(0D,ORA,ABS) X(0E,ASL,ABS) X(0F,XXX,IMP) \
+    X(10,BPL,REL) X(11,ORA,INDY) X(12,XXX,IMP) X(13,XXX,IMP) X(14,XXX,IMP) X(15,ORA,ZPX) X(16,ASL,ZPX) X(17,XXX,IMP) \
+    X(18,CLC,IMP) X(19,ORA,ABSY) X(1A,XXX,IMP) X(1B,XXX,IMP) X(1C,XXX,IMP) X(1D,ORA,ABSX) X(1E,ASL,ABSX) X(1F,XXX,IMP) \
+    X(20,JSR,ABS) X(21,AND,INDX) X(22,XXX,IMP) X(23,XXX,IMP) X(24,BIT,ZP) X(25,AND,ZP) X(26,ROL,ZP) X(27,XXX,IMP) \
+    X(28,PLP,IMP) X(29,AND,IMM) X(2A,ROL,ACC) X(2B,XXX,IMP) X(2C,BIT,ABS) X(2D,AND,ABS) X(2E,ROL,ABS) X(2F,XXX,IMP) \
+    X(30,BMI,REL) X(31,AND,INDY) X(32,XXX,IMP) X(33,XXX,IMP) X(34,XXX,IMP) X(35,AND,ZPX) X(36,ROL,ZPX) X(37,XXX,IMP) \
+    X(38,SEC,IMP) X(39,AND,ABSY) X(3A,XXX,IMP) X(3B,XXX,IMP) X(3C,XXX,IMP) X(3D,AND,ABSX) X(3E,ROL,ABSX) X(3F,XXX,IMP) \
+    X(40,RTI,IMP) X(41,EOR,INDX) X(42,XXX,IMP) X(43,XXX,IMP) X(44,XXX,IMP) X(45,EOR,ZP) X(46,LSR,ZP) X(47,XXX,IMP) \
+    X(48,PHA,IMP) X(49,EOR,IMM) X(4A,LSR,ACC) X(4B,XXX,IMP) X(4C,JMP,ABS) X(4D,EOR,ABS) X(4E,LSR,ABS) X(4F,XXX,IMP) \
+    X(50,BVC,REL) X(51,EOR,INDY) X(52,XXX,IMP) X(53,XXX,IMP) X(54,XXX,IMP) X(55,EOR,ZPX) X(56,LSR,ZPX) X(57,XXX,IMP) \
+    X(58,CLI,IMP) X(59,EOR,ABSY) X(5A,XXX,IMP) X(5B,XXX,IMP) X(5C,XXX,IMP) X(5D,EOR,ABSX) X(5E,LSR,ABSX) X(5F,XXX,IMP) \
+    X(60,RTS,IMP) X(61,ADC,INDX) X(62,XXX,IMP) X(63,XXX,IMP) X(64,XXX,IMP) X(65,ADC,ZP) X(66,ROR,ZP) X(67,XXX,IMP) \
+    X(68,PLA,IMP) X(69,ADC,IMM) X(6A,ROR,ACC) X(6B,XXX,IMP) X(6C,JMP,IND) X(6D,ADC,ABS) X(6E,ROR,ABS) X(6F,XXX,IMP) \
+    X(70,BVS,REL) X(71,ADC,INDY) X(72,XXX,IMP) X(73,XXX,IMP) X(74,XXX,IMP) X(75,ADC,ZPX) X(76,ROR,ZPX) X(77,XXX,IMP) \
+    X(78,SEI,IMP) X(79,ADC,ABSY) X(7A,XXX,IMP) X(7B,XXX,IMP) X(7C,XXX,IMP) X(7D,ADC,ABSX) X(7E,ROR,ABSX) X(7F,XXX,IMP) \
+    X(80,XXX,IMP) X(81,STA,INDX) X(82,XXX,IMP) X(83,XXX,IMP) X(84,STY,ZP) X(85,STA,ZP) X(86,STX,ZP) X(87,XXX,IMP) \
+    X(88,DEY,IMP) X(89,XXX,IMP) X(8A,TXA,IMP) X(8B,XXX,IMP) X(8C,STY,ABS) X(8D,STA,ABS) X(8E,STX,ABS) X(8F,XXX,IMP) \
+    X(90,BCC,REL) X(91,STA,INDY) X(92,XXX,IMP) X(93,XXX,IMP) X(94,STY,ZPX) X(95,STA,ZPX) X(96,STX,ZPY) X(97,XXX,IMP) \
+    X(98,TYA,IMP) X(99,STA,ABSY) X(9A,TXS,IMP) X(9B,XXX,IMP) X(9C,XXX,IMP) X(9D,STA,ABSX) X(9E,XXX,IMP) X(9F,XXX,IMP) \
+    X(A0,LDY,IMM) X(A1,LDA,INDX) X(A2,LDX,IMM) X(A3,XXX,IMP) X(A4,LDY,ZP) X(A5,LDA,ZP) X(A6,LDX,ZP) X(A7,XXX,IMP) \
+    X(A8,TAY,IMP) X(A9,LDA,IMM) X(AA,TAX,IMP) X(AB,XXX,IMP) X(AC,LDY,ABS) X(AD,LDA,ABS) X(AE,LDX,ABS) X(AF,XXX,IMP) \
+    X(B0,BCS,REL) X(B1,LDA,INDY) X(B2,XXX,IMP) X(B3,XXX,IMP) X(B4,LDY,ZPX) X(B5,LDA,ZPX) X(B6,LDX,ZPY) X(B7,XXX,IMP) \
+    X(B8,CLV,IMP) X(B9,LDA,ABSY) X(BA,TSX,IMP) X(BB,XXX,IMP) X(BC,LDY,ABSX) X(BD,LDA,ABSX) X(BE,LDX,ABSY) X(BF,XXX,IMP) \
+    X(C0,CPY,IMM) X(C1,CMP,INDX) X(C2,XXX,IMP) X(C3,XXX,IMP) X(C4,CPY,ZP) X(C5,CMP,ZP) X(C6,DEC,ZP) X(C7,XXX,IMP) \
+    X(C8,INY,IMP) X(C9,CMP,IMM) X(CA,DEX,IMP) X(CB,XXX,IMP) X(CC,CPY,ABS) X(CD,CMP,ABS) X(CE,DEC,ABS) X(CF,XXX,IMP) \
+    X(D0,BNE,REL) X(D1,CMP,INDY) X(D2,XXX,IMP) X(D3,XXX,IMP) X(D4,XXX,IMP) X(D5,CMP,ZPX) X(D6,DEC,ZPX) X(D7,XXX,IMP) \
+    X(D8,CLD,IMP) X(D9,CMP,ABSY) X(DA,XXX,IMP) X(DB,XXX,IMP) X(DC,XXX,IMP) X(DD,CMP,ABSX) X(DE,DEC,ABSX) X(DF,XXX,IMP) \
+    X(E0,CPX,IMM) X(E1,SBC,INDX) X(E2,XXX,IMP) X(E3,XXX,IMP) X(E4,CPX,ZP) X(E5,SBC,ZP) X(E6,INC,ZP) X(E7,XXX,IMP) \
+    X(E8,INX,IMP) X(E9,SBC,IMM) X(EA,NOP,IMP) X(EB,XXX,IMP) X(EC,CPX,ABS) X(ED,SBC,ABS) X(EE,INC,ABS) X(EF,XXX,IMP) \
+    X(F0,BEQ,REL) X(F1,SBC,INDY) X(F2,XXX,IMP) X(F3,XXX,IMP) X(F4,XXX,IMP) X(F5,SBC,ZPX) X(F6,INC,ZPX) X(F7,XXX,IMP) \
+    X(F8,SED,IMP) X(F9,SBC,ABSY) X(FA,XXX,IMP) X(FB,XXX,IMP) X(FC,XXX,IMP) X(FD,SBC,ABSX) X(FE,INC,ABSX) X(FF,XXX,IMP)
+
+// Undefined opcodes: length (high nibble) and base cycles (low nibble) on
+// the NMOS 6502, page crossings not counted. JAM (x2) halts a real CPU,
+// here it is one byte and two cycles. Defined opcodes are 0.
+static const uint8_t mos6502Undefined[256] = {
+    0x00, 0x00, 0x12, 0x28, 0x23, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x34, 0x00, 0x00, 0x36,  // 0
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // 1
+    0x00, 0x00, 0x12, 0x28, 0x00, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x36,  // 2
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // 3
+    0x00, 0x00, 0x12, 0x28, 0x23, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x36,  // 4
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // 5
+    0x00, 0x00, 0x12, 0x28, 0x23, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x36,  // 6
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // 7
+    0x22, 0x00, 0x22, 0x26, 0x00, 0x00, 0x00, 0x23, 0x00, 0x22, 0x00, 0x22, 0x00, 0x00, 0x00, 0x34,  // 8
+    0x00, 0x00, 0x12, 0x26, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x35, 0x35, 0x00, 0x35, 0x35,  // 9
+    0x00, 0x00, 0x00, 0x26, 0x00, 0x00, 0x00, 0x23, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x34,  // A
+    0x00, 0x00, 0x12, 0x25, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x34, 0x00, 0x00, 0x00, 0x34,  // B
+    0x00, 0x00, 0x22, 0x28, 0x00, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x36,  // C
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // D
+    0x00, 0x00, 0x22, 0x28, 0x00, 0x00, 0x00, 0x25, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x36,  // E
+    0x00, 0x00, 0x12, 0x28, 0x24, 0x00, 0x00, 0x26, 0x00, 0x00, 0x12, 0x37, 0x34, 0x00, 0x00, 0x37,  // F
+};
+
+/**
+ * @class Mos6502
+ * @brief NMOS 6502; the undocumented opcodes only take their length and cycles
+ * @tparam Bus Bus policy, see the file comment
+ */
+template <class Bus>
+class Mos6502 {
+public:
+    uint16_t pc;
+    uint8_t a, x, y, s, p;
+    uint64_t clock;             // Running cycle counter at the start of the instruction
+    uint32_t cycles;            // Cycles of the current instruction so far
+    uint64_t instructions;      // Instructions run, with MOS6502_COUNT_INSTRUCTIONS
+
+    explicit Mos6502(Bus& bus) :
+        pc(0), a(0), x(0), y(0), s(0xFF), p(0), clock(0), cycles(0), instructions(0),
+        _bus(bus) {}
+
+    /**
+     * @brief Clear the registers and load the PC from the reset vector
+     */
+    void reset() {
+        const PagedMemory& mem = _bus.memory();
+        a = x = y = 0;
+        p = 0;
+        s = 255;
+        pc = mem.read(0xfffc) | (mem.read(0xfffd) << 8);
+    }
+
+    /**
+     * @brief Set up a call of a routine that ends with RTS
+     *
+     * A return address is pushed that RTS turns into 0x0000, and run()
+     * returns once the PC gets there.
+     *
+     * @param addr Routine address
+     * @param acc Value of A
+     * @param xr Value of X
+     * @param yr Value of Y
+     */
+    void call(uint16_t addr, uint8_t acc, uint8_t xr = 0, uint8_t yr = 0) {
+        PagedMemory& mem = _bus.memory();
+        a = acc;
+        x = xr;
+        y = yr;
+        p = 0;
+        s = 255;
+        mem.write(0x100 + s--, 0xff);
+        mem.write(0x100 + s--, 0xff);
+        pc = addr;
+    }
+
+    /**
+     * @brief Time of the bus access in progress
+     */
+    uint64_t now() const { return clock + cycles; }
+
+    /**
+     * @brief Run until a routine returns or the cycles are used up
+     *
+     * Instructions are never split, so the last one may end past the
+     * limit.
+     *
+     * @param maxCycles Cycle limit
+     * @return Cycles run
+     */
+    uint32_t run(uint32_t maxCycles);
+
+private:
+    Bus& _bus;
+
+    struct Core;
+};
+
+// ============================================================================
+// Core
+// ============================================================================
+
+template <class Bus>
+struct Mos6502<Bus>::Core {
+    Mos6502* cpu;
+    Bus* bus;
+    PagedMemory* mem;
+    uint64_t clock;             // Cycle counter at the start of the instruction
+    uint64_t deadline;          // Stop at the first instruction boundary past this
+    uint32_t cycles;            // Cycles of the current instruction
+    uint32_t instructions;
+    uint16_t pc;
+    uint8_t a, x, y, s, p;
+
+    // Instruction fetches never go to a page handler
+    MOS6502_INLINE uint8_t fetch() {
+        return mem->read(pc++);
+    }
+
+    MOS6502_INLINE uint16_t fetchWord() {
+        uint16_t ad = mem->read(pc++);
+        ad |= mem->read(pc++) << 8;
+        return ad;
+    }
+
+    // Plain memory inlines; a null page pointer means the page has a
+    // handler (or, for writes, is not in RAM yet) and goes to the bus
+    MOS6502_INLINE uint8_t read(uint16_t addr) {
+        const uint8_t* page = mem->readPointer(addr >> 8);
+        if (MOS6502_UNLIKELY(!page)) return readIO(addr);
+        return page[addr & 0xff];
+    }
+
+    uint8_t readIO(uint16_t addr) {
+        cpu->clock = clock;
+        cpu->cycles = cycles;
+        uint8_t value = bus->ioRead(addr);
+
+        // Acknowledging an interrupt can bring the next one forward
+        if (bus->nextEvent() < deadline) deadline = bus->nextEvent();
+        return value;
+    }
+
+    // Zero page and stack never have handlers either
+    MOS6502_INLINE uint16_t readZpWord(uint8_t addr) {
+        return mem->read(addr) | (mem->read((uint8_t)(addr + 1)) << 8);
+    }
+
+    MOS6502_INLINE void write(uint16_t addr, uint8_t value) {
+        uint8_t* page = mem->writePointer(addr >> 8);
+        if (MOS6502_UNLIKELY(!page)) {
+            writeIO(addr, value);
+        } else {
+            page[addr & 0xff] = value;
+        }
+    }
+
+    void writeIO(uint16_t addr, uint8_t value) {
+        // Hand the bus the time of the store for I/O writes
+        cpu->clock = clock;
+        cpu->cycles = cycles;
+        bus->ioWrite(addr, value);
+        if (bus->nextEvent() < deadline) deadline = bus->nextEvent();
+    }
+
+    MOS6502_INLINE void push(uint8_t value) {
+        write(0x100 + s--, value);
+    }
+
+    MOS6502_INLINE uint8_t pull() {
+        return mem->read(0x100 + ++s);
+    }
+
+    MOS6502_INLINE void setNZ(uint8_t value) {
+        p = (p & ~(FLAG_N | FLAG_Z)) | (value & FLAG_N) | (value ? 0 : FLAG_Z);
+    }
+
+    MOS6502_INLINE void setFlag(uint8_t flag, bool cond) {
+        if (cond) p |= flag;
+        else p &= ~flag;
+    }
+
+    // After the I flag may have been cleared: leave the instruction loop
+    // so run() takes an IRQ that is already waiting
+    MOS6502_INLINE void checkIrq() {
+        if (MOS6502_UNLIKELY(bus->irqLine()) && !(p & FLAG_I)) deadline = 0;
+    }
+
+    // IRQ or NMI entry at an instruction boundary, like BRK without the B flag
+    void interrupt(uint16_t vector) {
+        push(pc >> 8);
+        push(pc & 0xff);
+        push((p & ~FLAG_B) | 0x20);
+        p |= FLAG_I;
+        pc = read(vector) | (read(vector + 1) << 8);
+        clock += 7;
+    }
+
+    // ------------------------------------------------------------------------
+    // Addressing modes
+    // ------------------------------------------------------------------------
+
+    // Effective address of a read operand
+    template <uint8_t Mode>
+    MOS6502_INLINE uint16_t readAddr() {
+        uint16_t ad, ad2;
+        switch (Mode) {
+            case MOS6502_MODE_ABS:
+                cycles += 4;
+                return fetchWord();
+            case MOS6502_MODE_ABSX:
+            case MOS6502_MODE_ABSY:
+                cycles += 4;
+                ad = fetchWord();
+                ad2 = ad + (Mode == MOS6502_MODE_ABSX ? x : y);
+                if ((ad2 & 0xff00) != (ad & 0xff00)) cycles++;
+                return ad2;
+            case MOS6502_MODE_ZP:
+                cycles += 3;
+                return fetch();
+            case MOS6502_MODE_ZPX:
+                cycles += 4;
+                return (uint8_t)(fetch() + x);
+            case MOS6502_MODE_ZPY:
+                cycles += 4;
+                return (uint8_t)(fetch() + y);
+            case MOS6502_MODE_INDX:
+                cycles += 6;
+                ad = (uint8_t)(fetch() + x);
+                return readZpWord(ad);
+            case MOS6502_MODE_INDY:
+                cycles += 5;
+                ad = fetch();
+                ad2 = readZpWord(ad);
+                ad = ad2 + y;
+                if ((ad2 & 0xff00) != (ad & 0xff00)) cycles++;
+                return ad;
+        }
+        return 0;
+    }
+
+    // Effective address of a store operand
+    template <uint8_t Mode>
+    MOS6502_INLINE uint16_t storeAddr() {
+        uint16_t ad, ad2;
+        switch (Mode) {
+            case MOS6502_MODE_ABS:
+                cycles += 4;
+                return fetchWord();
+            case MOS6502_MODE_ABSX:
+                cycles += 5;
+                return fetchWord() + x;
+            case MOS6502_MODE_ABSY:
+                cycles += 5;
+                return fetchWord() + y;
+            case MOS6502_MODE_ZP:
+                cycles += 3;
+                return fetch();
+            case MOS6502_MODE_ZPX:
+                cycles += 4;
+                return (uint8_t)(fetch() + x);
+            case MOS6502_MODE_ZPY:
+                cycles += 4;
+                return (uint8_t)(fetch() + y);
+            case MOS6502_MODE_INDX:
+                cycles += 6;
+                ad = (uint8_t)(fetch() + x);
+                return readZpWord(ad);
+            case MOS6502_MODE_INDY:
+                cycles += 6;
+                ad = fetch();
+                ad2 = readZpWord(ad);
+                return ad2 + y;
+        }
+        return 0;
+    }
+
+    // Effective address of a read-modify-write operand
+    template <uint8_t Mode>
+    MOS6502_INLINE uint16_t modifyAddr() {
+        switch (Mode) {
+            case MOS6502_MODE_ABS:
+                cycles += 6;
+                return fetchWord();
+            case MOS6502_MODE_ABSX:
+                cycles += 7;
+                return fetchWord() + x;
+            case MOS6502_MODE_ZP:
+                cycles += 5;
+                return fetch();
+            case MOS6502_MODE_ZPX:
+                cycles += 6;
+                return (uint8_t)(fetch() + x);
+        }
+        return 0;
+    }
+
+    template <uint8_t Mode>
+    MOS6502_INLINE uint8_t load() {
+        if (Mode == MOS6502_MODE_IMM) {
+            cycles += 2;
+            return fetch();
+        }
+        return read(readAddr<Mode>());
+    }
+
+    template <uint8_t Mode>
+    MOS6502_INLINE void store(uint8_t value) {
+        write(storeAddr<Mode>(), value);
+    }
+
+    template <uint8_t Mode, uint8_t (Core::*Op)(uint8_t)>
+    MOS6502_INLINE void modify() {
+        if (Mode == MOS6502_MODE_ACC) {
+            cycles += 2;
+            a = (this->*Op)(a);
+            return;
+        }
+        uint16_t ad = modifyAddr<Mode>();
+        write(ad, (this->*Op)(read(ad)));
+    }
+
+    MOS6502_INLINE void branch(bool condition) {
+        int8_t dist = (int8_t)fetch();
+        cycles += 2;
+        if (condition) {
+            uint16_t newpc = pc + dist;
+            cycles += ((pc & 0xff00) != (newpc & 0xff00)) ? 2 : 1;
+            pc = newpc;
+        }
+    }
+
+    MOS6502_INLINE void compare(uint8_t reg, uint8_t value) {
+        setNZ((uint8_t)(reg - value));
+        setFlag(FLAG_C, reg >= value);
+    }
+
+    MOS6502_INLINE void addWithCarry(uint8_t value) {
+        uint16_t sum = (uint16_t)a + value + (p & FLAG_C);
+        setFlag(FLAG_V, ~(a ^ value) & (a ^ sum) & 0x80);
+        setFlag(FLAG_C, sum & 0x100);
+        a = (uint8_t)sum;
+        setNZ(a);
+    }
+
+    // Read-modify-write operations
+    MOS6502_INLINE uint8_t doASL(uint8_t v) {
+        setFlag(FLAG_C, v & 0x80);
+        v <<= 1;
+        setNZ(v);
+        return v;
+    }
+
+    MOS6502_INLINE uint8_t doLSR(uint8_t v) {
+        setFlag(FLAG_C, v & 1);
+        v >>= 1;
+        setNZ(v);
+        return v;
+    }
+
+    MOS6502_INLINE uint8_t doROL(uint8_t v) {
+        uint8_t carry = p & FLAG_C;
+        setFlag(FLAG_C, v & 0x80);
+        v = (v << 1) | carry;
+        setNZ(v);
+        return v;
+    }
+
+    MOS6502_INLINE uint8_t doROR(uint8_t v) {
+        uint8_t carry = (p & FLAG_C) << 7;
+        setFlag(FLAG_C, v & 1);
+        v = (v >> 1) | carry;
+        setNZ(v);
+        return v;
+    }
+
+    MOS6502_INLINE uint8_t doINC(uint8_t v) {
+        setNZ(++v);
+        return v;
+    }
+
+    MOS6502_INLINE uint8_t doDEC(uint8_t v) {
+        setNZ(--v);
+        return v;
+    }
+
+    // ------------------------------------------------------------------------
+    // Instruction handlers
+    // ------------------------------------------------------------------------
+
+#define MOS6502_OP(name) \
+    template <uint8_t Mode> MOS6502_INLINE void op##name()
+
+    MOS6502_OP(LDA) { a = load<Mode>(); setNZ(a); }
+    MOS6502_OP(LDX) { x = load<Mode>(); setNZ(x); }
+    MOS6502_OP(LDY) { y = load<Mode>(); setNZ(y); }
+    MOS6502_OP(STA) { store<Mode>(a); }
+    MOS6502_OP(STX) { store<Mode>(x); }
+    MOS6502_OP(STY) { store<Mode>(y); }
+
+    MOS6502_OP(ADC) { addWithCarry(load<Mode>()); }
+    MOS6502_OP(SBC) { addWithCarry(load<Mode>() ^ 0xff); }
+    MOS6502_OP(AND) { a &= load<Mode>(); setNZ(a); }
+    MOS6502_OP(ORA) { a |= load<Mode>(); setNZ(a); }
+    MOS6502_OP(EOR) { a ^= load<Mode>(); setNZ(a); }
+    MOS6502_OP(CMP) { compare(a, load<Mode>()); }
+    MOS6502_OP(CPX) { compare(x, load<Mode>()); }
+    MOS6502_OP(CPY) { compare(y, load<Mode>()); }
+
+    MOS6502_OP(BIT) {
+        uint8_t v = load<Mode>();
+        p = (p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) | ((a & v) ? 0 : FLAG_Z);
+    }
+
+    MOS6502_OP(ASL) { modify<Mode, &Core::doASL>(); }
+    MOS6502_OP(LSR) { modify<Mode, &Core::doLSR>(); }
+    MOS6502_OP(ROL) { modify<Mode, &Core::doROL>(); }
+    MOS6502_OP(ROR) { modify<Mode, &Core::doROR>(); }
+    MOS6502_OP(INC) { modify<Mode, &Core::doINC>(); }
+    MOS6502_OP(DEC) { modify<Mode, &Core::doDEC>(); }
+
+    MOS6502_OP(INX) { cycles += 2; setNZ(++x); }
+    MOS6502_OP(INY) { cycles += 2; setNZ(++y); }
+    MOS6502_OP(DEX) { cycles += 2; setNZ(--x); }
+    MOS6502_OP(DEY) { cycles += 2; setNZ(--y); }
+    MOS6502_OP(TAX) { cycles += 2; x = a; setNZ(x); }
+    MOS6502_OP(TAY) { cycles += 2; y = a; setNZ(y); }
+    MOS6502_OP(TXA) { cycles += 2; a = x; setNZ(a); }
+    MOS6502_OP(TYA) { cycles += 2; a = y; setNZ(a); }
+    MOS6502_OP(TSX) { cycles += 2; x = s; setNZ(x); }
+    MOS6502_OP(TXS) { cycles += 2; s = x; }
+
+    MOS6502_OP(CLC) { cycles += 2; p &= ~FLAG_C; }
+    MOS6502_OP(SEC) { cycles += 2; p |= FLAG_C; }
+    MOS6502_OP(CLD) { cycles += 2; p &= ~FLAG_D; }
+    MOS6502_OP(SED) { cycles += 2; p |= FLAG_D; }
+    MOS6502_OP(CLI) { cycles += 2; p &= ~FLAG_I; checkIrq(); }
+    MOS6502_OP(SEI) { cycles += 2; p |= FLAG_I; }
+    MOS6502_OP(CLV) { cycles += 2; p &= ~FLAG_V; }
+    MOS6502_OP(NOP) { cycles += 2; }
+
+    MOS6502_OP(BCC) { branch(!(p & FLAG_C)); }
+    MOS6502_OP(BCS) { branch(p & FLAG_C); }
+    MOS6502_OP(BNE) { branch(!(p & FLAG_Z)); }
+    MOS6502_OP(BEQ) { branch(p & FLAG_Z); }
+    MOS6502_OP(BPL) { branch(!(p & FLAG_N)); }
+    MOS6502_OP(BMI) { branch(p & FLAG_N); }
+    MOS6502_OP(BVC) { branch(!(p & FLAG_V)); }
+    MOS6502_OP(BVS) { branch(p & FLAG_V); }
+
+    MOS6502_OP(PHA) { cycles += 3; push(a); }
+    MOS6502_OP(PHP) { cycles += 3; push(p); }
+    MOS6502_OP(PLA) { cycles += 4; a = pull(); setNZ(a); }
+    MOS6502_OP(PLP) { cycles += 4; p = pull(); checkIrq(); }
+
+    MOS6502_OP(JMP) {
+        uint16_t ad = fetchWord();
+        if (Mode == MOS6502_MODE_IND) {
+            // The pointer does not carry into the high byte (6502 page wrap)
+            cycles += 5;
+            pc = read(ad) | (read((ad & 0xff00) | ((ad + 1) & 0xff)) << 8);
+        } else {
+            cycles += 3;
+            pc = ad;
+        }
+    }
+
+    MOS6502_OP(JSR) {
+        // Return address is the last byte of the JSR, high byte pushed first
+        uint16_t ad = fetchWord();
+        uint16_t ret = pc - 1;
+        cycles += 6;
+        push(ret >> 8);
+        push(ret & 0xff);
+        pc = ad;
+    }
+
+    MOS6502_OP(RTS) {
+        uint16_t ad = pull();
+        ad |= pull() << 8;
+        pc = ad + 1;
+        cycles += 6;
+    }
+
+    MOS6502_OP(RTI) {
+        p = pull();
+        uint16_t ad = pull();
+        ad |= pull() << 8;
+        pc = ad;
+        cycles += 6;
+        checkIrq();
+    }
+
+    MOS6502_OP(BRK) {
+        uint16_t ret = pc + 1;
+        push(ret >> 8);
+        push(ret & 0xff);
+        push(p | FLAG_B);
+        p |= FLAG_I;
+        pc = read(0xfffe) | (read(0xffff) << 8);
+        cycles += 7;
+    }
+
+    // Undefined opcodes do nothing, but take their length and time
+    MOS6502_OP(XXX) {
+        uint8_t timing = mos6502Undefined[mem->read(pc - 1)];
+        pc += (timing >> 4) - 1;
+        cycles += timing & 0x0f;
+    }
+
+#undef MOS6502_OP
+};
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+template <class Bus>
+uint32_t Mos6502<Bus>::run(uint32_t maxCycles) {
+    Core c;
+    c.cpu = this;
+    c.bus = &_bus;
+    c.mem = &_bus.memory();
+    c.clock = clock;
+    c.cycles = 0;
+    c.instructions = 0;
+    c.pc = pc;
+    c.a = a;
+    c.x = x;
+    c.y = y;
+    c.s = s;
+    c.p = p;
+
+    const uint64_t start = c.clock;
+    const uint64_t end = start + maxCycles;
+
+#if MOS6502_THREADED
+    // Each handler ends in its own indirect jump to the next one
+#define MOS6502_LABEL(code, name, mode) &&op_##code,
+    static void* const dispatch[256] = { MOS6502_OPCODES(MOS6502_LABEL) };
+#undef MOS6502_LABEL
+#else
+    typedef void (Core::*Handler)();
+#define MOS6502_HANDLER(code, name, mode) &Core::template op##name<MOS6502_MODE_##mode>,
+    static const Handler handlers[256] = { MOS6502_OPCODES(MOS6502_HANDLER) };
+#undef MOS6502_HANDLER
+#endif
+
+    for (;;) {
+        // Instructions run without looking at the bus until its next
+        // event is due
+        uint64_t event = _bus.nextEvent();
+        c.deadline = (event < end) ? event : end;
+        c.cycles = 0;
+
+#if MOS6502_THREADED
+#define MOS6502_NEXT() \
+    do { \
+        c.clock += c.cycles; \
+        if (!c.pc || c.clock >= c.deadline) goto done; \
+        c.cycles = 0; \
+        MOS6502_COUNT(c); \
+        goto *dispatch[c.fetch()]; \
+    } while (0)
+
+#define MOS6502_CASE(code, name, mode) \
+    op_##code: c.template op##name<MOS6502_MODE_##mode>(); MOS6502_NEXT();
+
+        MOS6502_NEXT();
+        MOS6502_OPCODES(MOS6502_CASE)
+done:
+#undef MOS6502_CASE
+#undef MOS6502_NEXT
+#else
+        while (c.pc && c.clock < c.deadline) {
+            c.cycles = 0;
+            MOS6502_COUNT(c);
+            (c.*handlers[c.fetch()])();
+            c.clock += c.cycles;
+        }
+#endif
+
+        if (!c.pc) {
+            // A routine has returned; a bus that keeps the machine running
+            // waits for the next interrupt
+            if (!_bus.idleUntilEvent()) break;
+            if (c.clock < c.deadline) c.clock = c.deadline;
+        }
+
+        if (c.clock >= _bus.nextEvent()) _bus.serviceEvents(c.clock);
+        if (_bus.takeNmi()) {
+            c.interrupt(0xfffa);
+        } else if (_bus.irqLine() && !(c.p & FLAG_I)) {
+            c.interrupt(0xfffe);
+        }
+
+        if (c.clock >= end) break;
+    }
+
+    clock = c.clock;
+    cycles = c.cycles;
+    instructions += c.instructions;
+    pc = c.pc;
+    a = c.a;
+    x = c.x;
+    y = c.y;
+    s = c.s;
+    p = c.p;
+
+    return (uint32_t)(c.clock - start);
+}
+
+#endif // MOS6502_H
@@ -0,0 +1,612 @@
+/**
+ * @file Mos6502Player.h
+ * @brief Routine, tick and write queue machinery shared by the 6502 players
+ *
+ * SIDPlayer and SAPPlayer both run a tune's init and play routines on
+ * Mos6502<Bus> in resumable slices, call the play routine on a tick, and
+ * send the register stores it makes straight, timestamped for replay, or
+ * captured per frame ahead of the tick. Everything that does not depend on
+ * the sound chip lives here, as a base class the player derives from with
+ * itself as the first template parameter (so the calls below are resolved
+ * at compile time). The player provides:
+ *
+ *     void startPlayCall();               // Start the next play call
+ *     void finishRoutine();               // A routine returned (MOS6502_ROUTINE_NONE is set)
+ *     void writeFrame(const Frame& frame);    // Send a captured frame to the chips
+ *     void flushWrites();                 // Send the stores captured outside a frame
+ *     void sendWrite(uint8_t chip, uint8_t reg, uint8_t value);  // Send one store
+ *
+ * and may hide runRoutine(), consumeTick(), takeTick(), playNextFrame()
+ * and the public methods with its own versions. A player that keeps these methods private befriends
+ * its Mos6502Player.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef MOS6502_PLAYER_H
+#define MOS6502_PLAYER_H
+
+#include <Arduino.h>
+#include "FrameRing.h"
+#include "PagedMemory.h"
+#include "Mos6502.h"
+
+#if defined(ESP32)
+#include <esp_timer.h>
+#endif
+
+// Routine number of an idle player; each player numbers its own routines
+#define MOS6502_ROUTINE_NONE    0
+
+/**
+ * @class Mos6502Player
+ * @brief Base of a file player whose tunes run on the 6502
+ * @tparam Player The player deriving from this class, see the file comment
+ * @tparam Frame Register frame of one play call
+ * @tparam QueueSize Entries in the timed write queue (power of two)
+ * @tparam RingSize Frames buffered ahead of playback (power of two)
+ */
+template <class Player, class Frame, uint16_t QueueSize, uint16_t RingSize>
+class Mos6502Player {
+    static_assert(QueueSize && !(QueueSize & (QueueSize - 1)), "Write queue size must be a power of two");
+
+public:
+    /**
+     * @brief Start/stop playback
+     * @param play true to start, false to stop
+     */
+    void play(bool play) {
+        if (!_fileLoaded && play) {
+            return;
+        }
+        _playing = play;
+    }
+
+    /**
+     * @brief Check if currently playing
+     * @return true if playing
+     */
+    bool isPlaying() {
+        return _playing;
+    }
+
+    /**
+     * @brief Start the player's own play call timer
+     *
+     * An esp_timer fires at the tune's play rate (see getPlayPeriod()),
+     * so the sketch no longer needs a Ticker or to call timerCallback().
+     * Rate changes made by the tune take effect on the next tick.
+     *
+     * @return true if the timer is running (always false off the ESP32)
+     */
+    bool startTimer() {
+#if defined(ESP32)
+        if (_timer) return true;
+
+        esp_timer_create_args_t args = {};
+        args.callback = &Mos6502Player::timerEntry;
+        args.arg = this;
+        args.name = _name;
+        if (esp_timer_create(&args, &_timer) != ESP_OK) {
+            _timer = NULL;
+            return false;
+        }
+
+        _timerDue = esp_timer_get_time() + _playPeriodUs;
+        esp_timer_start_once(_timer, _playPeriodUs);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Stop the play call timer started by startTimer()
+     */
+    void stopTimer() {
+#if defined(ESP32)
+        if (!_timer) return;
+
+        esp_timer_stop(_timer);
+        esp_timer_delete(_timer);
+        _timer = NULL;
+#endif
+    }
+
+    /**
+     * @brief Get the average delay from a tick to its play call or frame
+     * @return Running average in microseconds
+     */
+    uint32_t getJitter() {
+        return _jitterSum >> 4;
+    }
+
+    /**
+     * @brief Get the longest delay from a tick to its play call or frame
+     * @return Maximum since the last resetJitter(), in microseconds
+     */
+    uint32_t getMaxJitter() {
+        return _jitterMax;
+    }
+
+    /**
+     * @brief Clear the jitter statistics
+     */
+    void resetJitter() {
+        _jitterSum = 0;
+        _jitterMax = 0;
+    }
+
+    /**
+     * @brief Call this from a timer at the rate given by getPlayPeriod()
+     *        when startTimer() is not used
+     */
+    void timerCallback() {
+        _tickMicros = micros();
+        _timerTick = true;
+    }
+
+    /**
+     * @brief Limit the 6502 cycles emulated per update() call
+     * @param cycles Cycle budget (default one frame of the machine, 0 = unlimited)
+     */
+    void setCycleBudget(uint32_t cycles) {
+        _cycleBudget = cycles;
+    }
+
+    /**
+     * @brief Limit the cycles a single init or play call may take
+     *
+     * A routine that runs longer is aborted and playback stops, see
+     * watchdogTripped().
+     *
+     * @param cycles Cycle limit (default 10s of machine time, 0 = disabled)
+     */
+    void setWatchdog(uint32_t cycles) {
+        _watchdogCycles = cycles;
+    }
+
+    /**
+     * @brief Check if an init or play routine is still in progress
+     * @return true while a routine has not returned yet
+     */
+    bool isBusy() {
+        return _routine != MOS6502_ROUTINE_NONE;
+    }
+
+    /**
+     * @brief Check if the watchdog aborted a routine since the last load
+     * @return true if a routine was aborted
+     */
+    bool watchdogTripped() {
+        return _watchdogTripped;
+    }
+
+    /**
+     * @brief Set the replay delay used in timed write mode
+     *
+     * A play call's first store reaches the chip this long after the
+     * call started, later stores follow at their 6502 cycle offsets.
+     *
+     * @param us Delay in microseconds (default one frame, 20000)
+     */
+    void setWriteLatency(uint32_t us) {
+        _writeLatency = us;
+    }
+
+    /**
+     * @brief Render play calls ahead of the tick
+     *
+     * update() emulates up to this many frames ahead in its spare cycle
+     * budget and a tick only writes out the next prepared frame, so one
+     * slow play call no longer delays the output. Register stores are
+     * captured per frame as in coalesced write mode.
+     *
+     * @param frames Frames to keep ready (0 = off, max RingSize)
+     */
+    void setLookAhead(uint8_t frames) {
+        if (frames > RingSize) frames = RingSize;
+        _lookAhead = frames;
+
+        if (frames && !_frameCapture) {
+            startFrameCapture();
+        } else if (!frames && _frameCapture) {
+            endFrameCapture();
+        }
+    }
+
+    /**
+     * @brief Get the number of frames rendered ahead
+     * @return Frames waiting to be played
+     */
+    uint8_t getBufferedFrames() {
+        return _frameRing.count();
+    }
+
+    /**
+     * @brief Get the number of ticks that found no prepared frame
+     * @return Underrun count since the player was created
+     */
+    uint32_t getUnderruns() {
+        return _underruns;
+    }
+
+    /**
+     * @brief Run the tune offline and return its next register frame
+     *
+     * Used for transcoding: runs the init routine, then one play call per
+     * frame, without the timer and without writing to the chips. The
+     * first frame holds the stores of the init routine. Do not mix with
+     * update() on the same player.
+     *
+     * @param frame Receives the frame of every chip
+     * @return false if no tune is loaded or the watchdog stopped it
+     */
+    bool renderFrame(Frame& frame) {
+        if (!_fileLoaded) return false;
+
+        _frameCapture = true;
+        while (_frameRing.empty()) {
+            if (_routine == MOS6502_ROUTINE_NONE) {
+                self().startPlayCall();
+            }
+            uint32_t budget = 0xFFFFFFFFUL;
+            self().runRoutine(budget);
+            if (_watchdogTripped) return false;
+        }
+        return _frameRing.pop(frame);
+    }
+
+    /**
+     * @brief Get number of timed writes waiting to be sent
+     * @return Queued write count
+     */
+    uint16_t getQueuedWrites() {
+        return (_queueTail - _queueHead) & (QueueSize - 1);
+    }
+
+    /**
+     * @brief Get the running 6502 cycle counter
+     * @return Cycles emulated since the player was created
+     */
+    uint64_t getCycleCount() {
+        return _cpu.clock;
+    }
+
+    /**
+     * @brief Get the running 6502 instruction counter
+     * @return Instructions emulated since the player was created, 0 unless
+     *         the build defines MOS6502_COUNT_INSTRUCTIONS
+     */
+    uint64_t getInstructionCount() {
+        return _cpu.instructions;
+    }
+
+    /**
+     * @brief Get the cycles of the last init or play call
+     *
+     * A machine that runs on between play calls (an RSID tune) counts
+     * the last frame slice, including the time spent waiting for an
+     * interrupt.
+     *
+     * @return Cycles the routine ran, so far if it is still running
+     */
+    uint32_t getRoutineCycles() {
+        return _routineCycles;
+    }
+
+    /**
+     * @brief Get the RAM used for 6502 memory
+     * @return Bytes of RAM held by written or file-loaded pages
+     */
+    size_t getMemoryUsage() {
+        return (size_t)_memory.getRamPages() * PAGED_MEMORY_PAGE_SIZE;
+    }
+
+protected:
+    // Timed write queue entry
+    struct TimedWrite {
+        uint32_t cycle;         // Low 32 bits of the cycle counter at the store
+        uint8_t chip;
+        uint8_t reg;
+        uint8_t value;
+    };
+
+    /**
+     * @param bus The deriving player, which is the bus of the CPU
+     * @param name Chip name for messages and the timer
+     * @param cycleBudget Default of setCycleBudget()
+     * @param watchdogCycles Default of setWatchdog()
+     * @param writeLatency Default of setWriteLatency()
+     */
+    Mos6502Player(Player& bus, const char* name, uint32_t cycleBudget, uint32_t watchdogCycles,
+                  uint32_t writeLatency) :
+        _name(name), _playing(false), _fileLoaded(false), _timerTick(false),
+        _queueHead(0), _queueTail(0), _nextFrameCycle(0),
+        _anchorCycle(0), _anchorMicros(0), _writeLatency(writeLatency), _usPerCycleQ16(0),
+        _playPeriodCycles(0), _playPeriodUs(0), _tickMicros(0), _jitterSum(0), _jitterMax(0),
+#if defined(ESP32)
+        _timer(NULL), _timerDue(0),
+#endif
+        _routine(MOS6502_ROUTINE_NONE), _routineCycles(0), _cycleBudget(cycleBudget),
+        _watchdogCycles(watchdogCycles), _watchdogTripped(false),
+        _frameCapture(false), _framesPrimed(false), _lookAhead(0), _underruns(0),
+        _cpu(bus) {}
+
+    Player& self() { return static_cast<Player&>(*this); }
+
+    const char* _name;
+    bool _playing;
+    bool _fileLoaded;
+    volatile bool _timerTick;
+
+    // Timed write queue
+    TimedWrite _writeQueue[QueueSize];
+    volatile uint16_t _queueHead;   // Next entry to send
+    volatile uint16_t _queueTail;   // Next free entry
+    uint64_t _nextFrameCycle;   // 6502 time at which the next play call starts
+    uint32_t _anchorCycle;      // Cycle that maps to _anchorMicros
+    uint32_t _anchorMicros;
+    uint32_t _writeLatency;
+    uint32_t _usPerCycleQ16;    // Microseconds per cycle, 16.16 fixed point
+
+    // Play call rate
+    uint32_t _playPeriodCycles; // 6502 cycles between play calls
+    volatile uint32_t _playPeriodUs;
+    volatile uint32_t _tickMicros;  // When the pending tick was due
+    uint32_t _jitterSum;        // Running average x 16
+    uint32_t _jitterMax;
+#if defined(ESP32)
+    esp_timer_handle_t _timer;
+    int64_t _timerDue;          // When the timer should fire next
+#endif
+
+    // Resumable routine execution
+    uint8_t _routine;           // Routine in progress, numbered by the player
+    uint32_t _routineCycles;    // Cycles spent in it so far
+    uint32_t _cycleBudget;
+    uint32_t _watchdogCycles;
+    bool _watchdogTripped;
+
+    // Frames produced ahead of playback
+    FrameRing<Frame, RingSize> _frameRing;
+    bool _frameCapture;         // Register stores are collected into _frameRing
+    bool _framesPrimed;         // A frame was played since the last load
+    uint8_t _lookAhead;         // Frames to render ahead (0 = whole ring when a task renders)
+    uint32_t _underruns;
+
+    // 6502 CPU, with the player as its bus
+    PagedMemory _memory;        // 6502 address space, RAM only for written pages
+    Mos6502<Player> _cpu;
+
+    void startRoutine(uint8_t routine, uint16_t addr, uint8_t a, uint8_t x = 0, uint8_t y = 0) {
+        _cpu.call(addr, a, x, y);
+        _routine = routine;
+        _routineCycles = 0;
+    }
+
+    // Run the CPU for a slice of the budget, charged to the routine
+    void runSlice(uint32_t& budget, uint32_t slice) {
+        uint32_t used = _cpu.run(slice);
+        budget = (used < budget) ? budget - used : 0;
+        _routineCycles += used;
+    }
+
+    // Run the routine in progress, true once it has returned
+    bool runRoutine(uint32_t& budget) {
+        uint32_t slice = budget;
+        if (_watchdogCycles && slice > _watchdogCycles - _routineCycles) {
+            // Never run past the watchdog limit inside one slice
+            slice = _watchdogCycles - _routineCycles;
+        }
+        runSlice(budget, slice);
+
+        if (_cpu.pc != 0 && _watchdogCycles && _routineCycles >= _watchdogCycles) {
+            Serial.print(_name);
+            Serial.print(" routine stopped by watchdog at $");
+            Serial.println(_cpu.pc, HEX);
+            _watchdogTripped = true;
+            _playing = false;
+            _cpu.pc = 0;
+        }
+
+        // RTS back to 0x0000: the routine has returned
+        if (_cpu.pc == 0) {
+            self().finishRoutine();
+            return true;
+        }
+        return false;
+    }
+
+    void queueWrite(uint8_t chip, uint8_t reg, uint8_t value) {
+        uint16_t next = (_queueTail + 1) & (QueueSize - 1);
+        if (next == _queueHead) {
+            // Queue full: send the oldest entry now rather than drop a store
+            TimedWrite& w = _writeQueue[_queueHead];
+            self().sendWrite(w.chip, w.reg, w.value);
+            _queueHead = (_queueHead + 1) & (QueueSize - 1);
+        }
+
+        TimedWrite& w = _writeQueue[_queueTail];
+        w.cycle = (uint32_t)_cpu.now();
+        w.chip = chip;
+        w.reg = reg;
+        w.value = value;
+        _queueTail = next;
+    }
+
+    // Send the queued writes whose time has come
+    void serviceWriteQueue() {
+        uint32_t now = micros();
+
+        while (_queueHead != _queueTail) {
+            TimedWrite& w = _writeQueue[_queueHead];
+            uint32_t offset = (uint32_t)(((uint64_t)(w.cycle - _anchorCycle) * _usPerCycleQ16) >> 16);
+            uint32_t due = _anchorMicros + offset;
+            if ((int32_t)(now - due) < 0) break;
+
+            self().sendWrite(w.chip, w.reg, w.value);
+            _queueHead = (_queueHead + 1) & (QueueSize - 1);
+        }
+    }
+
+    void drainWriteQueue() {
+        while (_queueHead != _queueTail) {
+            TimedWrite& w = _writeQueue[_queueHead];
+            self().sendWrite(w.chip, w.reg, w.value);
+            _queueHead = (_queueHead + 1) & (QueueSize - 1);
+        }
+    }
+
+    // Play calls start on frame boundaries of the 6502 timeline, as if the
+    // routine were called from the machine's frame interrupt
+    void alignPlayCall() {
+        if (_cpu.clock < _nextFrameCycle) {
+            _cpu.clock = _nextFrameCycle;
+        }
+        _nextFrameCycle = _cpu.clock + _playPeriodCycles;
+    }
+
+    // Re-anchor the timeline when nothing is pending and the replay fell
+    // behind real time (start of playback, resume after pause, overrun)
+    void anchorTimeline() {
+        if (_queueHead != _queueTail) return;
+
+        uint32_t now = micros();
+        uint32_t offset = (uint32_t)(((uint64_t)((uint32_t)_cpu.clock - _anchorCycle) * _usPerCycleQ16) >> 16);
+        if ((int32_t)(now + _writeLatency - (_anchorMicros + offset)) > 0) {
+            _anchorCycle = (uint32_t)_cpu.clock;
+            _anchorMicros = now + _writeLatency;
+        }
+    }
+
+    void setPlayRate(uint32_t periodCycles, uint32_t clock) {
+        _playPeriodCycles = periodCycles;
+        _playPeriodUs = (uint32_t)((uint64_t)periodCycles * 1000000UL / clock);
+        _usPerCycleQ16 = (uint32_t)((1000000ULL << 16) / clock);
+    }
+
+    // Take the pending tick, returns how late it is served in microseconds
+    uint32_t consumeTick() {
+        _timerTick = false;
+
+        uint32_t late = micros() - _tickMicros;
+        if (late > _jitterMax) _jitterMax = late;
+        _jitterSum += late - (_jitterSum >> 4);
+        return late;
+    }
+
+    // Take the pending tick for the next play call, false if there is none
+    bool takeTick() {
+        if (!_timerTick) return false;
+        self().consumeTick();
+        return true;
+    }
+
+    /**
+     * @brief Body of update(): run the emulation for one cycle budget
+     * @param serviceQueue Send the timed writes that are due
+     * @param render Render frames ahead when they are captured
+     */
+    void updatePlayback(bool serviceQueue, bool render) {
+        uint32_t budget = _cycleBudget ? _cycleBudget : 0xFFFFFFFFUL;
+
+        if (_frameCapture) {
+            // A tick only copies out the next prepared frame
+            if (_playing && _timerTick) {
+                self().consumeTick();
+                self().playNextFrame();
+            }
+            if (render) renderAhead(budget);
+            return;
+        }
+
+        if (serviceQueue) {
+            serviceWriteQueue();
+        }
+
+        // Run the pending routine, then start the next play call if a tick
+        // came in, until this call's cycle budget is used up
+        while (budget) {
+            if (_routine == MOS6502_ROUTINE_NONE) {
+                if (!_playing || !self().takeTick()) break;
+                self().startPlayCall();
+            }
+            if (!self().runRoutine(budget)) break;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Look-ahead frames
+    // ------------------------------------------------------------------------
+
+    bool needFrame() {
+        uint16_t target = _lookAhead ? _lookAhead : RingSize;
+        return _routine == MOS6502_ROUTINE_NONE && _playing && _fileLoaded &&
+               _frameRing.count() < target;
+    }
+
+    void renderAhead(uint32_t& budget) {
+        while (budget) {
+            if (_routine == MOS6502_ROUTINE_NONE) {
+                if (!needFrame()) break;
+                self().startPlayCall();
+            }
+            if (!self().runRoutine(budget)) break;
+        }
+    }
+
+    void playNextFrame() {
+        const Frame* frame = _frameRing.peek();
+        if (!frame) {
+            // Nothing prepared in time (not counted before the first frame)
+            if (_framesPrimed) _underruns++;
+            return;
+        }
+
+        self().writeFrame(*frame);
+        _frameRing.release();
+        _framesPrimed = true;
+    }
+
+    // Writes still waiting for their time are sent now, from here on
+    // stores are collected per frame
+    void startFrameCapture() {
+        drainWriteQueue();
+        _frameRing.clear();
+        _framesPrimed = false;
+        _frameCapture = true;
+    }
+
+    void endFrameCapture() {
+        // Bring the chips up to date with everything that was emulated
+        const Frame* frame;
+        while ((frame = _frameRing.peek()) != NULL) {
+            self().writeFrame(*frame);
+            _frameRing.release();
+        }
+        self().flushWrites();
+        _frameCapture = false;
+    }
+
+#if defined(ESP32)
+    static void timerEntry(void* arg) {
+        static_cast<Mos6502Player*>(arg)->onTimer();
+    }
+
+    void onTimer() {
+        int64_t now = esp_timer_get_time();
+        _tickMicros = (uint32_t)_timerDue;
+        _timerTick = true;
+
+        // Schedule from the due time rather than from now so the rate does not
+        // drift; the period is re-read so tempo changes apply on the next tick
+        _timerDue += _playPeriodUs;
+        if (_timerDue <= now) _timerDue = now + _playPeriodUs;
+        esp_timer_start_once(_timer, _timerDue - now);
+    }
+#endif
+};
+
+#endif // MOS6502_PLAYER_H
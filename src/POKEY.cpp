@@ -12,138 +12,155 @@
 // POKEYChannel Implementation
 // ============================================================================
 
-POKEYChannel::POKEYChannel() : _baseAddr(0), _freqAddr(0),
-                               _ctrlAddr(0), _freq(0), _ctrl(0) {
+POKEYChannel::POKEYChannel() : _regs(NULL), _freqAddr(0), _ctrlAddr(0) {
 }
 
-void POKEYChannel::begin(uint16_t baseAddr, uint8_t freqAddr, uint8_t ctrlAddr) {
-    _baseAddr = baseAddr;
+void POKEYChannel::begin(ShadowRegisterFile<POKEY_NUM_AUDIO_REGS, POKEYConfig::busWidth>& regs,
+                         uint8_t freqAddr, uint8_t ctrlAddr) {
+    _regs = &regs;
     _freqAddr = freqAddr;
     _ctrlAddr = ctrlAddr;
-    reset();
-}
-
-void POKEYChannel::writeReg(uint8_t addr, uint8_t value) {
-    wishboneWrite8(_baseAddr + addr, value);
 }
 
-void POKEYChannel::updateCtrl() {
-    writeReg(_ctrlAddr, _ctrl);
+void POKEYChannel::setCtrl(uint8_t keep, uint8_t bits) {
+    _regs->write(_ctrlAddr, (_regs->get(_ctrlAddr) & keep) | bits);
 }
 
 void POKEYChannel::setFrequency(uint8_t freq) {
-    _freq = freq;
-    writeReg(_freqAddr, freq);
+    _regs->write(_freqAddr, freq);
 }
 
 uint8_t POKEYChannel::getFrequency() {
-    return _freq;
+    return _regs->get(_freqAddr);
 }
 
 void POKEYChannel::setVolume(uint8_t volume) {
-    _ctrl = (_ctrl & 0xF0) | (volume & 0x0F);
-    updateCtrl();
+    setCtrl(0xF0, volume & 0x0F);
 }
 
 uint8_t POKEYChannel::getVolume() {
-    return _ctrl & 0x0F;
+    return _regs->get(_ctrlAddr) & 0x0F;
 }
 
 void POKEYChannel::setDistortion(uint8_t dist) {
-    _ctrl = (_ctrl & 0x0F) | (dist & 0xF0);
-    updateCtrl();
+    setCtrl(0x0F, dist & 0xF0);
 }
 
 void POKEYChannel::setVolumeOnly(bool active) {
-    if (active) {
-        _ctrl |= 0x10;  // Set volume-only bit
-    } else {
-        _ctrl &= ~0x10;
-    }
-    updateCtrl();
+    // Volume-only bit
+    setCtrl(~0x10, active ? 0x10 : 0);
 }
 
 void POKEYChannel::reset() {
-    _freq = 0;
-    _ctrl = 0;
-    writeReg(_freqAddr, 0);
-    writeReg(_ctrlAddr, 0);
+    _regs->write(_freqAddr, 0);
+    _regs->write(_ctrlAddr, 0);
 }
 
 // ============================================================================
 // POKEY Implementation
 // ============================================================================
 
-POKEY::POKEY(uint16_t baseAddr)
-    : _baseAddr(baseAddr), _audctl(0) {
+POKEY::POKEY(uint16_t baseAddr) : _baseAddr(baseAddr), _bankStage(false) {
+    _regs.begin(baseAddr);
 }
 
 void POKEY::begin() {
-    CH1.begin(_baseAddr, POKEY_REG_AUDF1, POKEY_REG_AUDC1);
-    CH2.begin(_baseAddr, POKEY_REG_AUDF2, POKEY_REG_AUDC2);
-    CH3.begin(_baseAddr, POKEY_REG_AUDF3, POKEY_REG_AUDC3);
-    CH4.begin(_baseAddr, POKEY_REG_AUDF4, POKEY_REG_AUDC4);
+    CH1.begin(_regs, POKEY_REG_AUDF1, POKEY_REG_AUDC1);
+    CH2.begin(_regs, POKEY_REG_AUDF2, POKEY_REG_AUDC2);
+    CH3.begin(_regs, POKEY_REG_AUDF3, POKEY_REG_AUDC3);
+    CH4.begin(_regs, POKEY_REG_AUDF4, POKEY_REG_AUDC4);
     reset();
 }
 
 void POKEY::writeReg(uint8_t addr, uint8_t data) {
-    wishboneWrite8(_baseAddr + addr, data);
+    if (addr < POKEY_NUM_AUDIO_REGS) {
+        _regs.write(addr, data);
+    } else {
+        audioBusWrite8(_baseAddr + addr, data);
+    }
+}
+
+void POKEY::writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count) {
+    if (startAddr + count <= POKEY_NUM_AUDIO_REGS) {
+        _regs.writeRegs(startAddr, data, count);
+    } else {
+        audioBusBurstWrite8(_baseAddr + startAddr, data, count);
+    }
 }
 
 uint8_t POKEY::readReg(uint8_t addr) {
-    return wishboneRead8(_baseAddr + addr);
+    return audioBusRead8(_baseAddr + addr);
+}
+
+uint8_t POKEY::getReg(uint8_t addr) {
+    return _regs.get(addr);
+}
+
+uint32_t POKEY::getBusWriteCount() {
+    return _regs.sentCount();
+}
+
+void POKEY::setCommitMode(ShadowCommitMode mode) {
+    _regs.setMode(mode);
+}
+
+void POKEY::commit() {
+    _regs.commit();
+}
+
+void POKEY::enableRegisterBank(bool enable) {
+    _bankStage = enable;
+    writeReg(POKEY_REG_BANK, enable ? POKEY_BANK_STAGE : 0);
+}
+
+void POKEY::commitBank(bool now) {
+    _regs.commit();
+    
+    uint8_t ctrl = POKEY_BANK_COMMIT;
+    if (_bankStage) ctrl |= POKEY_BANK_STAGE;
+    if (now) ctrl |= POKEY_BANK_NOW;
+    writeReg(POKEY_REG_BANK, ctrl);
+}
+
+bool POKEY::isBankPending() {
+    return (readReg(POKEY_REG_BANK) & POKEY_BANK_STATUS_PENDING) != 0;
 }
 
 void POKEY::setAUDCTL(uint8_t value) {
-    _audctl = value;
-    writeReg(POKEY_REG_AUDCTL, _audctl);
+    writeReg(POKEY_REG_AUDCTL, value);
 }
 
 uint8_t POKEY::getAUDCTL() {
-    return _audctl;
+    return _regs.get(POKEY_REG_AUDCTL);
 }
 
-void POKEY::setPoly9(bool enable) {
+void POKEY::setAUDCTLBit(uint8_t bit, bool enable) {
+    uint8_t audctl = getAUDCTL();
     if (enable) {
-        _audctl |= POKEY_AUDCTL_POLY9;
+        audctl |= bit;
     } else {
-        _audctl &= ~POKEY_AUDCTL_POLY9;
+        audctl &= ~bit;
     }
-    writeReg(POKEY_REG_AUDCTL, _audctl);
+    writeReg(POKEY_REG_AUDCTL, audctl);
+}
+
+void POKEY::setPoly9(bool enable) {
+    setAUDCTLBit(POKEY_AUDCTL_POLY9, enable);
 }
 
 void POKEY::set15kHz(bool enable) {
-    if (enable) {
-        _audctl |= POKEY_AUDCTL_15KHZ;
-    } else {
-        _audctl &= ~POKEY_AUDCTL_15KHZ;
-    }
-    writeReg(POKEY_REG_AUDCTL, _audctl);
+    setAUDCTLBit(POKEY_AUDCTL_15KHZ, enable);
 }
 
 void POKEY::joinChannels12(bool enable) {
-    if (enable) {
-        _audctl |= POKEY_AUDCTL_CH12_JOIN;
-    } else {
-        _audctl &= ~POKEY_AUDCTL_CH12_JOIN;
-    }
-    writeReg(POKEY_REG_AUDCTL, _audctl);
+    setAUDCTLBit(POKEY_AUDCTL_CH12_JOIN, enable);
 }
 
 void POKEY::joinChannels34(bool enable) {
-    if (enable) {
-        _audctl |= POKEY_AUDCTL_CH34_JOIN;
-    } else {
-        _audctl &= ~POKEY_AUDCTL_CH34_JOIN;
-    }
-    writeReg(POKEY_REG_AUDCTL, _audctl);
+    setAUDCTLBit(POKEY_AUDCTL_CH34_JOIN, enable);
 }
 
 void POKEY::reset() {
-    CH1.reset();
-    CH2.reset();
-    CH3.reset();
-    CH4.reset();
-    _audctl = 0;
-    writeReg(POKEY_REG_AUDCTL, 0);
+    // AUDF1..AUDC4 and AUDCTL are contiguous: clear them in one burst
+    _regs.reset();
 }
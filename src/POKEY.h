@@ -23,6 +23,9 @@
 
 #include <Arduino.h>
 #include "WishboneSPI.h"
+#include "AudioBus.h"
+#include "ShadowRegisterFile.h"
+#include "ChipConfig.h"
 
 // POKEY Register addresses
 #define POKEY_REG_AUDF1     0x00    // Audio frequency 1
@@ -35,6 +38,21 @@
 #define POKEY_REG_AUDC4     0x07    // Audio control 4
 #define POKEY_REG_AUDCTL    0x08    // Audio control
 
+// Register bank control / status (gateware extension)
+#define POKEY_REG_BANK      0x10
+
+// Number of POKEY audio registers (AUDF1..AUDCTL)
+#define POKEY_NUM_AUDIO_REGS    9
+
+// Bank control bits
+#define POKEY_BANK_STAGE        0x01    // Stage writes to AUDF1-AUDCTL
+#define POKEY_BANK_COMMIT       0x02    // Commit the staged writes
+#define POKEY_BANK_NOW          0x04    // Apply the commit without waiting for frame_tick
+
+// Bank status bits
+#define POKEY_BANK_STATUS_STAGING   0x01
+#define POKEY_BANK_STATUS_PENDING   0x02
+
 // AUDCTL bits
 #define POKEY_AUDCTL_POLY9      0x80    // Use 9-bit poly instead of 17-bit
 #define POKEY_AUDCTL_CH1_HICLK  0x40    // Channel 1 high-pass filter clocked by ch 3
@@ -64,12 +82,13 @@ public:
     POKEYChannel();
     
     /**
-     * @brief Initialize the channel
-     * @param baseAddr POKEY base address
+     * @brief Attach the channel to its chip's registers
+     * @param regs Register shadow of the POKEY
      * @param freqAddr Frequency register address
      * @param ctrlAddr Control register address
      */
-    void begin(uint16_t baseAddr, uint8_t freqAddr, uint8_t ctrlAddr);
+    void begin(ShadowRegisterFile<POKEY_NUM_AUDIO_REGS, POKEYConfig::busWidth>& regs,
+               uint8_t freqAddr, uint8_t ctrlAddr);
     
     /**
      * @brief Set channel frequency
@@ -113,14 +132,13 @@ public:
     void reset();
     
 private:
-    uint16_t _baseAddr;
+    friend class POKEY;
+    
+    ShadowRegisterFile<POKEY_NUM_AUDIO_REGS, POKEYConfig::busWidth>* _regs;
     uint8_t _freqAddr;
-    uint8_t _ctrlAddr;
-    uint8_t _freq;
-    uint8_t _ctrl;  // Volume in lower 4 bits, distortion in upper 4 bits
+    uint8_t _ctrlAddr;  // Volume in lower 4 bits, distortion in upper 4 bits
     
-    void writeReg(uint8_t addr, uint8_t value);
-    void updateCtrl();
+    void setCtrl(uint8_t keep, uint8_t bits);
 };
 
 /**
@@ -138,7 +156,7 @@ public:
      * @brief Constructor
      * @param baseAddr Base address for POKEY (default 0x60)
      */
-    POKEY(uint16_t baseAddr = 0x60);
+    POKEY(uint16_t baseAddr = POKEYConfig::baseAddr);
     
     /**
      * @brief Initialize the POKEY
@@ -147,11 +165,23 @@ public:
     
     /**
      * @brief Write to a POKEY register
+     * 
+     * Writes to AUDF1..AUDCTL go through the register shadow and are
+     * dropped when they would not change the register.
+     * 
      * @param addr Register address
      * @param data Data to write
      */
     void writeReg(uint8_t addr, uint8_t data);
     
+    /**
+     * @brief Write a block of consecutive POKEY registers in one burst
+     * @param startAddr Address of the first register
+     * @param data Register values
+     * @param count Number of registers to write
+     */
+    void writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count);
+    
     /**
      * @brief Read from a POKEY register
      * @param addr Register address
@@ -159,6 +189,64 @@ public:
      */
     uint8_t readReg(uint8_t addr);
     
+    /**
+     * @brief Get the last value written to a register, without a bus access
+     * @param addr Register address (AUDF1..AUDCTL)
+     * @return Register value
+     */
+    uint8_t getReg(uint8_t addr);
+    
+    /**
+     * @brief Get the number of shadowed register writes sent to the chip
+     * @return Register values put on the bus since the object was created,
+     *         not counting unchanged writes that were dropped
+     */
+    uint32_t getBusWriteCount();
+    
+    /**
+     * @brief Send writes at once or hold them until commit()
+     * @param mode SHADOW_WRITE_THROUGH (default) or SHADOW_DEFERRED
+     */
+    void setCommitMode(ShadowCommitMode mode);
+    
+    /**
+     * @brief Send the registers changed since the last commit
+     */
+    void commit();
+    
+    /**
+     * @brief Stage register writes in the gateware bank
+     * 
+     * While enabled, writes to AUDF1-AUDCTL are collected by the slave and
+     * only reach the chip on commitBank(), all in the same instant.
+     * 
+     * @param enable True to stage writes, false to apply them as they arrive
+     */
+    void enableRegisterBank(bool enable);
+    
+    /**
+     * @brief Apply the staged writes together
+     * 
+     * Pending shadow writes (SHADOW_DEFERRED) are sent first. The bank is
+     * applied on the next frame_tick input (the SID slave's frame_irq), or at once when now is set. Writes
+     * made before it is applied are staged for the next commit.
+     * 
+     * @param now True to apply without waiting for the frame tick
+     */
+    void commitBank(bool now = false);
+    
+    /**
+     * @brief Check whether a committed bank still waits for its tick
+     * @return true while the commit is pending
+     */
+    bool isBankPending();
+    
+    /**
+     * @brief Check whether writes are being staged
+     * @return true after enableRegisterBank(true)
+     */
+    bool isRegisterBankEnabled() const { return _bankStage; }
+    
     /**
      * @brief Set audio control register
      * @param value AUDCTL value (use POKEY_AUDCTL_* constants)
@@ -202,7 +290,10 @@ public:
     
 private:
     uint16_t _baseAddr;
-    uint8_t _audctl;
+    ShadowRegisterFile<POKEY_NUM_AUDIO_REGS, POKEYConfig::busWidth> _regs;
+    bool _bankStage;            // Writes go to the gateware bank
+    
+    void setAUDCTLBit(uint8_t bit, bool enable);
 };
 
 #endif // POKEY_H
@@ -0,0 +1,124 @@
+/**
+ * @file PagedMemory.cpp
+ * @brief Sparse 6502 memory implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "PagedMemory.h"
+#include <string.h>
+
+// Shared by every page that was never written
+const uint8_t PagedMemory::zeroPage[PAGED_MEMORY_PAGE_SIZE] = { 0 };
+
+PagedMemory::PagedMemory() : _ramPages(0), _hasSnapshot(false) {
+    for (uint16_t i = 0; i < PAGED_MEMORY_PAGES; i++) {
+        _pages[i].handler = 0;
+        _pages[i].hookReads = false;
+        _pages[i].frozen = zeroPage;
+        _pages[i].frozenInRam = false;
+        setData(i, zeroPage, false);
+    }
+}
+
+PagedMemory::~PagedMemory() {
+    clear();
+}
+
+void PagedMemory::clear() {
+    for (uint16_t i = 0; i < PAGED_MEMORY_PAGES; i++) {
+        free(ramPointer(i));
+        if (_pages[i].frozenInRam) free((uint8_t*)_pages[i].frozen);
+        _pages[i].frozen = zeroPage;
+        _pages[i].frozenInRam = false;
+        setData(i, zeroPage, false);
+    }
+    _ramPages = 0;
+    _hasSnapshot = false;
+}
+
+void PagedMemory::takeSnapshot() {
+    for (uint16_t i = 0; i < PAGED_MEMORY_PAGES; i++) {
+        Page& p = _pages[i];
+
+        // Not written since the last snapshot: nothing to freeze
+        if (p.frozen == p.data) continue;
+
+        if (p.frozenInRam) {
+            free((uint8_t*)p.frozen);
+            _ramPages--;
+        }
+        p.frozen = p.data;
+        p.frozenInRam = p.inRam;
+
+        // RAM now belongs to the snapshot, the next write copies it
+        setData(i, p.data, false);
+    }
+    _hasSnapshot = true;
+}
+
+bool PagedMemory::restoreSnapshot() {
+    if (!_hasSnapshot) return false;
+
+    for (uint16_t i = 0; i < PAGED_MEMORY_PAGES; i++) {
+        Page& p = _pages[i];
+        if (p.data == p.frozen) continue;
+
+        if (p.inRam) {
+            free((uint8_t*)p.data);
+            _ramPages--;
+        }
+        setData(i, p.frozen, false);
+    }
+    return true;
+}
+
+void PagedMemory::setHandler(uint8_t page, uint8_t handler, bool hookReads) {
+    _pages[page].handler = handler;
+    _pages[page].hookReads = handler && hookReads;
+    setData(page, _pages[page].data, _pages[page].inRam);
+}
+
+void PagedMemory::setData(uint8_t page, const uint8_t* data, bool inRam) {
+    Page& p = _pages[page];
+    p.data = data;
+    p.inRam = inRam;
+    p.read = p.hookReads ? nullptr : data;
+    p.write = (inRam && !p.handler) ? (uint8_t*)data : nullptr;
+}
+
+uint8_t* PagedMemory::copyPage(uint8_t page) {
+    uint8_t* ram = (uint8_t*)malloc(PAGED_MEMORY_PAGE_SIZE);
+    if (!ram) return nullptr;
+
+    memcpy(ram, _pages[page].data, PAGED_MEMORY_PAGE_SIZE);
+    setData(page, ram, true);
+    _ramPages++;
+    return ram;
+}
+
+bool PagedMemory::map(uint16_t addr, const uint8_t* data, size_t length) {
+    uint32_t pos = addr;
+    uint32_t end = pos + length;
+    if (end > 0x10000) end = 0x10000;
+
+    while (pos < end) {
+        uint8_t page = pos >> 8;
+        uint16_t offset = pos & 0xFF;
+        uint32_t chunk = PAGED_MEMORY_PAGE_SIZE - offset;
+        if (chunk > end - pos) chunk = end - pos;
+
+        if (chunk == PAGED_MEMORY_PAGE_SIZE && !_pages[page].inRam && !_pages[page].handler) {
+            setData(page, data, false);
+        } else {
+            uint8_t* ram = writePage(page);
+            if (!ram) return false;
+            memcpy(ram + offset, data, chunk);
+        }
+
+        data += chunk;
+        pos += chunk;
+    }
+    return true;
+}
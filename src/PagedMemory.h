@@ -0,0 +1,208 @@
+/**
+ * @file PagedMemory.h
+ * @brief 64 KB 6502 address space built from 256-byte pages
+ *
+ * Pages that were never written read from one shared page of zeros, pages
+ * of an embedded tune read straight from flash, and only pages the tune
+ * writes get 256 bytes of RAM (copy-on-write). A typical tune touches a
+ * few KB instead of holding a full 64 KB array per player.
+ *
+ * Each page has a fast read and write pointer. A null pointer sends the
+ * access to the owner's slow path: the first write to a page (which copies
+ * it to RAM) or a page with a handler attached, such as an I/O chip. Plain
+ * memory therefore costs one table lookup per access and no extra checks,
+ * and instruction fetches, which never go to a handler, not even a branch.
+ *
+ * A snapshot freezes the current contents: RAM pages become read-only
+ * and are copied again on their next write, like flash pages. Restoring
+ * frees the pages written since and points every page back at its frozen
+ * data, so a tune image can be reset without reloading it.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef PAGED_MEMORY_H
+#define PAGED_MEMORY_H
+
+#include <Arduino.h>
+
+#define PAGED_MEMORY_PAGES      256
+#define PAGED_MEMORY_PAGE_SIZE  256
+
+/**
+ * @class PagedMemory
+ * @brief Sparse, copy-on-write 64 KB memory with per-page handlers
+ */
+class PagedMemory {
+public:
+    PagedMemory();
+    ~PagedMemory();
+
+    /**
+     * @brief Free all RAM pages and make the whole space read as zero
+     *
+     * The snapshot is dropped as well.
+     */
+    void clear();
+
+    /**
+     * @brief Freeze the current contents for restoreSnapshot()
+     *
+     * Replaces an earlier snapshot. Pages written afterwards cost a RAM
+     * copy each, the frozen pages stay allocated until clear().
+     */
+    void takeSnapshot();
+
+    /**
+     * @brief Return every page to its contents at takeSnapshot()
+     * @return false if there is no snapshot
+     */
+    bool restoreSnapshot();
+
+    /**
+     * @brief Check whether a snapshot was taken since the last clear()
+     * @return true if restoreSnapshot() can be used
+     */
+    bool hasSnapshot() const { return _hasSnapshot; }
+
+    /**
+     * @brief Stored contents of a page, bypassing handlers
+     * @param page Page number
+     * @return Page data (never nullptr)
+     */
+    const uint8_t* dataPointer(uint8_t page) const {
+        return _pages[page].data;
+    }
+
+    /**
+     * @brief Fast read pointer of a page
+     * @param page Page number
+     * @return Page data, or nullptr if reads of the page go to its handler
+     */
+    const uint8_t* readPointer(uint8_t page) const {
+        return _pages[page].read;
+    }
+
+    /**
+     * @brief Fast write pointer of a page
+     * @param page Page number
+     * @return Page RAM, or nullptr if the page is not in RAM yet or has a handler
+     */
+    uint8_t* writePointer(uint8_t page) const {
+        return _pages[page].write;
+    }
+
+    /**
+     * @brief Read the stored value of a byte, bypassing handlers
+     * @param addr Address
+     * @return Value at addr
+     */
+    uint8_t read(uint16_t addr) const {
+        return _pages[addr >> 8].data[addr & 0xFF];
+    }
+
+    /**
+     * @brief Store a byte, bypassing handlers
+     *
+     * The page gets RAM on its first write. The write is dropped if no RAM
+     * is left for the page.
+     *
+     * @param addr Address
+     * @param value Value to store
+     */
+    void write(uint16_t addr, uint8_t value) {
+        uint8_t* page = _pages[addr >> 8].write;
+        if (!page) page = writePage(addr >> 8);
+        if (page) page[addr & 0xFF] = value;
+    }
+
+    /**
+     * @brief Get a RAM page to fill directly (copied on first use)
+     * @param page Page number
+     * @return Page data, or nullptr if out of memory
+     */
+    uint8_t* writePage(uint8_t page) {
+        uint8_t* ram = ramPointer(page);
+        return ram ? ram : copyPage(page);
+    }
+
+    /**
+     * @brief Map read-only data (flash or PROGMEM) into the address space
+     *
+     * Whole pages point into data, which must stay valid until the next
+     * clear(). Partly covered pages at either end, and pages with a
+     * handler, are copied to RAM.
+     *
+     * @param addr Address of the first byte
+     * @param data Data to map
+     * @param length Number of bytes, clipped at the end of the address space
+     * @return false if a page could not be allocated
+     */
+    bool map(uint16_t addr, const uint8_t* data, size_t length);
+
+    /**
+     * @brief Attach a handler to a page
+     *
+     * Writes to the page always go to the slow path. Reads do too if
+     * hookReads is set, otherwise they return the stored value directly.
+     * Handlers are kept across clear().
+     *
+     * @param page Page number
+     * @param handler Handler number (0 = plain memory)
+     * @param hookReads Send reads to the handler as well
+     */
+    void setHandler(uint8_t page, uint8_t handler, bool hookReads = true);
+
+    /**
+     * @brief Get the handler of the page holding an address
+     * @param addr Address
+     * @return Handler number (0 = plain memory)
+     */
+    uint8_t getHandler(uint16_t addr) const {
+        return _pages[addr >> 8].handler;
+    }
+
+    /**
+     * @brief Check whether reads of an address go to its page handler
+     * @param addr Address
+     * @return true if the page was attached with hookReads
+     */
+    bool hooksReads(uint16_t addr) const {
+        return _pages[addr >> 8].hookReads;
+    }
+
+    /**
+     * @brief Get the number of pages held in RAM
+     * @return Page count (each PAGED_MEMORY_PAGE_SIZE bytes), frozen pages included
+     */
+    uint16_t getRamPages() const { return _ramPages; }
+
+private:
+    PagedMemory(const PagedMemory&) = delete;
+    PagedMemory& operator=(const PagedMemory&) = delete;
+
+    struct Page {
+        const uint8_t* data;    // Stored contents: zeros, flash or RAM
+        const uint8_t* read;    // Fast read pointer, nullptr = slow path
+        uint8_t* write;         // Fast write pointer, nullptr = slow path
+        uint8_t handler;        // Page handler, 0 = memory
+        bool hookReads;
+        bool inRam;             // data is RAM owned by the page
+        const uint8_t* frozen;  // Contents at the snapshot
+        bool frozenInRam;       // frozen is RAM owned by the page
+    };
+    Page _pages[PAGED_MEMORY_PAGES];
+    uint16_t _ramPages;
+    bool _hasSnapshot;
+
+    static const uint8_t zeroPage[PAGED_MEMORY_PAGE_SIZE];
+
+    uint8_t* ramPointer(uint8_t page) const {
+        return _pages[page].inRam ? (uint8_t*)_pages[page].data : nullptr;
+    }
+    uint8_t* copyPage(uint8_t page);
+    void setData(uint8_t page, const uint8_t* data, bool inRam);
+};
+
+#endif // PAGED_MEMORY_H
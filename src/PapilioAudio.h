@@ -22,7 +22,11 @@
 #include "POKEY.h"
 #include "AudioMixer.h"
 #include "SIDPlayer.h"
+#include "SAPPlayer.h"
 #include "YMPlayer.h"
+#include "SIDDump.h"
+#include "TuneLibrary.h"
+#include "Playlist.h"
 
 // Default Wishbone base addresses for audio peripherals
 // These match the address map in top.v gateware
@@ -42,4 +46,13 @@
 #define WB_AUDIO_MIXER_BASE   0x8260   // Audio mixer: 0x8260-0x827F (32 bytes)
 #endif
 
+// Optional second and third SID for 2SID/3SID tunes
+#ifndef WB_AUDIO_SID2_BASE
+#define WB_AUDIO_SID2_BASE    0x8280   // SID 2: 0x8280-0x829F (32 bytes)
+#endif
+
+#ifndef WB_AUDIO_SID3_BASE
+#define WB_AUDIO_SID3_BASE    0x82A0   // SID 3: 0x82A0-0x82BF (32 bytes)
+#endif
+
 #endif // PAPILIO_AUDIO_H
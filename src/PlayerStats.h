@@ -0,0 +1,132 @@
+/**
+ * @file PlayerStats.h
+ * @brief Per-frame runtime statistics of the file players
+ *
+ * A player fills in a PlayerStats record after every frame it plays.
+ * The record is published through a sequence counter: the player bumps
+ * the counter to odd before it writes and back to even after, and a
+ * reader copies the record and retries if the counter moved. Readers
+ * never block the player, so the stats can be polled from any task,
+ * for example to stream them to telemetry.
+ *
+ * load[] is a rolling histogram of the time update() spent on a frame
+ * as a share of the frame period, in powers of two: below 1/64, 1/64 to
+ * 1/32, ... 1/2 to 1, and a full period or more. All buckets are halved
+ * every PLAYER_STATS_WINDOW frames, so it follows the recent past.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef PLAYER_STATS_H
+#define PLAYER_STATS_H
+
+#include <Arduino.h>
+
+#define PLAYER_STATS_BUCKETS    8
+#define PLAYER_STATS_WINDOW     256     // Frames between halvings of load[]
+
+// Attempts of PlayerStatsCell::read() before it gives up on a busy writer
+#define PLAYER_STATS_READ_TRIES 8
+
+/**
+ * @brief What a player did for its last frame, and totals since the reset
+ */
+struct PlayerStats {
+    uint32_t frames;            // Frames played since the reset
+    uint32_t cycles;            // 6502 cycles of the last play call
+    uint32_t instructions;      // 6502 instructions of it (MOS6502_COUNT_INSTRUCTIONS)
+    uint32_t updateMicros;      // Time update() spent on the last frame
+    uint32_t maxUpdateMicros;   // Longest since the reset
+    uint16_t stores;            // Register stores of the last frame
+    uint16_t busWrites;         // Register writes it put on the bus
+    uint16_t coalesced;         // Stores that needed no bus write of their own
+    uint8_t bufferedFrames;     // Frames ready in the look-ahead ring
+    uint32_t lateTicks;         // Ticks served a whole period or more late
+    uint32_t missedTicks;       // Ticks that came while the previous one was pending
+    uint32_t maxJitter;         // Longest delay from a tick to its frame (µs)
+    uint16_t load[PLAYER_STATS_BUCKETS];
+};
+
+/**
+ * @class PlayerStatsCell
+ * @brief PlayerStats with one writer and any number of lock-free readers
+ */
+class PlayerStatsCell {
+public:
+    PlayerStatsCell() : _seq(0) {
+        memset(&_stats, 0, sizeof(_stats));
+    }
+
+    /**
+     * @brief Start changing the record (writer)
+     * @return The record, to be filled in before publish()
+     */
+    PlayerStats& edit() {
+        __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return _stats;
+    }
+
+    /**
+     * @brief Make the changes since edit() visible (writer)
+     */
+    void publish() {
+        __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Count a frame in frames, maxUpdateMicros and load[] (writer)
+     * @param updateMicros Time update() spent on the frame
+     * @param periodMicros Frame period
+     */
+    void countFrame(uint32_t updateMicros, uint32_t periodMicros) {
+        _stats.frames++;
+        _stats.updateMicros = updateMicros;
+        if (updateMicros > _stats.maxUpdateMicros) _stats.maxUpdateMicros = updateMicros;
+
+        // Share of the period in 64ths, then one bucket per power of two
+        uint32_t share = periodMicros ? (uint32_t)(((uint64_t)updateMicros << 6) / periodMicros) : 0;
+        uint8_t bucket = 0;
+        while (share && bucket < PLAYER_STATS_BUCKETS - 1) {
+            share >>= 1;
+            bucket++;
+        }
+        if (_stats.load[bucket] < 0xFFFF) _stats.load[bucket]++;
+
+        if (!(_stats.frames % PLAYER_STATS_WINDOW)) {
+            for (uint8_t i = 0; i < PLAYER_STATS_BUCKETS; i++) _stats.load[i] >>= 1;
+        }
+    }
+
+    /**
+     * @brief Clear the record (writer)
+     */
+    void clear() {
+        edit();
+        memset(&_stats, 0, sizeof(_stats));
+        publish();
+    }
+
+    /**
+     * @brief Copy out the last published record (any reader)
+     * @param out Receives the record
+     * @return false if the writer was busy on every attempt
+     */
+    bool read(PlayerStats& out) const {
+        for (uint8_t i = 0; i < PLAYER_STATS_READ_TRIES; i++) {
+            uint32_t seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+            memcpy(&out, (const void*)&_stats, sizeof(out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq) return true;
+        }
+        return false;
+    }
+
+private:
+    uint32_t _seq;              // Odd while the writer is changing _stats
+    PlayerStats _stats;
+};
+
+#endif // PLAYER_STATS_H
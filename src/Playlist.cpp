@@ -0,0 +1,453 @@
+/**
+ * @file Playlist.cpp
+ * @brief Gapless playlist implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "Playlist.h"
+
+Playlist::Playlist(SIDPlayer* sidA, SIDPlayer* sidB, YMPlayer* ymA, YMPlayer* ymB, AudioMixer* mixer)
+    : _mixer(mixer), _count(0), _defaultLength(PLAYLIST_DEFAULT_LENGTH_MS), _fadeMs(0), _repeat(true),
+      _playing(false), _current(PLAYLIST_NO_ENTRY), _live(PLAYLIST_NO_DECK), _outgoing(PLAYLIST_NO_DECK),
+      _liveStart(0), _liveLength(0), _late(false), _ymTick(0),
+      _cueState(PLAYLIST_CUE_NONE), _cueEntry(PLAYLIST_NO_ENTRY), _cueDeck(PLAYLIST_NO_DECK),
+      _failStreak(0), _cueSize(0), _cueRead(0),
+      _fade(FADE_NONE), _fadeStart(0), _lateSwitches(0), _failures(0) {
+    SIDPlayer* sids[2] = { sidA, sidB };
+    YMPlayer* yms[2] = { ymA, ymB };
+    for (uint8_t i = 0; i < 2; i++) {
+        _decks[i].sid = sids[i];
+        _decks[i].ym = NULL;
+        _decks[i].image = NULL;
+        _decks[2 + i].sid = NULL;
+        _decks[2 + i].ym = yms[i];
+        _decks[2 + i].image = NULL;
+    }
+    _level[0] = 0;
+    _level[1] = 0;
+}
+
+Playlist::~Playlist() {
+    _cueFile.close();
+    for (uint8_t i = 0; i < 4; i++) free(_decks[i].image);
+}
+
+void Playlist::begin() {
+    for (uint8_t i = 0; i < 2; i++) {
+        if (!_decks[i].sid) continue;
+        _decks[i].sid->setStandby(true);
+        _decks[i].sid->startTimer();
+    }
+}
+
+// ============================================================================
+// Entries
+// ============================================================================
+
+bool Playlist::add(const char* path, uint8_t subSong, uint32_t lengthMs) {
+    if (_count >= PLAYLIST_MAX_ENTRIES || strlen(path) >= sizeof(_entries[0].path)) return false;
+
+    PlaylistEntry& entry = _entries[_count++];
+    strcpy(entry.path, path);
+    entry.subSong = subSong;
+    entry.lengthMs = lengthMs;
+    return true;
+}
+
+void Playlist::clear() {
+    stop();
+    _count = 0;
+}
+
+uint8_t Playlist::nextEntry(uint8_t index) {
+    if (index + 1 < _count) return index + 1;
+    return _repeat ? 0 : PLAYLIST_NO_ENTRY;
+}
+
+uint8_t Playlist::pickDeck(const char* path) {
+    uint8_t type = TuneLibrary::tuneType(path);
+    uint8_t first;
+    if (type & TUNE_TYPE_SID) {
+        first = 0;
+    } else if (type) {
+        first = 2;
+    } else {
+        return PLAYLIST_NO_DECK;
+    }
+
+    // A pair plays one tune while the other deck gets the next ready
+    for (uint8_t i = first; i < first + 2; i++) {
+        if (!_decks[i].sid && !_decks[i].ym) return PLAYLIST_NO_DECK;
+    }
+    for (uint8_t i = first; i < first + 2; i++) {
+        if (i != _live && i != _outgoing) return i;
+    }
+    return PLAYLIST_NO_DECK;
+}
+
+// ============================================================================
+// Getting the next entry ready
+// ============================================================================
+
+void Playlist::startCue() {
+    const PlaylistEntry& entry = _entries[_cueEntry];
+    _cueDeck = pickDeck(entry.path);
+    if (_cueDeck == PLAYLIST_NO_DECK) {
+        failCue();
+        return;
+    }
+
+    Deck& deck = _decks[_cueDeck];
+    if (deck.ym) {
+        // Not playing, so the load leaves the chip to the live deck; the
+        // digidrums are read in steps
+        if (!deck.ym->startLoad(entry.path)) {
+            failCue();
+            return;
+        }
+        _cueState = PLAYLIST_CUE_READING;
+        return;
+    }
+
+    // Off the chips until it goes live
+    deck.sid->play(false);
+    deck.sid->setStandby(true);
+
+    _cueFile = LittleFS.open(entry.path, "r");
+    if (!_cueFile) {
+        failCue();
+        return;
+    }
+    _cueSize = _cueFile.size();
+    _cueRead = 0;
+    if (_cueSize < SID_HEADER_SIZE || _cueSize > 65536) {
+        failCue();
+        return;
+    }
+
+    // The deck maps the image in place, the last one is no longer needed
+    free(deck.image);
+    deck.image = (uint8_t*)malloc(_cueSize);
+    if (!deck.image) {
+        failCue();
+        return;
+    }
+    _cueState = PLAYLIST_CUE_READING;
+}
+
+void Playlist::stepCue() {
+    if (_cueState == PLAYLIST_CUE_NONE) {
+        // After a failure, try the entry behind the one that failed
+        if (_failStreak >= _count) return;
+        uint8_t next = nextEntry(_failStreak ? _cueEntry : _current);
+        _cueEntry = next;
+        if (next != PLAYLIST_NO_ENTRY) startCue();
+        return;
+    }
+
+    Deck& deck = _decks[_cueDeck];
+    switch (_cueState) {
+        case PLAYLIST_CUE_READING: {
+            if (deck.ym) {
+                if (!deck.ym->loadStep()) {
+                    failCue();
+                    return;
+                }
+                if (deck.ym->isLoading()) return;
+                _cueState = PLAYLIST_CUE_INIT;
+                break;
+            }
+
+            uint32_t n = _cueSize - _cueRead;
+            if (n > PLAYLIST_READ_CHUNK) n = PLAYLIST_READ_CHUNK;
+            if (_cueFile.read(deck.image + _cueRead, n) != n) {
+                failCue();
+                return;
+            }
+            _cueRead += n;
+            if (_cueRead < _cueSize) return;
+
+            _cueFile.close();
+            if (!deck.sid->loadFromMemory(deck.image, _cueSize, _entries[_cueEntry].subSong)) {
+                failCue();
+                return;
+            }
+            _cueState = PLAYLIST_CUE_INIT;
+            break;
+        }
+
+        case PLAYLIST_CUE_INIT:
+            if (deck.ym) {
+                // The first block unpacks a step per call
+                if (deck.ym->isCued()) deck.ym->prefetch();
+                else deck.ym->cue();
+                if (deck.ym->hasFailed()) {
+                    failCue();
+                    return;
+                }
+                if (!deck.ym->isReady()) return;
+            } else {
+                // Init runs within the deck's cycle budget, or on its task
+                deck.sid->update();
+                if (deck.sid->isBusy()) return;
+                if (deck.sid->watchdogTripped()) {
+                    failCue();
+                    return;
+                }
+            }
+            _cueState = PLAYLIST_CUE_READY;
+            _failStreak = 0;
+            break;
+
+        case PLAYLIST_CUE_READY:
+            if (deck.ym) deck.ym->prefetch();
+            break;
+
+        default:
+            break;
+    }
+}
+
+void Playlist::failCue() {
+    Serial.print("Playlist: cannot play ");
+    Serial.println(_entries[_cueEntry].path);
+
+    _cueFile.close();
+    _cueState = PLAYLIST_CUE_NONE;
+    _cueDeck = PLAYLIST_NO_DECK;
+    _failStreak++;
+    _failures++;
+}
+
+void Playlist::cancelCue() {
+    // A cued deck has not touched the chips, it only stops being used
+    _cueFile.close();
+    _cueState = PLAYLIST_CUE_NONE;
+    _cueEntry = PLAYLIST_NO_ENTRY;
+    _cueDeck = PLAYLIST_NO_DECK;
+    _failStreak = 0;
+}
+
+// ============================================================================
+// Decks
+// ============================================================================
+
+void Playlist::goLive(uint32_t now) {
+    Deck& deck = _decks[_cueDeck];
+    const PlaylistEntry& entry = _entries[_cueEntry];
+    _live = _cueDeck;
+    _current = _cueEntry;
+
+    if (deck.sid) {
+        // The chips take the init state at once, play calls follow the timer
+        deck.sid->setStandby(false);
+        deck.sid->play(true);
+        _liveLength = entry.lengthMs ? entry.lengthMs : _defaultLength;
+    } else {
+        // The first frame takes the boundary the last tune left
+        deck.ym->play();
+        _liveLength = entry.lengthMs ? entry.lengthMs :
+                      (uint32_t)((uint64_t)deck.ym->getNumFrames() * deck.ym->getFramePeriod() / 1000);
+        _ymTick = now;
+        tickYM(deck.ym, now);
+    }
+
+    _liveStart = millis();
+    _late = false;
+    _cueState = PLAYLIST_CUE_NONE;
+    _cueDeck = PLAYLIST_NO_DECK;
+}
+
+void Playlist::stopDeck(uint8_t deck, bool silence) {
+    Deck& d = _decks[deck];
+    if (d.sid) {
+        d.sid->play(false);
+        d.sid->setStandby(true, silence);
+    } else {
+        d.ym->stop();
+    }
+}
+
+void Playlist::tickYM(YMPlayer* ym, uint32_t now) {
+    _ymTick += ym->getFramePeriod();
+
+    // A whole frame behind: start a new cadence rather than catch up
+    if ((int32_t)(now - _ymTick) >= 0) _ymTick = now + ym->getFramePeriod();
+    ym->update();
+}
+
+void Playlist::setChannel(uint8_t deck, uint8_t level, uint16_t ms) {
+    _mixer->rampTo(channelOf(deck) ? MIXER_CHANNEL_YM2149 : MIXER_CHANNEL_SID, level, ms);
+}
+
+void Playlist::startFade(FadeMode mode) {
+    _fade = mode;
+    _fadeStart = millis();
+
+    // One ramp per channel; the mixer runs it
+    switch (mode) {
+        case FADE_OUT:
+            // Stays down until the swap
+            setChannel(_live, 0, _fadeMs);
+            break;
+
+        case FADE_IN:
+            setChannel(_live, 0, 0);
+            setChannel(_live, _level[channelOf(_live)], _fadeMs);
+            break;
+
+        case FADE_CROSS:
+            setChannel(_live, _level[channelOf(_live)], _fadeMs);
+            setChannel(_outgoing, 0, _fadeMs);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void Playlist::updateFade() {
+    if (_fade == FADE_NONE || _fade == FADE_OUT) return;
+    if (millis() - _fadeStart < _fadeMs) return;
+
+    if (_fade == FADE_CROSS) {
+        // Silence the chips before their channel is turned back up
+        stopDeck(_outgoing, true);
+        setChannel(_outgoing, _level[channelOf(_outgoing)], 0);
+        _outgoing = PLAYLIST_NO_DECK;
+    }
+    _fade = FADE_NONE;
+}
+
+// ============================================================================
+// Transport
+// ============================================================================
+
+bool Playlist::play(uint8_t index) {
+    stop();
+    if (index >= _count) return false;
+
+    if (_mixer) {
+        _level[0] = _mixer->getReg(MIXER_REG_CH1_VOL);
+        _level[1] = _mixer->getReg(MIXER_REG_CH2_VOL);
+    }
+
+    // The first entry is loaded at once
+    _cueEntry = index;
+    startCue();
+    while (_cueState == PLAYLIST_CUE_READING || _cueState == PLAYLIST_CUE_INIT) {
+        stepCue();
+    }
+    if (_cueState != PLAYLIST_CUE_READY) {
+        cancelCue();
+        return false;
+    }
+
+    _playing = true;
+    goLive(micros());
+    return true;
+}
+
+void Playlist::stop() {
+    cancelCue();
+    if (_playing) {
+        stopDeck(_live, true);
+        if (_outgoing != PLAYLIST_NO_DECK) stopDeck(_outgoing, true);
+        if (_mixer) {
+            _mixer->rampTo(MIXER_CHANNEL_SID, _level[0], 0);
+            _mixer->rampTo(MIXER_CHANNEL_YM2149, _level[1], 0);
+        }
+    }
+
+    _playing = false;
+    _current = PLAYLIST_NO_ENTRY;
+    _live = PLAYLIST_NO_DECK;
+    _outgoing = PLAYLIST_NO_DECK;
+    _fade = FADE_NONE;
+}
+
+void Playlist::skip() {
+    if (!_playing) return;
+    _liveLength = getElapsed() + ((_mixer && _fadeMs) ? _fadeMs : 0);
+}
+
+void Playlist::update() {
+    if (!_playing) return;
+    uint32_t now = micros();
+
+    // The decks that play; a swap waits for the live deck's frame boundary
+    uint8_t live = _live;
+    bool boundary;
+    if (_decks[live].sid) {
+        uint32_t position = _decks[live].sid->getPosition();
+        _decks[live].sid->update();
+        boundary = _decks[live].sid->getPosition() != position;
+    } else {
+        _decks[live].ym->prefetch();
+        boundary = (int32_t)(now - _ymTick) >= 0;
+    }
+
+    if (_outgoing != PLAYLIST_NO_DECK) {
+        Deck& out = _decks[_outgoing];
+        if (out.sid) {
+            out.sid->update();
+        } else if ((int32_t)(now - _ymTick) >= 0) {
+            tickYM(out.ym, now);
+        }
+    }
+
+    stepCue();
+
+    uint32_t elapsed = millis() - _liveStart;
+    bool fades = _mixer && _fadeMs;
+    bool last = _cueState == PLAYLIST_CUE_NONE &&
+                (_cueEntry == PLAYLIST_NO_ENTRY || _failStreak >= _count);
+    bool otherChip = _cueState != PLAYLIST_CUE_NONE && channelOf(_cueDeck) != channelOf(_live);
+
+    if (_outgoing == PLAYLIST_NO_DECK) {
+        if (fades && otherChip) {
+            // Overlap: the next tune starts under the fade
+            if (_cueState == PLAYLIST_CUE_READY && elapsed + _fadeMs >= _liveLength) {
+                setChannel(_cueDeck, 0, 0);
+                _outgoing = _live;
+                goLive(now);
+                startFade(FADE_CROSS);
+            }
+        } else {
+            if (fades && _fade == FADE_NONE && elapsed + _fadeMs >= _liveLength) {
+                startFade(FADE_OUT);
+            }
+
+            if (elapsed >= _liveLength && (_fade != FADE_OUT || millis() - _fadeStart >= _fadeMs)) {
+                if (last) {
+                    stop();
+                    return;
+                }
+                if (_cueState == PLAYLIST_CUE_READY && boundary) {
+                    // Another chip is silenced, the same chips take the
+                    // next tune's state over the last one's
+                    stopDeck(_live, otherChip);
+                    goLive(now);
+                    _fade = FADE_NONE;
+                    if (fades) startFade(FADE_IN);
+                }
+            }
+        }
+
+        // Still playing past the end: the next entry was not ready
+        if (_live == live && elapsed >= _liveLength && _cueState != PLAYLIST_CUE_READY &&
+            !_late && !last) {
+            _late = true;
+            _lateSwitches++;
+        }
+    }
+
+    // The live YM deck's frame, unless the next tune took the boundary
+    if (boundary && _decks[live].ym && (_live == live || _outgoing == live)) {
+        tickYM(_decks[live].ym, now);
+    }
+
+    updateFade();
+}
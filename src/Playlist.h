@@ -0,0 +1,249 @@
+/**
+ * @file Playlist.h
+ * @brief Gapless playback of a list of SID and YM files
+ *
+ * Loading a tune when the previous one ends stops the music for the file
+ * read and the init routine. A Playlist plays through two players of each
+ * type (decks) on the same chips instead: while one deck plays, the next
+ * entry is made ready on the other during update() calls, a piece at a
+ * time. A SID file is read in PLAYLIST_READ_CHUNK steps and its init runs
+ * within the deck's cycle budget in standby (or on its emulation task); a
+ * YM file is loaded with YMPlayer::loadStep() and its first block unpacked
+ * through YMPlayer::cue() and prefetch(), a step per update().
+ * When the playing entry has run its length the decks swap on a frame
+ * boundary, so the chips only see the next tune's first frame.
+ *
+ * With an AudioMixer and setCrossfade(), a change between a SID and a YM
+ * tune overlaps them, one mixer channel fading out as the other fades in.
+ * The fades are AudioMixer::rampTo() ramps, a write per channel each.
+ * Two tunes for the same chip cannot overlap: the channel fades out before
+ * the swap and back in after it.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "SIDPlayer.h"
+#include "YMPlayer.h"
+#include "AudioMixer.h"
+#include "TuneLibrary.h"
+
+#define PLAYLIST_MAX_ENTRIES        32
+#define PLAYLIST_DEFAULT_LENGTH_MS  180000UL    // SID tunes never end by themselves
+
+// Bytes of the next SID file read per update()
+#define PLAYLIST_READ_CHUNK         1024
+
+#define PLAYLIST_NO_ENTRY           0xFF
+#define PLAYLIST_NO_DECK            0xFF
+
+/**
+ * @brief One tune of the list
+ */
+struct PlaylistEntry {
+    char path[TUNE_LIBRARY_PATH_MAX];
+    uint32_t lengthMs;          // Play time, 0 = setDefaultLength() for SID, one pass for YM
+    uint8_t subSong;            // SID sub-song, 0-based
+};
+
+/**
+ * @brief Progress of the entry being made ready
+ */
+enum PlaylistCue {
+    PLAYLIST_CUE_NONE,          // No entry picked yet
+    PLAYLIST_CUE_READING,       // SID file read in chunks, or YM digidrums
+    PLAYLIST_CUE_INIT,          // SID init running, or YM first block unpacking
+    PLAYLIST_CUE_READY          // Can take over on the next boundary
+};
+
+/**
+ * @class Playlist
+ * @brief Plays a list of tunes back to back through two decks per chip
+ */
+class Playlist {
+public:
+    /**
+     * @brief Constructor
+     *
+     * Both players of a pair drive the same chips. SID tunes need both SID
+     * decks and YM tunes both YM decks; entries without them are skipped.
+     *
+     * @param sidA First SID deck
+     * @param sidB Second SID deck
+     * @param ymA First YM deck (optional)
+     * @param ymB Second YM deck (optional)
+     * @param mixer Mixer for crossfades (optional)
+     */
+    Playlist(SIDPlayer* sidA, SIDPlayer* sidB, YMPlayer* ymA = NULL, YMPlayer* ymB = NULL,
+             AudioMixer* mixer = NULL);
+    ~Playlist();
+
+    /**
+     * @brief Put the SID decks in standby and start their play timers
+     *
+     * Call after the players' begin(). Each SID deck keeps its own timer
+     * (and emulation task if started); attachFrameTick() serves only one
+     * player and does not suit a playlist.
+     */
+    void begin();
+
+    /**
+     * @brief Append a tune
+     * @param path .sid, .ym or .ymd file on LittleFS
+     * @param subSong SID sub-song (0-based)
+     * @param lengthMs Play time, 0 for the default
+     * @return false if the list is full or the path too long
+     */
+    bool add(const char* path, uint8_t subSong = 0, uint32_t lengthMs = 0);
+
+    /**
+     * @brief Stop and empty the list
+     */
+    void clear();
+
+    uint8_t count() const { return _count; }
+    const PlaylistEntry* getEntry(uint8_t index) const { return index < _count ? &_entries[index] : NULL; }
+
+    /**
+     * @brief Set the play time of SID entries without their own
+     * @param ms Milliseconds (default PLAYLIST_DEFAULT_LENGTH_MS)
+     */
+    void setDefaultLength(uint32_t ms) { _defaultLength = ms; }
+
+    /**
+     * @brief Set the fade between tunes (needs the mixer)
+     * @param ms Fade time, 0 = straight cut (default)
+     */
+    void setCrossfade(uint16_t ms) { _fadeMs = ms; }
+
+    /**
+     * @brief Start over at the first entry after the last one
+     * @param repeat True to loop the list (default)
+     */
+    void setRepeat(bool repeat) { _repeat = repeat; }
+
+    /**
+     * @brief Start playing at an entry
+     *
+     * The first entry is loaded before this returns; the ones after it
+     * are made ready in the background.
+     *
+     * @param index Entry to start with
+     * @return false if the entry could not be loaded
+     */
+    bool play(uint8_t index = 0);
+
+    /**
+     * @brief Stop and silence all decks
+     */
+    void stop();
+
+    /**
+     * @brief End the current entry now, with the fade if one is set
+     */
+    void skip();
+
+    /**
+     * @brief Play the decks and make the next entry ready
+     *
+     * Call from loop() as often as possible instead of the players'
+     * update(). YM frames go out every getFramePeriod() from here.
+     */
+    void update();
+
+    bool isPlaying() const { return _playing; }
+
+    /**
+     * @brief Get the entry playing
+     * @return Entry number, PLAYLIST_NO_ENTRY when stopped
+     */
+    uint8_t getCurrent() const { return _current; }
+
+    /**
+     * @brief Get the time the current entry has played
+     * @return Milliseconds since it started
+     */
+    uint32_t getElapsed() const { return _playing ? millis() - _liveStart : 0; }
+
+    // Play time of the current entry in ms
+    uint32_t getLength() const { return _liveLength; }
+
+    // The next entry can take over
+    bool isNextReady() const { return _cueState == PLAYLIST_CUE_READY; }
+
+    // Entries that ran past their length waiting for the next one
+    uint32_t getLateSwitches() const { return _lateSwitches; }
+
+    // Entries skipped because they could not be loaded
+    uint32_t getFailures() const { return _failures; }
+
+private:
+    enum FadeMode {
+        FADE_NONE,
+        FADE_OUT,               // Live channel down before a swap on the same chips
+        FADE_IN,                // Live channel up after it
+        FADE_CROSS              // Live channel up, the outgoing deck's down
+    };
+
+    // One player and, for SID, the file image it plays from
+    struct Deck {
+        SIDPlayer* sid;
+        YMPlayer* ym;
+        uint8_t* image;
+    };
+
+    Deck _decks[4];             // SID A, SID B, YM A, YM B
+    AudioMixer* _mixer;
+
+    PlaylistEntry _entries[PLAYLIST_MAX_ENTRIES];
+    uint8_t _count;
+    uint32_t _defaultLength;
+    uint16_t _fadeMs;
+    bool _repeat;
+
+    bool _playing;
+    uint8_t _current;
+    uint8_t _live;              // Deck playing the current entry
+    uint8_t _outgoing;          // Deck fading out under it
+    uint32_t _liveStart;        // millis() when the current entry started
+    uint32_t _liveLength;
+    bool _late;                 // The current entry is past its length
+    uint32_t _ymTick;           // micros() of the next YM frame
+
+    // The entry being made ready
+    PlaylistCue _cueState;
+    uint8_t _cueEntry;
+    uint8_t _cueDeck;
+    uint8_t _failStreak;        // Entries in a row that failed to load
+    File _cueFile;
+    uint32_t _cueSize;
+    uint32_t _cueRead;
+
+    FadeMode _fade;
+    uint32_t _fadeStart;
+    uint8_t _level[2];          // Mixer levels of the SID and YM channels
+
+    uint32_t _lateSwitches;
+    uint32_t _failures;
+
+    uint8_t pickDeck(const char* path);
+    uint8_t nextEntry(uint8_t index);
+    void startCue();
+    void stepCue();
+    void failCue();
+    void cancelCue();
+    void goLive(uint32_t now);
+    void stopDeck(uint8_t deck, bool silence);
+    void tickYM(YMPlayer* ym, uint32_t now);
+    void startFade(FadeMode mode);
+    void updateFade();
+    void setChannel(uint8_t deck, uint8_t level, uint16_t ms);
+    uint8_t channelOf(uint8_t deck) const { return deck < 2 ? 0 : 1; }
+};
+
+#endif // PLAYLIST_H
@@ -0,0 +1,559 @@
+/**
+ * @file SAPPlayer.cpp
+ * @brief SAP file player implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "SAPPlayer.h"
+#include <string.h>
+
+#if defined(ESP32) || defined(ESP8266)
+#include <LittleFS.h>
+#endif
+
+// POKEY and ANTIC registers the player looks at
+#define SAP_POKEY_RANDOM    0x0A
+#define SAP_ANTIC_VCOUNT    0x0B
+
+SAPPlayer::SAPPlayer(POKEY* pokey, POKEY* pokey2) :
+    Mos6502Player(*this, "SAP", SAP_DEFAULT_CYCLE_BUDGET, SAP_DEFAULT_WATCHDOG_CYCLES,
+                  SAP_FRAME_PERIOD_US),
+    _numChips(pokey2 ? 2 : 1),
+    _type('B'), _initAddr(0), _playerAddr(0), _musicAddr(0),
+    _numSongs(1), _defaultSong(0), _currentSong(0), _stereo(false), _ntsc(false),
+    _fastplay(SAP_LINES_PAL),
+    _writeMode(SAP_WRITE_DIRECT)
+{
+    _pokeys[0] = pokey;
+    _pokeys[1] = pokey2;
+    memset(_durations, 0, sizeof(_durations));
+    memset(_title, 0, sizeof(_title));
+    memset(_author, 0, sizeof(_author));
+    memset(_date, 0, sizeof(_date));
+    memset(_shadow, 0, sizeof(_shadow));
+    memset(_dirty, 0, sizeof(_dirty));
+    setPlayRate(SAP_LINES_PAL * SAP_CYCLES_PER_LINE, SAP_CLOCK_PAL);
+    
+    _memory.setHandler(0xD2, SAP_IO_POKEY);
+    _memory.setHandler(0xD4, SAP_IO_ANTIC);
+}
+
+void SAPPlayer::begin() {
+    for (uint8_t i = 0; i < _numChips; i++) {
+        _pokeys[i]->begin();
+    }
+    resetPOKEYs();
+}
+
+uint8_t SAPPlayer::getMem(uint16_t addr) {
+    uint8_t handler = _memory.getHandler(addr);
+    if (handler) return readIO(handler, addr);
+    return _memory.read(addr);
+}
+
+void SAPPlayer::setMem(uint16_t addr, uint8_t value) {
+    uint8_t handler = _memory.getHandler(addr);
+    if (handler) writeIO(handler, addr, value);
+    else _memory.write(addr, value);
+}
+
+uint8_t SAPPlayer::readIO(uint8_t handler, uint16_t addr) {
+    uint64_t now = _cpu.now();
+    
+    switch (handler) {
+        case SAP_IO_POKEY:
+            if ((addr & 0x0F) == SAP_POKEY_RANDOM) {
+                // Stands in for the polynomial counter, which runs every cycle
+                uint32_t r = (uint32_t)now * 2654435761UL;
+                return r >> 24;
+            }
+            break;
+        case SAP_IO_ANTIC:
+            if ((addr & 0x0F) == SAP_ANTIC_VCOUNT) {
+                // Scanline / 2, from where the cycle counter is in the frame
+                uint32_t lines = _ntsc ? SAP_LINES_NTSC : SAP_LINES_PAL;
+                uint32_t line = (uint32_t)((now / SAP_CYCLES_PER_LINE) % lines);
+                return line >> 1;
+            }
+            break;
+    }
+    return 0xFF;
+}
+
+void SAPPlayer::writeIO(uint8_t handler, uint16_t addr, uint8_t value) {
+    switch (handler) {
+        case SAP_IO_POKEY: {
+            // Mono tunes see the POKEY mirrored every 16 bytes, stereo
+            // tunes have the second POKEY at $D210
+            uint8_t chip = (_stereo && (addr & 0x10)) ? 1 : 0;
+            writePOKEYReg(chip, addr & 0x0F, value);
+            break;
+        }
+        case SAP_IO_ANTIC:
+            // No display: WSYNC and the DMA and NMI enables are ignored
+            break;
+    }
+}
+
+void SAPPlayer::writePOKEYReg(uint8_t chip, uint8_t reg, uint8_t value) {
+    if (chip >= _numChips) return;
+    
+    // STIMER, SKCTL and the rest have no shadow and go out at once
+    if (reg >= POKEY_NUM_AUDIO_REGS) {
+        _pokeys[chip]->writeReg(reg, value);
+    } else if (_writeMode == SAP_WRITE_COALESCED || _frameCapture) {
+        storePOKEYReg(chip, reg, value);
+    } else if (_writeMode == SAP_WRITE_TIMED && _routine == SAP_ROUTINE_PLAY) {
+        queueWrite(chip, reg, value);
+    } else {
+        _pokeys[chip]->writeReg(reg, value);
+    }
+}
+
+void SAPPlayer::storePOKEYReg(uint8_t chip, uint8_t reg, uint8_t value) {
+    _shadow[chip][reg] = value;
+    _dirty[chip] |= 1 << reg;
+}
+
+void SAPPlayer::flushWrites() {
+    // The chip's own shadow drops the registers that did not change
+    for (uint8_t i = 0; i < _numChips; i++) {
+        if (!_dirty[i]) continue;
+        _pokeys[i]->writeRegs(0, _shadow[i], POKEY_NUM_AUDIO_REGS);
+        _dirty[i] = 0;
+    }
+}
+
+void SAPPlayer::writeFrame(const SAPPlayerFrame& frame) {
+    for (uint8_t i = 0; i < _numChips; i++) {
+        if (frame.dirty[i]) _pokeys[i]->writeRegs(0, frame.regs[i], POKEY_NUM_AUDIO_REGS);
+    }
+}
+
+void SAPPlayer::pushPOKEYFrame() {
+    SAPPlayerFrame* frame = _frameRing.writeSlot();
+    
+    // Ring full: the stores stay pending and go out with the next frame
+    if (!frame) return;
+    
+    memcpy(frame->regs, _shadow, sizeof(frame->regs));
+    memcpy(frame->dirty, _dirty, sizeof(frame->dirty));
+    memset(_dirty, 0, sizeof(_dirty));
+    _frameRing.commit();
+}
+
+void SAPPlayer::resetPOKEYs() {
+    for (uint8_t i = 0; i < _numChips; i++) {
+        _pokeys[i]->reset();
+    }
+    
+    // Matches the chip state after POKEY::reset()
+    memset(_shadow, 0, sizeof(_shadow));
+    memset(_dirty, 0, sizeof(_dirty));
+}
+
+// ============================================================================
+// Routines
+// ============================================================================
+
+void SAPPlayer::startInit() {
+    if (_type == 'C') {
+        // CMC player: A=$70 with the music address in X/Y, then A=0, X=song
+        startRoutine(SAP_ROUTINE_MUSIC, _playerAddr + 3, 0x70, _musicAddr & 0xFF, _musicAddr >> 8);
+    } else {
+        startRoutine(SAP_ROUTINE_INIT, _initAddr, _currentSong);
+    }
+}
+
+void SAPPlayer::startPlayCall() {
+    // FASTPLAY boundaries, as if called from the vertical blank interrupt
+    alignPlayCall();
+    if (_writeMode == SAP_WRITE_TIMED) anchorTimeline();
+    startRoutine(SAP_ROUTINE_PLAY, _type == 'C' ? _playerAddr + 6 : _playerAddr, 0);
+}
+
+void SAPPlayer::finishRoutine() {
+    uint8_t routine = _routine;
+    _routine = SAP_ROUTINE_NONE;
+    
+    if (routine == SAP_ROUTINE_MUSIC && !_watchdogTripped) {
+        startRoutine(SAP_ROUTINE_INIT, _playerAddr + 3, 0x00, _currentSong);
+        return;
+    }
+    
+    if (_frameCapture) {
+        pushPOKEYFrame();
+    } else if (_writeMode == SAP_WRITE_COALESCED) {
+        flushWrites();
+    }
+}
+
+// ============================================================================
+// Loading
+// ============================================================================
+
+// Copy a tag value, without its quotes, into a 33-byte field
+static void copyTagString(char* dst, const char* value, size_t length) {
+    if (length && value[0] == '"') {
+        value++;
+        length--;
+        if (length && value[length - 1] == '"') length--;
+    }
+    if (length > 32) length = 32;
+    memcpy(dst, value, length);
+    dst[length] = '\0';
+}
+
+static uint32_t parseNumber(const char* s, size_t length, uint8_t base) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = s[i];
+        uint8_t digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (base == 16 && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else if (base == 16 && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else break;
+        value = value * base + digit;
+    }
+    return value;
+}
+
+// TIME value: [mm:]ss[.xxx], optionally followed by LOOP
+static uint32_t parseTime(const char* s, size_t length) {
+    uint32_t ms = 0;
+    uint32_t field = 0;
+    size_t i = 0;
+    
+    for (; i < length && s[i] != '.' && s[i] != ' '; i++) {
+        if (s[i] == ':') {
+            ms = (ms + field) * 60;
+            field = 0;
+        } else if (s[i] >= '0' && s[i] <= '9') {
+            field = field * 10 + (s[i] - '0');
+        }
+    }
+    ms = (ms + field) * 1000;
+    
+    if (i < length && s[i] == '.') {
+        uint32_t scale = 100;
+        for (i++; i < length && s[i] >= '0' && s[i] <= '9' && scale; i++) {
+            ms += (s[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    return ms;
+}
+
+void SAPPlayer::parseTag(const char* line, size_t length) {
+    size_t tagLength = 0;
+    while (tagLength < length && line[tagLength] != ' ') tagLength++;
+    
+    const char* value = line + tagLength;
+    size_t valueLength = length - tagLength;
+    while (valueLength && *value == ' ') {
+        value++;
+        valueLength--;
+    }
+
+#define SAP_TAG(name) (tagLength == sizeof(name) - 1 && !memcmp(line, name, tagLength))
+    if (SAP_TAG("AUTHOR")) {
+        copyTagString(_author, value, valueLength);
+    } else if (SAP_TAG("NAME")) {
+        copyTagString(_title, value, valueLength);
+    } else if (SAP_TAG("DATE")) {
+        copyTagString(_date, value, valueLength);
+    } else if (SAP_TAG("SONGS")) {
+        uint32_t songs = parseNumber(value, valueLength, 10);
+        _numSongs = (songs >= 1 && songs <= 255) ? songs : 1;
+    } else if (SAP_TAG("DEFSONG")) {
+        _defaultSong = parseNumber(value, valueLength, 10);
+    } else if (SAP_TAG("STEREO")) {
+        _stereo = true;
+    } else if (SAP_TAG("NTSC")) {
+        _ntsc = true;
+    } else if (SAP_TAG("TYPE")) {
+        _type = valueLength ? value[0] : 0;
+    } else if (SAP_TAG("FASTPLAY")) {
+        _fastplay = parseNumber(value, valueLength, 10);
+    } else if (SAP_TAG("INIT")) {
+        _initAddr = parseNumber(value, valueLength, 16);
+    } else if (SAP_TAG("PLAYER")) {
+        _playerAddr = parseNumber(value, valueLength, 16);
+    } else if (SAP_TAG("MUSIC")) {
+        _musicAddr = parseNumber(value, valueLength, 16);
+    } else if (SAP_TAG("TIME")) {
+        // One TIME tag per song, in order
+        uint8_t song = 0;
+        while (song < SAP_MAX_SONGS && _durations[song]) song++;
+        if (song < SAP_MAX_SONGS) _durations[song] = parseTime(value, valueLength);
+    }
+#undef SAP_TAG
+}
+
+bool SAPPlayer::parseSAPHeader(const uint8_t* data, size_t length, size_t& binStart) {
+    if (length < 5 || memcmp(data, "SAP", 3) != 0) return false;
+    
+    _type = 0;
+    _initAddr = _playerAddr = _musicAddr = 0;
+    _numSongs = 1;
+    _defaultSong = 0;
+    _stereo = false;
+    _ntsc = false;
+    _fastplay = 0;
+    memset(_durations, 0, sizeof(_durations));
+    _title[0] = _author[0] = _date[0] = '\0';
+    
+    // Text lines ending in CR LF, up to the $FFFF that starts the binary part
+    size_t pos = 0;
+    for (;;) {
+        if (pos + 1 >= length) return false;
+        if (data[pos] == 0xFF && data[pos + 1] == 0xFF) break;
+        
+        size_t end = pos;
+        while (end < length && data[end] != '\n') end++;
+        if (end >= length) return false;
+        
+        size_t lineLength = end - pos;
+        if (lineLength && data[end - 1] == '\r') lineLength--;
+        if (pos) parseTag((const char*)&data[pos], lineLength);
+        pos = end + 1;
+    }
+    binStart = pos;
+    
+    if (_type == 'B') {
+        if (!_initAddr || !_playerAddr) return false;
+    } else if (_type == 'C') {
+        if (!_playerAddr || !_musicAddr) return false;
+    } else {
+        // TYPE D and S need interrupts, TYPE R is a register dump
+        Serial.print("SAP type not supported: ");
+        Serial.println(_type);
+        return false;
+    }
+    
+    if (!_fastplay) _fastplay = _ntsc ? SAP_LINES_NTSC : SAP_LINES_PAL;
+    if (_defaultSong >= _numSongs) _defaultSong = 0;
+    return true;
+}
+
+bool SAPPlayer::loadBlocks(const uint8_t* data, size_t length) {
+    // Atari binary load file: $FFFF, then start/end address pairs with their data
+    size_t pos = 0;
+    while (pos + 4 <= length) {
+        uint16_t start = data[pos] | (data[pos + 1] << 8);
+        if (start == 0xFFFF) {
+            pos += 2;
+            continue;
+        }
+        uint16_t end = data[pos + 2] | (data[pos + 3] << 8);
+        pos += 4;
+        
+        size_t count = (size_t)end - start + 1;
+        if (end < start || pos + count > length) return false;
+        if (!_memory.map(start, &data[pos], count)) return false;
+        pos += count;
+    }
+    return true;
+}
+
+void SAPPlayer::initTune(uint8_t subSong) {
+    _currentSong = (subSong == SAP_DEFAULT_SONG) ? _defaultSong : subSong;
+    if (_currentSong >= _numSongs) _currentSong = 0;
+    
+    // The loaded image, for restoring on a song change
+    _memory.takeSnapshot();
+    
+    // Reset and initialize
+    _queueHead = _queueTail = 0;
+    _frameRing.clear();
+    _framesPrimed = false;
+    resetPOKEYs();
+    updatePlayRate();
+    _watchdogTripped = false;
+    
+    // Init routine runs from update()
+    startInit();
+    
+    _fileLoaded = true;
+}
+
+bool SAPPlayer::loadFromMemory(const uint8_t* data, size_t length, uint8_t subSong) {
+    size_t binStart;
+    if (!parseSAPHeader(data, length, binStart)) return false;
+    
+    // Block data is read straight from data, RAM is only used once written
+    _routine = SAP_ROUTINE_NONE;
+    _memory.clear();
+    if (!loadBlocks(&data[binStart], length - binStart)) {
+        Serial.println("Failed to load SAP blocks");
+        _memory.clear();
+        _fileLoaded = false;
+        _playing = false;
+        return false;
+    }
+    
+    initTune(subSong);
+    return true;
+}
+
+bool SAPPlayer::loadFile(const char* filename, uint8_t subSong) {
+#if defined(ESP32) || defined(ESP8266)
+    File file = LittleFS.open(filename, "r");
+    if (!file) {
+        Serial.print("Failed to open SAP file: ");
+        Serial.println(filename);
+        return false;
+    }
+    
+    uint8_t header[SAP_MAX_HEADER];
+    size_t headerSize = file.read(header, sizeof(header));
+    
+    size_t binStart;
+    if (!parseSAPHeader(header, headerSize, binStart)) {
+        file.close();
+        return false;
+    }
+    
+    // Read each block straight into the pages it occupies
+    _routine = SAP_ROUTINE_NONE;
+    _memory.clear();
+    file.seek(binStart);
+    
+    bool ok = true;
+    uint8_t addr[4];
+    while (ok && file.read(addr, 2) == 2) {
+        uint16_t start = addr[0] | (addr[1] << 8);
+        if (start == 0xFFFF) continue;
+        if (file.read(&addr[2], 2) != 2) {
+            ok = false;
+            break;
+        }
+        uint16_t end = addr[2] | (addr[3] << 8);
+        if (end < start) {
+            ok = false;
+            break;
+        }
+        
+        uint32_t pos = start;
+        size_t remaining = (size_t)end - start + 1;
+        while (remaining) {
+            uint16_t offset = pos & 0xFF;
+            size_t chunk = PAGED_MEMORY_PAGE_SIZE - offset;
+            if (chunk > remaining) chunk = remaining;
+            
+            uint8_t* page = _memory.writePage(pos >> 8);
+            if (!page || file.read(page + offset, chunk) != chunk) {
+                ok = false;
+                break;
+            }
+            pos += chunk;
+            remaining -= chunk;
+        }
+    }
+    file.close();
+    
+    if (!ok) {
+        Serial.println("Failed to read complete SAP file");
+        _memory.clear();
+        _fileLoaded = false;
+        _playing = false;
+        return false;
+    }
+    
+    initTune(subSong);
+    return true;
+#else
+    // Non-ESP platforms not supported for file loading
+    (void)filename;
+    (void)subSong;
+    return false;
+#endif
+}
+
+// ============================================================================
+// Playback
+// ============================================================================
+
+void SAPPlayer::update() {
+    updatePlayback(_writeMode == SAP_WRITE_TIMED, true);
+}
+
+const char* SAPPlayer::getTitle() {
+    return _title;
+}
+
+const char* SAPPlayer::getAuthor() {
+    return _author;
+}
+
+const char* SAPPlayer::getDate() {
+    return _date;
+}
+
+uint8_t SAPPlayer::getNumSongs() {
+    return _numSongs;
+}
+
+uint8_t SAPPlayer::getCurrentSong() {
+    return _currentSong;
+}
+
+uint32_t SAPPlayer::getSongDuration(uint8_t song) {
+    return song < SAP_MAX_SONGS ? _durations[song] : 0;
+}
+
+bool SAPPlayer::isStereo() {
+    return _stereo;
+}
+
+void SAPPlayer::nextSong() {
+    if (_currentSong < _numSongs - 1) switchSong(_currentSong + 1);
+}
+
+void SAPPlayer::prevSong() {
+    if (_currentSong > 0) switchSong(_currentSong - 1);
+}
+
+void SAPPlayer::restart() {
+    if (_fileLoaded) switchSong(_currentSong);
+}
+
+void SAPPlayer::switchSong(uint8_t song) {
+    _currentSong = song;
+    drainWriteQueue();
+    _frameRing.clear();
+    _framesPrimed = false;
+    
+    // Init sees the memory as loaded, not as the last song left it
+    _memory.restoreSnapshot();
+    startInit();
+}
+
+void SAPPlayer::setWriteMode(SAPWriteMode mode) {
+    if (_writeMode == SAP_WRITE_COALESCED && mode != SAP_WRITE_COALESCED) {
+        flushWrites();
+    }
+    if (_writeMode == SAP_WRITE_TIMED && mode != SAP_WRITE_TIMED) {
+        drainWriteQueue();
+    }
+    _writeMode = mode;
+}
+
+SAPWriteMode SAPPlayer::getWriteMode() {
+    return _writeMode;
+}
+
+// ============================================================================
+// Play call rate
+// ============================================================================
+
+void SAPPlayer::updatePlayRate() {
+    uint32_t clock = _ntsc ? SAP_CLOCK_NTSC : SAP_CLOCK_PAL;
+    setPlayRate((uint32_t)_fastplay * SAP_CYCLES_PER_LINE, clock);
+}
+
+uint32_t SAPPlayer::getPlayPeriod() {
+    return _playPeriodUs;
+}
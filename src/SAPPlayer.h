@@ -0,0 +1,298 @@
+/**
+ * @file SAPPlayer.h
+ * @brief SAP file player for the POKEY
+ *
+ * Plays .sap (Atari 8-bit Slight Atari Player) files of TYPE B and C on
+ * the POKEY gateware, with the same 6502 core as SIDPlayer. Stores to
+ * $D200-$D2FF go to the POKEY; stereo tunes send $D210-$D21F to a second
+ * POKEY when one is given.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef SAP_PLAYER_H
+#define SAP_PLAYER_H
+
+#include <Arduino.h>
+#include "POKEY.h"
+#include "Mos6502Player.h"
+
+// Atari timing
+#define SAP_CLOCK_PAL               1773447UL   // 6502 clock in Hz
+#define SAP_CLOCK_NTSC              1789772UL
+#define SAP_CYCLES_PER_LINE         114
+#define SAP_LINES_PAL               312
+#define SAP_LINES_NTSC              262
+#define SAP_FRAME_PERIOD_US         20000       // PAL frame, default replay delay
+
+// POKEYs one player can drive (stereo tunes use two)
+#define SAP_MAX_POKEYS              2
+
+// Songs whose TIME tag is kept, see getSongDuration()
+#define SAP_MAX_SONGS               32
+
+// Text header bytes loadFile() reads before the binary part
+#define SAP_MAX_HEADER              1024
+
+// Sub-song argument that selects the DEFSONG of the header
+#define SAP_DEFAULT_SONG            0xFF
+
+// Entries in the timed write queue (power of two)
+#define SAP_WRITE_QUEUE_SIZE        256
+
+// 6502 cycle limits, see setCycleBudget() / setWatchdog()
+#define SAP_DEFAULT_CYCLE_BUDGET    (SAP_LINES_PAL * SAP_CYCLES_PER_LINE)  // Per update() call
+#define SAP_DEFAULT_WATCHDOG_CYCLES (10UL * SAP_CLOCK_PAL)                  // 10s of Atari time
+
+// Register frames buffered ahead of playback (power of two)
+#define SAP_FRAME_RING_SIZE         16
+
+/**
+ * @brief How POKEY register stores made by the 6502 reach the chip
+ */
+enum SAPWriteMode {
+    SAP_WRITE_DIRECT,       ///< Every store is sent to the bus immediately
+    SAP_WRITE_COALESCED,    ///< Stores are shadowed and flushed once per routine call
+    SAP_WRITE_TIMED         ///< Stores are timestamped and replayed at their cycle offset
+};
+
+/**
+ * @brief 6502 routine currently being executed
+ */
+enum SAPRoutine {
+    SAP_ROUTINE_NONE = MOS6502_ROUTINE_NONE,
+    SAP_ROUTINE_MUSIC,          ///< TYPE C: hand the player the music address
+    SAP_ROUTINE_INIT,
+    SAP_ROUTINE_PLAY
+};
+
+/**
+ * @brief Handlers of the 6502 I/O pages
+ */
+enum SAPIOPage {
+    SAP_IO_RAM = 0,             // Plain memory
+    SAP_IO_POKEY,               // POKEY registers ($D200-$D2FF)
+    SAP_IO_ANTIC                // ANTIC ($D400-$D4FF), VCOUNT only
+};
+
+/**
+ * @brief AUDF1..AUDCTL of every POKEY, from one play call
+ */
+struct SAPPlayerFrame {
+    uint8_t regs[SAP_MAX_POKEYS][POKEY_NUM_AUDIO_REGS];
+    uint16_t dirty[SAP_MAX_POKEYS];     // Registers stored during the call
+};
+
+/**
+ * @class SAPPlayer
+ * @brief Plays .sap files using 6502 CPU emulation
+ *
+ * Playback, timer, cycle limit and look-ahead controls come from
+ * Mos6502Player.
+ */
+class SAPPlayer : public Mos6502Player<SAPPlayer, SAPPlayerFrame, SAP_WRITE_QUEUE_SIZE,
+                                       SAP_FRAME_RING_SIZE> {
+public:
+    /**
+     * @brief Constructor
+     *
+     * Stereo tunes send their second POKEY's stores to pokey2. Without it
+     * those stores are dropped.
+     *
+     * @param pokey Pointer to POKEY instance
+     * @param pokey2 Second POKEY (optional)
+     */
+    SAPPlayer(POKEY* pokey, POKEY* pokey2 = NULL);
+    
+    /**
+     * @brief Initialize the player
+     */
+    void begin();
+    
+    /**
+     * @brief Load a SAP file from memory
+     *
+     * The tune's init routine is started here and runs from update().
+     * Blocks are mapped in place rather than copied, so data must stay
+     * valid while it is loaded.
+     *
+     * @param data Pointer to SAP file data
+     * @param length Length of data in bytes
+     * @param subSong Sub-song number to play (SAP_DEFAULT_SONG = DEFSONG)
+     * @return true if loaded successfully
+     */
+    bool loadFromMemory(const uint8_t* data, size_t length, uint8_t subSong = SAP_DEFAULT_SONG);
+    
+    /**
+     * @brief Load a SAP file from LittleFS
+     *
+     * The blocks are read straight into the pages they occupy.
+     *
+     * @param filename Path to .sap file
+     * @param subSong Sub-song number to play (SAP_DEFAULT_SONG = DEFSONG)
+     * @return true if loaded successfully
+     */
+    bool loadFile(const char* filename, uint8_t subSong = SAP_DEFAULT_SONG);
+    
+    /**
+     * @brief Get the time between play calls
+     *
+     * FASTPLAY scanlines of 114 cycles, a whole frame unless the header
+     * says otherwise.
+     *
+     * @return Play call period in microseconds
+     */
+    uint32_t getPlayPeriod();
+    
+    /**
+     * @brief Call this from main loop to process audio
+     *
+     * Runs the 6502 emulator for at most the cycle budget, then returns.
+     * A routine that does not finish in one call resumes on the next.
+     */
+    void update();
+    
+    /**
+     * @brief Get song name from the NAME tag
+     * @return Song name string
+     */
+    const char* getTitle();
+    
+    /**
+     * @brief Get author from the AUTHOR tag
+     * @return Author string
+     */
+    const char* getAuthor();
+    
+    /**
+     * @brief Get release date from the DATE tag
+     * @return Date string
+     */
+    const char* getDate();
+    
+    /**
+     * @brief Get number of sub-songs
+     * @return Number of sub-songs
+     */
+    uint8_t getNumSongs();
+    
+    /**
+     * @brief Get current sub-song
+     * @return Current sub-song number
+     */
+    uint8_t getCurrentSong();
+    
+    /**
+     * @brief Get the length of a sub-song from its TIME tag
+     * @param song Sub-song number
+     * @return Milliseconds, 0 if the header does not say
+     */
+    uint32_t getSongDuration(uint8_t song);
+    
+    /**
+     * @brief Check if the tune is written for two POKEYs
+     * @return true for STEREO tunes
+     */
+    bool isStereo();
+    
+    /**
+     * @brief Play next sub-song
+     */
+    void nextSong();
+    
+    /**
+     * @brief Play previous sub-song
+     */
+    void prevSong();
+    
+    /**
+     * @brief Play the current sub-song again from its init routine
+     * 
+     * Like nextSong() and prevSong(), the tune memory is first returned
+     * to its state right after loading, without reading the file again.
+     */
+    void restart();
+    
+    /**
+     * @brief Select how POKEY register stores are sent to the chip
+     *
+     * In SAP_WRITE_COALESCED mode stores to AUDF1..AUDCTL go into a
+     * shadow and only the registers that changed are sent when the init or
+     * play routine returns. Other POKEY registers are always written at
+     * once.
+     *
+     * @param mode SAP_WRITE_DIRECT, SAP_WRITE_COALESCED or SAP_WRITE_TIMED
+     */
+    void setWriteMode(SAPWriteMode mode);
+    
+    /**
+     * @brief Get the current write mode
+     * @return Current write mode
+     */
+    SAPWriteMode getWriteMode();
+
+private:
+    POKEY* _pokeys[SAP_MAX_POKEYS];
+    uint8_t _numChips;          // Chips passed to the constructor
+    
+    // SAP header info
+    char _type;                 // 'B' or 'C'
+    uint16_t _initAddr;
+    uint16_t _playerAddr;
+    uint16_t _musicAddr;
+    uint8_t _numSongs;
+    uint8_t _defaultSong;
+    uint8_t _currentSong;
+    bool _stereo;
+    bool _ntsc;
+    uint16_t _fastplay;         // Scanlines between play calls
+    uint32_t _durations[SAP_MAX_SONGS];     // TIME tags in ms, 0 = none
+    char _title[33];
+    char _author[33];
+    char _date[33];
+    
+    // POKEY register shadow (coalesced write mode), one per chip
+    SAPWriteMode _writeMode;
+    uint8_t _shadow[SAP_MAX_POKEYS][POKEY_NUM_AUDIO_REGS];
+    uint16_t _dirty[SAP_MAX_POKEYS];
+    
+    // The player is the bus of its CPU and the chip side of Mos6502Player
+    friend class Mos6502<SAPPlayer>;
+    friend class Mos6502Player;
+    PagedMemory& memory() { return _memory; }
+    uint8_t ioRead(uint16_t addr) { return getMem(addr); }
+    void ioWrite(uint16_t addr, uint8_t value) { setMem(addr, value); }
+    uint64_t nextEvent() const { return MOS6502_EVENT_NEVER; }
+    void serviceEvents(uint64_t now) { (void)now; }
+    bool irqLine() const { return false; }
+    bool takeNmi() { return false; }
+    bool idleUntilEvent() const { return false; }
+    
+    void startInit();
+    void startPlayCall();
+    void finishRoutine();
+    
+    uint8_t getMem(uint16_t addr);
+    void setMem(uint16_t addr, uint8_t value);
+    uint8_t readIO(uint8_t handler, uint16_t addr);
+    void writeIO(uint8_t handler, uint16_t addr, uint8_t value);
+    void writePOKEYReg(uint8_t chip, uint8_t reg, uint8_t value);
+    void sendWrite(uint8_t chip, uint8_t reg, uint8_t value) { _pokeys[chip]->writeReg(reg, value); }
+    
+    void storePOKEYReg(uint8_t chip, uint8_t reg, uint8_t value);
+    void flushWrites();
+    void pushPOKEYFrame();
+    void writeFrame(const SAPPlayerFrame& frame);
+    void resetPOKEYs();
+    
+    // Parse the text header, returns where the binary blocks start
+    bool parseSAPHeader(const uint8_t* data, size_t length, size_t& binStart);
+    void parseTag(const char* line, size_t length);
+    bool loadBlocks(const uint8_t* data, size_t length);
+    void initTune(uint8_t subSong);
+    void switchSong(uint8_t song);
+    void updatePlayRate();
+};
+
+#endif // SAP_PLAYER_H
@@ -8,89 +8,58 @@
 
 #include "SID6581.h"
 
-// MIDI note to SID frequency conversion table
-const uint16_t SIDVoice::MIDI2freq[129] = {
-    // 0-7
-    291, 291, 291, 291, 291, 291, 291, 291,
-    // 8-15
-    291, 291, 291, 291, 291, 291, 308, 326,
-    // 16-23
-    346, 366, 388, 411, 435, 461, 489, 518,
-    // 24-31
-    549, 581, 616, 652, 691, 732, 776, 822,
-    // 32-39
-    871, 923, 978, 1036, 1097, 1163, 1232, 1305,
-    // 40-47
-    1383, 1465, 1552, 1644, 1742, 1845, 1955, 2071,
-    // 48-55
-    2195, 2325, 2463, 2610, 2765, 2930, 3104, 3288,
-    // 56-63
-    3484, 3691, 3910, 4143, 4389, 4650, 4927, 5220,
-    // 64-71
-    5530, 5859, 6207, 6577, 6968, 7382, 7821, 8286,
-    // 72-79
-    8779, 9301, 9854, 10440, 11060, 11718, 12415, 13153,
-    // 80-87
-    13935, 14764, 15642, 16572, 17557, 18601, 19709, 20897,
-    // 88-95
-    22121, 23436, 24830, 26306, 27871, 29528, 31234, 33144,
-    // 96-103
-    35115, 37203, 39415, 41759, 44242, 46873, 49660, 52613,
-    // 104-111
-    55741, 59056, 62567, 65535, 65535, 65535, 65535, 65535,
-    // 112-119
-    65535, 65535, 65535, 65535, 65535, 65535, 65535, 65535,
-    // 120-127
-    65535, 65535, 65535, 65535, 65535, 65535, 65535, 65535,
-    // 128 (note off)
-    0
-};
-
 // ============================================================================
 // SIDVoice Implementation
 // ============================================================================
 
-SIDVoice::SIDVoice() : _baseAddr(0), _currentFreq(0),
-                       _controlReg(0), _attackDecay(0), _sustainRelease(0) {
+SIDVoice::SIDVoice() : _regs(NULL), _offset(0) {
 }
 
-void SIDVoice::begin(uint16_t baseAddr) {
-    _baseAddr = baseAddr;
-    reset();
+void SIDVoice::begin(ShadowRegisterFile<SID_NUM_REGS, SIDConfig::busWidth>& regs, uint8_t offset) {
+    _regs = &regs;
+    _offset = offset;
+}
+
+uint8_t SIDVoice::readShadow(uint8_t offset) {
+    return _regs->get(_offset + offset);
 }
 
 void SIDVoice::writeReg(uint8_t offset, uint8_t value) {
-    wishboneWrite16(_baseAddr + offset, value);
+    _regs->write(_offset + offset, value);
 }
 
-void SIDVoice::updateControlReg() {
-    writeReg(SID_VOICE_CONTROL, _controlReg);
+void SIDVoice::writeRegs(uint8_t offset, const uint8_t* values, uint8_t count) {
+    _regs->writeRegs(_offset + offset, values, count);
 }
 
-void SIDVoice::updateADSR() {
-    writeReg(SID_VOICE_ATTACK_DECAY, _attackDecay);
-    writeReg(SID_VOICE_SUSTAIN_RELEASE, _sustainRelease);
+void SIDVoice::setControlBit(uint8_t bit, bool active) {
+    uint8_t control = readShadow(SID_VOICE_CONTROL);
+    if (active) {
+        control |= bit;
+    } else {
+        control &= ~bit;
+    }
+    writeReg(SID_VOICE_CONTROL, control);
 }
 
 void SIDVoice::setNote(uint8_t note, bool active) {
     if (note > 128) note = 128;
-    setFreq(MIDI2freq[note]);
+    setFreq(MIDI2freq::notes[note]);
     setGate(active);
 }
 
 void SIDVoice::setFreq(uint16_t freq) {
-    _currentFreq = freq;
-    writeReg(SID_VOICE_FREQ_LO, freq & 0xFF);
-    writeReg(SID_VOICE_FREQ_HI, (freq >> 8) & 0xFF);
+    uint8_t regs[2] = { (uint8_t)(freq & 0xFF), (uint8_t)((freq >> 8) & 0xFF) };
+    writeRegs(SID_VOICE_FREQ_LO, regs, 2);
 }
 
 uint16_t SIDVoice::getCurrentFreq() {
-    return _currentFreq;
+    return readShadow(SID_VOICE_FREQ_LO) | ((uint16_t)readShadow(SID_VOICE_FREQ_HI) << 8);
 }
 
 void SIDVoice::setPulseWidth(uint16_t pw) {
-    writeReg(SID_VOICE_PW_LO, pw & 0xFF);
-    writeReg(SID_VOICE_PW_HI, (pw >> 8) & 0x0F);
+    uint8_t regs[2] = { (uint8_t)(pw & 0xFF), (uint8_t)((pw >> 8) & 0x0F) };
+    writeRegs(SID_VOICE_PW_LO, regs, 2);
 }
 
 void SIDVoice::setPWLo(uint8_t pw) {
@@ -102,202 +71,301 @@ void SIDVoice::setPWHi(uint8_t pw) {
 }
 
 void SIDVoice::setGate(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_GATE;
-    } else {
-        _controlReg &= ~SID_CTRL_GATE;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_GATE, active);
 }
 
 void SIDVoice::setSync(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_SYNC;
-    } else {
-        _controlReg &= ~SID_CTRL_SYNC;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_SYNC, active);
 }
 
 void SIDVoice::setRingMod(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_RING_MOD;
-    } else {
-        _controlReg &= ~SID_CTRL_RING_MOD;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_RING_MOD, active);
 }
 
 void SIDVoice::setTest(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_TEST;
-    } else {
-        _controlReg &= ~SID_CTRL_TEST;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_TEST, active);
 }
 
 void SIDVoice::setTriangle(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_TRIANGLE;
-    } else {
-        _controlReg &= ~SID_CTRL_TRIANGLE;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_TRIANGLE, active);
 }
 
 void SIDVoice::setSawtooth(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_SAWTOOTH;
-    } else {
-        _controlReg &= ~SID_CTRL_SAWTOOTH;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_SAWTOOTH, active);
 }
 
 void SIDVoice::setSquare(bool active, uint16_t pwm) {
-    if (active) {
-        _controlReg |= SID_CTRL_SQUARE;
-        setPulseWidth(pwm);
-    } else {
-        _controlReg &= ~SID_CTRL_SQUARE;
-    }
-    updateControlReg();
+    if (active) setPulseWidth(pwm);
+    setControlBit(SID_CTRL_SQUARE, active);
 }
 
 void SIDVoice::setNoise(bool active) {
-    if (active) {
-        _controlReg |= SID_CTRL_NOISE;
-    } else {
-        _controlReg &= ~SID_CTRL_NOISE;
-    }
-    updateControlReg();
+    setControlBit(SID_CTRL_NOISE, active);
 }
 
 void SIDVoice::setEnvelopeAttack(uint8_t rate) {
-    _attackDecay = (_attackDecay & 0x0F) | ((rate & 0x0F) << 4);
-    updateADSR();
+    uint8_t ad = readShadow(SID_VOICE_ATTACK_DECAY);
+    writeReg(SID_VOICE_ATTACK_DECAY, (ad & 0x0F) | ((rate & 0x0F) << 4));
 }
 
 void SIDVoice::setEnvelopeDecay(uint8_t rate) {
-    _attackDecay = (_attackDecay & 0xF0) | (rate & 0x0F);
-    updateADSR();
+    uint8_t ad = readShadow(SID_VOICE_ATTACK_DECAY);
+    writeReg(SID_VOICE_ATTACK_DECAY, (ad & 0xF0) | (rate & 0x0F));
 }
 
 void SIDVoice::setEnvelopeSustain(uint8_t level) {
-    _sustainRelease = (_sustainRelease & 0x0F) | ((level & 0x0F) << 4);
-    updateADSR();
+    uint8_t sr = readShadow(SID_VOICE_SUSTAIN_RELEASE);
+    writeReg(SID_VOICE_SUSTAIN_RELEASE, (sr & 0x0F) | ((level & 0x0F) << 4));
 }
 
 void SIDVoice::setEnvelopeRelease(uint8_t rate) {
-    _sustainRelease = (_sustainRelease & 0xF0) | (rate & 0x0F);
-    updateADSR();
+    uint8_t sr = readShadow(SID_VOICE_SUSTAIN_RELEASE);
+    writeReg(SID_VOICE_SUSTAIN_RELEASE, (sr & 0xF0) | (rate & 0x0F));
 }
 
 void SIDVoice::setInstrument(const char* name, uint8_t attack, uint8_t decay,
                              uint8_t sustain, uint8_t release,
                              bool noise, bool square, bool sawtooth, bool triangle,
                              uint16_t pwm) {
-    setEnvelopeAttack(attack);
-    setEnvelopeDecay(decay);
-    setEnvelopeSustain(sustain);
-    setEnvelopeRelease(release);
+    uint8_t adsr[2] = {
+        (uint8_t)(((attack & 0x0F) << 4) | (decay & 0x0F)),
+        (uint8_t)(((sustain & 0x0F) << 4) | (release & 0x0F))
+    };
+    writeRegs(SID_VOICE_ATTACK_DECAY, adsr, 2);
     
     // Clear all waveform bits first
-    _controlReg &= ~(SID_CTRL_NOISE | SID_CTRL_SQUARE | SID_CTRL_SAWTOOTH | SID_CTRL_TRIANGLE);
+    uint8_t control = readShadow(SID_VOICE_CONTROL);
+    control &= ~(SID_CTRL_NOISE | SID_CTRL_SQUARE | SID_CTRL_SAWTOOTH | SID_CTRL_TRIANGLE);
     
-    if (noise) _controlReg |= SID_CTRL_NOISE;
+    if (noise) control |= SID_CTRL_NOISE;
     if (square) {
-        _controlReg |= SID_CTRL_SQUARE;
+        control |= SID_CTRL_SQUARE;
         setPulseWidth(pwm);
     }
-    if (sawtooth) _controlReg |= SID_CTRL_SAWTOOTH;
-    if (triangle) _controlReg |= SID_CTRL_TRIANGLE;
+    if (sawtooth) control |= SID_CTRL_SAWTOOTH;
+    if (triangle) control |= SID_CTRL_TRIANGLE;
     
-    updateControlReg();
+    writeReg(SID_VOICE_CONTROL, control);
 }
 
 void SIDVoice::reset() {
-    _currentFreq = 0;
-    _controlReg = 0;
-    _attackDecay = 0;
-    _sustainRelease = 0;
+    static const uint8_t zeros[7] = { 0 };
     
-    writeReg(SID_VOICE_FREQ_LO, 0);
-    writeReg(SID_VOICE_FREQ_HI, 0);
-    writeReg(SID_VOICE_PW_LO, 0);
-    writeReg(SID_VOICE_PW_HI, 0);
-    writeReg(SID_VOICE_CONTROL, 0);
-    writeReg(SID_VOICE_ATTACK_DECAY, 0);
-    writeReg(SID_VOICE_SUSTAIN_RELEASE, 0);
+    writeRegs(SID_VOICE_FREQ_LO, zeros, sizeof(zeros));
 }
 
 // ============================================================================
 // SID6581 Implementation
 // ============================================================================
 
-SID6581::SID6581(uint16_t baseAddr) 
-    : _baseAddr(baseAddr), _modeVolume(0), _resFilt(0) {
+// Order in which writeFrame() sends registers: everything that shapes
+// a voice goes out before its control register so a new gate sees the new
+// frequency and envelope, followed by the filter and volume registers.
+static const uint8_t sidFlushOrder[25] = {
+    0x00, 0x01, 0x02, 0x03, 0x05, 0x06, 0x04,   // Voice 1
+    0x07, 0x08, 0x09, 0x0A, 0x0C, 0x0D, 0x0B,   // Voice 2
+    0x0E, 0x0F, 0x10, 0x11, 0x13, 0x14, 0x12,   // Voice 3
+    0x15, 0x16, 0x17, 0x18                      // Filter / volume
+};
+
+SID6581::SID6581(uint16_t baseAddr) : _baseAddr(baseAddr), _bankStage(false) {
+    _regs.begin(baseAddr);
 }
 
 void SID6581::begin() {
-    V1.begin(_baseAddr + SID_VOICE1_BASE);
-    V2.begin(_baseAddr + SID_VOICE2_BASE);
-    V3.begin(_baseAddr + SID_VOICE3_BASE);
+    V1.begin(_regs, SID_VOICE1_BASE);
+    V2.begin(_regs, SID_VOICE2_BASE);
+    V3.begin(_regs, SID_VOICE3_BASE);
     reset();
 }
 
 void SID6581::writeReg(uint8_t addr, uint8_t data) {
-    wishboneWrite16(_baseAddr + addr, data);
+    if (addr < SID_NUM_REGS) {
+        _regs.write(addr, data);
+    } else {
+        audioBusWrite16(_baseAddr + addr, data);
+    }
+}
+
+void SID6581::writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count) {
+    if (startAddr + count <= SID_NUM_REGS) {
+        _regs.writeRegs(startAddr, data, count);
+    } else {
+        audioBusBurstWrite16(_baseAddr + startAddr, data, count);
+    }
 }
 
 uint8_t SID6581::readReg(uint8_t addr) {
-    return wishboneRead16(_baseAddr + addr);
+    return audioBusRead16(_baseAddr + addr);
+}
+
+uint8_t SID6581::getReg(uint8_t addr) {
+    return _regs.get(addr);
+}
+
+uint32_t SID6581::getBusWriteCount() {
+    return _regs.sentCount();
+}
+
+void SID6581::setCommitMode(ShadowCommitMode mode) {
+    _regs.setMode(mode);
+}
+
+void SID6581::commit() {
+    _regs.commit();
+}
+
+void SID6581::enableRegisterBank(bool enable) {
+    _bankStage = enable;
+    writeReg(SID_BANK_CTRL, enable ? SID_BANK_STAGE : 0);
+}
+
+void SID6581::commitBank(bool now) {
+    _regs.commit();
+    
+    uint8_t ctrl = SID_BANK_COMMIT;
+    if (_bankStage) ctrl |= SID_BANK_STAGE;
+    if (now) ctrl |= SID_BANK_NOW;
+    writeReg(SID_BANK_CTRL, ctrl);
+}
+
+bool SID6581::isBankPending() {
+    return (readReg(SID_FIFO_STATUS) & SID_FIFO_STATUS_PENDING) != 0;
 }
 
 void SID6581::setVolume(uint8_t volume) {
-    _modeVolume = (_modeVolume & 0xF0) | (volume & 0x0F);
-    writeReg(SID_FILTER_MODE_VOL, _modeVolume);
+    uint8_t modeVolume = _regs.get(SID_FILTER_MODE_VOL);
+    writeReg(SID_FILTER_MODE_VOL, (modeVolume & 0xF0) | (volume & 0x0F));
+}
+
+uint8_t SID6581::getVolume() {
+    return _regs.get(SID_FILTER_MODE_VOL) & 0x0F;
 }
 
 void SID6581::setFilterCutoff(uint16_t freq) {
-    writeReg(SID_FILTER_FC_LO, freq & 0x07);  // Only 3 LSB used
-    writeReg(SID_FILTER_FC_HI, (freq >> 3) & 0xFF);
+    uint8_t regs[2] = {
+        (uint8_t)(freq & 0x07),         // Only 3 LSB used
+        (uint8_t)((freq >> 3) & 0xFF)
+    };
+    writeRegs(SID_FILTER_FC_LO, regs, 2);
 }
 
 void SID6581::setFilterResonance(uint8_t resonance) {
-    _resFilt = (_resFilt & 0x0F) | ((resonance & 0x0F) << 4);
-    writeReg(SID_FILTER_RES_FILT, _resFilt);
+    uint8_t resFilt = _regs.get(SID_FILTER_RES_FILT);
+    writeReg(SID_FILTER_RES_FILT, (resFilt & 0x0F) | ((resonance & 0x0F) << 4));
 }
 
 void SID6581::setFilterEnable(uint8_t voice, bool enable) {
     uint8_t bit = (1 << (voice - 1)) & 0x07;
+    uint8_t resFilt = _regs.get(SID_FILTER_RES_FILT);
     if (enable) {
-        _resFilt |= bit;
+        resFilt |= bit;
     } else {
-        _resFilt &= ~bit;
+        resFilt &= ~bit;
     }
-    writeReg(SID_FILTER_RES_FILT, _resFilt);
+    writeReg(SID_FILTER_RES_FILT, resFilt);
 }
 
 void SID6581::setFilterMode(bool lowpass, bool bandpass, bool highpass) {
-    _modeVolume &= 0x0F;  // Keep volume
-    if (lowpass)  _modeVolume |= 0x10;
-    if (bandpass) _modeVolume |= 0x20;
-    if (highpass) _modeVolume |= 0x40;
-    writeReg(SID_FILTER_MODE_VOL, _modeVolume);
+    uint8_t modeVolume = _regs.get(SID_FILTER_MODE_VOL) & 0x0F;  // Keep volume
+    if (lowpass)  modeVolume |= 0x10;
+    if (bandpass) modeVolume |= 0x20;
+    if (highpass) modeVolume |= 0x40;
+    writeReg(SID_FILTER_MODE_VOL, modeVolume);
 }
 
-void SID6581::reset() {
-    V1.reset();
-    V2.reset();
-    V3.reset();
+void SID6581::enableWriteQueue(bool enable, bool clear) {
+    uint8_t ctrl = 0;
+    if (enable) ctrl |= SID_FIFO_CTRL_ENABLE;
+    if (clear)  ctrl |= SID_FIFO_CTRL_CLEAR;
+    writeReg(SID_FIFO_CTRL, ctrl);
+}
+
+void SID6581::queueWrite(uint16_t delay, uint8_t addr, uint8_t data) {
+    if (addr >= SID_NUM_REGS) return;
+    
+    // The staged delay returns to zero after every entry, so it only has
+    // to be sent for entries that actually wait. An entry that neither
+    // waits nor changes the register can be left out.
+    if (delay) {
+        uint8_t regs[2] = { (uint8_t)(delay & 0xFF), (uint8_t)(delay >> 8) };
+        writeRegs(SID_FIFO_DELAY_LO, regs, 2);
+    } else if (!(_regs.dirtyMask() & ((uint32_t)1 << addr)) && _regs.get(addr) == data) {
+        return;
+    }
+    audioBusWrite16(_baseAddr + addr, data);
+    _regs.record(addr, data);
+}
+
+uint16_t SID6581::getWriteQueueLevel() {
+    uint16_t level = readReg(SID_FIFO_LEVEL_LO);
+    level |= (uint16_t)readReg(SID_FIFO_LEVEL_HI) << 8;
+    return level;
+}
+
+uint8_t SID6581::getWriteQueueStatus() {
+    return readReg(SID_FIFO_STATUS);
+}
+
+void SID6581::setFrameTick(uint32_t cycles, bool restart) {
+    if (!cycles) {
+        writeReg(SID_TICK_CTRL, 0);
+        return;
+    }
     
-    _modeVolume = 0;
-    _resFilt = 0;
+    uint32_t period = cycles - 1;
+    if (period > 0xFFFF) period = 0xFFFF;
+    uint8_t regs[3] = {
+        (uint8_t)(period & 0xFF),
+        (uint8_t)(period >> 8),
+        (uint8_t)(SID_TICK_CTRL_ENABLE | (restart ? SID_TICK_CTRL_RESTART : 0))
+    };
+    writeRegs(SID_TICK_PERIOD_LO, regs, 3);
+}
+
+void SID6581::writeFrame(const uint8_t* regs, uint32_t dirty, uint8_t gateOff) {
+    // Consecutive registers are merged into bursts by the bus layer
+    AudioBusWrite writes[SID_FRAME_MAX_WRITES];
+    uint8_t count = frameWrites(regs, dirty, gateOff, writes);
+    audioBusWriteBatch16(writes, count);
+}
+
+uint8_t SID6581::frameWrites(const uint8_t* regs, uint32_t dirty, uint8_t gateOff,
+                             AudioBusWrite* out) {
+    uint8_t count = 0;
     
-    writeReg(SID_FILTER_FC_LO, 0);
-    writeReg(SID_FILTER_FC_HI, 0);
-    writeReg(SID_FILTER_RES_FILT, 0);
-    writeReg(SID_FILTER_MODE_VOL, 0);
+    for (uint8_t i = 0; i < sizeof(sidFlushOrder); i++) {
+        uint8_t reg = sidFlushOrder[i];
+        if (!(dirty & ((uint32_t)1 << reg))) continue;
+        
+        uint8_t value = regs[reg];
+        bool pending = _regs.dirtyMask() & ((uint32_t)1 << reg);
+        
+        if ((reg % 7) == SID_VOICE_CONTROL) {
+            // Gate was dropped and raised again since the last flush: send
+            // the release first so the envelope restarts on the chip
+            bool released = gateOff & (1 << (reg / 7));
+            if (released && (value & SID_CTRL_GATE) && (_regs.sent(reg) & SID_CTRL_GATE)) {
+                out[count].addr = _baseAddr + reg;
+                out[count].value = value & ~SID_CTRL_GATE;
+                count++;
+                _regs.record(reg, value & ~SID_CTRL_GATE);
+                pending = false;
+            }
+        }
+        
+        if (!pending && value == _regs.sent(reg)) continue;
+        _regs.record(reg, value);
+        
+        out[count].addr = _baseAddr + reg;
+        out[count].value = value;
+        count++;
+    }
+    
+    return count;
+}
+
+void SID6581::reset() {
+    // Voices and filter are contiguous: clear all of them in one burst
+    _regs.reset();
 }
@@ -21,6 +21,9 @@
 
 #include <Arduino.h>
 #include "WishboneSPI.h"
+#include "AudioBus.h"
+#include "ShadowRegisterFile.h"
+#include "ChipConfig.h"
 
 // SID Register offsets (relative to voice base)
 #define SID_VOICE_FREQ_LO       0x00
@@ -42,6 +45,52 @@
 #define SID_FILTER_RES_FILT     0x17
 #define SID_FILTER_MODE_VOL     0x18
 
+// Number of writable SID registers
+#define SID_NUM_REGS            0x19
+
+// Most bus writes one frame can take: every register plus a gate release
+// per voice
+#define SID_FRAME_MAX_WRITES    (SID_NUM_REGS + 3)
+
+// Timed write FIFO registers (gateware extension, offset from SID base)
+#define SID_FIFO_DELAY_LO       0x1D    // W: delay of the next entry, low byte
+#define SID_FIFO_DELAY_HI       0x1E    // W: delay of the next entry, high byte
+#define SID_FIFO_CTRL           0x1F    // W: FIFO control
+#define SID_FIFO_LEVEL_LO       0x1D    // R: FIFO fill level, low byte
+#define SID_FIFO_LEVEL_HI       0x1E    // R: FIFO fill level, high byte
+#define SID_FIFO_STATUS         0x1F    // R: FIFO status
+
+// FIFO control / status bits
+#define SID_FIFO_CTRL_ENABLE    0x01    // Queue writes to 0x00-0x18
+#define SID_FIFO_CTRL_CLEAR     0x02    // Discard all queued entries
+#define SID_FIFO_STATUS_ENABLED 0x01
+#define SID_FIFO_STATUS_EMPTY   0x02
+#define SID_FIFO_STATUS_FULL    0x04
+#define SID_FIFO_STATUS_TICK    0x08    // Frame tick enabled
+#define SID_FIFO_STATUS_IRQ     0x10    // frame_irq is high
+#define SID_FIFO_STATUS_STAGING 0x20    // Register bank staging enabled
+#define SID_FIFO_STATUS_PENDING 0x40    // Bank commit waiting or being copied
+
+// Frame tick registers (gateware extension, write only)
+#define SID_TICK_PERIOD_LO      0x19    // SID cycles per tick minus one, low byte
+#define SID_TICK_PERIOD_HI      0x1A    // High byte
+#define SID_TICK_CTRL           0x1B    // Tick control
+
+// Tick control bits
+#define SID_TICK_CTRL_ENABLE    0x01    // Raise frame_irq once per period
+#define SID_TICK_CTRL_RESTART   0x02    // Start a new period now
+
+// Register bank control (gateware extension, write only)
+#define SID_BANK_CTRL           0x1C
+
+// Bank control bits
+#define SID_BANK_STAGE          0x01    // Stage writes to 0x00-0x18
+#define SID_BANK_COMMIT         0x02    // Commit the staged writes
+#define SID_BANK_NOW            0x04    // Apply the commit without waiting for the tick
+
+// Default FIFO depth of wb_sid6581 (FIFO_DEPTH_LOG2 = 8)
+#define SID_FIFO_DEPTH          256
+
 // SID Control register bits
 #define SID_CTRL_GATE           0x01
 #define SID_CTRL_SYNC           0x02
@@ -52,6 +101,15 @@
 #define SID_CTRL_SQUARE         0x40
 #define SID_CTRL_NOISE          0x80
 
+/**
+ * @brief One frame of SID register state, e.g. the result of one play call
+ */
+struct SIDFrame {
+    uint8_t regs[SID_NUM_REGS];
+    uint8_t gateOff;            // Voices whose gate was cleared during the call
+    uint32_t dirty;             // Registers stored during the call
+};
+
 /**
  * @class SIDVoice
  * @brief Represents a single SID voice with its associated registers
@@ -61,10 +119,11 @@ public:
     SIDVoice();
     
     /**
-     * @brief Initialize the voice with base address
-     * @param baseAddr Base address of this voice (SID base + voice offset)
+     * @brief Attach the voice to its chip's registers
+     * @param regs Register shadow of the chip
+     * @param offset Offset of the voice's first register
      */
-    void begin(uint16_t baseAddr);
+    void begin(ShadowRegisterFile<SID_NUM_REGS, SIDConfig::busWidth>& regs, uint8_t offset);
     
     /**
      * @brief Set frequency from MIDI note number
@@ -190,18 +249,18 @@ public:
     void reset();
     
 private:
-    uint16_t _baseAddr;
-    uint16_t _currentFreq;
-    uint8_t _controlReg;
-    uint8_t _attackDecay;
-    uint8_t _sustainRelease;
+    friend class SID6581;
+    
+    ShadowRegisterFile<SID_NUM_REGS, SIDConfig::busWidth>* _regs;
+    uint8_t _offset;
     
+    uint8_t readShadow(uint8_t offset);
     void writeReg(uint8_t offset, uint8_t value);
-    void updateControlReg();
-    void updateADSR();
+    void writeRegs(uint8_t offset, const uint8_t* values, uint8_t count);
+    void setControlBit(uint8_t bit, bool active);
     
-    // MIDI to SID frequency conversion table
-    static const uint16_t MIDI2freq[129];
+    // MIDI note to SID frequency, generated for SID_CLOCK_HZ
+    typedef PitchTable<SIDPitch<SIDConfig::clock> > MIDI2freq;
 };
 
 /**
@@ -218,7 +277,7 @@ public:
      * @brief Constructor
      * @param baseAddr Base address for SID chip (default 0x30)
      */
-    SID6581(uint16_t baseAddr = 0x30);
+    SID6581(uint16_t baseAddr = SIDConfig::baseAddr);
     
     /**
      * @brief Initialize the SID chip
@@ -227,11 +286,23 @@ public:
     
     /**
      * @brief Write directly to a SID register
+     * 
+     * Writes to 0x00-0x18 go through the register shadow and are dropped
+     * when they would not change the register.
+     * 
      * @param addr Register offset
      * @param data Data to write
      */
     void writeReg(uint8_t addr, uint8_t data);
     
+    /**
+     * @brief Write a block of consecutive SID registers in one burst
+     * @param startAddr Offset of the first register
+     * @param data Register values
+     * @param count Number of registers to write
+     */
+    void writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count);
+    
     /**
      * @brief Read from a SID register
      * @param addr Register offset
@@ -239,12 +310,76 @@ public:
      */
     uint8_t readReg(uint8_t addr);
     
+    /**
+     * @brief Get the last value written to a register, without a bus access
+     * @param addr Register offset (0x00-0x18)
+     * @return Register value
+     */
+    uint8_t getReg(uint8_t addr);
+    
+    /**
+     * @brief Get the number of shadowed register writes sent to the chip
+     * @return Register values put on the bus since the object was created,
+     *         not counting unchanged writes that were dropped
+     */
+    uint32_t getBusWriteCount();
+    
+    /**
+     * @brief Send writes at once or hold them until commit()
+     * @param mode SHADOW_WRITE_THROUGH (default) or SHADOW_DEFERRED
+     */
+    void setCommitMode(ShadowCommitMode mode);
+    
+    /**
+     * @brief Send the registers changed since the last commit
+     */
+    void commit();
+    
+    /**
+     * @brief Stage register writes in the gateware bank
+     * 
+     * While enabled, writes to 0x00-0x18 are collected by the slave and
+     * only reach the chip on commitBank(), all in the same instant.
+     * 
+     * @param enable True to stage writes, false to apply them as they arrive
+     */
+    void enableRegisterBank(bool enable);
+    
+    /**
+     * @brief Apply the staged writes together
+     * 
+     * Pending shadow writes (SHADOW_DEFERRED) are sent first. The bank is
+     * applied on the next frame tick of this slave, or at once when now is set. Writes
+     * made before it is applied are staged for the next commit.
+     * 
+     * @param now True to apply without waiting for the frame tick
+     */
+    void commitBank(bool now = false);
+    
+    /**
+     * @brief Check whether a committed bank still waits for its tick
+     * @return true while the commit is pending
+     */
+    bool isBankPending();
+    
+    /**
+     * @brief Check whether writes are being staged
+     * @return true after enableRegisterBank(true)
+     */
+    bool isRegisterBankEnabled() const { return _bankStage; }
+    
     /**
      * @brief Set master volume
      * @param volume Volume level (0-15)
      */
     void setVolume(uint8_t volume);
     
+    /**
+     * @brief Get master volume
+     * @return Volume level (0-15)
+     */
+    uint8_t getVolume();
+    
     /**
      * @brief Set filter cutoff frequency
      * @param freq 11-bit cutoff frequency
@@ -272,6 +407,79 @@ public:
      */
     void setFilterMode(bool lowpass, bool bandpass, bool highpass);
     
+    /**
+     * @brief Enable or disable the gateware timed write FIFO
+     * 
+     * While enabled, every register write (including the ones made by the
+     * voice setters) is queued and applied by the FPGA in order. Pending
+     * entries keep draining after the queue is disabled.
+     * 
+     * @param enable True to queue writes
+     * @param clear True to discard entries that are still pending
+     */
+    void enableWriteQueue(bool enable, bool clear = false);
+    
+    /**
+     * @brief Queue a register write in the gateware FIFO
+     * @param delay SID cycles to wait after the previous entry was applied
+     * @param addr Register offset (0x00-0x18)
+     * @param data Data to write
+     */
+    void queueWrite(uint16_t delay, uint8_t addr, uint8_t data);
+    
+    /**
+     * @brief Get the number of entries waiting in the gateware FIFO
+     * @return FIFO fill level
+     */
+    uint16_t getWriteQueueLevel();
+    
+    /**
+     * @brief Get the gateware FIFO status
+     * @return SID_FIFO_STATUS_* bits
+     */
+    uint8_t getWriteQueueStatus();
+    
+    /**
+     * @brief Program the gateware frame tick
+     * 
+     * The slave pulses its frame_irq output once every period, counted
+     * on the SID clock (SID_CLOCK_HZ), not in C64 CPU cycles. Wire it to a
+     * GPIO with a rising edge interrupt.
+     * A new period applies from the next tick, unless restart is set.
+     * 
+     * @param cycles SID cycles per tick (1-65536), 0 to stop the tick
+     * @param restart True to start counting the period now
+     */
+    void setFrameTick(uint32_t cycles, bool restart = false);
+    
+    /**
+     * @brief Write the registers of a frame that differ from the chip
+     * 
+     * Voice registers go out before their control register, and a gate
+     * that was released and raised again within the frame is sent as a
+     * release followed by the new value.
+     * 
+     * @param regs Register values (SID_NUM_REGS bytes)
+     * @param dirty Bit mask of the registers to consider
+     * @param gateOff Bit mask of voices whose gate was cleared in the frame
+     */
+    void writeFrame(const uint8_t* regs, uint32_t dirty, uint8_t gateOff);
+    
+    /**
+     * @brief Collect the writes of a frame instead of sending them
+     * 
+     * Same order and rules as writeFrame(), so the frames of several
+     * chips can go out together with audioBusWriteBatch16().
+     * The register shadow is updated as if the writes had been sent.
+     * 
+     * @param regs Register values (SID_NUM_REGS bytes)
+     * @param dirty Bit mask of the registers to consider
+     * @param gateOff Bit mask of voices whose gate was cleared in the frame
+     * @param out Receives at most SID_FRAME_MAX_WRITES writes
+     * @return Number of writes added
+     */
+    uint8_t frameWrites(const uint8_t* regs, uint32_t dirty, uint8_t gateOff, AudioBusWrite* out);
+    
     /**
      * @brief Reset the entire SID chip
      */
@@ -279,8 +487,8 @@ public:
     
 private:
     uint16_t _baseAddr;
-    uint8_t _modeVolume;
-    uint8_t _resFilt;
+    ShadowRegisterFile<SID_NUM_REGS, SIDConfig::busWidth> _regs;
+    bool _bankStage;            // Writes go to the gateware bank
 };
 
 #endif // SID6581_H
@@ -0,0 +1,356 @@
+/**
+ * @file SIDDump.cpp
+ * @brief SID register dump transcoder and player implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "SIDDump.h"
+#include "SIDPlayer.h"
+#include <string.h>
+
+static const char sidDumpMagic[4] = { 'S', 'I', 'D', 'D' };
+
+// Control register of each voice, indexed by the record's retrigger bits
+static const uint8_t voiceControl[3] = {
+    SID_VOICE1_BASE + SID_VOICE_CONTROL,
+    SID_VOICE2_BASE + SID_VOICE_CONTROL,
+    SID_VOICE3_BASE + SID_VOICE_CONTROL
+};
+
+// ============================================================================
+// SIDDumpEncoder Implementation
+// ============================================================================
+
+SIDDumpEncoder::SIDDumpEncoder() {
+    reset();
+}
+
+void SIDDumpEncoder::reset() {
+    memset(_regs, 0, sizeof(_regs));
+    _idleFrames = 0;
+}
+
+uint8_t SIDDumpEncoder::encode(const SIDFrame& frame, uint8_t* out) {
+    uint32_t mask = 0;
+    uint8_t retrigger = 0;
+
+    for (uint8_t reg = 0; reg < SID_NUM_REGS; reg++) {
+        if (frame.regs[reg] != _regs[reg]) mask |= (uint32_t)1 << reg;
+    }
+
+    // A release + retrigger leaves the control value unchanged, so it has
+    // to be flagged separately to produce the gate edge on playback
+    for (uint8_t v = 0; v < 3; v++) {
+        uint8_t ctrl = voiceControl[v];
+        if ((frame.gateOff & (1 << v)) && (frame.dirty & ((uint32_t)1 << ctrl)) &&
+            (frame.regs[ctrl] & SID_CTRL_GATE) && (_regs[ctrl] & SID_CTRL_GATE)) {
+            retrigger |= 1 << v;
+        }
+    }
+
+    if (!mask && !retrigger) {
+        _idleFrames++;
+        if (_idleFrames < SID_DUMP_MAX_IDLE_RUN) return 0;
+        return finish(out);
+    }
+
+    uint8_t n = finish(out);
+    uint8_t tag = n++;
+    out[tag] = 0x80 | (retrigger << 4);
+
+    for (uint8_t i = 0; i < 4; i++) {
+        uint8_t bits = (mask >> (i * 8)) & 0xFF;
+        if (bits) {
+            out[tag] |= 1 << i;
+            out[n++] = bits;
+        }
+    }
+
+    for (uint8_t reg = 0; reg < SID_NUM_REGS; reg++) {
+        if (mask & ((uint32_t)1 << reg)) {
+            out[n++] = frame.regs[reg];
+            _regs[reg] = frame.regs[reg];
+        }
+    }
+
+    return n;
+}
+
+uint8_t SIDDumpEncoder::finish(uint8_t* out) {
+    if (!_idleFrames) return 0;
+
+    out[0] = _idleFrames - 1;
+    _idleFrames = 0;
+    return 1;
+}
+
+// ============================================================================
+// SIDTranscoder Implementation
+// ============================================================================
+
+static void putString(uint8_t* dst, const char* src) {
+    size_t len = strlen(src);
+    if (len > 32) len = 32;
+    memset(dst, 0, 32);
+    memcpy(dst, src, len);
+}
+
+uint32_t SIDTranscoder::transcode(SIDPlayer& player, Print& out, uint32_t frames) {
+    // The first frame completes the init routine, which may set the rate
+    SIDFrame frame;
+    bool rendered = frames && player.renderFrame(frame);
+    uint32_t period = player.getPlayPeriod();
+    uint32_t rate = (1000000UL + period / 2) / period;
+    if (period > 0xFFFF) period = 0;
+
+    uint8_t header[SID_DUMP_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, sidDumpMagic, 4);
+    header[4] = SID_DUMP_VERSION;
+    header[5] = rate > 255 ? 255 : rate;
+    header[6] = period & 0xFF;
+    header[7] = (period >> 8) & 0xFF;
+    header[8] = frames & 0xFF;
+    header[9] = (frames >> 8) & 0xFF;
+    header[10] = (frames >> 16) & 0xFF;
+    header[11] = (frames >> 24) & 0xFF;
+    putString(&header[0x0C], player.getTitle());
+    putString(&header[0x2C], player.getAuthor());
+    putString(&header[0x4C], player.getCopyright());
+    out.write(header, sizeof(header));
+
+    SIDDumpEncoder encoder;
+    uint8_t record[2 * SID_DUMP_MAX_RECORD];
+    uint32_t written = 0;
+
+    while (rendered) {
+        uint8_t n = encoder.encode(frame, record);
+        if (n) out.write(record, n);
+        if (++written >= frames) break;
+        rendered = player.renderFrame(frame);
+    }
+
+    uint8_t n = encoder.finish(record);
+    if (n) out.write(record, n);
+
+    return written;
+}
+
+// ============================================================================
+// SIDDumpPlayer Implementation
+// ============================================================================
+
+SIDDumpPlayer::SIDDumpPlayer(SID6581* sid) :
+    _sid(sid), _playing(false), _loaded(false), _timerTick(false),
+    _data(NULL), _length(0), _pos(0), _numFrames(0), _framePeriod(SID_FRAME_PERIOD_US),
+    _position(0), _idleFrames(0)
+{
+    memset(_regs, 0, sizeof(_regs));
+    memset(_title, 0, sizeof(_title));
+    memset(_author, 0, sizeof(_author));
+    memset(_copyright, 0, sizeof(_copyright));
+}
+
+void SIDDumpPlayer::begin() {
+    _sid->begin();
+    _sid->reset();
+}
+
+bool SIDDumpPlayer::parseHeader(const uint8_t* header) {
+    if (memcmp(header, sidDumpMagic, 4) != 0) return false;
+    if (header[4] != SID_DUMP_VERSION) return false;
+
+    _numFrames = (uint32_t)header[8] | ((uint32_t)header[9] << 8) |
+                 ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24);
+
+    _framePeriod = header[6] | (header[7] << 8);
+    if (!_framePeriod) {
+        _framePeriod = header[5] ? 1000000UL / header[5] : SID_FRAME_PERIOD_US;
+    }
+
+    memcpy(_title, &header[0x0C], 32);
+    _title[32] = '\0';
+    memcpy(_author, &header[0x2C], 32);
+    _author[32] = '\0';
+    memcpy(_copyright, &header[0x4C], 32);
+    _copyright[32] = '\0';
+
+    return true;
+}
+
+bool SIDDumpPlayer::loadFromMemory(const uint8_t* data, size_t length) {
+    _playing = false;
+    _loaded = false;
+#if defined(ESP32) || defined(ESP8266)
+    if (_file) _file.close();
+#endif
+
+    if (length < SID_DUMP_HEADER_SIZE || !parseHeader(data)) {
+        return false;
+    }
+
+    _data = data;
+    _length = length;
+    rewind();
+    _loaded = true;
+    return true;
+}
+
+bool SIDDumpPlayer::loadFile(const char* filename) {
+#if defined(ESP32) || defined(ESP8266)
+    _playing = false;
+    _loaded = false;
+    _data = NULL;
+    if (_file) _file.close();
+
+    _file = LittleFS.open(filename, "r");
+    if (!_file) {
+        Serial.print("Failed to open SID dump: ");
+        Serial.println(filename);
+        return false;
+    }
+
+    uint8_t header[SID_DUMP_HEADER_SIZE];
+    if (_file.read(header, sizeof(header)) != sizeof(header) || !parseHeader(header)) {
+        Serial.println("Not a SID dump file");
+        _file.close();
+        return false;
+    }
+
+    rewind();
+    _loaded = true;
+    return true;
+#else
+    // Non-ESP platforms not supported for file loading
+    return false;
+#endif
+}
+
+void SIDDumpPlayer::rewind() {
+    _pos = SID_DUMP_HEADER_SIZE;
+#if defined(ESP32) || defined(ESP8266)
+    if (_file) _file.seek(SID_DUMP_HEADER_SIZE);
+#endif
+
+    // Records are relative to a freshly reset chip
+    _sid->reset();
+    memset(_regs, 0, sizeof(_regs));
+    _idleFrames = 0;
+    _position = 0;
+}
+
+int SIDDumpPlayer::readByte() {
+    if (_data) {
+        if (_pos >= _length) return -1;
+        return _data[_pos++];
+    }
+#if defined(ESP32) || defined(ESP8266)
+    if (_file) return _file.read();
+#endif
+    return -1;
+}
+
+bool SIDDumpPlayer::readFrame(uint32_t& dirty, uint8_t& gateOff) {
+    dirty = 0;
+    gateOff = 0;
+
+    if (_idleFrames) {
+        _idleFrames--;
+        return true;
+    }
+
+    int tag = readByte();
+    if (tag < 0) return false;
+
+    if (tag < 0x80) {
+        // This frame and the next 'tag' frames are unchanged
+        _idleFrames = tag;
+        return true;
+    }
+
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (tag & (1 << i)) {
+            int bits = readByte();
+            if (bits < 0) return false;
+            mask |= (uint32_t)bits << (i * 8);
+        }
+    }
+
+    for (uint8_t reg = 0; reg < SID_NUM_REGS; reg++) {
+        if (mask & ((uint32_t)1 << reg)) {
+            int value = readByte();
+            if (value < 0) return false;
+            _regs[reg] = value;
+        }
+    }
+
+    gateOff = (tag >> 4) & 0x07;
+    for (uint8_t v = 0; v < 3; v++) {
+        if (gateOff & (1 << v)) mask |= (uint32_t)1 << voiceControl[v];
+    }
+    dirty = mask;
+    return true;
+}
+
+void SIDDumpPlayer::play(bool play) {
+    if (!_loaded && play) {
+        return;
+    }
+    _playing = play;
+}
+
+bool SIDDumpPlayer::isPlaying() {
+    return _playing;
+}
+
+void SIDDumpPlayer::timerCallback() {
+    _timerTick = true;
+}
+
+void SIDDumpPlayer::update() {
+    if (!_playing || !_timerTick) return;
+    _timerTick = false;
+
+    uint32_t dirty;
+    uint8_t gateOff;
+    if (!readFrame(dirty, gateOff)) {
+        // End of the dump: start over
+        rewind();
+        if (!readFrame(dirty, gateOff)) {
+            _playing = false;
+            return;
+        }
+    }
+
+    if (dirty) {
+        _sid->writeFrame(_regs, dirty, gateOff);
+    }
+    _position++;
+}
+
+const char* SIDDumpPlayer::getTitle() {
+    return _title;
+}
+
+const char* SIDDumpPlayer::getAuthor() {
+    return _author;
+}
+
+const char* SIDDumpPlayer::getCopyright() {
+    return _copyright;
+}
+
+uint32_t SIDDumpPlayer::getNumFrames() {
+    return _numFrames;
+}
+
+uint32_t SIDDumpPlayer::getFramePeriod() {
+    return _framePeriod;
+}
+
+uint32_t SIDDumpPlayer::getPosition() {
+    return _position;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file SIDDump.h
+ * @brief SID register dumps: transcoder and CPU-free player
+ *
+ * A dump holds the SID register state after every play call of a tune,
+ * so it plays back without the 6502 emulator. SIDTranscoder produces one
+ * from a loaded SIDPlayer (on the device or with tools/sid2dump), and
+ * SIDDumpPlayer streams it to the chip.
+ *
+ * File layout (little-endian):
+ *   0x00  "SIDD"
+ *   0x04  Version (1)
+ *   0x05  Frame rate in Hz (rounded, 255 = see period)
+ *   0x06  Frame period in microseconds (uint16, 0 = 1000000 / rate)
+ *   0x08  Number of frames (uint32)
+ *   0x0C  Title, author, copyright (32 bytes each)
+ *   0x6C  Frame records
+ *
+ * Frame records:
+ *   0x00-0x7F  No register changes for (n + 1) frames
+ *   0x80-0xFF  Bits 0-3: which of the four register mask bytes follow,
+ *              bits 4-6: voices whose gate is released and retriggered.
+ *              The mask bytes are followed by one value per set mask bit,
+ *              in register order.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef SID_DUMP_H
+#define SID_DUMP_H
+
+#include <Arduino.h>
+#include "SID6581.h"
+
+#if defined(ESP32) || defined(ESP8266)
+#include <LittleFS.h>
+#endif
+
+class SIDPlayer;
+
+#define SID_DUMP_VERSION        1
+#define SID_DUMP_HEADER_SIZE    0x6C
+
+// Longest frame record: tag, four mask bytes, all register values
+#define SID_DUMP_MAX_RECORD     (1 + 4 + SID_NUM_REGS)
+
+// Longest run of unchanged frames in one record
+#define SID_DUMP_MAX_IDLE_RUN   128
+
+/**
+ * @class SIDDumpEncoder
+ * @brief Turns register frames into dump records
+ */
+class SIDDumpEncoder {
+public:
+    SIDDumpEncoder();
+
+    /**
+     * @brief Start a new dump (chip state after reset)
+     */
+    void reset();
+
+    /**
+     * @brief Encode one frame
+     * @param frame Register frame
+     * @param out Buffer of at least 2 * SID_DUMP_MAX_RECORD bytes
+     * @return Number of bytes written (0 while unchanged frames are counted)
+     */
+    uint8_t encode(const SIDFrame& frame, uint8_t* out);
+
+    /**
+     * @brief Write out a pending run of unchanged frames
+     * @param out Buffer of at least 1 byte
+     * @return Number of bytes written
+     */
+    uint8_t finish(uint8_t* out);
+
+private:
+    uint8_t _regs[SID_NUM_REGS];    // State the decoder will have
+    uint8_t _idleFrames;            // Unchanged frames not written yet
+};
+
+/**
+ * @class SIDTranscoder
+ * @brief Records a tune played by SIDPlayer as a register dump
+ */
+class SIDTranscoder {
+public:
+    /**
+     * @brief Run a loaded tune offline and write its dump
+     *
+     * The player must have a tune loaded and must not be played with
+     * update() at the same time.
+     *
+     * @param player Player with the tune loaded
+     * @param out Destination (a File, or any other Print)
+     * @param frames Number of frames to record (one per play call)
+     * @return Number of frames written
+     */
+    static uint32_t transcode(SIDPlayer& player, Print& out, uint32_t frames);
+};
+
+/**
+ * @class SIDDumpPlayer
+ * @brief Plays register dumps without the 6502 emulator
+ */
+class SIDDumpPlayer {
+public:
+    /**
+     * @brief Constructor
+     * @param sid Pointer to SID6581 instance
+     */
+    SIDDumpPlayer(SID6581* sid);
+
+    /**
+     * @brief Initialize the player
+     */
+    void begin();
+
+    /**
+     * @brief Play a dump from memory (flash or PROGMEM)
+     * @param data Dump data, must stay valid while playing
+     * @param length Length of data in bytes
+     * @return true if the header is valid
+     */
+    bool loadFromMemory(const uint8_t* data, size_t length);
+
+    /**
+     * @brief Play a dump streamed from LittleFS
+     * @param filename Path to the dump file
+     * @return true if the file was opened and the header is valid
+     */
+    bool loadFile(const char* filename);
+
+    /**
+     * @brief Start/stop playback
+     * @param play true to start, false to stop
+     */
+    void play(bool play);
+
+    /**
+     * @brief Check if currently playing
+     * @return true if playing
+     */
+    bool isPlaying();
+
+    /**
+     * @brief Call this at the dump's frame rate from a timer
+     */
+    void timerCallback();
+
+    /**
+     * @brief Call this from main loop, writes the next frame after a tick
+     */
+    void update();
+
+    const char* getTitle();
+    const char* getAuthor();
+    const char* getCopyright();
+
+    /**
+     * @brief Get the number of frames in the dump
+     * @return Frame count from the header
+     */
+    uint32_t getNumFrames();
+
+    /**
+     * @brief Get the time between frames
+     * @return Frame period in microseconds, for the sketch's timer
+     */
+    uint32_t getFramePeriod();
+
+    /**
+     * @brief Get the playback position
+     * @return Frames played since the start of the dump
+     */
+    uint32_t getPosition();
+
+private:
+    SID6581* _sid;
+    bool _playing;
+    bool _loaded;
+    volatile bool _timerTick;
+
+    const uint8_t* _data;
+    size_t _length;
+    size_t _pos;
+#if defined(ESP32) || defined(ESP8266)
+    File _file;
+#endif
+
+    uint32_t _numFrames;
+    uint32_t _framePeriod;
+    uint32_t _position;
+    uint8_t _idleFrames;
+    uint8_t _regs[SID_NUM_REGS];    // Decoded register state
+    char _title[33];
+    char _author[33];
+    char _copyright[33];
+
+    bool parseHeader(const uint8_t* header);
+    void rewind();
+    int readByte();
+    bool readFrame(uint32_t& dirty, uint8_t& gateOff);
+};
+
+#endif // SID_DUMP_H
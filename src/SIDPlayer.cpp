@@ -18,630 +18,486 @@
 #include <LittleFS.h>
 #endif
 
-// Addressing modes
-#define MODE_IMP  0
-#define MODE_IMM  1
-#define MODE_ABS  2
-#define MODE_ABSX 3
-#define MODE_ABSY 4
-#define MODE_ZP   6
-#define MODE_ZPX  7
-#define MODE_ZPY  8
-#define MODE_IND  9
-#define MODE_INDX 10
-#define MODE_INDY 11
-#define MODE_ACC  12
-#define MODE_REL  13
-#define MODE_XXX  14
-
-// Opcodes
-enum {
-    OPadc, OPand, OPasl, OPbcc, OPbcs, OPbeq, OPbit, OPbmi, OPbne, OPbpl, OPbrk, OPbvc, OPbvs, OPclc,
-    OPcld, OPcli, OPclv, OPcmp, OPcpx, OPcpy, OPdec, OPdex, OPdey, OPeor, OPinc, OPinx, OPiny, OPjmp,
-    OPjsr, OPlda, OPldx, OPldy, OPlsr, OPnop, OPora, OPpha, OPphp, OPpla, OPplp, OProl, OPror, OPrti,
-    OPrts, OPsbc, OPsec, OPsed, OPsei, OPsta, OPstx, OPsty, OPtax, OPtay, OPtsx, OPtxa, OPtxs, OPtya,
-    OPxxx
-};
-
-static const uint8_t opcodes[256] = {
-    OPbrk,OPora,OPxxx,OPxxx,OPxxx,OPora,OPasl,OPxxx,OPphp,OPora,OPasl,OPxxx,OPxxx,OPora,OPasl,OPxxx,
-    OPbpl,OPora,OPxxx,OPxxx,OPxxx,OPora,OPasl,OPxxx,OPclc,OPora,OPxxx,OPxxx,OPxxx,OPora,OPasl,OPxxx,
-    OPjsr,OPand,OPxxx,OPxxx,OPbit,OPand,OProl,OPxxx,OPplp,OPand,OProl,OPxxx,OPbit,OPand,OProl,OPxxx,
-    OPbmi,OPand,OPxxx,OPxxx,OPxxx,OPand,OProl,OPxxx,OPsec,OPand,OPxxx,OPxxx,OPxxx,OPand,OProl,OPxxx,
-    OPrti,OPeor,OPxxx,OPxxx,OPxxx,OPeor,OPlsr,OPxxx,OPpha,OPeor,OPlsr,OPxxx,OPjmp,OPeor,OPlsr,OPxxx,
-    OPbvc,OPeor,OPxxx,OPxxx,OPxxx,OPeor,OPlsr,OPxxx,OPcli,OPeor,OPxxx,OPxxx,OPxxx,OPeor,OPlsr,OPxxx,
-    OPrts,OPadc,OPxxx,OPxxx,OPxxx,OPadc,OPror,OPxxx,OPpla,OPadc,OPror,OPxxx,OPjmp,OPadc,OPror,OPxxx,
-    OPbvs,OPadc,OPxxx,OPxxx,OPxxx,OPadc,OPror,OPxxx,OPsei,OPadc,OPxxx,OPxxx,OPxxx,OPadc,OPror,OPxxx,
-    OPxxx,OPsta,OPxxx,OPxxx,OPsty,OPsta,OPstx,OPxxx,OPdey,OPxxx,OPtxa,OPxxx,OPsty,OPsta,OPstx,OPxxx,
-    OPbcc,OPsta,OPxxx,OPxxx,OPsty,OPsta,OPstx,OPxxx,OPtya,OPsta,OPtxs,OPxxx,OPxxx,OPsta,OPxxx,OPxxx,
-    OPldy,OPlda,OPldx,OPxxx,OPldy,OPlda,OPldx,OPxxx,OPtay,OPlda,OPtax,OPxxx,OPldy,OPlda,OPldx,OPxxx,
-    OPbcs,OPlda,OPxxx,OPxxx,OPldy,OPlda,OPldx,OPxxx,OPclv,OPlda,OPtsx,OPxxx,OPldy,OPlda,OPldx,OPxxx,
-    OPcpy,OPcmp,OPxxx,OPxxx,OPcpy,OPcmp,OPdec,OPxxx,OPiny,OPcmp,OPdex,OPxxx,OPcpy,OPcmp,OPdec,OPxxx,
-    OPbne,OPcmp,OPxxx,OPxxx,OPxxx,OPcmp,OPdec,OPxxx,OPcld,OPcmp,OPxxx,OPxxx,OPxxx,OPcmp,OPdec,OPxxx,
-    OPcpx,OPsbc,OPxxx,OPxxx,OPcpx,OPsbc,OPinc,OPxxx,OPinx,OPsbc,OPnop,OPxxx,OPcpx,OPsbc,OPinc,OPxxx,
-    OPbeq,OPsbc,OPxxx,OPxxx,OPxxx,OPsbc,OPinc,OPxxx,OPsed,OPsbc,OPxxx,OPxxx,OPxxx,OPsbc,OPinc,OPxxx
-};
-
-static const uint8_t modes[256] = {
-    MODE_IMP,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_ACC,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX,
-    MODE_ABS,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_ACC,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX,
-    MODE_IMP,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_ACC,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX,
-    MODE_IMP,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_ACC,MODE_XXX,MODE_IND,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX,
-    MODE_XXX,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_XXX,MODE_IMP,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_ZPY,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_IMP,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_XXX,MODE_XXX,
-    MODE_IMM,MODE_INDX,MODE_IMM,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_IMP,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_ZPY,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_IMP,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_ABSY,MODE_XXX,
-    MODE_IMM,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_IMP,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX,
-    MODE_IMM,MODE_INDX,MODE_XXX,MODE_XXX,MODE_ZP,MODE_ZP,MODE_ZP,MODE_XXX,MODE_IMP,MODE_IMM,MODE_IMP,MODE_XXX,MODE_ABS,MODE_ABS,MODE_ABS,MODE_XXX,
-    MODE_REL,MODE_INDY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ZPX,MODE_ZPX,MODE_XXX,MODE_IMP,MODE_ABSY,MODE_XXX,MODE_XXX,MODE_XXX,MODE_ABSX,MODE_ABSX,MODE_XXX
-};
-
-// Helper variables for CPU emulation
-static uint8_t bval;
-static uint16_t wval;
-
-SIDPlayer::SIDPlayer(SID6581* sid) : 
-    _sid(sid), _playing(false), _fileLoaded(false), _timerTick(false),
-    _loadAddr(0), _initAddr(0), _playAddr(0), _numSongs(1), _currentSong(0),
-    _a(0), _x(0), _y(0), _s(0xFF), _p(0), _pc(0), _cycles(0)
+SIDPlayer::SIDPlayer(SID6581* sid, SID6581* sid2, SID6581* sid3) : 
+    Mos6502Player(*this, "SID", SID_DEFAULT_CYCLE_BUDGET, SID_DEFAULT_WATCHDOG_CYCLES,
+                  SID_FRAME_PERIOD_US),
+    _numChips(1),
+    _loadAddr(0), _initAddr(0), _playAddr(0), _numSIDs(1), _numSongs(1), _currentSong(0),
+    _writeMode(SID_WRITE_DIRECT),
+    _hwQueue(false),
+    _speedFlags(0), _ntsc(false), _ciaSpeed(false), _rateChanged(false),
+    _tickPin(SID_NO_TICK_PIN), _tickRateChanged(false),
+    _rsid(false), _nextEvent(C64_EVENT_NEVER), _irqLine(false), _nmiLine(false), _nmiPending(false),
+    _framesRun(0), _suppressOutput(false), _seeking(false), _fastForward(0), _fastLeft(0),
+    _standby(false),
+    _frameStores(0), _frameInstructions(0), _statsBusWrites(0), _statsMicros(0), _updateStart(0),
+    _lateTicks(0), _statsJitterMax(0), _missedTicks(0)
+#if defined(ESP32)
+    , _task(NULL), _cpuLock(NULL), _taskRun(false)
+#endif
 {
     memset(_title, 0, sizeof(_title));
     memset(_author, 0, sizeof(_author));
     memset(_copyright, 0, sizeof(_copyright));
-    memset(_memory, 0, sizeof(_memory));
+    memset(_sidShadow, 0, sizeof(_sidShadow));
+    memset(_sidDirty, 0, sizeof(_sidDirty));
+    memset(_sidGateOff, 0, sizeof(_sidGateOff));
+    memset(_hwQueueSynced, 0, sizeof(_hwQueueSynced));
+    memset(_hwQueueCycle, 0, sizeof(_hwQueueCycle));
+    memset(_hwQueueRemainder, 0, sizeof(_hwQueueRemainder));
+    setPlayRate(SID_CYCLES_PER_FRAME_PAL, SID_CLOCK_PAL);
+    
+    // Extra chips are only used if the ones before them are there
+    SID6581* chips[3] = { sid, sid2, sid3 };
+    memset(_sids, 0, sizeof(_sids));
+    _sids[0] = sid;
+    while (_numChips < SID_MAX_CHIPS && _numChips < 3 && chips[_numChips]) {
+        _sids[_numChips] = chips[_numChips];
+        _numChips++;
+    }
+    mapIO();
 }
 
 void SIDPlayer::begin() {
-    _sid->begin();
-    _sid->reset();
-    cpuReset();
+    for (uint8_t i = 0; i < _numChips; i++) {
+        _sids[i]->begin();
+    }
+    resetSIDs();
+    _cpu.reset();
 }
 
 uint8_t SIDPlayer::getMem(uint16_t addr) {
-    if (addr == 0xdd0d) _memory[addr] = 0;
-    return _memory[addr];
+    uint8_t handler = _memory.getHandler(addr);
+    if (handler && _memory.hooksReads(addr)) return readIO(handler, addr);
+    return _memory.read(addr);
 }
 
 void SIDPlayer::setMem(uint16_t addr, uint8_t value) {
-    // Intercept SID writes ($D400-$D7FF)
-    if ((addr & 0xfc00) == 0xd400) {
-        _sid->writeReg(addr & 31, value);
-    }
-    _memory[addr] = value;
-}
-
-inline void setFlags(uint8_t& p, uint8_t flag, bool cond) {
-    if (cond) p |= flag;
-    else p &= ~flag;
-}
-
-inline void SIDPlayer::branch(bool condition) {
-    int8_t dist = (int8_t)getAddr(MODE_IMM);
-    uint16_t newpc = _pc + dist;
-    if (condition) {
-        _cycles += ((_pc & 0x100) != (newpc & 0x100)) ? 2 : 1;
-        _pc = newpc;
-    }
-}
-
-uint8_t SIDPlayer::getAddr(uint8_t mode) {
-    uint16_t ad, ad2;
-    switch (mode) {
-        case MODE_IMP:
-            _cycles += 2;
-            return 0;
-        case MODE_IMM:
-            _cycles += 2;
-            return getMem(_pc++);
-        case MODE_ABS:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= getMem(_pc++) << 8;
-            return getMem(ad);
-        case MODE_ABSX:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= 256 * getMem(_pc++);
-            ad2 = ad + _x;
-            if ((ad2 & 0xff00) != (ad & 0xff00)) _cycles++;
-            return getMem(ad2);
-        case MODE_ABSY:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= 256 * getMem(_pc++);
-            ad2 = ad + _y;
-            if ((ad2 & 0xff00) != (ad & 0xff00)) _cycles++;
-            return getMem(ad2);
-        case MODE_ZP:
-            _cycles += 3;
-            ad = getMem(_pc++);
-            return getMem(ad);
-        case MODE_ZPX:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad += _x;
-            return getMem(ad & 0xff);
-        case MODE_ZPY:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad += _y;
-            return getMem(ad & 0xff);
-        case MODE_INDX:
-            _cycles += 6;
-            ad = getMem(_pc++);
-            ad += _x;
-            ad2 = getMem(ad & 0xff);
-            ad++;
-            ad2 |= getMem(ad & 0xff) << 8;
-            return getMem(ad2);
-        case MODE_INDY:
-            _cycles += 5;
-            ad = getMem(_pc++);
-            ad2 = getMem(ad);
-            ad2 |= getMem((ad + 1) & 0xff) << 8;
-            ad = ad2 + _y;
-            if ((ad2 & 0xff00) != (ad & 0xff00)) _cycles++;
-            return getMem(ad);
-        case MODE_ACC:
-            _cycles += 2;
-            return _a;
-    }
-    return 0;
-}
-
-void SIDPlayer::setAddr(uint8_t mode, uint8_t val) {
-    uint16_t ad, ad2;
-    switch (mode) {
-        case MODE_ABS:
-            _cycles += 2;
-            ad = getMem(_pc - 2);
-            ad |= 256 * getMem(_pc - 1);
-            setMem(ad, val);
-            return;
-        case MODE_ABSX:
-            _cycles += 3;
-            ad = getMem(_pc - 2);
-            ad |= 256 * getMem(_pc - 1);
-            ad2 = ad + _x;
-            if ((ad2 & 0xff00) != (ad & 0xff00)) _cycles--;
-            setMem(ad2, val);
-            return;
-        case MODE_ZP:
-            _cycles += 2;
-            ad = getMem(_pc - 1);
-            setMem(ad, val);
-            return;
-        case MODE_ZPX:
-            _cycles += 2;
-            ad = getMem(_pc - 1);
-            ad += _x;
-            setMem(ad & 0xff, val);
-            return;
-        case MODE_ACC:
-            _a = val;
-            return;
+    uint8_t handler = _memory.getHandler(addr);
+    if (handler) writeIO(handler, addr, value);
+    else _memory.write(addr, value);
+}
+
+uint8_t SIDPlayer::readIO(uint8_t handler, uint16_t addr) {
+    uint64_t now = _cpu.now();
+    uint8_t value;
+    
+    switch (handler) {
+        case SID_IO_CIA1:
+            value = _cia1.read(addr, now);
+            break;
+        case SID_IO_CIA2:
+            value = _cia2.read(addr, now);
+            break;
+        case SID_IO_VIC:
+            value = _vic.read(addr, now);
+            break;
+        default:
+            return _memory.read(addr);
     }
+    
+    // Reading an interrupt register may have acknowledged it
+    updateInterrupts();
+    return value;
 }
 
-void SIDPlayer::putAddr(uint8_t mode, uint8_t val) {
-    uint16_t ad, ad2;
-    switch (mode) {
-        case MODE_ABS:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= getMem(_pc++) << 8;
-            setMem(ad, val);
-            return;
-        case MODE_ABSX:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= getMem(_pc++) << 8;
-            ad2 = ad + _x;
-            setMem(ad2, val);
-            return;
-        case MODE_ABSY:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad |= getMem(_pc++) << 8;
-            ad2 = ad + _y;
-            if ((ad2 & 0xff00) != (ad & 0xff00)) _cycles++;
-            setMem(ad2, val);
-            return;
-        case MODE_ZP:
-            _cycles += 3;
-            ad = getMem(_pc++);
-            setMem(ad, val);
-            return;
-        case MODE_ZPX:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad += _x;
-            setMem(ad & 0xff, val);
-            return;
-        case MODE_ZPY:
-            _cycles += 4;
-            ad = getMem(_pc++);
-            ad += _y;
-            setMem(ad & 0xff, val);
-            return;
-        case MODE_INDX:
-            _cycles += 6;
-            ad = getMem(_pc++);
-            ad += _x;
-            ad2 = getMem(ad & 0xff);
-            ad++;
-            ad2 |= getMem(ad & 0xff) << 8;
-            setMem(ad2, val);
-            return;
-        case MODE_INDY:
-            _cycles += 5;
-            ad = getMem(_pc++);
-            ad2 = getMem(ad);
-            ad2 |= getMem((ad + 1) & 0xff) << 8;
-            ad = ad2 + _y;
-            setMem(ad, val);
-            return;
-        case MODE_ACC:
-            _cycles += 2;
-            _a = val;
+void SIDPlayer::writeIO(uint8_t handler, uint16_t addr, uint8_t value) {
+    uint64_t now = _cpu.now();
+    uint8_t chip;
+    
+    switch (handler) {
+        case SID_IO_SID:
+            // Registers repeat every 32 bytes; $xx19-$xx1F are not writable.
+            // Extra SIDs take over their 32-byte slot of the I/O area.
+            chip = _sidSlots[(addr >> 5) & 0x7F];
+            if (chip) writeSIDReg(chip - 1, addr & 31, value);
+            
+            // SID registers read back the last value written
+            _memory.write(addr, value);
             return;
+        case SID_IO_CIA1:
+            // Timer A latch: a CIA-timed tune changes its play rate
+            if ((addr & 0x0e) == CIA_TA_LO) _rateChanged = true;
+            _cia1.write(addr, value, now);
+            break;
+        case SID_IO_CIA2:
+            _cia2.write(addr, value, now);
+            break;
+        case SID_IO_VIC:
+            _vic.write(addr, value, now);
+            break;
     }
+    
+    // PSID reads of the CIAs see memory, as written
+    if (!_rsid) _memory.write(addr, value);
+    updateInterrupts();
 }
 
-void SIDPlayer::cpuReset() {
-    _a = _x = _y = 0;
-    _p = 0;
-    _s = 255;
-    _pc = getMem(0xfffc) | (getMem(0xfffd) << 8);
+void SIDPlayer::updateInterrupts() {
+    _nextEvent = C64_EVENT_NEVER;
+    _irqLine = false;
+    if (!_rsid) return;
+    
+    _irqLine = _cia1.irq() || _vic.irq();
+    bool nmi = _cia2.irq();
+    if (nmi && !_nmiLine) _nmiPending = true;
+    _nmiLine = nmi;
+    
+    // The core only stops for the earliest of the chips' next interrupts
+    uint64_t next = _cia1.nextEvent();
+    if (_cia2.nextEvent() < next) next = _cia2.nextEvent();
+    if (_vic.nextEvent() < next) next = _vic.nextEvent();
+    _nextEvent = next;
 }
 
-void SIDPlayer::cpuJsr(uint16_t addr, uint8_t acc) {
-    _a = acc;
-    _x = 0;
-    _y = 0;
-    _p = 0;
-    _s = 255;
-    _pc = addr;
+void SIDPlayer::resetIO() {
+    uint64_t now = _cpu.clock;
+    
+    _cia1.reset();
+    _cia2.reset();
+    if (_ntsc) _vic.reset(263, 65);
+    else _vic.reset(312, 63);
     
-    // Push return address (0x0000 - 1)
-    setMem(0x100 + _s--, 0x00);
-    setMem(0x100 + _s--, 0x00);
+    // State left by the KERNAL: CIA 1 timer A running with its IRQ enabled
+    uint16_t latch = _ntsc ? SID_CIA_DEFAULT_LATCH_NTSC : SID_CIA_DEFAULT_LATCH_PAL;
+    _cia1.write(CIA_TA_LO, latch & 0xff, now);
+    _cia1.write(CIA_TA_HI, latch >> 8, now);
+    _cia1.write(CIA_ICR, CIA_ICR_SET | CIA_ICR_TA, now);
+    _cia1.write(CIA_CRA, CIA_CR_START | CIA_CR_LOAD, now);
     
-    // Execute until RTS back to 0x0000
-    while (_pc) {
-        cpuStep();
+    _nmiLine = false;
+    _nmiPending = false;
+    updateInterrupts();
+}
+
+// KERNAL pieces RSID tunes rely on: the interrupt entry that pushes A/X/Y
+// and jumps through $0314/$0316/$0318, the usual exits, and the vectors
+static const uint8_t kernalIrqEntry[] = {   // $FF48
+    0x48, 0x8A, 0x48, 0x98, 0x48,           // PHA, TXA, PHA, TYA, PHA
+    0xBA, 0xBD, 0x04, 0x01,                 // TSX, LDA $0104,X
+    0x29, 0x10, 0xF0, 0x03,                 // AND #$10, BEQ +3
+    0x6C, 0x16, 0x03,                       // JMP ($0316)
+    0x6C, 0x14, 0x03                        // JMP ($0314)
+};
+static const uint8_t kernalIrqDefault[] = { 0x4C, 0x7E, 0xEA };     // $EA31: JMP $EA7E
+static const uint8_t kernalIrqExit[] = {                            // $EA7E
+    0xAD, 0x0D, 0xDC,                       // LDA $DC0D (acknowledge)
+    0x68, 0xA8, 0x68, 0xAA, 0x68, 0x40      // $EA81: PLA, TAY, PLA, TAX, PLA, RTI
+};
+static const uint8_t kernalNmiEntry[] = {                           // $FE43
+    0x78, 0x6C, 0x18, 0x03,                 // SEI, JMP ($0318)
+    0x40                                    // $FE47: RTI
+};
+static const uint8_t kernalBrk[] = { 0x4C, 0x81, 0xEA };            // $FE66: JMP $EA81
+static const uint8_t kernalNmiExit[] = { 0x68, 0xA8, 0x68, 0xAA, 0x68, 0x40 };  // $FEBC
+static const uint8_t kernalRamVectors[] = { 0x31, 0xEA, 0x66, 0xFE, 0x47, 0xFE };  // $0314
+static const uint8_t kernalVectors[] = { 0x43, 0xFE, 0xE2, 0xFC, 0x48, 0xFF };     // $FFFA
+
+static const struct {
+    uint16_t addr;
+    const uint8_t* code;
+    uint8_t length;
+} kernalPatches[] = {
+    { 0xFF48, kernalIrqEntry, sizeof(kernalIrqEntry) },
+    { 0xEA31, kernalIrqDefault, sizeof(kernalIrqDefault) },
+    { 0xEA7E, kernalIrqExit, sizeof(kernalIrqExit) },
+    { 0xFE43, kernalNmiEntry, sizeof(kernalNmiEntry) },
+    { 0xFE66, kernalBrk, sizeof(kernalBrk) },
+    { 0xFEBC, kernalNmiExit, sizeof(kernalNmiExit) },
+    { 0x0314, kernalRamVectors, sizeof(kernalRamVectors) },
+    { 0xFFFA, kernalVectors, sizeof(kernalVectors) },
+};
+
+void SIDPlayer::installKernal() {
+    // Written before the tune is loaded so the tune's own data wins
+    for (size_t i = 0; i < sizeof(kernalPatches) / sizeof(kernalPatches[0]); i++) {
+        for (uint8_t n = 0; n < kernalPatches[i].length; n++) {
+            _memory.write(kernalPatches[i].addr + n, kernalPatches[i].code[n]);
+        }
     }
 }
 
-bool SIDPlayer::cpuStep() {
-    uint8_t opc = getMem(_pc++);
-    uint8_t cmd = opcodes[opc];
-    uint8_t addr = modes[opc];
-    int c;
+void SIDPlayer::writeSIDReg(uint8_t chip, uint8_t reg, uint8_t value) {
+    // $xx19-$xx1F are read-only or unused: nothing to send in any mode
+    if (reg >= SID_NUM_REGS) return;
     
-    _cycles = 0;
+    _frameStores++;
+    if (_writeMode == SID_WRITE_COALESCED || _frameCapture || _suppressOutput) {
+        storeSIDReg(chip, reg, value);
+    } else if (_writeMode == SID_WRITE_TIMED &&
+               (_routine == SID_ROUTINE_PLAY || _routine == SID_ROUTINE_FRAME)) {
+        if (chip < _numChips) queueWrite(chip, reg, value);
+    } else if (chip < _numChips) {
+        _sids[chip]->writeReg(reg, value);
+    }
+}
+
+void SIDPlayer::storeSIDReg(uint8_t chip, uint8_t reg, uint8_t value) {
+    uint32_t bit = (uint32_t)1 << reg;
     
-    switch (cmd) {
-        case OPadc:
-            wval = (uint16_t)_a + getAddr(addr) + ((_p & FLAG_C) ? 1 : 0);
-            setFlags(_p, FLAG_C, wval & 0x100);
-            _a = (uint8_t)wval;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            setFlags(_p, FLAG_V, (!!(_p & FLAG_C)) ^ (!!(_p & FLAG_N)));
-            break;
-        case OPand:
-            bval = getAddr(addr);
-            _a &= bval;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        case OPasl:
-            wval = getAddr(addr);
-            wval <<= 1;
-            setAddr(addr, (uint8_t)wval);
-            setFlags(_p, FLAG_Z, !wval);
-            setFlags(_p, FLAG_N, wval & 0x80);
-            setFlags(_p, FLAG_C, wval & 0x100);
-            break;
-        case OPbcc:
-            branch(!(_p & FLAG_C));
-            break;
-        case OPbcs:
-            branch(_p & FLAG_C);
-            break;
-        case OPbne:
-            branch(!(_p & FLAG_Z));
-            break;
-        case OPbeq:
-            branch(_p & FLAG_Z);
-            break;
-        case OPbpl:
-            branch(!(_p & FLAG_N));
-            break;
-        case OPbmi:
-            branch(_p & FLAG_N);
-            break;
-        case OPbvc:
-            branch(!(_p & FLAG_V));
-            break;
-        case OPbvs:
-            branch(_p & FLAG_V);
-            break;
-        case OPbit:
-            bval = getAddr(addr);
-            setFlags(_p, FLAG_Z, !(_a & bval));
-            setFlags(_p, FLAG_N, bval & 0x80);
-            setFlags(_p, FLAG_V, bval & 0x40);
-            break;
-        case OPbrk:
-            setMem(0x100 + _s--, _pc & 0xff);
-            setMem(0x100 + _s--, _pc >> 8);
-            setMem(0x100 + _s--, _p);
-            setFlags(_p, FLAG_B, 1);
-            _pc = getMem(0xfffe) | (getMem(0xffff) << 8);
-            _cycles += 7;
-            break;
-        case OPclc:
-            _cycles += 2;
-            setFlags(_p, FLAG_C, 0);
-            break;
-        case OPcld:
-            _cycles += 2;
-            setFlags(_p, FLAG_D, 0);
-            break;
-        case OPcli:
-            _cycles += 2;
-            setFlags(_p, FLAG_I, 0);
-            break;
-        case OPclv:
-            _cycles += 2;
-            setFlags(_p, FLAG_V, 0);
-            break;
-        case OPcmp:
-            bval = getAddr(addr);
-            wval = (uint16_t)_a - bval;
-            setFlags(_p, FLAG_Z, !wval);
-            setFlags(_p, FLAG_N, wval & 0x80);
-            setFlags(_p, FLAG_C, _a >= bval);
-            break;
-        case OPcpx:
-            bval = getAddr(addr);
-            wval = (uint16_t)_x - bval;
-            setFlags(_p, FLAG_Z, !wval);
-            setFlags(_p, FLAG_N, wval & 0x80);
-            setFlags(_p, FLAG_C, _x >= bval);
-            break;
-        case OPcpy:
-            bval = getAddr(addr);
-            wval = (uint16_t)_y - bval;
-            setFlags(_p, FLAG_Z, !wval);
-            setFlags(_p, FLAG_N, wval & 0x80);
-            setFlags(_p, FLAG_C, _y >= bval);
-            break;
-        case OPdec:
-            bval = getAddr(addr);
-            bval--;
-            setAddr(addr, bval);
-            setFlags(_p, FLAG_Z, !bval);
-            setFlags(_p, FLAG_N, bval & 0x80);
-            break;
-        case OPdex:
-            _cycles += 2;
-            _x--;
-            setFlags(_p, FLAG_Z, !_x);
-            setFlags(_p, FLAG_N, _x & 0x80);
-            break;
-        case OPdey:
-            _cycles += 2;
-            _y--;
-            setFlags(_p, FLAG_Z, !_y);
-            setFlags(_p, FLAG_N, _y & 0x80);
-            break;
-        case OPeor:
-            bval = getAddr(addr);
-            _a ^= bval;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        case OPinc:
-            bval = getAddr(addr);
-            bval++;
-            setAddr(addr, bval);
-            setFlags(_p, FLAG_Z, !bval);
-            setFlags(_p, FLAG_N, bval & 0x80);
-            break;
-        case OPinx:
-            _cycles += 2;
-            _x++;
-            setFlags(_p, FLAG_Z, !_x);
-            setFlags(_p, FLAG_N, _x & 0x80);
-            break;
-        case OPiny:
-            _cycles += 2;
-            _y++;
-            setFlags(_p, FLAG_Z, !_y);
-            setFlags(_p, FLAG_N, _y & 0x80);
-            break;
-        case OPjmp:
-            _cycles += 3;
-            wval = getMem(_pc++);
-            wval |= 256 * getMem(_pc++);
-            if (addr == MODE_ABS) {
-                _pc = wval;
-            } else if (addr == MODE_IND) {
-                _pc = getMem(wval);
-                _pc |= 256 * getMem(wval + 1);
-                _cycles += 2;
-            }
-            break;
-        case OPjsr:
-            _cycles += 6;
-            setMem(0x100 + _s--, (_pc + 1) & 0xff);
-            setMem(0x100 + _s--, (_pc + 1) >> 8);
-            wval = getMem(_pc++);
-            wval |= 256 * getMem(_pc++);
-            _pc = wval;
-            break;
-        case OPlda:
-            _a = getAddr(addr);
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        case OPldx:
-            _x = getAddr(addr);
-            setFlags(_p, FLAG_Z, !_x);
-            setFlags(_p, FLAG_N, _x & 0x80);
-            break;
-        case OPldy:
-            _y = getAddr(addr);
-            setFlags(_p, FLAG_Z, !_y);
-            setFlags(_p, FLAG_N, _y & 0x80);
-            break;
-        case OPlsr:
-            bval = getAddr(addr);
-            wval = (uint8_t)bval;
-            wval >>= 1;
-            setAddr(addr, (uint8_t)wval);
-            setFlags(_p, FLAG_Z, !wval);
-            setFlags(_p, FLAG_N, wval & 0x80);
-            setFlags(_p, FLAG_C, bval & 1);
-            break;
-        case OPnop:
-            _cycles += 2;
-            break;
-        case OPora:
-            bval = getAddr(addr);
-            _a |= bval;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        case OPpha:
-            setMem(0x100 + _s--, _a);
-            _cycles += 3;
-            break;
-        case OPphp:
-            setMem(0x100 + _s--, _p);
-            _cycles += 3;
-            break;
-        case OPpla:
-            _a = getMem(0x100 + ++_s);
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            _cycles += 4;
-            break;
-        case OPplp:
-            _p = getMem(0x100 + ++_s);
-            _cycles += 4;
-            break;
-        case OProl:
-            bval = getAddr(addr);
-            c = !!(_p & FLAG_C);
-            setFlags(_p, FLAG_C, bval & 0x80);
-            bval <<= 1;
-            bval |= c;
-            setAddr(addr, bval);
-            setFlags(_p, FLAG_N, bval & 0x80);
-            setFlags(_p, FLAG_Z, !bval);
-            break;
-        case OPror:
-            bval = getAddr(addr);
-            c = !!(_p & FLAG_C);
-            setFlags(_p, FLAG_C, bval & 1);
-            bval >>= 1;
-            bval |= 128 * c;
-            setAddr(addr, bval);
-            setFlags(_p, FLAG_N, bval & 0x80);
-            setFlags(_p, FLAG_Z, !bval);
-            break;
-        case OPrti:
-            _p = getMem(0x100 + ++_s);
-            // Fall through
-        case OPrts:
-            wval = getMem(0x100 + ++_s) << 8;
-            wval |= getMem(0x100 + ++_s);
-            _pc = wval;
-            _cycles += 6;
-            break;
-        case OPsbc:
-            bval = getAddr(addr) ^ 0xff;
-            wval = (uint16_t)_a + bval + ((_p & FLAG_C) ? 1 : 0);
-            setFlags(_p, FLAG_C, wval & 0x100);
-            _a = (uint8_t)wval;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a > 127);
-            setFlags(_p, FLAG_V, (!!(_p & FLAG_C)) ^ (!!(_p & FLAG_N)));
-            break;
-        case OPsec:
-            _cycles += 2;
-            setFlags(_p, FLAG_C, 1);
-            break;
-        case OPsed:
-            _cycles += 2;
-            setFlags(_p, FLAG_D, 1);
-            break;
-        case OPsei:
-            _cycles += 2;
-            setFlags(_p, FLAG_I, 1);
-            break;
-        case OPsta:
-            putAddr(addr, _a);
-            break;
-        case OPstx:
-            putAddr(addr, _x);
-            break;
-        case OPsty:
-            putAddr(addr, _y);
-            break;
-        case OPtax:
-            _cycles += 2;
-            _x = _a;
-            setFlags(_p, FLAG_Z, !_x);
-            setFlags(_p, FLAG_N, _x & 0x80);
-            break;
-        case OPtay:
-            _cycles += 2;
-            _y = _a;
-            setFlags(_p, FLAG_Z, !_y);
-            setFlags(_p, FLAG_N, _y & 0x80);
-            break;
-        case OPtsx:
-            _cycles += 2;
-            _x = _s;
-            setFlags(_p, FLAG_Z, !_x);
-            setFlags(_p, FLAG_N, _x & 0x80);
-            break;
-        case OPtxa:
-            _cycles += 2;
-            _a = _x;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        case OPtxs:
-            _cycles += 2;
-            _s = _x;
-            break;
-        case OPtya:
-            _cycles += 2;
-            _a = _y;
-            setFlags(_p, FLAG_Z, !_a);
-            setFlags(_p, FLAG_N, _a & 0x80);
-            break;
-        default:
-            // Unknown opcode
-            break;
+    if (reg == (SID_VOICE1_BASE + SID_VOICE_CONTROL) ||
+        reg == (SID_VOICE2_BASE + SID_VOICE_CONTROL) ||
+        reg == (SID_VOICE3_BASE + SID_VOICE_CONTROL)) {
+        // A gate flipping against the pending value is an edge the merged
+        // value would hide (0-1-0 ends where it started): send the
+        // pending writes first when they go straight to the chip
+        if ((_sidDirty[chip] & bit) && ((_sidShadow[chip][reg] ^ value) & SID_CTRL_GATE) &&
+            _writeMode == SID_WRITE_COALESCED && !_frameCapture && !_suppressOutput) {
+            flushWrites();
+        }
+        
+        // Remember a gate-off so a release/retrigger pair within one
+        // frame still produces a gate edge on the chip
+        if (!(value & SID_CTRL_GATE)) {
+            _sidGateOff[chip] |= 1 << (reg / 7);
+        }
     }
     
+    _sidShadow[chip][reg] = value;
+    _sidDirty[chip] |= bit;
+}
+
+void SIDPlayer::flushWrites() {
+    // All chips' changes go out as one batch
+    AudioBusWrite writes[SID_MAX_CHIPS * SID_FRAME_MAX_WRITES];
+    uint16_t count = 0;
+    
+    for (uint8_t i = 0; i < _numChips; i++) {
+        if (!_sidDirty[i]) continue;
+        count += _sids[i]->frameWrites(_sidShadow[i], _sidDirty[i], _sidGateOff[i], &writes[count]);
+        _sidDirty[i] = 0;
+        _sidGateOff[i] = 0;
+    }
+    if (count) audioBusWriteBatch16(writes, count);
+}
+
+void SIDPlayer::writeFrame(const SIDPlayerFrame& frame) {
+    AudioBusWrite writes[SID_MAX_CHIPS * SID_FRAME_MAX_WRITES];
+    uint16_t count = 0;
+    
+    for (uint8_t i = 0; i < _numChips; i++) {
+        const SIDFrame& f = frame.sid[i];
+        if (!f.dirty) continue;
+        count += _sids[i]->frameWrites(f.regs, f.dirty, f.gateOff, &writes[count]);
+    }
+    if (count) audioBusWriteBatch16(writes, count);
+}
+
+void SIDPlayer::pushSIDFrame() {
+    SIDPlayerFrame* frame = _frameRing.writeSlot();
+    
+    // Ring full: the stores stay pending and go out with the next frame
+    if (!frame) return;
+    
+    for (uint8_t i = 0; i < SID_MAX_CHIPS; i++) {
+        memcpy(frame->sid[i].regs, _sidShadow[i], SID_NUM_REGS);
+        frame->sid[i].dirty = _sidDirty[i];
+        frame->sid[i].gateOff = _sidGateOff[i];
+        _sidDirty[i] = 0;
+        _sidGateOff[i] = 0;
+    }
+    frame->cycles = _routineCycles;
+    frame->instructions = (uint32_t)(_cpu.instructions - _frameInstructions);
+    frame->stores = _frameStores;
+    _frameInstructions = _cpu.instructions;
+    _frameStores = 0;
+    _frameRing.commit();
+}
+
+void SIDPlayer::pushWriteQueueToChip() {
+    if (_queueHead == _queueTail) return;
+    
+    // An empty FIFO means the FPGA ran out of entries (first frame, pause or
+    // a late host): restart the chain with the configured latency ahead of
+    // the start of the current frame. Each chip has its own FIFO and chain.
+    uint32_t latencyCycles = (uint32_t)(((uint64_t)_writeLatency << 16) / _usPerCycleQ16);
+    uint32_t frameStart = (uint32_t)(_nextFrameCycle - _playPeriodCycles);
+    for (uint8_t i = 0; i < _numChips; i++) {
+        if (_hwQueueSynced[i] && (_sids[i]->getWriteQueueStatus() & SID_FIFO_STATUS_EMPTY)) {
+            _hwQueueSynced[i] = false;
+        }
+        if (!_hwQueueSynced[i]) {
+            _hwQueueCycle[i] = frameStart - latencyCycles;
+            _hwQueueRemainder[i] = 0;
+            _hwQueueSynced[i] = true;
+        }
+    }
+    
+    // The FIFO counts SID clocks, the timeline 6502 cycles: scale each
+    // delay and carry the remainder so the chain keeps the CPU's pace
+    uint32_t clock = _ntsc ? SID_CLOCK_NTSC : SID_CLOCK_PAL;
+    while (_queueHead != _queueTail) {
+        TimedWrite& w = _writeQueue[_queueHead];
+        uint64_t scaled = (uint64_t)(w.cycle - _hwQueueCycle[w.chip]) * SID_CLOCK_HZ +
+                          _hwQueueRemainder[w.chip];
+        uint32_t delay = (uint32_t)(scaled / clock);
+        _hwQueueRemainder[w.chip] = (uint32_t)(scaled % clock);
+        if (delay > 0xFFFF) delay = 0xFFFF;
+        
+        _sids[w.chip]->queueWrite(delay, w.reg, w.value);
+        _hwQueueCycle[w.chip] = w.cycle;
+        _queueHead = (_queueHead + 1) & (SID_WRITE_QUEUE_SIZE - 1);
+    }
+}
+
+void SIDPlayer::beginPlayFrame() {
+    if (_rsid) {
+        // The machine runs continuously, frames only slice its timeline
+        _nextFrameCycle += _playPeriodCycles;
+        if (_nextFrameCycle <= _cpu.clock) {
+            _nextFrameCycle = _cpu.clock + _playPeriodCycles;
+        }
+    } else {
+        // Raster interrupt time for a PSID play call
+        alignPlayCall();
+    }
+    if (_writeMode == SID_WRITE_TIMED) anchorTimeline();
+}
+
+void SIDPlayer::resetSIDShadow() {
+    // Matches the chip state after SID6581::reset()
+    memset(_sidShadow, 0, sizeof(_sidShadow));
+    memset(_sidDirty, 0, sizeof(_sidDirty));
+    memset(_sidGateOff, 0, sizeof(_sidGateOff));
+}
+
+void SIDPlayer::resetSIDs() {
+    for (uint8_t i = 0; i < _numChips; i++) {
+        _sids[i]->reset();
+    }
+    resetSIDShadow();
+}
+
+void SIDPlayer::mapIO() {
+    // $01 banking is not emulated, so a PSID keeps whatever it stores
+    // under I/O: the VIC is plain memory and only CIA writes are hooked,
+    // for the timer A rate. An RSID gets the chips it was written for.
+    for (uint16_t page = 0xD0; page <= 0xD3; page++) {
+        _memory.setHandler(page, _rsid ? SID_IO_VIC : SID_IO_RAM);
+    }
+    for (uint16_t page = 0xD4; page <= 0xD7; page++) {
+        _memory.setHandler(page, SID_IO_SID, false);
+    }
+    _memory.setHandler(0xDC, SID_IO_CIA1, _rsid);
+    _memory.setHandler(0xDD, SID_IO_CIA2, _rsid);
+    
+    // The first SID fills $D400-$D7FF with mirrors, extra SIDs take their
+    // own 32-byte slot (inside that area or at $DE00-$DFFF)
+    memset(_sidSlots, 0, sizeof(_sidSlots));
+    memset(&_sidSlots[0x400 >> 5], 1, 0x400 >> 5);
+    _memory.setHandler(0xDE, SID_IO_RAM);
+    _memory.setHandler(0xDF, SID_IO_RAM);
+    
+    for (uint8_t i = 1; i < _numSIDs; i++) {
+        _sidSlots[(_sidAddr[i] >> 5) & 0x7F] = i + 1;
+        if ((_sidAddr[i] >> 8) >= 0xDE) _memory.setHandler(_sidAddr[i] >> 8, SID_IO_SID, false);
+    }
+}
+
+// ============================================================================
+// 6502 core
+// ============================================================================
+//
+// The instructions are in Mos6502.h; the player is the bus, with the CIAs
+// and the VIC as its events.
+
+void SIDPlayer::serviceEvents(uint64_t now) {
+    _cia1.update(now);
+    _cia2.update(now);
+    _vic.update(now);
+    updateInterrupts();
+}
+
+bool SIDPlayer::takeNmi() {
+    if (!_nmiPending) return false;
+    _nmiPending = false;
+    return true;
+}
+
+void SIDPlayer::startInit() {
+    _framesRun = 0;
+    _frameStores = 0;
+    _frameInstructions = _cpu.instructions;
+    _cpu.reset();
+    resetIO();
+    selectSongSpeed();
+    
+    if (_rsid) {
+        // Entered as if by SYS from BASIC: the CPU runs on from here in
+        // frame slices and the tune's interrupts keep it going once init
+        // returns, so there is no init routine to wait for
+        startRoutine(SID_ROUTINE_NONE, _initAddr, _currentSong);
+        _nextFrameCycle = _cpu.clock;
+    } else {
+        startRoutine(SID_ROUTINE_INIT, _initAddr, _currentSong);
+    }
+}
+
+void SIDPlayer::startPlayCall() {
+    beginPlayFrame();
+    if (_rsid) {
+        _routine = SID_ROUTINE_FRAME;
+        _routineCycles = 0;
+    } else {
+        startRoutine(SID_ROUTINE_PLAY, _playAddr, 0);
+    }
+}
+
+bool SIDPlayer::runRoutine(uint32_t& budget) {
+    if (_routine != SID_ROUTINE_FRAME) return Mos6502Player::runRoutine(budget);
+    
+    // Machine time only runs up to the end of the frame
+    uint64_t left = (_nextFrameCycle > _cpu.clock) ? _nextFrameCycle - _cpu.clock : 0;
+    runSlice(budget, budget > left ? (uint32_t)left : budget);
+    
+    if (_cpu.clock < _nextFrameCycle) return false;
+    finishRoutine();
     return true;
 }
 
-bool SIDPlayer::parseSIDHeader(const uint8_t* data, size_t length) {
-    if (length < 0x7C) return false;
+void SIDPlayer::finishRoutine() {
+    uint8_t routine = _routine;
+    _routine = SID_ROUTINE_NONE;
+    
+    if (_suppressOutput) {
+        // Seek or fast-forward: the stores wait in _sidShadow
+    } else if (_frameCapture) {
+        pushSIDFrame();
+    } else if (_writeMode == SID_WRITE_COALESCED) {
+        flushWrites();
+    }
+    
+    if (routine == SID_ROUTINE_INIT) {
+        // If play address is 0, get it from IRQ vector
+        if (_playAddr == 0) {
+            _playAddr = (_memory.read(0x0315) << 8) + _memory.read(0x0314);
+        }
+        updatePlayRate();
+    } else if (_rateChanged) {
+        updatePlayRate();
+    }
+    
+    if (routine == SID_ROUTINE_PLAY || routine == SID_ROUTINE_FRAME) {
+        _framesRun++;
+        
+        // The last frame of a fast-forward tick sends what the tick left
+        if (_suppressOutput && !_seeking && !_fastLeft) endSuppressedRun();
+    }
+    
+    if ((routine == SID_ROUTINE_PLAY || routine == SID_ROUTINE_FRAME) &&
+        !_frameCapture && !_suppressOutput) {
+        if (_writeMode == SID_WRITE_TIMED && _hwQueue) {
+            pushWriteQueueToChip();
+        }
+        
+        publishStats(_routineCycles, (uint32_t)(_cpu.instructions - _frameInstructions), _frameStores);
+        _frameInstructions = _cpu.instructions;
+        _frameStores = 0;
+    }
+}
+
+bool SIDPlayer::readHeader(const uint8_t* data, size_t length, SIDHeader& header) {
+    if (length < SID_HEADER_SIZE) return false;
     
     // Check magic
     if (data[0] != 'P' && data[0] != 'R') return false;
@@ -651,63 +507,135 @@ bool SIDPlayer::parseSIDHeader(const uint8_t* data, size_t length) {
     
     // Get header size
     uint8_t dataOffset = data[7];
+    if ((size_t)dataOffset + 2 > length) return false;
     
     // Get addresses (big-endian in PSID format)
-    _loadAddr = (data[8] << 8) | data[9];
-    _initAddr = (data[10] << 8) | data[11];
-    _playAddr = (data[12] << 8) | data[13];
+    header.version = data[5];
+    header.loadAddr = (data[8] << 8) | data[9];
+    header.initAddr = (data[10] << 8) | data[11];
+    header.playAddr = (data[12] << 8) | data[13];
     
     // Number of songs
-    _numSongs = data[0x0F];
-    _currentSong = data[0x11] - 1;
+    header.numSongs = data[0x0F];
+    header.startSong = data[0x11] - 1;
+    
+    // RSID tunes need the C64 environment and play from their own interrupts
+    header.rsid = (data[0] == 'R');
+    
+    // Speed: one bit per song (songs past 32 share bit 31), 1 = CIA timer
+    header.speedFlags = ((uint32_t)data[0x12] << 24) | ((uint32_t)data[0x13] << 16) |
+                        ((uint32_t)data[0x14] << 8) | data[0x15];
+    
+    // PSID v2+ flags: clock bits 2-3, 10 = NTSC only; SID model bits 4-5
+    bool flags = data[5] >= 2 && dataOffset >= 0x7C;
+    header.ntsc = flags && ((data[0x77] >> 2) & 3) == 2;
+    header.sidModel = flags ? (data[0x77] >> 4) & 3 : 0;
+    
+    // PSID v3/v4: extra SIDs at $Dxx0, given as xx (even, $42-$7F or $E0-$FE)
+    header.numSIDs = 1;
+    header.sidAddr[0] = 0xD400;
+    for (uint8_t i = 1; i < SID_MAX_CHIPS && i < 3; i++) {
+        uint8_t mid = data[0x79 + i];
+        if (data[5] < 2 + i || dataOffset < 0x7C) break;
+        if ((mid & 1) || !((mid >= 0x42 && mid <= 0x7F) || mid >= 0xE0)) break;
+        header.sidAddr[header.numSIDs++] = 0xD000 | (mid << 4);
+    }
     
     // If load address is 0, get it from data
-    if (_loadAddr == 0) {
-        _loadAddr = data[dataOffset] | (data[dataOffset + 1] << 8);
+    if (header.loadAddr == 0) {
+        header.loadAddr = data[dataOffset] | (data[dataOffset + 1] << 8);
     }
     
     // Copy strings (null-terminated, max 32 chars)
-    memcpy(_title, &data[0x16], 32);
-    _title[32] = '\0';
-    memcpy(_author, &data[0x36], 32);
-    _author[32] = '\0';
-    memcpy(_copyright, &data[0x56], 32);
-    _copyright[32] = '\0';
+    memcpy(header.title, &data[0x16], 32);
+    header.title[32] = '\0';
+    memcpy(header.author, &data[0x36], 32);
+    header.author[32] = '\0';
+    memcpy(header.copyright, &data[0x56], 32);
+    header.copyright[32] = '\0';
     
-    // Clear memory and load data
-    memset(_memory, 0, sizeof(_memory));
+    // Program data follows its actual load address
+    header.dataAddr = data[dataOffset] | (data[dataOffset + 1] << 8);
+    header.dataStart = dataOffset + 2;
     
-    // Load actual address from file
-    uint16_t actualLoadAddr = data[dataOffset] | (data[dataOffset + 1] << 8);
+    return true;
+}
+
+bool SIDPlayer::parseSIDHeader(const uint8_t* data, size_t length,
+                               uint16_t& dataAddr, size_t& dataStart) {
+    SIDHeader header;
+    if (!readHeader(data, length, header)) return false;
     
-    // Copy program data to memory
-    size_t dataSize = length - dataOffset - 2;
-    memcpy(&_memory[actualLoadAddr], &data[dataOffset + 2], dataSize);
+    _loadAddr = header.loadAddr;
+    _initAddr = header.initAddr;
+    _playAddr = header.playAddr;
+    _numSongs = header.numSongs;
+    _currentSong = header.startSong;
+    _rsid = header.rsid;
+    _speedFlags = header.speedFlags;
+    _ntsc = header.ntsc;
+    _numSIDs = header.numSIDs;
+    memcpy(_sidAddr, header.sidAddr, sizeof(_sidAddr));
+    memcpy(_title, header.title, sizeof(_title));
+    memcpy(_author, header.author, sizeof(_author));
+    memcpy(_copyright, header.copyright, sizeof(_copyright));
     
+    dataAddr = header.dataAddr;
+    dataStart = header.dataStart;
     return true;
 }
 
-bool SIDPlayer::loadFromMemory(const uint8_t* data, size_t length, uint8_t subSong) {
-    if (!parseSIDHeader(data, length)) {
-        return false;
-    }
-    
+void SIDPlayer::initTune(uint8_t subSong) {
     _currentSong = subSong;
     if (_currentSong >= _numSongs) _currentSong = 0;
     
+    // The loaded image, for restoring on a song change
+    _memory.takeSnapshot();
+    
     // Reset and initialize
-    _sid->reset();
-    cpuReset();
+    _queueHead = _queueTail = 0;
+    _frameRing.clear();
+    _framesPrimed = false;
+    mapIO();
+    if (_standby) {
+        // The chips belong to the player in front
+        resetSIDShadow();
+    } else {
+        resetSIDs();
+    }
+    _statsBusWrites = busWriteCount();
+    _watchdogTripped = false;
+    
+    // Init routine (song number in A) runs from update()
+    startInit();
     
-    // Call init routine with song number in A
-    cpuJsr(_initAddr, _currentSong);
+    _fileLoaded = true;
+}
+
+bool SIDPlayer::loadFromMemory(const uint8_t* data, size_t length, uint8_t subSong) {
+    lockCpu();
     
-    // If play address is 0, get it from IRQ vector
-    if (_playAddr == 0) {
-        _playAddr = (_memory[0x0315] << 8) + _memory[0x0314];
+    uint16_t dataAddr;
+    size_t dataStart;
+    if (!parseSIDHeader(data, length, dataAddr, dataStart)) {
+        unlockCpu();
+        return false;
     }
     
-    _fileLoaded = true;
+    // Tune pages read straight from data, RAM is only used once written
+    _routine = SID_ROUTINE_NONE;
+    _memory.clear();
+    if (_rsid) installKernal();
+    if (!_memory.map(dataAddr, &data[dataStart], length - dataStart)) {
+        Serial.println("Failed to allocate memory for SID file");
+        _fileLoaded = false;
+        _playing = false;
+        unlockCpu();
+        return false;
+    }
+    
+    initTune(subSong);
+    unlockCpu();
     return true;
 }
 
@@ -727,57 +655,112 @@ bool SIDPlayer::loadFile(const char* filename, uint8_t subSong) {
         return false;
     }
     
-    // Allocate buffer for file data
-    uint8_t* buffer = (uint8_t*)malloc(fileSize);
-    if (!buffer) {
-        Serial.println("Failed to allocate memory for SID file");
+    // Header plus the embedded load address
+    uint8_t header[SID_HEADER_SIZE + 2];
+    size_t headerSize = file.read(header, sizeof(header));
+    
+    lockCpu();
+    
+    uint16_t dataAddr;
+    size_t dataStart;
+    if (!parseSIDHeader(header, headerSize, dataAddr, dataStart)) {
+        unlockCpu();
         file.close();
         return false;
     }
     
-    // Read file into buffer
-    size_t bytesRead = file.read(buffer, fileSize);
+    // Read the program straight into the pages it occupies
+    _routine = SID_ROUTINE_NONE;
+    _memory.clear();
+    if (_rsid) installKernal();
+    file.seek(dataStart);
+    
+    uint32_t addr = dataAddr;
+    size_t remaining = fileSize - dataStart;
+    if (remaining > 0x10000 - addr) remaining = 0x10000 - addr;
+    
+    while (remaining) {
+        uint16_t offset = addr & 0xFF;
+        size_t chunk = PAGED_MEMORY_PAGE_SIZE - offset;
+        if (chunk > remaining) chunk = remaining;
+        
+        uint8_t* page = _memory.writePage(addr >> 8);
+        if (!page) {
+            Serial.println("Failed to allocate memory for SID file");
+            break;
+        }
+        if (file.read(page + offset, chunk) != chunk) {
+            Serial.println("Failed to read complete SID file");
+            break;
+        }
+        
+        addr += chunk;
+        remaining -= chunk;
+    }
     file.close();
     
-    if (bytesRead != fileSize) {
-        Serial.println("Failed to read complete SID file");
-        free(buffer);
+    if (remaining) {
+        _memory.clear();
+        _fileLoaded = false;
+        _playing = false;
+        unlockCpu();
         return false;
     }
     
-    // Load from the buffer
-    bool result = loadFromMemory(buffer, fileSize, subSong);
-    
-    // Free the buffer (data has been copied to _memory)
-    free(buffer);
-    
-    return result;
+    initTune(subSong);
+    unlockCpu();
+    return true;
 #else
     // Non-ESP platforms not supported for file loading
     return false;
 #endif
 }
 
-void SIDPlayer::play(bool play) {
-    if (!_fileLoaded && play) {
-        return;
-    }
-    _playing = play;
+void IRAM_ATTR SIDPlayer::timerCallback() {
+    // The previous tick was never served
+    if (_timerTick) _missedTicks++;
+    _tickMicros = micros();
+    _timerTick = true;
 }
 
-bool SIDPlayer::isPlaying() {
-    return _playing;
+void SIDPlayer::consumeTick() {
+    uint32_t late = Mos6502Player::consumeTick();
+    if (late > _statsJitterMax) _statsJitterMax = late;
+    if (late >= _playPeriodUs) _lateTicks++;
 }
 
-void SIDPlayer::timerCallback() {
-    _timerTick = true;
+void SIDPlayer::update() {
+    // Time spent here is charged to the next frame the player publishes
+    _updateStart = micros();
+    if (_tickRateChanged && !_standby) {
+        _tickRateChanged = false;
+        _sids[0]->setFrameTick(tickPeriod());
+    }
+    runUpdate();
+    _statsMicros += micros() - _updateStart;
 }
 
-void SIDPlayer::update() {
-    if (_playing && _timerTick) {
-        cpuJsr(_playAddr, 0);
-        _timerTick = false;
+void SIDPlayer::runUpdate() {
+    // The emulation task renders the frames once it runs
+    bool render = true;
+#if defined(ESP32)
+    render = (_task == NULL);
+#endif
+    updatePlayback(_writeMode == SID_WRITE_TIMED && !_hwQueue, render);
+}
+
+bool SIDPlayer::takeTick() {
+    // A fast-forward tick starts several play calls
+    if (!_fastLeft) {
+        if (!_timerTick) return false;
+        consumeTick();
+        if (_fastForward > 1) {
+            _fastLeft = _fastForward;
+            _suppressOutput = true;
+        }
     }
+    if (_fastLeft) _fastLeft--;
+    return true;
 }
 
 const char* SIDPlayer::getTitle() {
@@ -796,22 +779,470 @@ uint8_t SIDPlayer::getNumSongs() {
     return _numSongs;
 }
 
+uint8_t SIDPlayer::getNumSIDs() {
+    return _numSIDs;
+}
+
 uint8_t SIDPlayer::getCurrentSong() {
     return _currentSong;
 }
 
 void SIDPlayer::nextSong() {
-    if (_currentSong < _numSongs - 1) {
-        _currentSong++;
-        cpuReset();
-        cpuJsr(_initAddr, _currentSong);
-    }
+    if (_currentSong < _numSongs - 1) switchSong(_currentSong + 1);
 }
 
 void SIDPlayer::prevSong() {
-    if (_currentSong > 0) {
-        _currentSong--;
-        cpuReset();
-        cpuJsr(_initAddr, _currentSong);
+    if (_currentSong > 0) switchSong(_currentSong - 1);
+}
+
+void SIDPlayer::restart() {
+    if (_fileLoaded) switchSong(_currentSong);
+}
+
+void SIDPlayer::switchSong(uint8_t song) {
+    lockCpu();
+    _currentSong = song;
+    drainWriteQueue();
+    _frameRing.clear();
+    _framesPrimed = false;
+    
+    // Init sees the memory as loaded, not as the last song left it
+    _memory.restoreSnapshot();
+    startInit();
+    unlockCpu();
+}
+
+bool SIDPlayer::seekToFrame(uint32_t frame) {
+    if (!_fileLoaded) return false;
+    
+    lockCpu();
+    _seeking = true;
+    _suppressOutput = true;
+    _fastLeft = 0;
+    holdPendingWrites();
+    
+    // Play calls only run forward: an earlier frame starts from init
+    if (frame < _framesRun) {
+        _memory.restoreSnapshot();
+        startInit();
+        
+        // The stores of the later frames are still in the shadow and on
+        // the chips: the replayed state replaces all of it
+        resetSIDShadow();
+        for (uint8_t i = 0; i < _numChips; i++) {
+            _sidDirty[i] = ((uint32_t)1 << SID_NUM_REGS) - 1;
+            _sidGateOff[i] = 0x07;
+        }
+    }
+    
+    // Without the watchdog a routine that never returns would never let
+    // the loop end
+    uint32_t limit = _watchdogCycles ? _watchdogCycles : SID_SEEK_ROUTINE_CYCLES;
+    bool stopped = false;
+    while (!_watchdogTripped) {
+        if (_routine == SID_ROUTINE_NONE) {
+            if (_framesRun >= frame) break;
+            startPlayCall();
+        }
+        uint32_t budget = limit;
+        runRoutine(budget);
+        
+        if (_routine != SID_ROUTINE_NONE && _routine != SID_ROUTINE_FRAME &&
+            _routineCycles >= limit) {
+            Serial.print("SID routine stopped by seek at $");
+            Serial.println(_cpu.pc, HEX);
+            _playing = false;
+            _cpu.pc = 0;
+            finishRoutine();
+            stopped = true;
+            break;
+        }
+    }
+    
+    _seeking = false;
+    endSuppressedRun();
+    _frameStores = 0;
+    _frameInstructions = _cpu.instructions;
+    unlockCpu();
+    return !_watchdogTripped && !stopped;
+}
+
+uint32_t SIDPlayer::getPosition() {
+    return _framesRun - _frameRing.count();
+}
+
+void SIDPlayer::setFastForward(uint8_t speed) {
+    lockCpu();
+    
+    // Timed writes still waiting would land after the first tick's state
+    if (speed > 1 && _fastForward <= 1) drainWriteQueue();
+    _fastForward = speed;
+    unlockCpu();
+}
+
+uint8_t SIDPlayer::getFastForward() {
+    return _fastForward;
+}
+
+void SIDPlayer::holdPendingWrites() {
+    // Timed writes not sent yet go into the shadow in their order
+    while (_queueHead != _queueTail) {
+        TimedWrite& w = _writeQueue[_queueHead];
+        storeSIDReg(w.chip, w.reg, w.value);
+        _queueHead = (_queueHead + 1) & (SID_WRITE_QUEUE_SIZE - 1);
+    }
+    
+    // Prepared frames were copied from the shadow, only their changes are
+    // still to be sent
+    const SIDPlayerFrame* frame;
+    while ((frame = _frameRing.peek()) != NULL) {
+        for (uint8_t i = 0; i < SID_MAX_CHIPS; i++) {
+            _sidDirty[i] |= frame->sid[i].dirty;
+            _sidGateOff[i] |= frame->sid[i].gateOff;
+        }
+        _frameRing.release();
+    }
+    _framesPrimed = false;
+}
+
+void SIDPlayer::endSuppressedRun() {
+    // In standby the stores are sent when the player leaves it
+    if (_standby) return;
+    
+    _suppressOutput = false;
+    flushWrites();
+    
+    // The 6502 timeline ran ahead: timed writes continue from now
+    _anchorCycle = (uint32_t)_cpu.clock;
+    _anchorMicros = micros() + _writeLatency;
+    memset(_hwQueueSynced, 0, sizeof(_hwQueueSynced));
+}
+
+void SIDPlayer::setStandby(bool standby, bool resetChips) {
+    lockCpu();
+    if (standby && !_standby) {
+        // Writes not sent yet stay with the player
+        _fastLeft = 0;
+        holdPendingWrites();
+        _suppressOutput = true;
+        _standby = true;
+    } else if (!standby && _standby) {
+        _standby = false;
+        _timerTick = false;
+        _statsBusWrites = busWriteCount();
+        
+        // The chips hold what another player left: send every register
+        for (uint8_t i = 0; i < _numChips; i++) {
+            _sidDirty[i] = ((uint32_t)1 << SID_NUM_REGS) - 1;
+            _sidGateOff[i] = 0x07;
+        }
+        endSuppressedRun();
+        if (_tickPin != SID_NO_TICK_PIN) _tickRateChanged = true;
+    }
+    
+    if (standby && resetChips) {
+        for (uint8_t i = 0; i < _numChips; i++) {
+            _sids[i]->reset();
+        }
+    }
+    unlockCpu();
+}
+
+bool SIDPlayer::isStandby() {
+    return _standby;
+}
+
+void SIDPlayer::setWriteMode(SIDWriteMode mode) {
+    if (_writeMode == SID_WRITE_COALESCED && mode != SID_WRITE_COALESCED) {
+        flushWrites();
+    }
+    if (_writeMode == SID_WRITE_TIMED && mode != SID_WRITE_TIMED) {
+        drainWriteQueue();
+    }
+    _writeMode = mode;
+}
+
+SIDWriteMode SIDPlayer::getWriteMode() {
+    return _writeMode;
+}
+
+void SIDPlayer::setHardwareQueue(bool enable) {
+    if (enable == _hwQueue) return;
+    
+    drainWriteQueue();
+    for (uint8_t i = 0; i < _numChips; i++) {
+        _sids[i]->enableWriteQueue(enable, true);
+        _hwQueueSynced[i] = false;
     }
+    _hwQueue = enable;
 }
+
+// ============================================================================
+// Look-ahead frames
+// ============================================================================
+
+void SIDPlayer::playNextFrame() {
+    const SIDPlayerFrame* frame = _frameRing.peek();
+    if (!frame) {
+        // Nothing prepared in time (not counted before the first frame)
+        if (_framesPrimed) _underruns++;
+        return;
+    }
+    
+    if (_fastForward <= 1) {
+        writeFrame(*frame);
+        publishStats(frame->cycles, frame->instructions, frame->stores);
+        _frameRing.release();
+        _framesPrimed = true;
+        return;
+    }
+    
+    // Fast-forward: the tick's frames go out as the state they leave
+    SIDPlayerFrame merged = *frame;
+    _frameRing.release();
+    for (uint8_t n = 1; n < _fastForward && (frame = _frameRing.peek()) != NULL; n++) {
+        for (uint8_t i = 0; i < SID_MAX_CHIPS; i++) {
+            memcpy(merged.sid[i].regs, frame->sid[i].regs, SID_NUM_REGS);
+            merged.sid[i].dirty |= frame->sid[i].dirty;
+            merged.sid[i].gateOff |= frame->sid[i].gateOff;
+        }
+        merged.cycles = frame->cycles;
+        merged.instructions = frame->instructions;
+        merged.stores += frame->stores;
+        _frameRing.release();
+    }
+    
+    writeFrame(merged);
+    publishStats(merged.cycles, merged.instructions, merged.stores);
+    _framesPrimed = true;
+}
+
+void SIDPlayer::setLookAhead(uint8_t frames) {
+    lockCpu();
+#if defined(ESP32)
+    if (_task) {
+        // The task captures frames whatever the look-ahead
+        _lookAhead = frames < SID_FRAME_RING_SIZE ? frames : SID_FRAME_RING_SIZE;
+        unlockCpu();
+        return;
+    }
+#endif
+    Mos6502Player::setLookAhead(frames);
+    unlockCpu();
+}
+
+bool SIDPlayer::getStats(PlayerStats& stats) {
+    return _stats.read(stats);
+}
+
+void SIDPlayer::resetStats() {
+    _stats.clear();
+    _lateTicks = 0;
+    _statsJitterMax = 0;
+    _missedTicks = 0;
+}
+
+uint32_t SIDPlayer::busWriteCount() {
+    uint32_t sent = 0;
+    for (uint8_t i = 0; i < _numChips; i++) {
+        sent += _sids[i]->getBusWriteCount();
+    }
+    return sent;
+}
+
+void SIDPlayer::publishStats(uint32_t cycles, uint32_t instructions, uint16_t stores) {
+    uint32_t now = micros();
+    uint32_t spent = _statsMicros + (now - _updateStart);
+    _statsMicros = 0;
+    _updateStart = now;
+    
+    // Everything the chips were sent since the last record, whichever
+    // path (direct, batch or FIFO) it took
+    uint32_t sent = busWriteCount();
+    uint32_t writes = sent - _statsBusWrites;
+    _statsBusWrites = sent;
+    if (writes > 0xFFFF) writes = 0xFFFF;
+    
+    PlayerStats& s = _stats.edit();
+    s.cycles = cycles;
+    s.instructions = instructions;
+    s.stores = stores;
+    s.busWrites = writes;
+    s.coalesced = stores > writes ? stores - writes : 0;
+    s.bufferedFrames = _frameRing.count();
+    s.lateTicks = _lateTicks;
+    s.missedTicks = _missedTicks;
+    s.maxJitter = _statsJitterMax;
+    _stats.countFrame(spent, _playPeriodUs);
+    _stats.publish();
+}
+
+bool SIDPlayer::renderFrame(SIDFrame& frame) {
+    SIDPlayerFrame frames;
+    if (!renderFrame(frames)) return false;
+    
+    frame = frames.sid[0];
+    return true;
+}
+
+// ============================================================================
+// Play call rate
+// ============================================================================
+
+void SIDPlayer::selectSongSpeed() {
+    uint8_t bit = _currentSong < 31 ? _currentSong : 31;
+    _ciaSpeed = (_speedFlags >> bit) & 1;
+    updatePlayRate();
+}
+
+void SIDPlayer::updatePlayRate() {
+    uint32_t clock = _ntsc ? SID_CLOCK_NTSC : SID_CLOCK_PAL;
+    
+    if (_ciaSpeed) {
+        // Timer A underflows every latch + 1 cycles
+        uint16_t latch = _cia1.getLatchA();
+        if (!latch) latch = _ntsc ? SID_CIA_DEFAULT_LATCH_NTSC : SID_CIA_DEFAULT_LATCH_PAL;
+        setPlayRate((uint32_t)latch + 1, clock);
+    } else {
+        // Vertical blank: one call per video frame
+        setPlayRate(_ntsc ? SID_CYCLES_PER_FRAME_NTSC : SID_CYCLES_PER_FRAME_PAL, clock);
+    }
+    _rateChanged = false;
+    
+    // This can run on the emulation task, the bus write waits for update()
+    if (_tickPin != SID_NO_TICK_PIN) _tickRateChanged = true;
+}
+
+uint32_t SIDPlayer::getPlayPeriod() {
+    return _playPeriodUs;
+}
+
+uint32_t SIDPlayer::tickPeriod() {
+    // The gateware tick counts the SID clock, not the 6502 cycles of the C64
+    uint32_t clock = _ntsc ? SID_CLOCK_NTSC : SID_CLOCK_PAL;
+    return (uint32_t)(((uint64_t)_playPeriodCycles * SID_CLOCK_HZ + clock / 2) / clock);
+}
+
+bool SIDPlayer::startTimer() {
+    detachFrameTick();
+    return Mos6502Player::startTimer();
+}
+
+bool SIDPlayer::attachFrameTick(uint8_t pin) {
+#if defined(ESP32)
+    detachFrameTick();
+    stopTimer();
+    
+    pinMode(pin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(pin), &SIDPlayer::tickEntry, this, RISING);
+    _tickPin = pin;
+    _tickRateChanged = false;
+    _sids[0]->setFrameTick(tickPeriod(), true);
+    return true;
+#else
+    (void)pin;
+    return false;
+#endif
+}
+
+void SIDPlayer::detachFrameTick() {
+#if defined(ESP32)
+    if (_tickPin == SID_NO_TICK_PIN) return;
+    
+    _sids[0]->setFrameTick(0);
+    detachInterrupt(digitalPinToInterrupt(_tickPin));
+    _tickPin = SID_NO_TICK_PIN;
+    _tickRateChanged = false;
+#endif
+}
+
+#if defined(ESP32)
+void IRAM_ATTR SIDPlayer::tickEntry(void* arg) {
+    static_cast<SIDPlayer*>(arg)->timerCallback();
+}
+#endif
+
+// ============================================================================
+// Emulation task
+// ============================================================================
+
+void SIDPlayer::lockCpu() {
+#if defined(ESP32)
+    if (_cpuLock) xSemaphoreTake(_cpuLock, portMAX_DELAY);
+#endif
+}
+
+void SIDPlayer::unlockCpu() {
+#if defined(ESP32)
+    if (_cpuLock) xSemaphoreGive(_cpuLock);
+#endif
+}
+
+#if defined(ESP32)
+bool SIDPlayer::startTask(BaseType_t core, UBaseType_t priority) {
+    if (_task) return true;
+    
+    _cpuLock = xSemaphoreCreateMutex();
+    if (!_cpuLock) return false;
+    
+    if (!_frameCapture) startFrameCapture();
+    _taskRun = true;
+    
+    if (xTaskCreatePinnedToCore(taskEntry, "SIDPlayer", SID_TASK_STACK_SIZE,
+                                this, priority, &_task, core) != pdPASS) {
+        _task = NULL;
+        _taskRun = false;
+        if (!_lookAhead) _frameCapture = false;
+        vSemaphoreDelete(_cpuLock);
+        _cpuLock = NULL;
+        return false;
+    }
+    return true;
+}
+
+void SIDPlayer::stopTask() {
+    if (!_task) return;
+    
+    _taskRun = false;
+    while (_task) {
+        vTaskDelay(1);
+    }
+    
+    vSemaphoreDelete(_cpuLock);
+    _cpuLock = NULL;
+    
+    // Keep rendering ahead inside update() if a look-ahead is set
+    if (!_lookAhead) {
+        endFrameCapture();
+    }
+}
+
+void SIDPlayer::taskEntry(void* arg) {
+    static_cast<SIDPlayer*>(arg)->taskLoop();
+}
+
+void SIDPlayer::taskLoop() {
+    while (_taskRun) {
+        bool busy = false;
+        
+        xSemaphoreTake(_cpuLock, portMAX_DELAY);
+        if (needFrame()) {
+            startPlayCall();
+        }
+        if (_routine != SID_ROUTINE_NONE) {
+            // Run in slices so API calls from loop() can take the lock
+            uint32_t budget = _cycleBudget ? _cycleBudget : 0xFFFFFFFFUL;
+            runRoutine(budget);
+            busy = true;
+        }
+        xSemaphoreGive(_cpuLock);
+        
+        if (!busy) {
+            vTaskDelay(1);
+        }
+    }
+    
+    _task = NULL;
+    vTaskDelete(NULL);
+}
+#endif
@@ -19,27 +19,136 @@
 
 #include <Arduino.h>
 #include "SID6581.h"
+#include "Mos6502Player.h"
+#include "C64IO.h"
+#include "PlayerStats.h"
 
-// CPU Flags
-#define FLAG_N 128
-#define FLAG_V 64
-#define FLAG_B 16
-#define FLAG_D 8
-#define FLAG_I 4
-#define FLAG_Z 2
-#define FLAG_C 1
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#endif
+
+// C64 timing
+#define SID_CLOCK_PAL               985248UL    // 6510 / SID clock in Hz
+#define SID_CLOCK_NTSC              1022727UL
+#define SID_NO_TICK_PIN             0xFF        // No frame tick attached
+#define SID_CYCLES_PER_FRAME_PAL    19656       // 312 raster lines x 63 cycles
+#define SID_CYCLES_PER_FRAME_NTSC   17095       // 263 raster lines x 65 cycles
+#define SID_FRAME_PERIOD_US         20000       // 50Hz play call period
+
+// CIA 1 timer A latch left by the KERNAL (about 60Hz), programmed before
+// a tune's init routine runs
+#define SID_CIA_DEFAULT_LATCH_PAL   0x4025
+#define SID_CIA_DEFAULT_LATCH_NTSC  0x4295
+
+// SID chips one player can drive (PSID v3/v4 tunes use up to three)
+#ifndef SID_MAX_CHIPS
+#define SID_MAX_CHIPS               3
+#endif
+
+// Entries in the timed write queue (power of two)
+#define SID_WRITE_QUEUE_SIZE        256
+
+// 6502 cycle limits, see setCycleBudget() / setWatchdog()
+#define SID_DEFAULT_CYCLE_BUDGET    SID_CYCLES_PER_FRAME_PAL    // Per update() call
+#define SID_DEFAULT_WATCHDOG_CYCLES (10UL * SID_CLOCK_PAL)      // 10s of C64 time per routine
+#define SID_SEEK_ROUTINE_CYCLES     SID_DEFAULT_WATCHDOG_CYCLES // Per routine in seekToFrame(), watchdog off
+
+// Register frames buffered ahead of playback (power of two)
+#define SID_FRAME_RING_SIZE         16
+
+// Stack of the emulation task in bytes
+#define SID_TASK_STACK_SIZE         4096
+
+/**
+ * @brief How SID register stores made by the 6502 reach the chip
+ */
+enum SIDWriteMode {
+    SID_WRITE_DIRECT,       ///< Every store is sent to the bus immediately
+    SID_WRITE_COALESCED,    ///< Stores are shadowed and flushed once per routine call
+    SID_WRITE_TIMED         ///< Stores are timestamped and replayed at their cycle offset
+};
+
+/**
+ * @brief 6502 routine currently being executed
+ */
+enum SIDRoutine {
+    SID_ROUTINE_NONE = MOS6502_ROUTINE_NONE,
+    SID_ROUTINE_INIT,
+    SID_ROUTINE_PLAY,
+    SID_ROUTINE_FRAME           ///< One frame of free-running RSID machine time
+};
+
+/**
+ * @brief Register frames of every SID a tune uses, from one play call
+ */
+struct SIDPlayerFrame {
+    SIDFrame sid[SID_MAX_CHIPS];
+    uint32_t cycles;            // 6502 cycles of the play call
+    uint32_t instructions;      // 6502 instructions of it (MOS6502_COUNT_INSTRUCTIONS)
+    uint16_t stores;            // SID stores it made
+};
+
+// Size of the PSID/RSID header read before the program data
+#define SID_HEADER_SIZE             0x7C
+
+/**
+ * @brief Fields of a PSID/RSID file header, see SIDPlayer::readHeader()
+ */
+struct SIDHeader {
+    bool rsid;                  // Tune runs in real time from its own interrupts
+    uint8_t version;
+    uint16_t loadAddr;
+    uint16_t initAddr;
+    uint16_t playAddr;
+    uint8_t numSongs;
+    uint8_t startSong;          // Default sub-song, 0-based
+    uint32_t speedFlags;        // One bit per song, 1 = CIA-timed
+    bool ntsc;                  // Timed for an NTSC machine only
+    uint8_t sidModel;           // PSID v2+ model bits: 1 = 6581, 2 = 8580, 3 = both, 0 = unknown
+    uint8_t numSIDs;
+    uint16_t sidAddr[SID_MAX_CHIPS];
+    char title[33];
+    char author[33];
+    char copyright[33];
+    uint16_t dataAddr;          // Load address embedded before the program data
+    size_t dataStart;           // Offset of the program data in the file
+};
+
+/**
+ * @brief Handlers of the 6502 I/O pages
+ */
+enum SIDIOPage {
+    SID_IO_RAM = 0,             // Plain memory
+    SID_IO_SID,                 // SID registers ($D400-$D7FF)
+    SID_IO_CIA1,                // CIA 1 ($DC00-$DCFF)
+    SID_IO_CIA2,                // CIA 2 ($DD00-$DDFF)
+    SID_IO_VIC                  // VIC-II ($D000-$D3FF)
+};
 
 /**
  * @class SIDPlayer
  * @brief Plays .sid files using 6502 CPU emulation
+ *
+ * Playback, timer, cycle limit and look-ahead controls come from
+ * Mos6502Player.
  */
-class SIDPlayer {
+class SIDPlayer : public Mos6502Player<SIDPlayer, SIDPlayerFrame, SID_WRITE_QUEUE_SIZE,
+                                       SID_FRAME_RING_SIZE> {
 public:
     /**
      * @brief Constructor
+     * 
+     * Tunes written for two or three SIDs (PSID v3/v4) send the stores to
+     * their extra SID addresses to sid2 and sid3. Without them those
+     * stores are dropped.
+     * 
      * @param sid Pointer to SID6581 instance
+     * @param sid2 Second SID (optional, e.g. at WB_AUDIO_SID2_BASE)
+     * @param sid3 Third SID (optional, e.g. at WB_AUDIO_SID3_BASE)
      */
-    SIDPlayer(SID6581* sid);
+    SIDPlayer(SID6581* sid, SID6581* sid2 = NULL, SID6581* sid3 = NULL);
     
     /**
      * @brief Initialize the player
@@ -48,6 +157,14 @@ public:
     
     /**
      * @brief Load a SID file from memory
+     * 
+     * The tune's init routine is started here and runs from update().
+     * RSID tunes are not called per frame: the CPU keeps running from
+     * their init routine and is driven by the CIA and VIC interrupts
+     * they program, one frame of C64 time per tick.
+     * The tune is mapped in place rather than copied, so data must stay
+     * valid while it is loaded (an embedded tune in flash, for example).
+     * 
      * @param data Pointer to SID file data
      * @param length Length of data in bytes
      * @param subSong Sub-song number to play (0 = default)
@@ -57,6 +174,9 @@ public:
     
     /**
      * @brief Load a SID file from SPIFFS/LittleFS
+     * 
+     * The file is read page by page into the pages the tune occupies.
+     * 
      * @param filename Path to .sid file
      * @param subSong Sub-song number to play (0 = default)
      * @return true if loaded successfully
@@ -64,29 +184,133 @@ public:
     bool loadFile(const char* filename, uint8_t subSong = 0);
     
     /**
-     * @brief Start/stop playback
-     * @param play true to start, false to stop
+     * @brief Parse a PSID/RSID header without loading the tune
+     * 
+     * The header is followed by the two bytes of the embedded load
+     * address, so data should hold SID_HEADER_SIZE + 2 bytes or more.
+     * 
+     * @param data File contents from the start
+     * @param length Bytes available in data
+     * @param header Receives the fields
+     * @return false if data does not start with a valid header
      */
-    void play(bool play);
+    static bool readHeader(const uint8_t* data, size_t length, SIDHeader& header);
     
     /**
-     * @brief Check if currently playing
-     * @return true if playing
+     * @brief Start the player's own play call timer
+     * 
+     * As Mos6502Player::startTimer(), after detaching a frame tick taken
+     * with attachFrameTick().
+     * 
+     * @return true if the timer is running (always false off the ESP32)
      */
-    bool isPlaying();
+    bool startTimer();
     
     /**
-     * @brief Call this at 50Hz (PAL) or 60Hz (NTSC) from timer interrupt
+     * @brief Take play call ticks from the gateware frame tick
+     * 
+     * Programs the first SID's tick to the tune's play period in SID
+     * cycles and calls timerCallback() from a rising edge interrupt on
+     * pin, which must be wired to the slave's frame_irq output. The rate
+     * follows the SID clock, so it cannot drift from the audio. Rate
+     * changes are sent to the gateware on the next update(). Stops a
+     * timer started by startTimer().
+     * 
+     * @param pin GPIO connected to frame_irq
+     * @return true if the interrupt is attached (always false off the ESP32)
+     */
+    bool attachFrameTick(uint8_t pin);
+    
+    /**
+     * @brief Stop the gateware frame tick and release its interrupt
+     */
+    void detachFrameTick();
+    
+    /**
+     * @brief Get the time between play calls
+     * 
+     * Derived from the PSID speed and clock flags, and for CIA-timed songs
+     * from the CIA 1 timer A latch programmed by the tune.
+     * 
+     * @return Play call period in microseconds
+     */
+    uint32_t getPlayPeriod();
+    
+    /**
+     * @brief Call this from a timer at the rate given by getPlayPeriod()
+     *        (50Hz for most PAL tunes) when startTimer() is not used
      * Called from ISR context - runs the play routine
      */
     void timerCallback();
     
     /**
      * @brief Call this from main loop to process audio
-     * Runs the 6502 emulator
+     * 
+     * Runs the 6502 emulator for at most the cycle budget, then returns.
+     * A routine that does not finish in one call resumes on the next.
      */
     void update();
     
+    /**
+     * @brief Continue playback at a frame of the current sub-song
+     * 
+     * Runs the play routine up to the frame without sending anything to
+     * the chips, then sends the register state it left once. A frame
+     * before the current position replays the sub-song from its init,
+     * as restart() does, and sends every register afterwards.
+     * Returns when done, which takes a fraction of the frames' play time.
+     * With the watchdog disabled a routine is still stopped after
+     * SID_SEEK_ROUTINE_CYCLES, so a play routine that never returns
+     * cannot hang the call.
+     * 
+     * @param frame Play calls since the sub-song started
+     * @return false if no tune is loaded or a routine was stopped
+     */
+    bool seekToFrame(uint32_t frame);
+    
+    /**
+     * @brief Get the frame the chips are at
+     * @return Play calls heard since the sub-song started
+     */
+    uint32_t getPosition();
+    
+    /**
+     * @brief Play several frames per tick
+     * 
+     * Each tick emulates speed frames and only the state they leave is
+     * sent. With a look-ahead, a tick takes at most the frames prepared.
+     * 
+     * @param speed Frames per tick (0 or 1 = normal playback)
+     */
+    void setFastForward(uint8_t speed);
+    
+    /**
+     * @brief Get the fast-forward speed
+     * @return Frames per tick, 0 when playing normally
+     */
+    uint8_t getFastForward();
+    
+    /**
+     * @brief Keep the player off the chips while another one plays them
+     * 
+     * For two players on the same SIDs, as a Playlist uses them. In
+     * standby a player loads and runs init as usual, but its register
+     * stores wait in the player, and a load neither resets the chips nor
+     * reprograms the frame tick. Leaving standby sends the whole register
+     * state at once, with a release on every gated voice so the notes
+     * start clean, and drops a tick that came in while waiting.
+     * 
+     * @param standby True to stay off the chips
+     * @param resetChips Also reset the SIDs, silencing what they play
+     */
+    void setStandby(bool standby, bool resetChips = false);
+    
+    /**
+     * @brief Check if the player is in standby
+     * @return true while the player stays off the chips
+     */
+    bool isStandby();
+    
     /**
      * @brief Get song title from SID file
      * @return Song title string
@@ -111,6 +335,12 @@ public:
      */
     uint8_t getNumSongs();
     
+    /**
+     * @brief Get the number of SIDs the tune is written for
+     * @return 1 to 3, from the PSID header
+     */
+    uint8_t getNumSIDs();
+    
     /**
      * @brief Get current sub-song
      * @return Current sub-song number
@@ -126,44 +356,245 @@ public:
      * @brief Play previous sub-song
      */
     void prevSong();
+    
+    /**
+     * @brief Play the current sub-song again from its init routine
+     * 
+     * Like nextSong() and prevSong(), the tune memory is first returned
+     * to its state right after loading, without reading the file again.
+     */
+    void restart();
+    
+    /**
+     * @brief Select how SID register stores are sent to the chip
+     * 
+     * In SID_WRITE_COALESCED mode stores go into a shadow and only the
+     * registers that changed are sent when the init or play routine
+     * returns. A store that flips a voice's gate against the value still
+     * pending sends the pending writes first, so a retrigger (0-1-0) or a
+     * release (1-0-1) inside one call still reaches the chip.
+     * 
+     * Stores to $D419-$D41F (the read-only POT, OSC3 and ENV3 registers
+     * and the unused ones) are dropped in every mode; the chip ignores
+     * them and reads come from the C64 side.
+     * 
+     * @param mode SID_WRITE_DIRECT or SID_WRITE_COALESCED
+     */
+    void setWriteMode(SIDWriteMode mode);
+    
+    /**
+     * @brief Get the current SID write mode
+     * @return Current write mode
+     */
+    SIDWriteMode getWriteMode();
+    
+    /**
+     * @brief Hand timed writes to the gateware FIFO instead of replaying them
+     * 
+     * Only used in SID_WRITE_TIMED mode. After each play call the frame's
+     * writes are pushed to the SID slave's timed write FIFO with their
+     * cycle spacing, and the FPGA applies them on its own 1MHz clock.
+     * The spacing is scaled from C64 CPU cycles to SID_CLOCK_HZ.
+     * 
+     * @param enable True to use the gateware FIFO
+     */
+    void setHardwareQueue(bool enable);
+    
+    /**
+     * @brief Render play calls ahead of the tick
+     * 
+     * As Mos6502Player::setLookAhead(); while the emulation task runs
+     * only the number of frames it keeps ready changes.
+     * 
+     * @param frames Frames to keep ready (0 = off, max SID_FRAME_RING_SIZE)
+     */
+    void setLookAhead(uint8_t frames);
+    
+    /**
+     * @brief Get the statistics of the last frame played
+     * 
+     * The player publishes a new record after every play call (or, when
+     * frames are rendered ahead, every frame it writes out). Safe to call
+     * from any task: the record is read without a lock.
+     * 
+     * @param stats Receives the statistics
+     * @return false if the player was publishing throughout the call
+     */
+    bool getStats(PlayerStats& stats);
+    
+    /**
+     * @brief Clear the statistics
+     * Call from the task that calls update().
+     */
+    void resetStats();
+    
+    /**
+     * @brief Like Mos6502Player::renderFrame(), with the frame of the first SID only
+     * @param frame Receives the frame of the first SID
+     * @return false if no tune is loaded or the watchdog stopped it
+     */
+    bool renderFrame(SIDFrame& frame);
+    using Mos6502Player::renderFrame;
+    
+#if defined(ESP32)
+    /**
+     * @brief Run the 6502 emulator in a FreeRTOS task
+     * 
+     * The task emulates play calls ahead of time and queues the register
+     * frame of each call in a lock-free ring. update() then only writes
+     * the next frame to the SID on each tick. SID stores are captured per
+     * frame as in SID_WRITE_COALESCED mode while the task runs.
+     * 
+     * @param core Core to pin the task to (default 0; Arduino loop() runs on 1)
+     * @param priority FreeRTOS task priority
+     * @return true if the task is running
+     */
+    bool startTask(BaseType_t core = 0, UBaseType_t priority = 1);
+    
+    /**
+     * @brief Stop the emulation task and go back to emulating in update()
+     */
+    void stopTask();
+#endif
 
 private:
-    SID6581* _sid;
-    bool _playing;
-    bool _fileLoaded;
-    volatile bool _timerTick;
+    SID6581* _sids[SID_MAX_CHIPS];
+    uint8_t _numChips;          // Chips passed to the constructor
     
     // SID file header info
     uint16_t _loadAddr;
     uint16_t _initAddr;
     uint16_t _playAddr;
+    uint8_t _numSIDs;           // SIDs the tune is written for
+    uint16_t _sidAddr[SID_MAX_CHIPS];   // 6502 address of each SID
+    uint8_t _sidSlots[128];     // Chip + 1 for each 32-byte slot of $D000-$DFFF, 0 = none
     uint8_t _numSongs;
     uint8_t _currentSong;
     char _title[33];
     char _author[33];
     char _copyright[33];
     
-    // 6502 CPU state
-    uint8_t _memory[65536];
-    uint8_t _a, _x, _y, _s, _p;
-    uint16_t _pc;
-    uint32_t _cycles;
+    // SID register shadow (coalesced write mode), one per chip
+    SIDWriteMode _writeMode;
+    uint8_t _sidShadow[SID_MAX_CHIPS][SID_NUM_REGS];  // Last value stored by the tune
+    uint32_t _sidDirty[SID_MAX_CHIPS];      // Registers stored since the last flush
+    uint8_t _sidGateOff[SID_MAX_CHIPS];     // Voices whose gate was cleared since the last flush
     
-    // CPU emulation
-    void cpuReset();
-    void cpuJsr(uint16_t addr, uint8_t acc);
-    bool cpuStep();
+    // Gateware FIFO for the timed writes (SID_WRITE_TIMED mode)
+    bool _hwQueue;              // Push timed writes to the gateware FIFO
+    bool _hwQueueSynced[SID_MAX_CHIPS];     // _hwQueueCycle matches what the FIFO is playing
+    uint32_t _hwQueueCycle[SID_MAX_CHIPS];  // Cycle of the last entry pushed to each FIFO
+    uint32_t _hwQueueRemainder[SID_MAX_CHIPS];  // SID clock fraction carried, in 1/CPU clock
+    
+    // Play call rate
+    uint32_t _speedFlags;       // PSID speed bits, 1 = song is CIA-timed
+    bool _ntsc;                 // Tune is timed for an NTSC machine
+    bool _ciaSpeed;             // Current song is driven by CIA 1 timer A
+    bool _rateChanged;          // The tune wrote the timer A latch
+#if defined(ESP32)
+    static void tickEntry(void* arg);
+#endif
+    uint8_t _tickPin;           // GPIO of the frame tick, SID_NO_TICK_PIN if none
+    bool _tickRateChanged;      // The gateware tick needs the new period
+    
+    // C64 chips around the SID, their interrupts only reach RSID tunes
+    bool _rsid;                 // Tune runs in real time from its own interrupts
+    CIA6526 _cia1;              // IRQ source
+    CIA6526 _cia2;              // NMI source
+    VICRaster _vic;             // Raster IRQ source
+    uint64_t _nextEvent;        // Cycle of the next interrupt, see updateInterrupts()
+    bool _irqLine;              // IRQ asserted by CIA 1 or the VIC
+    bool _nmiLine;              // CIA 2 interrupt output
+    bool _nmiPending;           // NMI is edge-triggered: taken once per edge
+    
+    // Seek and fast-forward
+    uint32_t _framesRun;        // Play calls finished since init
+    bool _suppressOutput;       // Stores wait in _sidShadow until the run ends
+    bool _seeking;
+    uint8_t _fastForward;       // Frames per tick, 0 = normal
+    uint8_t _fastLeft;          // Frames left of the current tick
+    bool _standby;              // Stores wait until setStandby(false)
+    
+    // Per-frame statistics; the counts of a play call are taken by the
+    // side that emulates it, the rest belongs to update()
+    PlayerStatsCell _stats;
+    uint16_t _frameStores;      // SID stores since the last play call was counted
+    uint64_t _frameInstructions;    // Instruction counter at that point
+    uint32_t _statsBusWrites;   // Bus write count of the SIDs at the last record
+    uint32_t _statsMicros;      // update() time spent on the coming frame
+    uint32_t _updateStart;      // When the update() in progress started
+    uint32_t _lateTicks;
+    uint32_t _statsJitterMax;
+    volatile uint32_t _missedTicks;
+    
+#if defined(ESP32)
+    // Emulation task
+    TaskHandle_t _task;
+    SemaphoreHandle_t _cpuLock; // Held by whoever runs or modifies the CPU
+    volatile bool _taskRun;
+    
+    static void taskEntry(void* arg);
+    void taskLoop();
+#endif
+    
+    // The player is the bus of its CPU and the chip side of Mos6502Player
+    friend class Mos6502<SIDPlayer>;
+    friend class Mos6502Player;
+    PagedMemory& memory() { return _memory; }
+    uint8_t ioRead(uint16_t addr) { return getMem(addr); }
+    void ioWrite(uint16_t addr, uint8_t value) { setMem(addr, value); }
+    uint64_t nextEvent() const { return _nextEvent; }
+    void serviceEvents(uint64_t now);
+    bool irqLine() const { return _irqLine; }
+    bool takeNmi();
+    bool idleUntilEvent() const { return _routine == SID_ROUTINE_FRAME; }
+    
+    void startInit();
+    void startPlayCall();
+    bool runRoutine(uint32_t& budget);
+    void finishRoutine();
     
     uint8_t getMem(uint16_t addr);
     void setMem(uint16_t addr, uint8_t value);
+    uint8_t readIO(uint8_t handler, uint16_t addr);
+    void writeIO(uint8_t handler, uint16_t addr, uint8_t value);
+    void writeSIDReg(uint8_t chip, uint8_t reg, uint8_t value);
+    void sendWrite(uint8_t chip, uint8_t reg, uint8_t value) { _sids[chip]->writeReg(reg, value); }
+    
+    void resetIO();
+    void installKernal();
+    void updateInterrupts();
+    
+    void lockCpu();
+    void unlockCpu();
+    
+    void storeSIDReg(uint8_t chip, uint8_t reg, uint8_t value);
+    void flushWrites();
+    void pushSIDFrame();
+    void writeFrame(const SIDPlayerFrame& frame);
+    void resetSIDs();
+    void mapIO();
+    
+    void playNextFrame();
+    void resetSIDShadow();
+    void holdPendingWrites();
+    void endSuppressedRun();
     
-    uint8_t getAddr(uint8_t mode);
-    void setAddr(uint8_t mode, uint8_t val);
-    void putAddr(uint8_t mode, uint8_t val);
-    void branch(bool condition);
+    void pushWriteQueueToChip();
+    void beginPlayFrame();
     
-    // Parse SID file header
-    bool parseSIDHeader(const uint8_t* data, size_t length);
+    // Parse SID file header, returns where the program data starts
+    bool parseSIDHeader(const uint8_t* data, size_t length, uint16_t& dataAddr, size_t& dataStart);
+    void initTune(uint8_t subSong);
+    void switchSong(uint8_t song);
+    void selectSongSpeed();
+    uint32_t tickPeriod();      // Play period in SID clocks, for the gateware tick
+    void updatePlayRate();
+    void consumeTick();
+    bool takeTick();
+    void runUpdate();
+    uint32_t busWriteCount();
+    void publishStats(uint32_t cycles, uint32_t instructions, uint16_t stores);
 };
 
 #endif // SID_PLAYER_H
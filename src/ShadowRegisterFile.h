@@ -0,0 +1,228 @@
+/**
+ * @file ShadowRegisterFile.h
+ * @brief Host-side copy of a peripheral's write-only registers
+ *
+ * The sound chips' registers cannot be read back, so every chip class
+ * keeps what it last wrote in a ShadowRegisterFile. A write that would
+ * not change a register is dropped, and getters read the shadow instead
+ * of the bus.
+ *
+ * In write-through mode each write goes out at once. In deferred mode
+ * writes are only staged and commit() sends every register that changed
+ * since the last commit, runs of neighbouring registers as one burst.
+ * Registers with a side effect on every write (the YM2149 envelope shape
+ * restarts the envelope) are marked always-write and are never dropped.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef SHADOW_REGISTER_FILE_H
+#define SHADOW_REGISTER_FILE_H
+
+#include <Arduino.h>
+#include "AudioBus.h"
+
+// Clean registers a commit may rewrite to join two bursts into one. A burst
+// only saves bus time when the transport has a burst primitive.
+#ifndef SHADOW_BURST_GAP
+#if defined(AUDIO_BUS_BURST_WRITE16) || defined(AUDIO_BUS_BURST_WRITE8)
+#define SHADOW_BURST_GAP    2
+#else
+#define SHADOW_BURST_GAP    0
+#endif
+#endif
+
+enum ShadowCommitMode {
+    SHADOW_WRITE_THROUGH,       // Every write goes to the chip at once
+    SHADOW_DEFERRED             // Writes are staged until commit()
+};
+
+enum ShadowBusWidth {
+    SHADOW_BUS_16,              // audioBusWrite16 / audioBusBurstWrite16
+    SHADOW_BUS_8                // audioBusWrite8 / audioBusBurstWrite8
+};
+
+/**
+ * @class ShadowRegisterFile
+ * @brief Register shadow with a dirty mask
+ * @tparam N Number of registers, from the base address up (1-32)
+ * @tparam W Bus the peripheral sits on
+ */
+template <uint8_t N, ShadowBusWidth W = SHADOW_BUS_16>
+class ShadowRegisterFile {
+    static_assert(N > 0 && N <= 32, "ShadowRegisterFile holds 1 to 32 registers");
+
+public:
+    ShadowRegisterFile() :
+        _baseAddr(0), _mode(SHADOW_WRITE_THROUGH), _dirty(ALL), _unknown(ALL), _always(0), _sentCount(0)
+    {
+        memset(_regs, 0, sizeof(_regs));
+        memset(_chip, 0, sizeof(_chip));
+    }
+
+    /**
+     * @brief Set the Wishbone address of register 0
+     */
+    void begin(uint16_t baseAddr) { _baseAddr = baseAddr; }
+
+    uint16_t getBaseAddr() const { return _baseAddr; }
+
+    /**
+     * @brief Select write-through or deferred writes
+     * Switching to write-through commits what is staged.
+     */
+    void setMode(ShadowCommitMode mode) {
+        _mode = mode;
+        if (mode == SHADOW_WRITE_THROUGH) commit();
+    }
+
+    ShadowCommitMode getMode() const { return (ShadowCommitMode)_mode; }
+
+    /**
+     * @brief Never drop writes to a register
+     * @param reg Register whose writes have a side effect
+     * @param always False to drop unchanged writes again
+     */
+    void setAlwaysWrite(uint8_t reg, bool always = true) {
+        if (always) {
+            _always |= bit(reg);
+        } else {
+            _always &= ~bit(reg);
+        }
+    }
+
+    /**
+     * @brief Get the last value written to a register (staged or sent)
+     */
+    uint8_t get(uint8_t reg) const { return _regs[reg]; }
+
+    /**
+     * @brief Get the value the chip holds, without staged writes
+     */
+    uint8_t sent(uint8_t reg) const { return _chip[reg]; }
+
+    /**
+     * @brief Get the registers the next commit() sends
+     */
+    uint32_t dirtyMask() const { return _dirty; }
+
+    /**
+     * @brief Get the number of register values put on the bus
+     * Counts commits and record()ed writes since the file was created.
+     */
+    uint32_t sentCount() const { return _sentCount; }
+
+    /**
+     * @brief Write one register
+     */
+    void write(uint8_t reg, uint8_t value) {
+        stage(reg, value);
+        if (_mode == SHADOW_WRITE_THROUGH) commit();
+    }
+
+    /**
+     * @brief Write consecutive registers
+     */
+    void writeRegs(uint8_t start, const uint8_t* values, uint8_t count) {
+        for (uint8_t i = 0; i < count; i++) stage(start + i, values[i]);
+        if (_mode == SHADOW_WRITE_THROUGH) commit();
+    }
+
+    /**
+     * @brief Send every register that changed since the last commit
+     */
+    void commit() {
+        uint8_t reg = 0;
+        while (_dirty) {
+            while (!(_dirty & bit(reg))) reg++;
+
+            // Extend the burst over dirty registers and short gaps of clean
+            // ones, which are rewritten with the value they already hold
+            uint8_t last = reg;
+            for (uint8_t r = reg + 1; r < N; r++) {
+                if (_dirty & bit(r)) {
+                    last = r;
+                } else if ((_always & bit(r)) || r - last > SHADOW_BURST_GAP) {
+                    break;
+                }
+            }
+
+            uint8_t count = last - reg + 1;
+            if (W == SHADOW_BUS_8) {
+                audioBusBurstWrite8(_baseAddr + reg, &_regs[reg], count);
+            } else {
+                audioBusBurstWrite16(_baseAddr + reg, &_regs[reg], count);
+            }
+            memcpy(&_chip[reg], &_regs[reg], count);
+            _sentCount += count;
+
+            uint32_t sentMask = (uint32_t)(((uint64_t)1 << (last + 1)) - 1) & ~(bit(reg) - 1);
+            _dirty &= ~sentMask;
+            _unknown &= ~sentMask;
+            reg = last + 1;
+        }
+    }
+
+    /**
+     * @brief Note a value the chip was given some other way
+     *
+     * For writes that bypass the shadow, such as a batch spanning several
+     * chips or an entry of a gateware write queue.
+     */
+    void record(uint8_t reg, uint8_t value) {
+        _regs[reg] = value;
+        _chip[reg] = value;
+        _dirty &= ~bit(reg);
+        _unknown &= ~bit(reg);
+        _sentCount++;
+    }
+
+    /**
+     * @brief Forget what the chip holds
+     * The next commit sends every register.
+     */
+    void invalidate() {
+        _dirty = ALL;
+        _unknown = ALL;
+    }
+
+    /**
+     * @brief Load every register and send the whole file in one burst
+     * @param values N register values, NULL for zeros
+     */
+    void reset(const uint8_t* values = NULL) {
+        if (values) {
+            memcpy(_regs, values, N);
+        } else {
+            memset(_regs, 0, N);
+        }
+        invalidate();
+        commit();
+    }
+
+private:
+    static const uint32_t ALL = (uint32_t)(((uint64_t)1 << N) - 1);
+
+    uint16_t _baseAddr;
+    uint8_t _mode;
+    uint8_t _regs[N];           // Last value written, staged or not
+    uint8_t _chip[N];           // Last value sent
+    uint32_t _dirty;            // Registers the next commit sends
+    uint32_t _unknown;          // Registers never sent since invalidate()
+    uint32_t _always;           // Registers whose writes are never dropped
+    uint32_t _sentCount;        // Register values sent or recorded
+
+    static uint32_t bit(uint8_t reg) { return (uint32_t)1 << reg; }
+
+    void stage(uint8_t reg, uint8_t value) {
+        _regs[reg] = value;
+        if (value != _chip[reg] || ((_always | _unknown) & bit(reg))) {
+            _dirty |= bit(reg);
+        } else {
+            _dirty &= ~bit(reg);
+        }
+    }
+};
+
+#endif // SHADOW_REGISTER_FILE_H
@@ -0,0 +1,411 @@
+/**
+ * @file TuneLibrary.cpp
+ * @brief Tune index implementation
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "TuneLibrary.h"
+#include "SIDPlayer.h"
+#include "YMPlayer.h"
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static char lowerCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static bool sameNoCase(const char* a, const char* b) {
+    while (*a && lowerCase(*a) == lowerCase(*b)) {
+        a++;
+        b++;
+    }
+    return !*a && !*b;
+}
+
+static bool containsNoCase(const char* text, const char* word) {
+    for (; *text; text++) {
+        const char* t = text;
+        const char* w = word;
+        while (*w && lowerCase(*t) == lowerCase(*w)) {
+            t++;
+            w++;
+        }
+        if (!*w) return true;
+    }
+    return !*word;
+}
+
+uint32_t TuneLibrary::hashPath(const char* path) {
+    uint32_t hash = 2166136261UL;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+uint8_t TuneLibrary::tuneType(const char* path) {
+    const char* ext = strrchr(path, '.');
+    if (!ext) return 0;
+    if (sameNoCase(ext, ".sid")) return TUNE_TYPE_SID;
+    if (sameNoCase(ext, ".ym")) return TUNE_TYPE_YM;
+    if (sameNoCase(ext, ".ymd")) return TUNE_TYPE_YMD;
+    return 0;
+}
+
+bool TuneLibrary::matches(const TuneFilter& filter, const TuneEntry& entry) {
+    if (filter.types && !(filter.types & entry.type)) return false;
+    if (entry.numSongs < filter.minSongs) return false;
+    if (filter.text && *filter.text &&
+        !containsNoCase(entry.title, filter.text) &&
+        !containsNoCase(entry.author, filter.text) &&
+        !containsNoCase(entry.copyright, filter.text)) {
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Index file
+// ============================================================================
+
+TuneLibrary::TuneLibrary() : _count(0), _pathBase(0), _reused(0), _parsed(0) {
+    strcpy(_indexPath, TUNE_LIBRARY_INDEX);
+}
+
+TuneLibrary::~TuneLibrary() {
+    end();
+}
+
+bool TuneLibrary::begin(const char* indexPath) {
+    end();
+    if (indexPath != _indexPath) {
+        strncpy(_indexPath, indexPath, sizeof(_indexPath) - 1);
+        _indexPath[sizeof(_indexPath) - 1] = '\0';
+    }
+
+    if (!LittleFS.exists(_indexPath)) return false;
+    _index = LittleFS.open(_indexPath, "r");
+    if (!_index) return false;
+
+    IndexHeader header;
+    if (_index.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != TUNE_LIBRARY_MAGIC || header.version != TUNE_LIBRARY_VERSION ||
+        header.entrySize != sizeof(TuneEntry)) {
+        _index.close();
+        return false;
+    }
+
+    _count = header.count;
+    _pathBase = sizeof(IndexHeader) + header.count * sizeof(TuneEntry);
+    return true;
+}
+
+void TuneLibrary::end() {
+    _index.close();
+    _count = 0;
+    _pathBase = 0;
+}
+
+bool TuneLibrary::readEntries(uint32_t first, TuneEntry* out, uint16_t n) {
+    size_t bytes = (size_t)n * sizeof(TuneEntry);
+    return _index.seek(sizeof(IndexHeader) + first * sizeof(TuneEntry)) &&
+           _index.read((uint8_t*)out, bytes) == bytes;
+}
+
+bool TuneLibrary::getEntry(uint32_t index, TuneEntry& entry) {
+    if (index >= _count) return false;
+    return readEntries(index, &entry, 1);
+}
+
+bool TuneLibrary::getPath(const TuneEntry& entry, char* path, size_t size) {
+    if (!size || !_index.seek(_pathBase + entry.pathOffset)) return false;
+
+    size_t n = _index.read((uint8_t*)path, size);
+    for (size_t i = 0; i < n; i++) {
+        if (path[i] == '\0') return true;
+    }
+    path[0] = '\0';
+    return false;
+}
+
+int32_t TuneLibrary::findPath(const char* path) {
+    uint32_t hash = hashPath(path);
+    TuneEntry batch[TUNE_LIBRARY_READ_BATCH];
+    char found[TUNE_LIBRARY_PATH_MAX];
+
+    for (uint32_t first = 0; first < _count; first += TUNE_LIBRARY_READ_BATCH) {
+        uint16_t n = _count - first < TUNE_LIBRARY_READ_BATCH ? _count - first : TUNE_LIBRARY_READ_BATCH;
+        if (!readEntries(first, batch, n)) return -1;
+
+        for (uint16_t i = 0; i < n; i++) {
+            // The hash picks the candidates, the path decides
+            if (batch[i].pathHash == hash && getPath(batch[i], found, sizeof(found)) &&
+                strcmp(found, path) == 0) {
+                return first + i;
+            }
+        }
+    }
+    return -1;
+}
+
+uint16_t TuneLibrary::find(const TuneFilter& filter, uint32_t& cursor, TuneEntry* out, uint16_t max,
+                           uint32_t* indices) {
+    TuneEntry batch[TUNE_LIBRARY_READ_BATCH];
+    uint16_t found = 0;
+
+    while (found < max && cursor < _count) {
+        uint16_t n = _count - cursor < TUNE_LIBRARY_READ_BATCH ? _count - cursor : TUNE_LIBRARY_READ_BATCH;
+        if (!readEntries(cursor, batch, n)) {
+            cursor = _count;
+            break;
+        }
+
+        // Stop right after the entry that fills the page
+        uint16_t i = 0;
+        while (i < n && found < max) {
+            if (matches(filter, batch[i])) {
+                if (indices) indices[found] = cursor + i;
+                out[found++] = batch[i];
+            }
+            i++;
+        }
+        cursor += i;
+    }
+    return found;
+}
+
+uint32_t TuneLibrary::countMatches(const TuneFilter& filter) {
+    TuneEntry batch[TUNE_LIBRARY_READ_BATCH];
+    uint32_t count = 0;
+
+    for (uint32_t first = 0; first < _count; first += TUNE_LIBRARY_READ_BATCH) {
+        uint16_t n = _count - first < TUNE_LIBRARY_READ_BATCH ? _count - first : TUNE_LIBRARY_READ_BATCH;
+        if (!readEntries(first, batch, n)) break;
+        for (uint16_t i = 0; i < n; i++) {
+            if (matches(filter, batch[i])) count++;
+        }
+    }
+    return count;
+}
+
+// ============================================================================
+// Building
+// ============================================================================
+
+bool TuneLibrary::parseTune(const char* path, TuneEntry& entry) {
+    uint8_t type = tuneType(path);
+
+    if (type & TUNE_TYPE_SID) {
+        File file = LittleFS.open(path, "r");
+        if (!file) return false;
+        uint8_t data[SID_HEADER_SIZE + 2];
+        size_t length = file.read(data, sizeof(data));
+        file.close();
+
+        SIDHeader header;
+        if (!SIDPlayer::readHeader(data, length, header)) return false;
+
+        entry.type = header.rsid ? TUNE_TYPE_RSID : TUNE_TYPE_PSID;
+        entry.numSongs = header.numSongs;
+        entry.startSong = header.startSong;
+        entry.speedFlags = header.speedFlags;
+        entry.chips = header.numSIDs;
+        if (header.sidModel & 1) entry.chips |= TUNE_CHIPS_6581;
+        if (header.sidModel & 2) entry.chips |= TUNE_CHIPS_8580;
+        if (header.ntsc) entry.chips |= TUNE_CHIPS_NTSC;
+        memcpy(entry.title, header.title, sizeof(entry.title));
+        memcpy(entry.author, header.author, sizeof(entry.author));
+        memcpy(entry.copyright, header.copyright, sizeof(entry.copyright));
+        return true;
+    }
+
+    YMInfo info;
+    if (!YMPlayer::readInfo(path, info)) return false;
+
+    entry.type = info.version ? TUNE_TYPE_YM : TUNE_TYPE_YMD;
+    entry.numSongs = 1;
+    entry.chips = 1;
+    entry.length = (uint32_t)((uint64_t)info.numFrames * 1000 / info.frameRate);
+    memcpy(entry.title, info.title, sizeof(entry.title));
+    memcpy(entry.author, info.author, sizeof(entry.author));
+    memcpy(entry.copyright, info.comment, sizeof(entry.copyright));
+    return true;
+}
+
+void TuneLibrary::addFile(Builder& b, const char* path, uint32_t size, uint32_t modified) {
+    TuneEntry entry;
+    uint32_t hash = hashPath(path);
+    bool reused = false;
+
+    // Directories list in the same order as last time, so the old entry is
+    // usually the one after the previous match
+    for (uint32_t n = 0; n < b.numKeys; n++) {
+        uint32_t i = (b.hint + n) % b.numKeys;
+        const EntryKey& key = b.keys[i];
+        if (key.pathHash != hash) continue;
+
+        if (key.fileSize == size && key.modified == modified && readEntries(i, &entry, 1)) {
+            reused = true;
+            b.hint = i + 1;
+        }
+        break;
+    }
+
+    if (reused) {
+        _reused++;
+    } else {
+        memset(&entry, 0, sizeof(entry));
+        if (!parseTune(path, entry)) return;
+        entry.pathHash = hash;
+        entry.fileSize = size;
+        entry.modified = modified;
+        _parsed++;
+    }
+
+    size_t length = strlen(path) + 1;
+    entry.pathOffset = b.pathBytes;
+    if (b.paths.write((const uint8_t*)path, length) != length ||
+        b.out.write((const uint8_t*)&entry, sizeof(entry)) != sizeof(entry)) {
+        b.failed = true;
+        return;
+    }
+    b.pathBytes += length;
+    b.count++;
+}
+
+#if defined(ESP32) || defined(ESP8266)
+void TuneLibrary::scanDirectory(Builder& b, const char* dir, uint8_t depth) {
+    File d = LittleFS.open(dir);
+    if (!d) return;
+    if (!d.isDirectory()) {
+        d.close();
+        return;
+    }
+
+    size_t dirLength = strlen(dir);
+    const char* sep = (dirLength && dir[dirLength - 1] == '/') ? "" : "/";
+    char path[TUNE_LIBRARY_PATH_MAX];
+
+    File f;
+    while (!b.failed && (f = d.openNextFile())) {
+        // Older cores name entries by their full path, newer ones by name
+        const char* name = f.name();
+        int length = (name[0] == '/') ? snprintf(path, sizeof(path), "%s", name)
+                                      : snprintf(path, sizeof(path), "%s%s%s", dir, sep, name);
+        bool isDir = f.isDirectory();
+        uint32_t size = f.size();
+        uint32_t modified = (uint32_t)f.getLastWrite();
+        f.close();
+        if (length < 0 || (size_t)length >= sizeof(path)) continue;
+
+        if (isDir) {
+            if (depth + 1 < TUNE_LIBRARY_DEPTH) scanDirectory(b, path, depth + 1);
+        } else if (tuneType(path)) {
+            addFile(b, path, size, modified);
+        }
+    }
+    d.close();
+}
+
+bool TuneLibrary::update(const char* root) {
+    Builder b;
+    b.keys = NULL;
+    b.numKeys = 0;
+    b.hint = 0;
+    b.count = 0;
+    b.pathBytes = 0;
+    b.failed = false;
+    _reused = 0;
+    _parsed = 0;
+
+    // Keys of the old entries in one pass; without them every file is parsed
+    if (_count) {
+        b.keys = (EntryKey*)malloc(_count * sizeof(EntryKey));
+    }
+    if (b.keys) {
+        TuneEntry batch[TUNE_LIBRARY_READ_BATCH];
+        for (uint32_t first = 0; first < _count; first += TUNE_LIBRARY_READ_BATCH) {
+            uint16_t n = _count - first < TUNE_LIBRARY_READ_BATCH ? _count - first : TUNE_LIBRARY_READ_BATCH;
+            if (!readEntries(first, batch, n)) {
+                free(b.keys);
+                b.keys = NULL;
+                break;
+            }
+            for (uint16_t i = 0; i < n; i++) {
+                b.keys[first + i].pathHash = batch[i].pathHash;
+                b.keys[first + i].fileSize = batch[i].fileSize;
+                b.keys[first + i].modified = batch[i].modified;
+            }
+        }
+        if (b.keys) b.numKeys = _count;
+    }
+
+    // Written next to the old index, which stays valid until the swap
+    char newPath[TUNE_LIBRARY_PATH_MAX + 4];
+    char pathsPath[TUNE_LIBRARY_PATH_MAX + 4];
+    snprintf(newPath, sizeof(newPath), "%s.new", _indexPath);
+    snprintf(pathsPath, sizeof(pathsPath), "%s.pth", _indexPath);
+
+    IndexHeader header;
+    header.magic = TUNE_LIBRARY_MAGIC;
+    header.version = TUNE_LIBRARY_VERSION;
+    header.entrySize = sizeof(TuneEntry);
+    header.count = 0;
+    header.pathBytes = 0;
+
+    b.out = LittleFS.open(newPath, "w");
+    b.paths = LittleFS.open(pathsPath, "w");
+    b.failed = !b.out || !b.paths ||
+               b.out.write((const uint8_t*)&header, sizeof(header)) != sizeof(header);
+    if (!b.failed) scanDirectory(b, root, 0);
+    b.paths.close();
+    free(b.keys);
+
+    // The path table goes after the entries, then the real header
+    if (!b.failed) {
+        File paths = LittleFS.open(pathsPath, "r");
+        uint8_t chunk[128];
+        size_t n;
+        while (paths && (n = paths.read(chunk, sizeof(chunk))) > 0) {
+            if (b.out.write(chunk, n) != n) b.failed = true;
+        }
+        paths.close();
+
+        header.count = b.count;
+        header.pathBytes = b.pathBytes;
+        if (!b.out.seek(0) ||
+            b.out.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+            b.failed = true;
+        }
+    }
+    b.out.close();
+    LittleFS.remove(pathsPath);
+
+    if (b.failed) {
+        LittleFS.remove(newPath);
+        return false;
+    }
+
+    end();
+    LittleFS.remove(_indexPath);
+    if (!LittleFS.rename(newPath, _indexPath)) return false;
+    return begin(_indexPath);
+}
+#else
+// Directory listing needs the board's file system
+void TuneLibrary::scanDirectory(Builder& b, const char* dir, uint8_t depth) {
+    (void)b;
+    (void)dir;
+    (void)depth;
+}
+
+bool TuneLibrary::update(const char* root) {
+    (void)root;
+    return false;
+}
+#endif
@@ -0,0 +1,234 @@
+/**
+ * @file TuneLibrary.h
+ * @brief Binary index of the SID and YM files on LittleFS
+ *
+ * Browsing a large collection should not mean opening every tune. The
+ * library keeps one index file: a header, a fixed-size TuneEntry per tune
+ * and a table of the paths. An entry holds what a menu shows and what a
+ * filter needs, so startup only opens the index, and queries read the
+ * entries in order instead of holding the collection in RAM.
+ *
+ * update() walks the directories and writes a new index. A file whose
+ * path hash, size and modification time match its old entry keeps that
+ * entry; only new or changed files are opened, and their headers parsed
+ * with SIDPlayer::readHeader() and YMPlayer::readInfo().
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef TUNE_LIBRARY_H
+#define TUNE_LIBRARY_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#define TUNE_LIBRARY_MAGIC      0x42494C54UL    // "TLIB"
+#define TUNE_LIBRARY_VERSION    1
+#define TUNE_LIBRARY_INDEX      "/tunes.idx"
+
+// Longest path update() indexes, and the directory levels it descends
+#define TUNE_LIBRARY_PATH_MAX   128
+#define TUNE_LIBRARY_DEPTH      4
+
+// Entries read from the index at a time by the queries
+#define TUNE_LIBRARY_READ_BATCH 4
+
+// Tune types (bits, so a filter can take several)
+#define TUNE_TYPE_PSID          0x01
+#define TUNE_TYPE_RSID          0x02
+#define TUNE_TYPE_YM            0x04    // YM5/YM6, packed or plain
+#define TUNE_TYPE_YMD           0x08    // Raw YM register dump
+#define TUNE_TYPE_SID           (TUNE_TYPE_PSID | TUNE_TYPE_RSID)
+#define TUNE_TYPE_ALL           0x0F
+
+// TuneEntry::chips
+#define TUNE_CHIPS_COUNT        0x03    // Chips the tune plays on (1-3)
+#define TUNE_CHIPS_6581         0x04    // Written for the 6581
+#define TUNE_CHIPS_8580         0x08    // Written for the 8580
+#define TUNE_CHIPS_NTSC         0x10    // Timed for an NTSC machine only
+
+/**
+ * @brief One indexed tune, as stored in the index file
+ */
+struct TuneEntry {
+    uint32_t pathHash;          // FNV-1a of the path
+    uint32_t pathOffset;        // Offset of the path in the path table
+    uint32_t fileSize;
+    uint32_t modified;          // Last write time, 0 if the file system keeps none
+    uint32_t speedFlags;        // SID: one bit per song, 1 = CIA-timed
+    uint32_t length;            // YM: song length in ms, 0 for SID
+    uint8_t type;               // TUNE_TYPE_*
+    uint8_t numSongs;
+    uint8_t startSong;          // Default sub-song, 0-based
+    uint8_t chips;              // TUNE_CHIPS_*
+    char title[33];
+    char author[33];
+    char copyright[33];         // YM: the comment
+};
+
+/**
+ * @brief What TuneLibrary::find() returns, zero-initialise for everything
+ */
+struct TuneFilter {
+    uint8_t types;              // TUNE_TYPE_* bits to include, 0 = all
+    uint8_t minSongs;           // Fewest sub-songs
+    const char* text;           // In the title, author or copyright (any case), NULL = any
+};
+
+/**
+ * @class TuneLibrary
+ * @brief Index of the tunes on LittleFS with paged, filtered queries
+ */
+class TuneLibrary {
+public:
+    TuneLibrary();
+    ~TuneLibrary();
+
+    /**
+     * @brief Open the index
+     * @param indexPath Index file, created by update() if missing
+     * @return false if there is no valid index yet (run update())
+     */
+    bool begin(const char* indexPath = TUNE_LIBRARY_INDEX);
+
+    /**
+     * @brief Close the index
+     */
+    void end();
+
+    /**
+     * @brief Bring the index up to date with the file system
+     *
+     * Indexes the .sid, .ym and .ymd files under root, down to
+     * TUNE_LIBRARY_DEPTH directory levels. Unchanged files keep their old
+     * entry without being opened. The new index replaces the old one once
+     * it is complete.
+     *
+     * @param root Directory to index
+     * @return false if the index could not be written
+     */
+    bool update(const char* root = "/");
+
+    /**
+     * @brief Get the number of indexed tunes
+     * @return Entries in the index
+     */
+    uint32_t count() const { return _count; }
+
+    /**
+     * @brief Read an entry
+     * @param index Entry number (0 to count() - 1)
+     * @param entry Receives the entry
+     * @return false if index is out of range or the read failed
+     */
+    bool getEntry(uint32_t index, TuneEntry& entry);
+
+    /**
+     * @brief Get the path of an entry, for loadFile()
+     * @param entry Entry from getEntry() or find()
+     * @param path Receives the path
+     * @param size Size of path
+     * @return false if the path does not fit or could not be read
+     */
+    bool getPath(const TuneEntry& entry, char* path, size_t size);
+
+    /**
+     * @brief Find the entry of a path
+     * @param path Path as update() saw it
+     * @return Entry number, or -1 if the path is not indexed
+     */
+    int32_t findPath(const char* path);
+
+    /**
+     * @brief Get the next page of entries that pass a filter
+     *
+     * Start with cursor 0 and pass it back for the next page; it moves
+     * past the last entry examined. Does not fill out when no entries are
+     * left, cursor then equals count().
+     *
+     * @param filter Entries to return
+     * @param cursor Entry number to continue from
+     * @param out Receives the entries
+     * @param max Size of out
+     * @param indices Receives the entry number of each one (optional)
+     * @return Entries written to out
+     */
+    uint16_t find(const TuneFilter& filter, uint32_t& cursor, TuneEntry* out, uint16_t max,
+                  uint32_t* indices = NULL);
+
+    /**
+     * @brief Count the entries that pass a filter
+     * @param filter Entries to count
+     * @return Number of entries
+     */
+    uint32_t countMatches(const TuneFilter& filter);
+
+    /**
+     * @brief Check an entry against a filter
+     * @param filter Filter to apply
+     * @param entry Entry to check
+     * @return true if the entry passes
+     */
+    static bool matches(const TuneFilter& filter, const TuneEntry& entry);
+
+    /**
+     * @brief Hash of a path as stored in TuneEntry::pathHash
+     * @param path Path
+     * @return 32-bit FNV-1a hash
+     */
+    static uint32_t hashPath(const char* path);
+
+    /**
+     * @brief Type of a tune file by its extension
+     * @param path Path or file name
+     * @return TUNE_TYPE_SID for .sid (PSID or RSID), TUNE_TYPE_YM, TUNE_TYPE_YMD, 0 otherwise
+     */
+    static uint8_t tuneType(const char* path);
+
+    // Files the last update() took from the old index / had to open
+    uint32_t getReused() const { return _reused; }
+    uint32_t getParsed() const { return _parsed; }
+
+private:
+    struct IndexHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t entrySize;     // sizeof(TuneEntry) when written
+        uint32_t count;
+        uint32_t pathBytes;     // Size of the path table after the entries
+    };
+
+    // What update() compares to reuse an old entry
+    struct EntryKey {
+        uint32_t pathHash;
+        uint32_t fileSize;
+        uint32_t modified;
+    };
+
+    // State of one update() run
+    struct Builder {
+        File out;               // New index: header, entries
+        File paths;             // Path table, appended at the end
+        EntryKey* keys;         // Old entries
+        uint32_t numKeys;
+        uint32_t hint;          // Old entry after the last match
+        uint32_t count;
+        uint32_t pathBytes;
+        bool failed;
+    };
+
+    File _index;
+    char _indexPath[TUNE_LIBRARY_PATH_MAX];
+    uint32_t _count;
+    uint32_t _pathBase;         // File offset of the path table
+    uint32_t _reused;
+    uint32_t _parsed;
+
+    bool readEntries(uint32_t first, TuneEntry* out, uint16_t n);
+    void scanDirectory(Builder& b, const char* dir, uint8_t depth);
+    void addFile(Builder& b, const char* path, uint32_t size, uint32_t modified);
+    static bool parseTune(const char* path, TuneEntry& entry);
+};
+
+#endif // TUNE_LIBRARY_H
@@ -21,6 +21,9 @@
 
 #include <Arduino.h>
 #include "WishboneSPI.h"
+#include "AudioBus.h"
+#include "ShadowRegisterFile.h"
+#include "ChipConfig.h"
 
 // YM2149 Register addresses
 #define YM_REG_FREQ_A_LO        0x00
@@ -38,6 +41,21 @@
 #define YM_REG_ENV_FREQ_HI      0x0C
 #define YM_REG_ENV_SHAPE        0x0D
 
+// Register bank control / status (gateware extension)
+#define YM_REG_BANK             0x0E
+
+// Number of YM2149 sound registers
+#define YM_NUM_REGS             14
+
+// Bank control bits
+#define YM_BANK_STAGE           0x01  // Stage writes to R0-R13
+#define YM_BANK_COMMIT          0x02  // Commit the staged writes
+#define YM_BANK_NOW             0x04  // Apply the commit without waiting for frame_tick
+
+// Bank status bits
+#define YM_BANK_STATUS_STAGING  0x01
+#define YM_BANK_STATUS_PENDING  0x02
+
 // Mixer register bits
 #define YM_MIXER_TONE_A         0x01
 #define YM_MIXER_TONE_B         0x02
@@ -64,13 +82,13 @@ public:
     YMVoice();
     
     /**
-     * @brief Initialize the voice
-     * @param baseAddr Base address for this chip
+     * @brief Attach the voice to its chip's registers
+     * @param regs Register shadow of the chip
      * @param freqAddr Register address for frequency
      * @param levelAddr Register address for level
      * @param voiceNum Voice number (0, 1, or 2)
      */
-    void begin(uint16_t baseAddr, uint8_t freqAddr, 
+    void begin(ShadowRegisterFile<YM_NUM_REGS, YMConfig::busWidth>& regs, uint8_t freqAddr,
                uint8_t levelAddr, uint8_t voiceNum);
     
     /**
@@ -128,23 +146,19 @@ public:
     void reset();
     
 private:
-    uint16_t _baseAddr;
+    friend class YM2149;
+    
+    ShadowRegisterFile<YM_NUM_REGS, YMConfig::busWidth>* _regs;   // Shared with the other voices
     uint8_t _freqAddr;
     uint8_t _levelAddr;
     uint8_t _voiceNum;
     uint8_t _toneBit;
     uint8_t _noiseBit;
-    uint16_t _currentFreq;
-    uint8_t _level;
-    bool _useEnvelope;
     
-    void writeReg(uint8_t addr, uint8_t value);
-    uint8_t readReg(uint8_t addr);
-    void updateLevel();
-    void updateMixer();
+    void setMixerBits(uint8_t bits, bool enable);
     
-    // MIDI to YM frequency conversion table
-    static const uint16_t MIDI2freq[129];
+    // MIDI note to tone period, generated for YM_CLOCK_HZ
+    typedef PitchTable<YMPitch<YMConfig::clock> > MIDI2freq;
 };
 
 /**
@@ -161,7 +175,7 @@ public:
      * @brief Constructor
      * @param baseAddr Base address for YM2149 (default 0x50)
      */
-    YM2149(uint16_t baseAddr = 0x50);
+    YM2149(uint16_t baseAddr = YMConfig::baseAddr);
     
     /**
      * @brief Initialize the YM2149
@@ -170,11 +184,24 @@ public:
     
     /**
      * @brief Write to a YM2149 register
+     * 
+     * Writes to R0-R13 go through the register shadow and are dropped when
+     * they would not change the register, except for R13 (envelope shape),
+     * which restarts the envelope on every write.
+     * 
      * @param addr Register address
      * @param data Data to write
      */
     void writeReg(uint8_t addr, uint8_t data);
     
+    /**
+     * @brief Write a block of consecutive YM2149 registers in one burst
+     * @param startAddr Address of the first register
+     * @param data Register values
+     * @param count Number of registers to write
+     */
+    void writeRegs(uint8_t startAddr, const uint8_t* data, uint8_t count);
+    
     /**
      * @brief Read from a YM2149 register
      * @param addr Register address
@@ -182,6 +209,64 @@ public:
      */
     uint8_t readReg(uint8_t addr);
     
+    /**
+     * @brief Get the last value written to a register, without a bus access
+     * @param addr Register address (0-13)
+     * @return Register value
+     */
+    uint8_t getReg(uint8_t addr);
+    
+    /**
+     * @brief Get the number of shadowed register writes sent to the chip
+     * @return Register values put on the bus since the object was created,
+     *         not counting unchanged writes that were dropped
+     */
+    uint32_t getBusWriteCount();
+    
+    /**
+     * @brief Send writes at once or hold them until commit()
+     * @param mode SHADOW_WRITE_THROUGH (default) or SHADOW_DEFERRED
+     */
+    void setCommitMode(ShadowCommitMode mode);
+    
+    /**
+     * @brief Send the registers changed since the last commit
+     */
+    void commit();
+    
+    /**
+     * @brief Stage register writes in the gateware bank
+     * 
+     * While enabled, writes to R0-R13 are collected by the slave and
+     * only reach the chip on commitBank(), all in the same instant.
+     * 
+     * @param enable True to stage writes, false to apply them as they arrive
+     */
+    void enableRegisterBank(bool enable);
+    
+    /**
+     * @brief Apply the staged writes together
+     * 
+     * Pending shadow writes (SHADOW_DEFERRED) are sent first. The bank is
+     * applied on the next frame_tick input (the SID slave's frame_irq), or at once when now is set. Writes
+     * made before it is applied are staged for the next commit.
+     * 
+     * @param now True to apply without waiting for the frame tick
+     */
+    void commitBank(bool now = false);
+    
+    /**
+     * @brief Check whether a committed bank still waits for its tick
+     * @return true while the commit is pending
+     */
+    bool isBankPending();
+    
+    /**
+     * @brief Check whether writes are being staged
+     * @return true after enableRegisterBank(true)
+     */
+    bool isRegisterBankEnabled() const { return _bankStage; }
+    
     /**
      * @brief Set noise generator frequency
      * @param freq Noise frequency (0-31)
@@ -210,7 +295,8 @@ public:
     
 private:
     uint16_t _baseAddr;
-    uint8_t _mixer;
+    ShadowRegisterFile<YM_NUM_REGS, YMConfig::busWidth> _regs;
+    bool _bankStage;            // Writes go to the gateware bank
 };
 
 #endif // YM2149_H
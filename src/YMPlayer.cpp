@@ -5,8 +5,62 @@
 
 #include "YMPlayer.h"
 
-YMPlayer::YMPlayer(YM2149& ym) 
-    : _ym(ym), _playing(false), _paused(false), _volume(11) {
+// Size of an LHA level 0 header up to the file name
+#define LHA_HEADER_SIZE     22
+
+// YM5/YM6 header up to the extra data
+#define YM_HEADER_SIZE      34
+
+// Register bits that reach the chip, the rest carries YM5/YM6 effects
+static const uint8_t ymRegMask[YM_NUM_REGS] = {
+    0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0xFF,
+    0x1F, 0x1F, 0x1F, 0xFF, 0xFF, 0x0F
+};
+
+// Atari ST MFP timer predivisors
+static const uint8_t mfpPrediv[8] = { 0, 4, 10, 16, 50, 64, 100, 200 };
+
+// YM2149 output level of each volume step, for 4-bit digidrums
+static const uint8_t ymLevel8[16] = {
+    1, 1, 2, 3, 5, 7, 11, 15, 21, 28, 42, 57, 86, 121, 181, 255
+};
+
+static uint32_t readBE32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t readBE16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t readLE32(const uint8_t* p) {
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+YMPlayer::YMPlayer(YM2149& ym)
+    : _ym(ym), _playing(false), _paused(false), _cued(false), _volume(11), _fastForward(0),
+      _lookAhead(YM_DEFAULT_LOOK_AHEAD), _underruns(0),
+      _format(YM_FORMAT_YMD), _packed(false), _dataOffset(0), _dataPos(0),
+      _frameBase(0), _caching(false), _cached(false), _attributes(0), _clock(YM_CLOCK_HZ), _numFrames(0),
+      _loopFrame(0), _framePeriod(20000), _nextFrame(0), _position(0), _current(0),
+      _blockFrames(0), _newBlockFrames(YM_DEFAULT_BLOCK_SIZE / sizeof(YMFrame)), _blockReads(0),
+      _filling(false), _fillFirst(0), _fillRun(0), _fillDone(0), _fillFailed(false),
+      _loading(false), _loadSkip(0), _loadDrums(0), _loadDrum(0), _loadSized(false), _loadLength(0),
+      _loadDone(0), _drumBytes(0),
+      _numDrums(0), _drumHandler(NULL),
+      _tickDue(false), _nextTick(0), _statsBusWrites(0), _lateTicks(0), _missedTicks(0), _statsJitterMax(0),
+      _bank(false), _bankAtTick(false) {
+    _cachePath[0] = '\0';
+    _lh5.file = &_file;
+    memset(_blocks, 0, sizeof(_blocks));
+    memset(_drums, 0, sizeof(_drums));
+    _title[0] = '\0';
+    _author[0] = '\0';
+    _comment[0] = '\0';
+}
+
+YMPlayer::~YMPlayer() {
+    closeTune();
 }
 
 bool YMPlayer::begin() {
@@ -18,7 +72,24 @@ bool YMPlayer::begin() {
 }
 
 bool YMPlayer::loadFile(const char* filename) {
-    stop();
+    if (!startLoad(filename)) return false;
+    while (_loading) {
+        if (!loadStep()) return false;
+    }
+    
+    Serial.print("Loaded: ");
+    Serial.print(filename);
+    Serial.print(" (");
+    Serial.print(_file.size());
+    Serial.println(" bytes)");
+    
+    return true;
+}
+
+bool YMPlayer::startLoad(const char* filename) {
+    if (_playing) stop();
+    _cued = false;
+    closeTune();
     
     if (_file) {
         _file.close();
@@ -31,48 +102,438 @@ bool YMPlayer::loadFile(const char* filename) {
         return false;
     }
     
-    Serial.print("Loaded: ");
-    Serial.print(filename);
-    Serial.print(" (");
-    Serial.print(_file.size());
-    Serial.println(" bytes)");
+    // Anything that is not an LHA archive or a YM5/YM6 file plays as .ymd
+    uint8_t head[LHA_HEADER_SIZE];
+    size_t length = _file.read(head, sizeof(head));
+    bool lha = length == sizeof(head) && head[2] == '-' && head[3] == 'l' && head[4] == 'h' &&
+               head[6] == '-';
+    bool ym = length >= 4 && head[0] == 'Y' && head[1] == 'M' && head[3] == '!';
+    
+    bool ok;
+    if (lha || ym) {
+        ok = openYM(lha ? head : NULL);
+    } else {
+        _numFrames = _file.size() / sizeof(YMFrame);
+        ok = true;
+    }
+    
+    if (!ok) {
+        closeTune();
+        _file.close();
+        return false;
+    }
+    _loading = true;
+    return true;
+}
+
+bool YMPlayer::loadStep() {
+    if (!_loading) return true;
     
+    // Extra data, then each digidrum's size and samples, then the strings
+    for (uint32_t budget = YM_LOAD_STEP; budget; ) {
+        if (_loadSkip) {
+            uint32_t n = _loadSkip < budget ? _loadSkip : budget;
+            if (!seekData(_dataPos + n)) return failLoad();
+            _loadSkip -= n;
+            budget -= n;
+        } else if (_loadDrum < _loadDrums) {
+            if (!stepDrum(budget)) return failLoad();
+        } else {
+            if (!finishLoad()) {
+                closeTune();
+                _file.close();
+                return false;
+            }
+            return true;
+        }
+    }
+    return true;
+}
+
+bool YMPlayer::failLoad() {
+    Serial.println("Truncated YM file");
+    closeTune();
+    _file.close();
+    return false;
+}
+
+bool YMPlayer::openYM(const uint8_t* lha) {
+    _dataOffset = 0;
+    _packed = false;
+    
+    if (lha) {
+        // Level 0 header: size, checksum, method, packed and original size
+        if (lha[20] != 0 || (lha[5] != '5' && lha[5] != '0')) {
+            Serial.println("Unsupported LHA archive (need -lh5- or -lh0-, level 0)");
+            return false;
+        }
+        _dataOffset = lha[0] + 2;
+        _packed = lha[5] == '5';
+        if (_packed && !_lh5.begin(readLE32(&lha[11]))) {
+            Serial.println("Out of memory for the LH5 window");
+            return false;
+        }
+    }
+    
+    _file.seek(_dataOffset);
+    if (_packed) _lh5.reset();
+    _dataPos = 0;
+    
+    uint8_t header[YM_HEADER_SIZE];
+    if (readData(header, sizeof(header)) != sizeof(header)) {
+        Serial.println("Truncated YM file");
+        return false;
+    }
+    
+    if (memcmp(header, "YM5!", 4) == 0) {
+        _format = YM_FORMAT_YM5;
+    } else if (memcmp(header, "YM6!", 4) == 0) {
+        _format = YM_FORMAT_YM6;
+    } else {
+        Serial.println("Unsupported YM version (need YM5 or YM6)");
+        return false;
+    }
+    if (memcmp(&header[4], "LeOnArD!", 8) != 0) {
+        Serial.println("Not a YM file");
+        return false;
+    }
+    
+    _numFrames = readBE32(&header[12]);
+    _attributes = readBE32(&header[16]);
+    _clock = readBE32(&header[22]);
+    uint16_t rate = readBE16(&header[26]);
+    _loopFrame = readBE32(&header[28]);
+    
+    if (!_numFrames) return false;
+    if (_loopFrame >= _numFrames) _loopFrame = 0;
+    if (!_clock) _clock = YM_CLOCK_HZ;
+    _framePeriod = 1000000UL / (rate ? rate : 50);
+    
+    // The extra data, the drums and the three strings follow in loadStep()
+    _loadSkip = readBE16(&header[32]);
+    _loadDrums = readBE16(&header[20]);
+    return true;
+}
+
+bool YMPlayer::finishLoad() {
+    if (_format != YM_FORMAT_YMD) {
+        _numDrums = _loadDrums < YM_MAX_DIGIDRUMS ? _loadDrums : YM_MAX_DIGIDRUMS;
+        if (!readString(_title) || !readString(_author) || !readString(_comment)) {
+            Serial.println("Truncated YM file");
+            return false;
+        }
+        _frameBase = _dataPos;
+        
+        // Interleaved frames of a block come from all over the song: the
+        // first block's fill unpacks them to the cache on its way
+        if (_packed && (_attributes & YM_ATTR_INTERLEAVED) && _cachePath[0]) {
+            _cacheFile = LittleFS.open(_cachePath, "w");
+            _caching = _cacheFile;
+            if (!_caching) Serial.println("No YM cache file, each block unpacks the song");
+        }
+    }
+    
+    if (!allocBlocks()) return false;
+    _loading = false;
+    return true;
+}
+
+bool YMPlayer::openCache() {
+    _cacheFile.close();
+    File cache = LittleFS.open(_cachePath, "r");
+    if (!cache) return false;
+    
+    // Play the cache like an unpacked file holding only the frames
+    _file.close();
+    _file = cache;
+    _lh5.end();
+    _packed = false;
+    _caching = false;
+    _cached = true;
+    _dataOffset = 0;
+    _dataPos = 0;
+    _frameBase = 0;
+    return true;
+}
+
+void YMPlayer::dropCache() {
+    _cacheFile.close();
+    LittleFS.remove(_cachePath);
+    _caching = false;
+    Serial.println("YM cache file failed, each block unpacks the song");
+}
+
+// Reads the unpacked stream for readInfo(), skips when buf is NULL
+static size_t readInfoData(File& file, LH5Decoder& lh5, bool packed, uint8_t* buf, size_t n) {
+    if (packed) return lh5.read(buf, n);
+    if (buf) return file.read(buf, n);
+    return file.seek(file.position() + n) ? n : 0;
+}
+
+static bool readInfoString(File& file, LH5Decoder& lh5, bool packed, char* dst) {
+    uint8_t len = 0;
+    uint8_t c;
+    do {
+        if (readInfoData(file, lh5, packed, &c, 1) != 1) return false;
+        if (len < 32) dst[len++] = c;
+    } while (c);
+    dst[len] = '\0';
+    return true;
+}
+
+bool YMPlayer::readInfo(const char* filename, YMInfo& info) {
+    memset(&info, 0, sizeof(info));
+    info.frameRate = 50;
+    info.clock = YM_CLOCK_HZ;
+    
+    File file = LittleFS.open(filename, "r");
+    if (!file) return false;
+    
+    uint8_t head[LHA_HEADER_SIZE];
+    size_t length = file.read(head, sizeof(head));
+    bool lha = length == sizeof(head) && head[2] == '-' && head[3] == 'l' && head[4] == 'h' &&
+               head[6] == '-';
+    bool ym = length >= 4 && head[0] == 'Y' && head[1] == 'M' && head[3] == '!';
+    if (!lha && !ym) {
+        info.numFrames = file.size() / sizeof(YMFrame);
+        file.close();
+        return info.numFrames != 0;
+    }
+    
+    FileDecoder lh5;
+    lh5.file = &file;
+    uint32_t offset = 0;
+    bool ok = true;
+    if (lha) {
+        ok = head[20] == 0 && (head[5] == '5' || head[5] == '0');
+        offset = head[0] + 2;
+        info.packed = head[5] == '5';
+        if (ok && info.packed) ok = lh5.begin(readLE32(&head[11]));
+    }
+    
+    uint8_t header[YM_HEADER_SIZE];
+    if (ok) {
+        file.seek(offset);
+        if (info.packed) lh5.reset();
+        ok = readInfoData(file, lh5, info.packed, header, sizeof(header)) == sizeof(header) &&
+             (memcmp(header, "YM5!", 4) == 0 || memcmp(header, "YM6!", 4) == 0) &&
+             memcmp(&header[4], "LeOnArD!", 8) == 0;
+    }
+    
+    if (ok) {
+        info.version = header[2] - '0';
+        info.numFrames = readBE32(&header[12]);
+        if (readBE32(&header[22])) info.clock = readBE32(&header[22]);
+        if (readBE16(&header[26])) info.frameRate = readBE16(&header[26]);
+        info.loopFrame = readBE32(&header[28]);
+        if (info.loopFrame >= info.numFrames) info.loopFrame = 0;
+        
+        // Skip the extra data and the drums to get to the strings
+        uint16_t extra = readBE16(&header[32]);
+        ok = readInfoData(file, lh5, info.packed, NULL, extra) == extra;
+        for (uint16_t i = readBE16(&header[20]); ok && i; i--) {
+            uint8_t size[4];
+            ok = readInfoData(file, lh5, info.packed, size, 4) == 4 &&
+                 readInfoData(file, lh5, info.packed, NULL, readBE32(size)) == readBE32(size);
+        }
+        ok = ok && readInfoString(file, lh5, info.packed, info.title) &&
+             readInfoString(file, lh5, info.packed, info.author) &&
+             readInfoString(file, lh5, info.packed, info.comment);
+    }
+    
+    file.close();
+    return ok && info.numFrames;
+}
+
+void YMPlayer::closeTune() {
+    for (uint8_t i = 0; i < YM_MAX_DIGIDRUMS; i++) free(_drums[i].data);
+    memset(_drums, 0, sizeof(_drums));
+    _numDrums = 0;
+    
+    freeBlocks();
+    _lh5.end();
+    _filling = false;
+    _fillFailed = false;
+    
+    _loading = false;
+    _loadSkip = 0;
+    _loadDrums = 0;
+    _loadDrum = 0;
+    _loadSized = false;
+    _drumBytes = 0;
+    
+    // The cache only holds this tune
+    if (_caching) {
+        _cacheFile.close();
+        LittleFS.remove(_cachePath);
+        _caching = false;
+    }
+    if (_cached) {
+        _file.close();
+        LittleFS.remove(_cachePath);
+        _cached = false;
+    }
+    
+    // Defaults describe a .ymd file: raw frames from the start
+    _format = YM_FORMAT_YMD;
+    _packed = false;
+    _dataOffset = 0;
+    _dataPos = 0;
+    _frameBase = 0;
+    _attributes = 0;
+    _clock = YM_CLOCK_HZ;
+    _numFrames = 0;
+    _loopFrame = 0;
+    _framePeriod = 20000;
+    _title[0] = '\0';
+    _author[0] = '\0';
+    _comment[0] = '\0';
+}
+
+bool YMPlayer::seekData(uint32_t offset) {
+    if (!_packed) {
+        if (!_file.seek(_dataOffset + offset)) return false;
+        _dataPos = offset;
+        return true;
+    }
+    
+    // Unpacking only runs forward, going back starts over
+    if (offset < _dataPos) {
+        _file.seek(_dataOffset);
+        _lh5.reset();
+        _dataPos = 0;
+    }
+    uint32_t skip = offset - _dataPos;
+    return readData(NULL, skip) == skip;
+}
+
+size_t YMPlayer::readData(uint8_t* buf, size_t n) {
+    size_t done;
+    if (_packed) {
+        done = _lh5.read(buf, n);
+    } else if (buf) {
+        done = _file.read(buf, n);
+    } else {
+        done = _file.seek(_dataOffset + _dataPos + n) ? n : 0;
+    }
+    _dataPos += done;
+    return done;
+}
+
+bool YMPlayer::readString(char* dst) {
+    // NUL-terminated, kept up to 32 characters
+    uint8_t len = 0;
+    uint8_t c;
+    do {
+        if (readData(&c, 1) != 1) return false;
+        if (len < 32) dst[len++] = c;
+    } while (c);
+    dst[len] = '\0';
+    return true;
+}
+
+bool YMPlayer::stepDrum(uint32_t& budget) {
+    uint16_t i = _loadDrum;
+    if (!_loadSized) {
+        uint8_t size[4];
+        if (readData(size, 4) != 4) return false;
+        budget = budget > 4 ? budget - 4 : 0;
+        _loadLength = readBE32(size);
+        _loadDone = 0;
+        _loadSized = true;
+        
+        // Drums past the RAM limit are skipped
+        if (i < YM_MAX_DIGIDRUMS && _loadLength && _drumBytes + _loadLength <= YM_DIGIDRUM_MAX_BYTES) {
+            _drums[i].data = (uint8_t*)malloc(_loadLength);
+        }
+        return true;
+    }
+    
+    uint8_t* data = i < YM_MAX_DIGIDRUMS ? _drums[i].data : NULL;
+    uint32_t n = _loadLength - _loadDone;
+    if (n > budget) n = budget;
+    if (data) {
+        if (readData(data + _loadDone, n) != n) return false;
+    } else if (!seekData(_dataPos + n)) {
+        return false;
+    }
+    _loadDone += n;
+    budget -= n;
+    if (_loadDone < _loadLength) return true;
+    
+    if (data) {
+        // Hand out unsigned 8-bit samples whatever the stored format
+        for (uint32_t j = 0; j < _loadLength; j++) {
+            if (_attributes & YM_ATTR_DRUM_4BIT) data[j] = ymLevel8[data[j] & 0x0F];
+            else if (_attributes & YM_ATTR_DRUM_SIGNED) data[j] ^= 0x80;
+        }
+        _drums[i].length = _loadLength;
+        _drumBytes += _loadLength;
+    }
+    _loadDrum++;
+    _loadSized = false;
     return true;
 }
 
 void YMPlayer::play() {
-    if (!_file) {
+    if (!_file || _loading) {
         Serial.println("No file loaded");
         return;
     }
     
-    _file.seek(0);
+    // Blocks stay valid, a restart from a buffered block needs no read
+    if (!_cued) {
+        _nextFrame = 0;
+        _position = 0;
+        _frameRing.clear();
+    }
+    _cued = false;
     _playing = true;
     _paused = false;
     
     // Reset YM chip
+    releaseBank();
     _ym.reset();
     _ym.V1.setVolume(_volume);
     _ym.V2.setVolume(_volume);
     _ym.V3.setVolume(_volume);
+    if (_bank) _ym.enableRegisterBank(true);
+    _statsBusWrites = _ym.getBusWriteCount();
+    _tickDue = false;
+    
+    prefetch();
 }
 
 void YMPlayer::stop() {
     _playing = false;
     _paused = false;
+    _cued = false;
+    _frameRing.clear();
     
     // Silence the YM chip
+    releaseBank();
     _ym.V1.setTone(false);
     _ym.V2.setTone(false);
     _ym.V3.setTone(false);
 }
 
+void YMPlayer::cue() {
+    if (!_file || _loading || _playing) return;
+    
+    _nextFrame = 0;
+    _position = 0;
+    _frameRing.clear();
+    _cued = true;
+    prefetch();
+}
+
 void YMPlayer::pause() {
     _paused = true;
 }
 
 void YMPlayer::resume() {
     _paused = false;
+    _tickDue = false;
 }
 
 void YMPlayer::setVolume(uint8_t vol) {
@@ -84,41 +545,451 @@ void YMPlayer::setVolume(uint8_t vol) {
     }
 }
 
-bool YMPlayer::readFrame(YMFrame& frame) {
-    if (!_file || !_playing) {
+void YMPlayer::setRegisterBank(bool enable, bool atTick) {
+    _bank = enable;
+    _bankAtTick = atTick;
+}
+
+void YMPlayer::releaseBank() {
+    if (!_ym.isRegisterBankEnabled()) return;
+    
+    // A commit still waiting would land on the writes that follow
+    _ym.commitBank(true);
+    _ym.enableRegisterBank(false);
+}
+
+void YMPlayer::setBlockSize(uint16_t bytes) {
+    uint16_t frames = bytes / sizeof(YMFrame);
+    _newBlockFrames = frames ? frames : 1;
+}
+
+void YMPlayer::setCacheFile(const char* path) {
+    _cachePath[0] = '\0';
+    if (path) {
+        strncpy(_cachePath, path, sizeof(_cachePath) - 1);
+        _cachePath[sizeof(_cachePath) - 1] = '\0';
+    }
+}
+
+void YMPlayer::setLoopFrame(uint32_t frame) {
+    _loopFrame = frame < _numFrames ? frame : 0;
+}
+
+void YMPlayer::seek(uint32_t frame) {
+    if (frame >= _numFrames) frame = _loopFrame;
+    _nextFrame = frame;
+    _position = frame;
+    
+    // Frames read ahead belong to the old position
+    _frameRing.clear();
+    if (_playing || _cued) prefetch();
+}
+
+bool YMPlayer::allocBlocks() {
+    _blockFrames = _newBlockFrames;
+    _current = 0;
+    _blockReads = 0;
+    
+    for (uint8_t i = 0; i < 2; i++) {
+        _blocks[i].frames = (YMFrame*)malloc(_blockFrames * sizeof(YMFrame));
+        _blocks[i].count = 0;
+        if (!_blocks[i].frames) {
+            Serial.println("Out of memory for the frame blocks");
+            return false;
+        }
+    }
+    return true;
+}
+
+void YMPlayer::freeBlocks() {
+    for (uint8_t i = 0; i < 2; i++) {
+        free(_blocks[i].frames);
+        _blocks[i].frames = NULL;
+        _blocks[i].count = 0;
+    }
+}
+
+bool YMPlayer::holds(const FrameBlock& block, uint32_t frame) const {
+    return block.count && frame >= block.first && frame - block.first < block.count;
+}
+
+bool YMPlayer::isReady() const {
+    return _frameRing.count() || holds(_blocks[0], _nextFrame) || holds(_blocks[1], _nextFrame);
+}
+
+uint32_t YMPlayer::blockLength(uint32_t first) const {
+    uint32_t n = _numFrames - first;
+    return n < _blockFrames ? n : _blockFrames;
+}
+
+bool YMPlayer::readBlock(FrameBlock& block, uint32_t first) {
+    block.count = 0;
+    uint32_t n = blockLength(first);
+    
+    if (_attributes & YM_ATTR_INTERLEAVED) {
+        // Register r of frame f is stored at r * frames + f: gather each
+        // register's run for the block, in file order
+        uint8_t chunk[32];
+        for (uint8_t r = 0; r < sizeof(YMFrame); r++) {
+            if (!seekData(_frameBase + r * _numFrames + first)) return false;
+            
+            for (uint32_t i = 0; i < n; ) {
+                uint32_t len = n - i;
+                if (len > sizeof(chunk)) len = sizeof(chunk);
+                if (readData(chunk, len) != len) return false;
+                for (uint32_t k = 0; k < len; k++) block.frames[i + k].regs[r] = chunk[k];
+                i += len;
+            }
+        }
+    } else {
+        uint32_t bytes = n * sizeof(YMFrame);
+        if (!seekData(_frameBase + first * sizeof(YMFrame)) ||
+            readData((uint8_t*)block.frames, bytes) != bytes) {
+            return false;
+        }
+    }
+    
+    block.first = first;
+    block.count = n;
+    _blockReads++;
+    return true;
+}
+
+bool YMPlayer::startFill(uint32_t first) {
+    // A plain file is read at once, packed data in steps from prefetch()
+    FrameBlock& spare = _blocks[_current ^ 1];
+    spare.count = 0;
+    _filling = false;
+    if (!_packed) {
+        if (readBlock(spare, first)) return true;
+        _fillFailed = true;
         return false;
     }
     
-    size_t bytesRead = _file.read((uint8_t*)&frame, sizeof(YMFrame));
+    _filling = true;
+    _fillFirst = first;
+    _fillRun = 0;
+    _fillDone = 0;
+    
+    // Unpacking only runs forward, a block behind the decoder starts over.
+    // The cache is written in one pass and takes the block when it is done.
+    uint32_t start = _attributes & YM_ATTR_INTERLEAVED ? first : first * sizeof(YMFrame);
+    if (!_caching && _dataPos > _frameBase + start) {
+        _file.seek(_dataOffset);
+        _lh5.reset();
+        _dataPos = 0;
+    }
+    return true;
+}
+
+bool YMPlayer::stepFill() {
+    if (_caching) return stepCache();
     
-    // Loop back to start if we hit EOF
-    if (bytesRead != sizeof(YMFrame)) {
-        _file.seek(0);
-        bytesRead = _file.read((uint8_t*)&frame, sizeof(YMFrame));
-        if (bytesRead != sizeof(YMFrame)) {
+    // One register run per frame byte when interleaved, else one run of
+    // whole frames
+    FrameBlock& block = _blocks[_current ^ 1];
+    bool interleaved = _attributes & YM_ATTR_INTERLEAVED;
+    uint32_t n = blockLength(_fillFirst);
+    uint32_t runLength = interleaved ? n : n * sizeof(YMFrame);
+    uint8_t runs = interleaved ? sizeof(YMFrame) : 1;
+    
+    uint8_t chunk[32];
+    uint32_t budget = YM_UNPACK_STEP;
+    while (budget) {
+        uint32_t at = _frameBase + _fillDone;
+        at += interleaved ? _fillRun * _numFrames + _fillFirst : _fillFirst * sizeof(YMFrame);
+        
+        // Decode past what the block does not use
+        uint32_t len = at - _dataPos;
+        if (len) {
+            if (len > budget) len = budget;
+            if (readData(NULL, len) != len) break;
+            budget -= len;
+            continue;
+        }
+        
+        len = runLength - _fillDone;
+        if (len > budget) len = budget;
+        if (interleaved) {
+            if (len > sizeof(chunk)) len = sizeof(chunk);
+            if (readData(chunk, len) != len) break;
+            for (uint32_t k = 0; k < len; k++) block.frames[_fillDone + k].regs[_fillRun] = chunk[k];
+        } else if (readData((uint8_t*)block.frames + _fillDone, len) != len) {
+            break;
+        }
+        budget -= len;
+        
+        _fillDone += len;
+        if (_fillDone < runLength) continue;
+        _fillDone = 0;
+        if (++_fillRun < runs) continue;
+        
+        block.first = _fillFirst;
+        block.count = n;
+        _blockReads++;
+        _filling = false;
+        return true;
+    }
+    
+    if (!budget) return true;
+    _filling = false;
+    _fillFailed = true;
+    return false;
+}
+
+bool YMPlayer::stepCache() {
+    // The frames are appended as they are decoded, in file order
+    uint32_t end = _frameBase + _numFrames * sizeof(YMFrame);
+    uint8_t chunk[256];
+    for (uint32_t budget = YM_UNPACK_STEP; budget && _dataPos < end; ) {
+        uint32_t len = end - _dataPos;
+        if (len > budget) len = budget;
+        if (len > sizeof(chunk)) len = sizeof(chunk);
+        if (readData(chunk, len) != len || _cacheFile.write(chunk, len) != len) {
+            dropCache();
+            return startFill(_fillFirst);
+        }
+        budget -= len;
+    }
+    if (_dataPos < end) return true;
+    
+    // Done: the block is read from the cache at once
+    if (!openCache()) dropCache();
+    return startFill(_fillFirst);
+}
+
+bool YMPlayer::fillBlock(uint32_t first) {
+    // Needed now: the remaining steps run at once
+    if ((!_filling || _fillFirst != first) && !startFill(first)) return false;
+    while (_filling) {
+        if (!stepFill()) return false;
+    }
+    return holds(_blocks[_current ^ 1], first);
+}
+
+void YMPlayer::refillSpare() {
+    // Frames are taken from the block holding the next one to read
+    if (!holds(_blocks[_current], _nextFrame) && holds(_blocks[_current ^ 1], _nextFrame)) {
+        _current ^= 1;
+    }
+    
+    // That block first, then the one after it or the loop frame's at the end
+    const FrameBlock& current = _blocks[_current];
+    uint32_t first = _nextFrame;
+    if (holds(current, first)) {
+        first = current.first + current.count;
+        if (first >= _numFrames) first = _loopFrame;
+        if (holds(current, first)) return;
+    }
+    if (holds(_blocks[_current ^ 1], first)) return;
+    
+    if ((!_filling || _fillFirst != first) && !startFill(first)) return;
+    if (_filling) stepFill();
+}
+
+bool YMPlayer::readFrame(YMFrame& frame) {
+    if (!_file || (!_playing && !_cued) || _loading || !_numFrames) {
+        return false;
+    }
+    
+    // Move on to the spare block, read at the tick only if it is not ready
+    if (!holds(_blocks[_current], _nextFrame)) {
+        if (!holds(_blocks[_current ^ 1], _nextFrame) && !fillBlock(_nextFrame)) {
             Serial.println("Failed to read frame");
             return false;
         }
+        _current ^= 1;
     }
     
+    const FrameBlock& block = _blocks[_current];
+    frame = block.frames[_nextFrame - block.first];
+    
+    if (++_nextFrame >= _numFrames) _nextFrame = _loopFrame;
     return true;
 }
 
+uint8_t YMPlayer::decodeFrame(YMFrame& frame) {
+    // 0xFF in R13 leaves the envelope running instead of restarting it
+    uint8_t count = frame.regs[YM_REG_ENV_SHAPE] == 0xFF ? YM_NUM_REGS - 1 : YM_NUM_REGS;
+    
+    // Both effect slots read the frame before any voice is muted
+    uint8_t muted;
+    if (_format == YM_FORMAT_YM6) {
+        muted = startEffect(frame, 1, 6, 14) | startEffect(frame, 3, 8, 15);
+    } else {
+        // YM5: a digidrum on the voice in R3 bits 4-5
+        uint8_t voice = (frame.regs[3] >> 4) & 0x03;
+        muted = voice ? startDigiDrum(frame, voice - 1, frame.regs[8] >> 5, frame.regs[15]) : 0;
+    }
+    
+    for (uint8_t r = 0; r < YM_NUM_REGS; r++) frame.regs[r] &= ymRegMask[r];
+    for (uint8_t v = 0; v < 3; v++) {
+        if (muted & (1 << v)) frame.regs[YM_REG_LEVEL_A + v] = 0;
+    }
+    if (_clock != YM_CLOCK_HZ) rescaleFrame(frame);
+    
+    return count;
+}
+
+uint8_t YMPlayer::startEffect(const YMFrame& frame, uint8_t codeReg, uint8_t predivReg, uint8_t countReg) {
+    uint8_t code = frame.regs[codeReg];
+    uint8_t voice = (code >> 4) & 0x03;
+    if (!voice) return 0;
+    
+    // SID voice, sinus SID and sync buzzer need a timer per sample and
+    // play as the plain registers
+    if ((code & 0xC0) != 0x40) return 0;
+    return startDigiDrum(frame, voice - 1, frame.regs[predivReg] >> 5, frame.regs[countReg]);
+}
+
+uint8_t YMPlayer::startDigiDrum(const YMFrame& frame, uint8_t voice, uint8_t prediv, uint8_t count) {
+    // The voice's level register holds the drum number, so the PSG voice is muted
+    uint8_t drum = frame.regs[YM_REG_LEVEL_A + voice] & 0x1F;
+    
+    uint32_t div = (uint32_t)mfpPrediv[prediv & 0x07] * count;
+    if (div && drum < _numDrums && _drums[drum].data && _drumHandler) {
+        _drumHandler(voice, _drums[drum].data, _drums[drum].length, YM_MFP_CLOCK_HZ / div);
+    }
+    return 1 << voice;
+}
+
+void YMPlayer::rescaleFrame(YMFrame& frame) {
+    // Keep the pitch of tunes made for other clocks (1.7734MHz Spectrum, 1MHz CPC)
+    for (uint8_t v = 0; v < 3; v++) {
+        uint64_t period = frame.regs[v * 2] | (frame.regs[v * 2 + 1] << 8);
+        period = (period * YM_CLOCK_HZ + _clock / 2) / _clock;
+        if (period > 0x0FFF) period = 0x0FFF;
+        frame.regs[v * 2] = period & 0xFF;
+        frame.regs[v * 2 + 1] = period >> 8;
+    }
+    
+    uint64_t noise = ((uint64_t)frame.regs[YM_REG_NOISE_FREQ] * YM_CLOCK_HZ + _clock / 2) / _clock;
+    frame.regs[YM_REG_NOISE_FREQ] = noise > 0x1F ? 0x1F : noise;
+    
+    uint64_t env = frame.regs[YM_REG_ENV_FREQ_LO] | (frame.regs[YM_REG_ENV_FREQ_HI] << 8);
+    env = (env * YM_CLOCK_HZ + _clock / 2) / _clock;
+    if (env > 0xFFFF) env = 0xFFFF;
+    frame.regs[YM_REG_ENV_FREQ_LO] = env & 0xFF;
+    frame.regs[YM_REG_ENV_FREQ_HI] = env >> 8;
+}
+
+void YMPlayer::setLookAhead(uint8_t frames) {
+    if (frames > YM_FRAME_RING_SIZE) frames = YM_FRAME_RING_SIZE;
+    _lookAhead = frames;
+}
+
+void YMPlayer::prefetch() {
+    if (!_playing && !_cued) {
+        return;
+    }
+    
+    while (_frameRing.count() < _lookAhead) {
+        // A packed block fills a step per call, its frames wait for it
+        if (!holds(_blocks[0], _nextFrame) && !holds(_blocks[1], _nextFrame)) {
+            refillSpare();
+            if (!holds(_blocks[0], _nextFrame) && !holds(_blocks[1], _nextFrame)) break;
+        }
+        
+        YMFrame* slot = _frameRing.writeSlot();
+        if (!slot || !readFrame(*slot)) {
+            break;
+        }
+        _frameRing.commit();
+    }
+    
+    // Then get the next block ready while this one plays
+    refillSpare();
+}
+
 void YMPlayer::update() {
     if (!_playing || _paused) {
         return;
     }
     
+    // Each call is a tick: measure it against the frame cadence, and start
+    // a new cadence after a pause, an early call or a whole missed period
+    uint32_t start = micros();
+    int32_t late = _tickDue ? (int32_t)(start - _nextTick) : -1;
+    if (late < 0 || (uint32_t)late >= _framePeriod) _nextTick = start;
+    if (late < 0) late = 0;
+    _nextTick += _framePeriod;
+    _tickDue = true;
+    
+    // Take the next frame from the look-ahead ring, fall back to the file
     YMFrame frame;
-    if (readFrame(frame)) {
-        // Apply volume adjustment to amplitude registers (8, 9, 10)
-        frame.regs[8] = constrain(frame.regs[8] - (15 - _volume), 0, 15);
-        frame.regs[9] = constrain(frame.regs[9] - (15 - _volume), 0, 15);
-        frame.regs[10] = constrain(frame.regs[10] - (15 - _volume), 0, 15);
-        
-        // Write all 14 registers to the YM2149
-        for (int i = 0; i < 14; i++) {
-            _ym.writeReg(i, frame.regs[i]);
+    bool ready = _frameRing.pop(frame);
+    if (!ready) {
+        if (_lookAhead) _underruns++;
+        ready = readFrame(frame);
+    }
+    
+    // Fast-forward: every frame holds all registers, the skipped ones
+    // need not be sent. Only an envelope restart is lost with them, so
+    // the last shape written in a skipped frame goes out with this one.
+    uint8_t shape = 0xFF;
+    for (uint8_t n = 1; ready && n < _fastForward; n++) {
+        if (frame.regs[YM_REG_ENV_SHAPE] != 0xFF) shape = frame.regs[YM_REG_ENV_SHAPE];
+        if (++_position >= _numFrames) _position = _loopFrame;
+        ready = _frameRing.pop(frame) || readFrame(frame);
+    }
+    if (ready && frame.regs[YM_REG_ENV_SHAPE] == 0xFF) frame.regs[YM_REG_ENV_SHAPE] = shape;
+    
+    uint8_t count = 0;
+    if (ready) {
+        count = YM_NUM_REGS;
+        if (_format != YM_FORMAT_YMD) count = decodeFrame(frame);
+    
+        // Apply volume adjustment to amplitude registers (8, 9, 10), the
+        // envelope mode bit is kept
+        for (uint8_t r = YM_REG_LEVEL_A; r <= YM_REG_LEVEL_C; r++) {
+            int level = (frame.regs[r] & 0x0F) - (15 - _volume);
+            frame.regs[r] = (frame.regs[r] & YM_LEVEL_MODE_ENV) | constrain(level, 0, 15);
         }
+    
+        // Write the registers to the YM2149 in one burst
+        _ym.writeRegs(YM_REG_FREQ_A_LO, frame.regs, count);
+        if (_bank) _ym.commitBank(!_bankAtTick);
+        
+        if (++_position >= _numFrames) _position = _loopFrame;
+    }
+    
+    // Refill after the frame is out, a slow read now only costs buffer
+    prefetch();
+    
+    if (ready) publishStats(count, late, micros() - start);
+}
+
+bool YMPlayer::getStats(PlayerStats& stats) const {
+    return _stats.read(stats);
+}
+
+void YMPlayer::resetStats() {
+    _stats.clear();
+    _lateTicks = 0;
+    _missedTicks = 0;
+    _statsJitterMax = 0;
+}
+
+void YMPlayer::publishStats(uint8_t stores, uint32_t late, uint32_t spent) {
+    if (late > _statsJitterMax) _statsJitterMax = late;
+    if (late >= _framePeriod) {
+        _lateTicks++;
+        _missedTicks += late / _framePeriod;
     }
+    
+    uint32_t sent = _ym.getBusWriteCount();
+    uint32_t writes = sent - _statsBusWrites;
+    _statsBusWrites = sent;
+    if (writes > 0xFFFF) writes = 0xFFFF;
+    
+    PlayerStats& s = _stats.edit();
+    s.stores = stores;
+    s.busWrites = writes;
+    s.coalesced = stores > writes ? stores - writes : 0;
+    s.bufferedFrames = _frameRing.count();
+    s.lateTicks = _lateTicks;
+    s.missedTicks = _missedTicks;
+    s.maxJitter = _statsJitterMax;
+    _stats.countFrame(spent, _framePeriod);
+    _stats.publish();
 }
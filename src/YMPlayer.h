@@ -1,10 +1,24 @@
 /**
  * @file YMPlayer.h
  * @brief YM file player for YM2149 chip
- * 
- * Plays .ymd files (compressed YM register dumps) on the YM2149 PSG.
- * Format: 16 bytes per frame (14 YM registers + 2 padding), plays at 50Hz
- * 
+ *
+ * Plays YM5/YM6 files (LHA -lh5- packed or plain) and .ymd files on the
+ * YM2149 PSG. A .ymd file is raw frames: 16 bytes per frame (14 YM
+ * registers + 2 padding), played at 50Hz.
+ *
+ * Frames are read in blocks into two buffers: one block plays while
+ * prefetch() fills the other with the frames that follow it (the loop
+ * frame's block at the end of the song), so the file is touched once per
+ * block and looping or seeking into a buffered block costs no I/O.
+ *
+ * YM5/YM6 files are unpacked while they play, so they stay compressed in
+ * flash. A packed block is decoded in steps of YM_UNPACK_STEP bytes, one
+ * or two per prefetch(), gathering the block's register runs as the
+ * stream passes them. Frames stored one register at a time over the whole
+ * song need a pass over most of the packed song per block; setCacheFile()
+ * lets those passes write the unpacked frames to a file once, in the same
+ * steps, and blocks are then read from it.
+ *
  * @author GadgetFactory
  * @license GPL-3.0
  */
@@ -15,13 +29,74 @@
 #include <Arduino.h>
 #include <LittleFS.h>
 #include "YM2149.h"
+#include "FrameRing.h"
+#include "LH5Decoder.h"
+#include "PlayerStats.h"
+
+// Frames read ahead of playback (power of two)
+#define YM_FRAME_RING_SIZE      32
+#define YM_DEFAULT_LOOK_AHEAD   8
+
+// Bytes per frame block, two blocks are allocated (16 bytes per frame)
+#ifndef YM_DEFAULT_BLOCK_SIZE
+#define YM_DEFAULT_BLOCK_SIZE   4096
+#endif
+
+// RAM for the digidrum samples of one tune, larger drums are left out
+#ifndef YM_DIGIDRUM_MAX_BYTES
+#define YM_DIGIDRUM_MAX_BYTES   16384
+#endif
+
+// Unpacked bytes one step of a packed block fill decodes
+#ifndef YM_UNPACK_STEP
+#define YM_UNPACK_STEP          2048
+#endif
+
+#define YM_CACHE_PATH_MAX       32
+
+// Bytes of extra data and digidrums one loadStep() reads
+#ifndef YM_LOAD_STEP
+#define YM_LOAD_STEP            1024
+#endif
+
+#define YM_MAX_DIGIDRUMS        32          // Drum numbers are 5 bits
+#define YM_MFP_CLOCK_HZ         2457600UL   // Atari ST timer clock for drum rates
+
+// YM5/YM6 song attributes
+#define YM_ATTR_INTERLEAVED     0x01
+#define YM_ATTR_DRUM_SIGNED     0x02
+#define YM_ATTR_DRUM_4BIT       0x04
+
+// Called when a frame starts a digidrum: unsigned 8-bit samples at rate Hz
+typedef void (*YMDigiDrumHandler)(uint8_t voice, const uint8_t* sample, uint32_t length, uint32_t rate);
+
+// Song info of a file, see YMPlayer::readInfo()
+struct YMInfo {
+    uint8_t version;        // 5 or 6, 0 for a .ymd register dump
+    bool packed;            // LHA -lh5- compressed
+    uint32_t numFrames;
+    uint32_t loopFrame;
+    uint16_t frameRate;     // Frames per second
+    uint32_t clock;         // YM clock the tune was made for
+    char title[33];
+    char author[33];
+    char comment[33];
+};
 
 class YMPlayer {
 public:
     YMPlayer(YM2149& ym);
+    ~YMPlayer();
     
     bool begin();
     bool loadFile(const char* filename);
+    
+    // loadFile() in pieces: startLoad() reads the headers, then each
+    // loadStep() up to YM_LOAD_STEP bytes of extra data and digidrums,
+    // until isLoading() is false. Either returns false if the file failed.
+    bool startLoad(const char* filename);
+    bool loadStep();
+    bool isLoading() const { return _loading; }
     void play();
     void stop();
     void pause();
@@ -29,25 +104,219 @@ public:
     bool isPlaying() const { return _playing; }
     bool isPaused() const { return _paused; }
     
-    // Call this at 50Hz to update YM registers
+    // Read the first frames ahead before play(), which then starts with no
+    // file read. A player that is not playing loads without touching the
+    // chip, so two players can share one YM2149.
+    void cue();
+    bool isCued() const { return _cued; }
+    
+    // The first frame play() needs is read. A packed block takes a step
+    // per prefetch() call, see YM_UNPACK_STEP.
+    bool isReady() const;
+    
+    // A block could not be read from the file since loading
+    bool hasFailed() const { return _fillFailed; }
+    
+    // Call this every getFramePeriod() microseconds to update YM registers
     void update();
     
+    // Call from loop() as often as possible to read frames ahead
+    void prefetch();
+    
+    // Frames to keep read ahead (0 = read at the tick, max YM_FRAME_RING_SIZE)
+    void setLookAhead(uint8_t frames);
+    uint8_t getBufferedFrames() const { return _frameRing.count(); }
+    
+    // Ticks that found no frame ready and had to read from the file
+    uint32_t getUnderruns() const { return _underruns; }
+    
+    // Statistics of the last frame update() played, safe to read from any
+    // task. Each update() counts as a tick; no 6502, so cycles stay 0.
+    bool getStats(PlayerStats& stats) const;
+    void resetStats();
+    
+    // Bytes per block (rounded down to whole frames), applies from the next loadFile()
+    void setBlockSize(uint16_t bytes);
+    
+    // File the frames of a packed, interleaved tune are unpacked to while
+    // the first block fills, applies from the next loadFile(). Each player
+    // needs its own. Off (NULL) by default: every block unpacks the song.
+    void setCacheFile(const char* path);
+    
+    // Blocks read from the file since loading
+    uint32_t getBlockReads() const { return _blockReads; }
+    
+    // Continue with frame number 'frame' (past the end: the loop frame)
+    void seek(uint32_t frame);
+    
+    // Next frame update() plays
+    uint32_t getPosition() const { return _position; }
+    
+    // Play every speed-th frame, one per update() (0 or 1 = normal playback).
+    // An envelope restart in a skipped frame is sent with the played one.
+    void setFastForward(uint8_t speed) { _fastForward = speed; }
+    uint8_t getFastForward() const { return _fastForward; }
+    
+    // Frame playback continues from after the last one (0 for .ymd)
+    void setLoopFrame(uint32_t frame);
+    
     void setVolume(uint8_t vol);
     uint8_t getVolume() const { return _volume; }
     
+    // Stage each frame in the gateware register bank and commit it whole,
+    // at once or on the next frame_tick (atTick). Applies from play().
+    void setRegisterBank(bool enable, bool atTick = false);
+    bool isRegisterBankEnabled() const { return _bank; }
+    
+    // Song info, from the YM5/YM6 header (empty for .ymd)
+    const char* getTitle() const { return _title; }
+    const char* getAuthor() const { return _author; }
+    const char* getComment() const { return _comment; }
+    uint32_t getNumFrames() const { return _numFrames; }
+    uint32_t getLoopFrame() const { return _loopFrame; }
+    
+    // Song info of a file without loading it (unpacks up to the strings)
+    static bool readInfo(const char* filename, YMInfo& info);
+    
+    // Microseconds between frames (20000 unless the header says otherwise)
+    uint32_t getFramePeriod() const { return _framePeriod; }
+    
+    // Digidrums are not played on the PSG itself, the handler gets each one
+    void setDigiDrumHandler(YMDigiDrumHandler handler) { _drumHandler = handler; }
+    uint8_t getNumDigiDrums() const { return _numDrums; }
+    
 private:
+    struct YMFrame {
+        uint8_t regs[16];   // 14 YM registers, then padding or YM5/YM6 effect data
+    };
+    
+    // Unpacks the LHA member straight from the file
+    class FileDecoder : public LH5Decoder {
+    public:
+        File* file;
+    protected:
+        size_t readInput(uint8_t* buf, size_t n) { return file->read(buf, n); }
+    };
+    
+    struct FrameBlock {
+        YMFrame* frames;
+        uint32_t first;     // Number of frames[0]
+        uint16_t count;     // Frames held, 0 = empty
+    };
+    
+    struct DigiDrum {
+        uint8_t* data;
+        uint32_t length;
+    };
+    
+    enum YMFormat {
+        YM_FORMAT_YMD,
+        YM_FORMAT_YM5,
+        YM_FORMAT_YM6
+    };
+    
     YM2149& _ym;
     File _file;
     bool _playing;
     bool _paused;
+    bool _cued;                 // Frames read ahead for the next play()
     uint8_t _volume;
+    uint8_t _fastForward;
     
-    struct YMFrame {
-        uint8_t regs[14];
-        uint8_t padding[2];
-    };
+    FrameRing<YMFrame, YM_FRAME_RING_SIZE> _frameRing;
+    uint8_t _lookAhead;
+    uint32_t _underruns;
+    
+    uint8_t _format;
+    bool _packed;
+    FileDecoder _lh5;
+    uint32_t _dataOffset;       // File offset of the YM data (packed or not)
+    uint32_t _dataPos;          // Unpacked read position
+    uint32_t _frameBase;        // Unpacked offset of the first frame
+    char _cachePath[YM_CACHE_PATH_MAX];
+    File _cacheFile;            // Cache being written
+    bool _caching;              // Decoded frames go to _cacheFile
+    bool _cached;               // _file is the cache file at _cachePath
+    uint32_t _attributes;
+    uint32_t _clock;
+    uint32_t _numFrames;
+    uint32_t _loopFrame;
+    uint32_t _framePeriod;
+    uint32_t _nextFrame;        // Next frame to read into the ring
+    uint32_t _position;         // Next frame to play
+    
+    FrameBlock _blocks[2];
+    uint8_t _current;           // Block frames are taken from
+    uint16_t _blockFrames;      // Frames per block
+    uint16_t _newBlockFrames;   // Frames per block from the next load
+    uint32_t _blockReads;
+    
+    // Packed fill of the spare block in progress
+    bool _filling;
+    uint32_t _fillFirst;        // First frame of the block
+    uint8_t _fillRun;           // Register run (interleaved) being gathered
+    uint32_t _fillDone;         // Bytes of that run gathered
+    bool _fillFailed;
+    
+    // Load in progress, see loadStep()
+    bool _loading;
+    uint32_t _loadSkip;         // Extra data still to skip
+    uint16_t _loadDrums;        // Digidrums in the file
+    uint16_t _loadDrum;         // Digidrum being read
+    bool _loadSized;            // Its size has been read
+    uint32_t _loadLength;
+    uint32_t _loadDone;         // Bytes of it read
+    uint32_t _drumBytes;        // RAM the kept digidrums take
+    
+    DigiDrum _drums[YM_MAX_DIGIDRUMS];
+    uint8_t _numDrums;
+    YMDigiDrumHandler _drumHandler;
+    
+    char _title[33];
+    char _author[33];
+    char _comment[33];
+    
+    // Per-frame statistics
+    PlayerStatsCell _stats;
+    bool _tickDue;              // _nextTick holds the time of the next tick
+    uint32_t _nextTick;
+    uint32_t _statsBusWrites;   // YM bus write count at the last record
+    uint32_t _lateTicks;
+    uint32_t _missedTicks;
+    uint32_t _statsJitterMax;
+    
+    // Register bank
+    bool _bank;
+    bool _bankAtTick;
     
     bool readFrame(YMFrame& frame);
+    
+    bool openYM(const uint8_t* lha);
+    bool finishLoad();
+    bool failLoad();
+    bool stepDrum(uint32_t& budget);
+    void closeTune();
+    bool openCache();
+    void dropCache();
+    bool seekData(uint32_t offset);
+    size_t readData(uint8_t* buf, size_t n);
+    bool readString(char* dst);
+    bool allocBlocks();
+    void freeBlocks();
+    bool holds(const FrameBlock& block, uint32_t frame) const;
+    uint32_t blockLength(uint32_t first) const;
+    bool readBlock(FrameBlock& block, uint32_t first);
+    bool startFill(uint32_t first);
+    bool stepFill();
+    bool stepCache();
+    bool fillBlock(uint32_t first);
+    void refillSpare();
+    uint8_t decodeFrame(YMFrame& frame);
+    uint8_t startEffect(const YMFrame& frame, uint8_t codeReg, uint8_t predivReg, uint8_t countReg);
+    void releaseBank();
+    uint8_t startDigiDrum(const YMFrame& frame, uint8_t voice, uint8_t prediv, uint8_t count);
+    void rescaleFrame(YMFrame& frame);
+    void publishStats(uint8_t stores, uint32_t late, uint32_t spent);
 };
 
 #endif // YM_PLAYER_H
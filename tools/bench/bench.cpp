@@ -0,0 +1,391 @@
+/**
+ * @file bench.cpp
+ * @brief Host tool: measure the file players against a recording bus
+ *
+ * Plays each file through the library's player for a fixed time, one
+ * tick and update() per frame as fast as the PC allows, and reports per
+ * tune:
+ *   - 6502 instructions per second and emulated clock rate
+ *   - cycles and instructions per play call (median, 99th percentile, worst)
+ *   - wall time of update() (median, 99th percentile, worst)
+ *   - Wishbone writes and transactions per frame
+ *   - heap and player memory
+ *
+ * .sid files play through SIDPlayer, .sap files through SAPPlayer, and
+ * .ymd/.ym files through YMPlayer. The bus is the recording stand-in of
+ * tools/host, with bursts counted as one transaction.
+ *
+ * Build from the repository root:
+ *   g++ -O2 -Itools/host -Isrc -DMOS6502_COUNT_INSTRUCTIONS \
+ *       -DAUDIO_BUS_BURST_WRITE16=hostBusBurstWrite16 \
+ *       -DAUDIO_BUS_BURST_WRITE8=hostBusBurstWrite8 \
+ *       -DAUDIO_BUS_WRITE_BATCH16=hostBusWriteBatch16 \
+ *       -o bench tools/bench/bench.cpp tools/host/host.cpp src/SIDPlayer.cpp \
+ *       src/SAPPlayer.cpp src/YMPlayer.cpp src/LH5Decoder.cpp src/PagedMemory.cpp \
+ *       src/C64IO.cpp src/SID6581.cpp src/POKEY.cpp src/YM2149.cpp src/AudioBus.cpp
+ *
+ * Leave out the AUDIO_BUS_* flags to measure a transport without bursts.
+ *
+ * Usage:
+ *   bench [-s seconds] [-m direct|coalesced|timed] <file>...
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include <Arduino.h>
+#include "SID6581.h"
+#include "POKEY.h"
+#include "YM2149.h"
+#include "SIDPlayer.h"
+#include "SAPPlayer.h"
+#include "YMPlayer.h"
+#include <strings.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#define DEFAULT_SECONDS 60
+
+// Wishbone addresses, as in PapilioAudio.h
+#define BENCH_SID_BASE      0x8200
+#define BENCH_YM2149_BASE   0x8220
+#define BENCH_POKEY_BASE    0x8240
+#define BENCH_SID2_BASE     0x8280
+#define BENCH_SID3_BASE     0x82A0
+
+// Stereo SAP tunes need a second POKEY; the gateware has no slot for one
+// yet, so it takes the next free one
+#define BENCH_POKEY2_BASE   0x82C0
+
+enum BenchMode {
+    BENCH_DIRECT,
+    BENCH_COALESCED,
+    BENCH_TIMED
+};
+
+// ============================================================================
+// Measurements
+// ============================================================================
+
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t heapInUse() {
+#if defined(__GLIBC__)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief One value per frame
+ */
+struct Series {
+    uint32_t* values;
+    uint32_t count;
+    uint64_t total;
+};
+
+static bool seriesInit(Series& s, uint32_t frames) {
+    s.values = (uint32_t*)malloc(frames * sizeof(uint32_t));
+    s.count = 0;
+    s.total = 0;
+    return s.values != NULL;
+}
+
+static void seriesAdd(Series& s, uint64_t value) {
+    if (value > 0xFFFFFFFFUL) value = 0xFFFFFFFFUL;
+    s.values[s.count++] = (uint32_t)value;
+    s.total += value;
+}
+
+static int compareValues(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts the series
+static void seriesPrint(Series& s, const char* label, double scale, const char* unit) {
+    if (!s.count) return;
+    qsort(s.values, s.count, sizeof(uint32_t), compareValues);
+    printf("  %-18s mean %9.1f  p50 %9.1f  p99 %9.1f  max %9.1f%s\n", label,
+           (double)s.total / s.count * scale,
+           s.values[s.count / 2] * scale,
+           s.values[(uint32_t)((uint64_t)s.count * 99 / 100)] * scale,
+           s.values[s.count - 1] * scale, unit);
+}
+
+static void seriesFree(Series& s) {
+    free(s.values);
+    s.values = NULL;
+}
+
+/**
+ * @brief Per-frame samples of one run
+ */
+struct Run {
+    Series cycles;              // 6502 cycles of the play call
+    Series instructions;        // 6502 instructions of the play call
+    Series nanos;               // Wall time of update()
+    Series writes;              // Register writes on the bus
+    Series transactions;        // Bus transactions
+    uint64_t cpuNanos;          // Time spent in update()
+};
+
+static bool runInit(Run& run, uint32_t frames) {
+    run.cpuNanos = 0;
+    return seriesInit(run.cycles, frames) && seriesInit(run.instructions, frames) &&
+           seriesInit(run.nanos, frames) && seriesInit(run.writes, frames) &&
+           seriesInit(run.transactions, frames);
+}
+
+static void runFree(Run& run) {
+    seriesFree(run.cycles);
+    seriesFree(run.instructions);
+    seriesFree(run.nanos);
+    seriesFree(run.writes);
+    seriesFree(run.transactions);
+}
+
+// Bus traffic and wall time of one update()
+template <class Player>
+static void timeUpdate(Player& player, Run& run) {
+    hostBusReset();
+    uint64_t start = nowNanos();
+    player.update();
+    uint64_t elapsed = nowNanos() - start;
+
+    run.cpuNanos += elapsed;
+    seriesAdd(run.nanos, elapsed);
+    seriesAdd(run.writes, hostBus.writes);
+    seriesAdd(run.transactions, hostBus.transactions);
+}
+
+// One tick per frame through the 6502 player's update()
+template <class Player>
+static void playFrames(Player& player, Run& run, uint32_t frames) {
+    for (uint32_t i = 0; i < frames; i++) {
+        uint64_t instr = player.getInstructionCount();
+        player.timerCallback();
+        timeUpdate(player, run);
+        if (player.watchdogTripped()) break;
+        seriesAdd(run.cycles, player.getRoutineCycles());
+        seriesAdd(run.instructions, player.getInstructionCount() - instr);
+    }
+}
+
+static void printRun(Run& run, size_t heap, size_t ram, size_t object) {
+    double seconds = run.cpuNanos / 1e9;
+    if (run.instructions.total && seconds > 0) {
+        printf("  6502               %.2f M instructions/s, %.1f MHz emulated\n",
+               run.instructions.total / seconds / 1e6, run.cycles.total / seconds / 1e6);
+    }
+    if (run.cycles.total) {
+        seriesPrint(run.cycles, "cycles/call", 1, "");
+    }
+    if (run.instructions.total) {
+        seriesPrint(run.instructions, "instructions/call", 1, "");
+    }
+    seriesPrint(run.nanos, "update()", 1e-3, " us");
+    seriesPrint(run.writes, "bus writes/frame", 1, "");
+    seriesPrint(run.transactions, "transactions/frame", 1, "");
+    printf("  memory             heap %u B after load, 6502 RAM %u B, player object %u B\n",
+           (unsigned)heap, (unsigned)ram, (unsigned)object);
+}
+
+// ============================================================================
+// Players
+// ============================================================================
+
+static uint8_t fileBuffer[65536 + 0x7C];
+
+static size_t readFile(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return 0;
+    }
+    size_t length = fread(fileBuffer, 1, sizeof(fileBuffer), in);
+    fclose(in);
+    return length;
+}
+
+static bool benchSID(const char* path, uint32_t seconds, BenchMode mode) {
+    size_t length = readFile(path);
+    if (!length) return false;
+
+    size_t heap = heapInUse();
+    SID6581 sid(BENCH_SID_BASE), sid2(BENCH_SID2_BASE), sid3(BENCH_SID3_BASE);
+    SIDPlayer* player = new SIDPlayer(&sid, &sid2, &sid3);
+    player->begin();
+    if (!player->loadFromMemory(fileBuffer, length)) {
+        fprintf(stderr, "%s: not a playable SID file\n", path);
+        delete player;
+        return false;
+    }
+
+    player->setCycleBudget(0);
+    if (mode == BENCH_TIMED) {
+        player->setHardwareQueue(true);
+        player->setWriteMode(SID_WRITE_TIMED);
+    } else {
+        player->setWriteMode(mode == BENCH_COALESCED ? SID_WRITE_COALESCED : SID_WRITE_DIRECT);
+    }
+    player->play(true);
+
+    // The init routine runs in the first update(), before any tick
+    player->update();
+    uint32_t initCycles = player->getRoutineCycles();
+
+    uint32_t frames = (uint64_t)seconds * 1000000UL / player->getPlayPeriod();
+    heap = heapInUse() - heap;
+    Run run;
+    if (!runInit(run, frames)) {
+        delete player;
+        return false;
+    }
+    playFrames(*player, run, frames);
+
+    printf("%s: \"%s\", %u SID%s, %u frames of %u us, init %u cycles\n", path,
+           player->getTitle(), player->getNumSIDs(), player->getNumSIDs() > 1 ? "s" : "",
+           (unsigned)run.nanos.count, (unsigned)player->getPlayPeriod(), (unsigned)initCycles);
+    if (player->watchdogTripped()) printf("  stopped by the watchdog\n");
+    printRun(run, heap, player->getMemoryUsage(), sizeof(SIDPlayer));
+
+    runFree(run);
+    delete player;
+    return true;
+}
+
+static bool benchSAP(const char* path, uint32_t seconds, BenchMode mode) {
+    size_t length = readFile(path);
+    if (!length) return false;
+
+    size_t heap = heapInUse();
+    POKEY pokey(BENCH_POKEY_BASE), pokey2(BENCH_POKEY2_BASE);
+    SAPPlayer* player = new SAPPlayer(&pokey, &pokey2);
+    player->begin();
+    if (!player->loadFromMemory(fileBuffer, length)) {
+        fprintf(stderr, "%s: not a playable SAP file\n", path);
+        delete player;
+        return false;
+    }
+
+    player->setCycleBudget(0);
+    static const SAPWriteMode modes[] = { SAP_WRITE_DIRECT, SAP_WRITE_COALESCED, SAP_WRITE_TIMED };
+    player->setWriteMode(modes[mode]);
+    player->play(true);
+
+    player->update();
+    uint32_t initCycles = player->getRoutineCycles();
+
+    uint32_t frames = (uint64_t)seconds * 1000000UL / player->getPlayPeriod();
+    heap = heapInUse() - heap;
+    Run run;
+    if (!runInit(run, frames)) {
+        delete player;
+        return false;
+    }
+    playFrames(*player, run, frames);
+
+    printf("%s: \"%s\", %s, %u frames of %u us, init %u cycles\n", path,
+           player->getTitle(), player->isStereo() ? "stereo" : "mono",
+           (unsigned)run.nanos.count, (unsigned)player->getPlayPeriod(), (unsigned)initCycles);
+    if (player->watchdogTripped()) printf("  stopped by the watchdog\n");
+    printRun(run, heap, player->getMemoryUsage(), sizeof(SAPPlayer));
+
+    runFree(run);
+    delete player;
+    return true;
+}
+
+static bool benchYM(const char* path, uint32_t seconds) {
+    size_t heap = heapInUse();
+    YM2149 ym(BENCH_YM2149_BASE);
+    YMPlayer* player = new YMPlayer(ym);
+    ym.begin();
+    player->begin();
+    if (!player->loadFile(path)) {
+        delete player;
+        return false;
+    }
+    player->play();
+
+    uint32_t frames = (uint64_t)seconds * 1000000UL / player->getFramePeriod();
+    heap = heapInUse() - heap;
+    Run run;
+    if (!runInit(run, frames)) {
+        delete player;
+        return false;
+    }
+    for (uint32_t i = 0; i < frames; i++) {
+        timeUpdate(*player, run);
+    }
+
+    printf("%s: \"%s\", %u frames of %u us, %u digidrums\n", path, player->getTitle(),
+           (unsigned)run.nanos.count, (unsigned)player->getFramePeriod(),
+           player->getNumDigiDrums());
+    printRun(run, heap, 0, sizeof(YMPlayer));
+
+    runFree(run);
+    delete player;
+    return true;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static bool hasExtension(const char* path, const char* ext) {
+    size_t n = strlen(path), m = strlen(ext);
+    return n >= m && strcasecmp(path + n - m, ext) == 0;
+}
+
+int main(int argc, char** argv) {
+    uint32_t seconds = DEFAULT_SECONDS;
+    BenchMode mode = BENCH_DIRECT;
+
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!strcmp(argv[arg], "-s")) {
+            seconds = strtoul(argv[arg + 1], NULL, 0);
+        } else if (!strcmp(argv[arg], "-m") && !strcmp(argv[arg + 1], "direct")) {
+            mode = BENCH_DIRECT;
+        } else if (!strcmp(argv[arg], "-m") && !strcmp(argv[arg + 1], "coalesced")) {
+            mode = BENCH_COALESCED;
+        } else if (!strcmp(argv[arg], "-m") && !strcmp(argv[arg + 1], "timed")) {
+            mode = BENCH_TIMED;
+        } else {
+            break;
+        }
+    }
+    if (arg >= argc || argv[arg][0] == '-') {
+        fprintf(stderr, "usage: %s [-s seconds] [-m direct|coalesced|timed] <file>...\n", argv[0]);
+        return 1;
+    }
+
+    int failed = 0;
+    for (; arg < argc; arg++) {
+        const char* path = argv[arg];
+        bool ok;
+        if (hasExtension(path, ".sid")) {
+            ok = benchSID(path, seconds, mode);
+        } else if (hasExtension(path, ".sap")) {
+            ok = benchSAP(path, seconds, mode);
+        } else if (hasExtension(path, ".ymd") || hasExtension(path, ".ym")) {
+            ok = benchYM(path, seconds);
+        } else {
+            fprintf(stderr, "%s: unknown file type\n", path);
+            ok = false;
+        }
+        if (!ok) failed++;
+    }
+    return failed ? 1 : 0;
+}
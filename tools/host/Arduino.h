@@ -0,0 +1,69 @@
+/**
+ * @file Arduino.h
+ * @brief Minimal Arduino core for building the library on a PC
+ *
+ * Only what the library sources use: fixed-width types, Print/Serial,
+ * millis()/micros() and constrain(). Used by the host tools; never on
+ * the board.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define PROGMEM
+#define IRAM_ATTR
+#define HEX 16
+#define DEC 10
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t println() { return write('\n'); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+    template <typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+/**
+ * @brief Print that writes to a stdio stream
+ */
+class StdioPrint : public Print {
+public:
+    StdioPrint(FILE* f) : _f(f) {}
+    size_t write(uint8_t c) { return fputc(c, _f) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) { return fwrite(buffer, 1, size, _f); }
+
+private:
+    FILE* _f;
+};
+
+extern StdioPrint Serial;
+
+#endif // HOST_ARDUINO_H
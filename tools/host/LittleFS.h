@@ -0,0 +1,62 @@
+/**
+ * @file LittleFS.h
+ * @brief Host stand-in for the LittleFS file system
+ *
+ * Opens files of the PC's file system, so the players that stream from
+ * flash run unchanged. Paths are host paths. As on the board, a File
+ * is a handle: copies share the open file and close() ends it for all.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+#include "Arduino.h"
+
+class File {
+public:
+    File() : _fp(NULL) {}
+    explicit File(FILE* fp) : _fp(fp) {}
+
+    operator bool() const { return _fp != NULL; }
+
+    size_t read(uint8_t* buf, size_t size) { return _fp ? fread(buf, 1, size, _fp) : 0; }
+    int read() { return _fp ? fgetc(_fp) : -1; }
+    size_t write(const uint8_t* buf, size_t size) { return _fp ? fwrite(buf, 1, size, _fp) : 0; }
+
+    bool seek(uint32_t pos) { return _fp && fseek(_fp, pos, SEEK_SET) == 0; }
+    size_t position() const { return _fp ? ftell(_fp) : 0; }
+    size_t size() const;
+
+    void close() {
+        if (_fp) fclose(_fp);
+        _fp = NULL;
+    }
+
+private:
+    FILE* _fp;
+};
+
+class HostFS {
+public:
+    bool begin(bool formatOnFail = false) {
+        (void)formatOnFail;
+        return true;
+    }
+
+    /**
+     * @brief Open a file
+     * @param path Host path
+     * @param mode "r", "w" or "a"
+     */
+    File open(const char* path, const char* mode = "r");
+
+    bool exists(const char* path);
+    bool remove(const char* path);
+};
+
+extern HostFS LittleFS;
+
+#endif // HOST_LITTLEFS_H
@@ -0,0 +1,56 @@
+/**
+ * @file WishboneSPI.h
+ * @brief Host stand-in for the Wishbone-over-SPI master
+ *
+ * Writes go nowhere and reads return 0, so the player code runs
+ * unchanged on a PC. Every transaction is counted in hostBus, and an
+ * optional trace function sees each register write in bus order.
+ *
+ * The burst and batch functions below stand in for the SPI master's
+ * multi-register primitives. Point the AudioBus hooks at them to count
+ * bursts as single transactions:
+ *   -DAUDIO_BUS_BURST_WRITE16=hostBusBurstWrite16
+ *   -DAUDIO_BUS_BURST_WRITE8=hostBusBurstWrite8
+ *   -DAUDIO_BUS_WRITE_BATCH16=hostBusWriteBatch16
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef HOST_WISHBONE_SPI_H
+#define HOST_WISHBONE_SPI_H
+
+#include <stdint.h>
+
+struct AudioBusWrite;
+
+/**
+ * @brief Bus traffic since the last hostBusReset()
+ */
+struct HostBusCounters {
+    uint32_t transactions;      // Single accesses, bursts and batches
+    uint32_t writes;            // Register values written
+    uint32_t reads;
+    uint32_t bursts;            // Multi-register bursts and batches
+};
+
+extern HostBusCounters hostBus;
+
+/**
+ * @brief Called for every register write, in bus order
+ */
+typedef void (*HostBusTrace)(uint16_t addr, uint8_t value);
+
+void hostBusReset();
+void hostBusSetTrace(HostBusTrace trace);
+
+void wishboneWrite16(uint16_t addr, uint16_t data);
+uint16_t wishboneRead16(uint16_t addr);
+void wishboneWrite8(uint16_t addr, uint8_t data);
+uint8_t wishboneRead8(uint16_t addr);
+
+void hostBusBurstWrite16(uint16_t addr, const uint8_t* data, uint8_t count);
+void hostBusBurstWrite8(uint16_t addr, const uint8_t* data, uint8_t count);
+void hostBusWriteBatch16(const AudioBusWrite* writes, uint16_t count);
+
+#endif // HOST_WISHBONE_SPI_H
@@ -0,0 +1,146 @@
+/**
+ * @file host.cpp
+ * @brief Host implementations of the Arduino, LittleFS and Wishbone stand-ins
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "Arduino.h"
+#include "LittleFS.h"
+#include "WishboneSPI.h"
+#include "AudioBus.h"
+#include <sys/stat.h>
+#include <time.h>
+
+StdioPrint Serial(stderr);
+
+// ============================================================================
+// Arduino core
+// ============================================================================
+
+static uint64_t monotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+    return monotonicMicros() / 1000;
+}
+
+unsigned long micros() {
+    return monotonicMicros();
+}
+
+void delay(unsigned long ms) {
+    struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+size_t Print::print(long n, int base) {
+    if (n < 0) {
+        return write('-') + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    do {
+        uint8_t digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n);
+    return print(p);
+}
+
+// ============================================================================
+// File system
+// ============================================================================
+
+HostFS LittleFS;
+
+size_t File::size() const {
+    struct stat st;
+    if (!_fp || fstat(fileno(_fp), &st) != 0) return 0;
+    return st.st_size;
+}
+
+File HostFS::open(const char* path, const char* mode) {
+    const char* hostMode = "rb";
+    if (mode[0] == 'w') hostMode = "wb";
+    if (mode[0] == 'a') hostMode = "ab";
+    return File(fopen(path, hostMode));
+}
+
+bool HostFS::exists(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+bool HostFS::remove(const char* path) {
+    return ::remove(path) == 0;
+}
+
+// ============================================================================
+// Wishbone bus
+// ============================================================================
+
+HostBusCounters hostBus;
+static HostBusTrace busTrace;
+
+void hostBusReset() {
+    memset(&hostBus, 0, sizeof(hostBus));
+}
+
+void hostBusSetTrace(HostBusTrace trace) {
+    busTrace = trace;
+}
+
+static void recordWrite(uint16_t addr, uint8_t value) {
+    hostBus.writes++;
+    if (busTrace) busTrace(addr, value);
+}
+
+void wishboneWrite16(uint16_t addr, uint16_t data) {
+    hostBus.transactions++;
+    recordWrite(addr, data);
+}
+
+uint16_t wishboneRead16(uint16_t addr) {
+    (void)addr;
+    hostBus.transactions++;
+    hostBus.reads++;
+    return 0;
+}
+
+void wishboneWrite8(uint16_t addr, uint8_t data) {
+    hostBus.transactions++;
+    recordWrite(addr, data);
+}
+
+uint8_t wishboneRead8(uint16_t addr) {
+    (void)addr;
+    hostBus.transactions++;
+    hostBus.reads++;
+    return 0;
+}
+
+void hostBusBurstWrite16(uint16_t addr, const uint8_t* data, uint8_t count) {
+    hostBus.transactions++;
+    hostBus.bursts++;
+    for (uint8_t i = 0; i < count; i++) recordWrite(addr + i, data[i]);
+}
+
+void hostBusBurstWrite8(uint16_t addr, const uint8_t* data, uint8_t count) {
+    hostBusBurstWrite16(addr, data, count);
+}
+
+void hostBusWriteBatch16(const AudioBusWrite* writes, uint16_t count) {
+    hostBus.transactions++;
+    hostBus.bursts++;
+    for (uint16_t i = 0; i < count; i++) recordWrite(writes[i].addr, writes[i].value);
+}
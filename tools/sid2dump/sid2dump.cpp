@@ -0,0 +1,73 @@
+/**
+ * @file sid2dump.cpp
+ * @brief Host tool: convert a PSID or RSID tune into a SID register dump
+ *
+ * Runs the library's SIDPlayer on the PC and writes the frames through
+ * SIDTranscoder, producing the same file an on-device transcode would.
+ *
+ * Build from the repository root:
+ *   g++ -O2 -Itools/host -Isrc -o sid2dump tools/sid2dump/sid2dump.cpp \
+ *       tools/host/host.cpp src/SIDPlayer.cpp src/SIDDump.cpp src/PagedMemory.cpp \
+ *       src/C64IO.cpp src/SID6581.cpp src/AudioBus.cpp
+ *
+ * Usage:
+ *   sid2dump <in.sid> <out.sdd> [seconds] [subsong]
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include <Arduino.h>
+#include "SID6581.h"
+#include "SIDPlayer.h"
+#include "SIDDump.h"
+
+#define DEFAULT_SECONDS 180
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <in.sid> <out.sdd> [seconds] [subsong]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t seconds = argc > 3 ? strtoul(argv[3], NULL, 0) : DEFAULT_SECONDS;
+    uint8_t subSong = argc > 4 ? strtoul(argv[4], NULL, 0) : 0;
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    static uint8_t tune[65536 + 0x7C];
+    size_t length = fread(tune, 1, sizeof(tune), in);
+    fclose(in);
+
+    SID6581 sid;
+    SIDPlayer player(&sid);
+    player.begin();
+    if (!player.loadFromMemory(tune, length, subSong)) {
+        fprintf(stderr, "%s: not a playable SID file\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    StdioPrint dump(out);
+    // Rate from the header; a rate set by the init routine is not known yet
+    uint32_t frames = (uint64_t)seconds * 1000000UL / player.getPlayPeriod();
+    uint32_t written = SIDTranscoder::transcode(player, dump, frames);
+    long size = ftell(out);
+    fclose(out);
+
+    if (written < frames) {
+        fprintf(stderr, "warning: tune stopped after %u frames\n", (unsigned)written);
+    }
+    printf("%s: %u frames, %ld bytes (%.1f bytes/frame)\n", player.getTitle(),
+           (unsigned)written, size, written ? (double)(size - SID_DUMP_HEADER_SIZE) / written : 0.0);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file TestSID.h
+ * @brief Host test helper: a one-song PSID around a short program
+ *
+ * Wraps a program in a PSID header loading at TEST_SID_LOAD, with init at
+ * the load address and play one byte after it (so a program starts with
+ * the RTS of init), and drives a player on one SID through the frames of
+ * a test while the bus trace is on.
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#ifndef TEST_SID_H
+#define TEST_SID_H
+
+#include <Arduino.h>
+#include "SID6581.h"
+#include "SIDPlayer.h"
+
+#define TEST_SID_LOAD       0x1000
+#define TEST_SID_DATA       0x7C                // PSID v2 header size
+#define TEST_SID_MAX        256                 // Program bytes
+
+class TestSID {
+public:
+    SID6581 sid;
+    SIDPlayer player;
+
+    TestSID() : player(&sid) {}
+
+    /**
+     * @brief Load a program and run its init and first play call
+     * @param program 6502 code for TEST_SID_LOAD on
+     * @param length Code length in bytes
+     * @param mode Write mode set before playback starts
+     * @param hwQueue Use the gateware FIFO in SID_WRITE_TIMED
+     * @return false (with a message) if the tune did not load
+     */
+    bool start(const uint8_t* program, size_t length, SIDWriteMode mode, bool hwQueue = false) {
+        if (length > TEST_SID_MAX) length = TEST_SID_MAX;
+        memset(_tune, 0, sizeof(_tune));
+        memcpy(_tune, "PSID", 4);
+        _tune[5] = 2;                               // Version
+        _tune[7] = TEST_SID_DATA;                   // Data offset
+        _tune[10] = TEST_SID_LOAD >> 8;             // Init address
+        _tune[12] = TEST_SID_LOAD >> 8;             // Play address
+        _tune[13] = (TEST_SID_LOAD + 1) & 0xFF;
+        _tune[15] = 1;                              // Songs
+        _tune[17] = 1;                              // Start song
+        _tune[TEST_SID_DATA] = TEST_SID_LOAD & 0xFF;    // Load address
+        _tune[TEST_SID_DATA + 1] = TEST_SID_LOAD >> 8;
+        memcpy(&_tune[TEST_SID_DATA + 2], program, length);
+
+        player.begin();
+        if (!player.loadFromMemory(_tune, TEST_SID_DATA + 2 + length)) {
+            fprintf(stderr, "FAIL: test tune did not load\n");
+            return false;
+        }
+        player.setHardwareQueue(hwQueue);
+        player.setWriteMode(mode);
+        player.play(true);
+        player.update();
+        return true;
+    }
+
+    /**
+     * @brief Play frames with every bus write going to a trace function
+     * @param frames Timer ticks to play
+     * @param trace Called with each bus address and value
+     */
+    void run(uint32_t frames, void (*trace)(uint16_t addr, uint8_t value)) {
+        hostBusSetTrace(trace);
+        for (uint32_t i = 0; i < frames; i++) {
+            player.timerCallback();
+            player.update();
+        }
+        hostBusSetTrace(NULL);
+    }
+
+private:
+    uint8_t _tune[TEST_SID_DATA + 2 + TEST_SID_MAX];
+};
+
+#endif // TEST_SID_H
@@ -0,0 +1,72 @@
+/**
+ * @file coalesced_gate_test.cpp
+ * @brief Host test: gate edges inside one play call survive SID_WRITE_COALESCED
+ *
+ * The play routine pulses voice 1's gate (0-1-0) and releases and
+ * retriggers voice 2 (1-0-1) in every call, then stores to $D41B. The
+ * merged values alone would hide voice 1's pulse, so the bus must see
+ * both voices gated on once per call, and nothing above $D418.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Itools/host -Isrc -o coalesced_gate_test tools/test/coalesced_gate_test.cpp \
+ *       tools/host/host.cpp src/SIDPlayer.cpp src/PagedMemory.cpp src/C64IO.cpp \
+ *       src/SID6581.cpp src/AudioBus.cpp
+ *   ./coalesced_gate_test
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "TestSID.h"
+
+#define TEST_FRAMES     100
+
+// init: RTS. play: voice 1 gate on, off; voice 2 gate off, on; STA $D41B; RTS
+static const uint8_t program[] = {
+    0x60,
+    0xA9, 0x11, 0x8D, 0x04, 0xD4, 0xA9, 0x10, 0x8D, 0x04, 0xD4,
+    0xA9, 0x10, 0x8D, 0x0B, 0xD4, 0xA9, 0x11, 0x8D, 0x0B, 0xD4,
+    0x8D, 0x1B, 0xD4, 0x60
+};
+
+static uint8_t gate[2];
+static uint32_t rises[2];
+static uint32_t highWrites;
+
+static void traceWrite(uint16_t addr, uint8_t value) {
+    uint16_t reg = addr - SIDConfig::baseAddr;
+    if (reg >= SID_NUM_REGS && reg < 0x20) highWrites++;
+
+    uint8_t v = reg == SID_VOICE1_BASE + SID_VOICE_CONTROL ? 0 :
+                reg == SID_VOICE2_BASE + SID_VOICE_CONTROL ? 1 : 2;
+    if (v < 2 && (value & SID_CTRL_GATE) != gate[v]) {
+        gate[v] = value & SID_CTRL_GATE;
+        if (gate[v]) rises[v]++;
+    }
+}
+
+int main() {
+    TestSID test;
+    if (!test.start(program, sizeof(program), SID_WRITE_COALESCED)) return 1;
+
+    gate[0] = test.sid.getReg(SID_VOICE1_BASE + SID_VOICE_CONTROL) & SID_CTRL_GATE;
+    gate[1] = test.sid.getReg(SID_VOICE2_BASE + SID_VOICE_CONTROL) & SID_CTRL_GATE;
+    test.run(TEST_FRAMES, traceWrite);
+
+    // Each call starts the envelope of either voice once
+    int failures = 0;
+    for (uint8_t v = 0; v < 2; v++) {
+        if (rises[v] != TEST_FRAMES) {
+            fprintf(stderr, "FAIL: voice %u gated on %u times in %u calls\n", v + 1, rises[v], TEST_FRAMES);
+            failures++;
+        }
+    }
+    if (highWrites) {
+        fprintf(stderr, "FAIL: %u writes to $D419-$D41F reached the bus\n", highWrites);
+        failures++;
+    }
+
+    if (failures) return 1;
+    printf("ok: both voices gated on in each of %u calls\n", TEST_FRAMES);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file pitch_table_test.cpp
+ * @brief Host test: the generated note tables against the hand-written ones
+ *
+ * The MIDI note tables of SIDVoice and YMVoice used to be typed in. At the
+ * default clocks (SID 1MHz, YM 2MHz) PitchTable must give the same values,
+ * except for the entries listed here, where the old table was wrong. Every
+ * generated value is the note's exact register value rounded to nearest
+ * (A4 = 440 Hz), saturated at the register width:
+ * - SID notes 0-12 were clamped to 291; they are now 137-274.
+ * - SID note 86 was 19709; exactly 19707.51, so 19708.
+ * - SID note 87 was 20897, a typo; exactly 20879.38, so 20879.
+ * - SID note 94 was 31234, a typo; exactly 31283.72, so 31284.
+ * - YM notes 0-22 held periods above 12 bits, which setFreq() wrapped;
+ *   they now saturate at 4095.
+ *
+ * Build and run from the repository root:
+ *   g++ -std=gnu++11 -Itools/host -Isrc -o pitch_table_test tools/test/pitch_table_test.cpp
+ *   ./pitch_table_test
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include <Arduino.h>
+#include "ChipConfig.h"
+
+#if SID_CLOCK_HZ != 1000000UL || YM_CLOCK_HZ != 2000000UL
+#error "The old tables were made for a 1MHz SID and a 2MHz YM2149"
+#endif
+
+struct PitchChange {
+    uint8_t first;
+    uint8_t last;
+};
+
+// The hand-written tables as they were
+static const uint16_t oldSID[PITCH_NUM_NOTES] = {
+    // 0-7
+    291, 291, 291, 291, 291, 291, 291, 291,
+    // 8-15
+    291, 291, 291, 291, 291, 291, 308, 326,
+    // 16-23
+    346, 366, 388, 411, 435, 461, 489, 518,
+    // 24-31
+    549, 581, 616, 652, 691, 732, 776, 822,
+    // 32-39
+    871, 923, 978, 1036, 1097, 1163, 1232, 1305,
+    // 40-47
+    1383, 1465, 1552, 1644, 1742, 1845, 1955, 2071,
+    // 48-55
+    2195, 2325, 2463, 2610, 2765, 2930, 3104, 3288,
+    // 56-63
+    3484, 3691, 3910, 4143, 4389, 4650, 4927, 5220,
+    // 64-71
+    5530, 5859, 6207, 6577, 6968, 7382, 7821, 8286,
+    // 72-79
+    8779, 9301, 9854, 10440, 11060, 11718, 12415, 13153,
+    // 80-87
+    13935, 14764, 15642, 16572, 17557, 18601, 19709, 20897,
+    // 88-95
+    22121, 23436, 24830, 26306, 27871, 29528, 31234, 33144,
+    // 96-103
+    35115, 37203, 39415, 41759, 44242, 46873, 49660, 52613,
+    // 104-111
+    55741, 59056, 62567, 65535, 65535, 65535, 65535, 65535,
+    // 112-119
+    65535, 65535, 65535, 65535, 65535, 65535, 65535, 65535,
+    // 120-127
+    65535, 65535, 65535, 65535, 65535, 65535, 65535, 65535,
+    // 128 (note off)
+    0
+};
+
+static const uint16_t oldYM[PITCH_NUM_NOTES] = {
+    // 0-7
+    15289, 14431, 13621, 12856, 12135, 11454, 10811, 10204,
+    // 8-15
+    9631, 9091, 8581, 8099, 7645, 7215, 6810, 6428,
+    // 16-23
+    6067, 5727, 5405, 5102, 4816, 4545, 4290, 4050,
+    // 24-31
+    3822, 3608, 3405, 3214, 3034, 2863, 2703, 2551,
+    // 32-39
+    2408, 2273, 2145, 2025, 1911, 1804, 1703, 1607,
+    // 40-47
+    1517, 1432, 1351, 1276, 1204, 1136, 1073, 1012,
+    // 48-55
+    956, 902, 851, 804, 758, 716, 676, 638,
+    // 56-63
+    602, 568, 536, 506, 478, 451, 426, 402,
+    // 64-71
+    379, 358, 338, 319, 301, 284, 268, 253,
+    // 72-79
+    239, 225, 213, 201, 190, 179, 169, 159,
+    // 80-87
+    150, 142, 134, 127, 119, 113, 106, 100,
+    // 88-95
+    95, 89, 84, 80, 75, 71, 67, 63,
+    // 96-103
+    60, 56, 53, 50, 47, 45, 42, 40,
+    // 104-111
+    38, 36, 34, 32, 30, 28, 27, 25,
+    // 112-119
+    24, 22, 21, 20, 19, 18, 17, 16,
+    // 120-127
+    15, 14, 13, 13, 12, 11, 11, 10,
+    // 128 (note off)
+    0
+};
+
+static const PitchChange sidChanges[] = { { 0, 12 }, { 86, 87 }, { 94, 94 } };
+static const PitchChange ymChanges[] = { { 0, 22 } };
+
+static bool changed(const PitchChange* changes, uint8_t count, uint8_t note) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (note >= changes[i].first && note <= changes[i].last) return true;
+    }
+    return false;
+}
+
+static int compare(const char* chip, const uint16_t* generated, const uint16_t* old,
+                   const PitchChange* changes, uint8_t count) {
+    int failures = 0;
+    for (uint8_t note = 0; note < PITCH_NUM_NOTES; note++) {
+        bool differs = generated[note] != old[note];
+        if (differs == changed(changes, count, note)) continue;
+        fprintf(stderr, "FAIL: %s note %u is %u, the old table has %u (%s)\n", chip, note,
+                generated[note], old[note], differs ? "unexpected change" : "expected a change");
+        failures++;
+    }
+    return failures;
+}
+
+int main() {
+    typedef PitchTable<SIDPitch<SID_CLOCK_HZ> > SIDNotes;
+    typedef PitchTable<YMPitch<YM_CLOCK_HZ> > YMNotes;
+
+    int failures = compare("SID", SIDNotes::notes, oldSID, sidChanges,
+                           sizeof(sidChanges) / sizeof(sidChanges[0]));
+    failures += compare("YM", YMNotes::notes, oldYM, ymChanges, sizeof(ymChanges) / sizeof(ymChanges[0]));
+
+    // The new values of the changed entries
+    static const struct { uint8_t note; uint16_t value; } sidFixed[] = {
+        { 0, 137 }, { 12, 274 }, { 86, 19708 }, { 87, 20879 }, { 94, 31284 }
+    };
+    for (uint8_t i = 0; i < sizeof(sidFixed) / sizeof(sidFixed[0]); i++) {
+        if (SIDNotes::notes[sidFixed[i].note] != sidFixed[i].value) {
+            fprintf(stderr, "FAIL: SID note %u is %u, %u expected\n", sidFixed[i].note,
+                    SIDNotes::notes[sidFixed[i].note], sidFixed[i].value);
+            failures++;
+        }
+    }
+    for (uint8_t note = 0; note <= 22; note++) {
+        if (YMNotes::notes[note] != 0x0FFF) {
+            fprintf(stderr, "FAIL: YM note %u is %u, 4095 expected\n", note, YMNotes::notes[note]);
+            failures++;
+        }
+    }
+
+    if (failures) return 1;
+    printf("ok: tables match the old ones but for the listed fixes\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file timed_queue_test.cpp
+ * @brief Host test: timed FIFO delays add up to the frame in SID clocks
+ *
+ * Plays a small PSID tune in SID_WRITE_TIMED mode with the gateware FIFO
+ * and decodes the queued entries from the bus trace. The play routine
+ * writes $D400 at the same point of every frame, so the delays between two
+ * of those entries must add up to one frame converted from 6502 cycles to
+ * SID_CLOCK_HZ, and many frames must not drift from the exact total.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Itools/host -Isrc -o timed_queue_test tools/test/timed_queue_test.cpp \
+ *       tools/host/host.cpp src/SIDPlayer.cpp src/PagedMemory.cpp src/C64IO.cpp \
+ *       src/SID6581.cpp src/AudioBus.cpp
+ *   ./timed_queue_test
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include "TestSID.h"
+
+#define TEST_FRAMES     500
+
+// init: RTS. play: INC $20; LDA $20; STA $D400; NOP x4; STA $D401; RTS
+static const uint8_t program[] = {
+    0x60,
+    0xE6, 0x20, 0xA5, 0x20, 0x8D, 0x00, 0xD4,
+    0xEA, 0xEA, 0xEA, 0xEA,
+    0x8D, 0x01, 0xD4, 0x60
+};
+
+static uint16_t pendingDelay;
+static uint32_t sinceMark;          // SID clocks since the last $D400 entry
+static bool marked;
+static uint32_t frames[TEST_FRAMES];
+static uint32_t numFrames;
+
+static void traceWrite(uint16_t addr, uint8_t value) {
+    uint16_t reg = addr - SIDConfig::baseAddr;
+    if (reg == SID_FIFO_DELAY_LO) {
+        pendingDelay = (pendingDelay & 0xFF00) | value;
+    } else if (reg == SID_FIFO_DELAY_HI) {
+        pendingDelay = (pendingDelay & 0x00FF) | ((uint16_t)value << 8);
+    } else if (reg < SID_NUM_REGS) {
+        // An entry: the staged delay returns to zero after it
+        sinceMark += pendingDelay;
+        pendingDelay = 0;
+        if (reg == 0) {
+            if (marked && numFrames < TEST_FRAMES) frames[numFrames++] = sinceMark;
+            marked = true;
+            sinceMark = 0;
+        }
+    }
+}
+
+int main() {
+    TestSID test;
+    if (!test.start(program, sizeof(program), SID_WRITE_TIMED, true)) return 1;
+    test.run(TEST_FRAMES + 1, traceWrite);
+
+    if (numFrames < TEST_FRAMES) {
+        fprintf(stderr, "FAIL: %u frames traced, %u expected\n", numFrames, TEST_FRAMES);
+        return 1;
+    }
+
+    // Each frame is the exact length rounded either way, the sum never drifts
+    uint64_t exact = (uint64_t)SID_CYCLES_PER_FRAME_PAL * SID_CLOCK_HZ;
+    uint32_t low = exact / SID_CLOCK_PAL;
+    uint64_t total = 0;
+    int failures = 0;
+    for (uint32_t i = 0; i < numFrames; i++) {
+        if (frames[i] != low && frames[i] != low + 1) {
+            if (failures++ < 5) fprintf(stderr, "FAIL: frame %u is %u SID clocks\n", i, frames[i]);
+        }
+        total += frames[i];
+    }
+    uint64_t expected = exact * numFrames / SID_CLOCK_PAL;
+    if (total + 1 < expected || total > expected + 1) {
+        fprintf(stderr, "FAIL: %u frames took %llu SID clocks, %llu expected\n", numFrames,
+                (unsigned long long)total, (unsigned long long)expected);
+        failures++;
+    }
+
+    if (failures) return 1;
+    printf("ok: %u frames, %llu SID clocks\n", numFrames, (unsigned long long)total);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * @file ym_refill_test.cpp
+ * @brief Host test: packed, interleaved YM blocks fill in bounded steps
+ *
+ * Packs a YM6 tune with its frames stored one register at a time into an
+ * LHA -lh5- file and plays it twice, through many block refills and two
+ * loops each:
+ *
+ * - Without a cache every block gathers its register runs from a pass
+ *   over the packed song, and every frame must reach the chip.
+ * - With a cache file the first block must take many prefetch() calls of
+ *   at most two YM_UNPACK_STEP steps, after which the file is emptied.
+ *   Every frame must still play, which only holds when the song was
+ *   unpacked to the cache once: a refill that went back to the packed
+ *   data would reset the decoder and read an empty file.
+ *
+ * The packer codes every byte as an 8-bit literal, which is valid -lh5-
+ * data without a compressor.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Itools/host -Isrc -o ym_refill_test tools/test/ym_refill_test.cpp \
+ *       tools/host/host.cpp src/YMPlayer.cpp src/YM2149.cpp src/LH5Decoder.cpp \
+ *       src/AudioBus.cpp
+ *   ./ym_refill_test
+ *
+ * @author GadgetFactory
+ * @license GPL-3.0
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "YM2149.h"
+#include "YMPlayer.h"
+
+#define TEST_FRAMES         2000
+#define TEST_LOOP_FRAME     700
+#define TEST_BLOCK_FRAMES   64
+#define TEST_PLAYED         (TEST_FRAMES * 3)
+#define TEST_TUNE           "/tmp/ym_refill_test.lzh"
+#define TEST_CACHE          "/tmp/ym_refill_test.tmp"
+
+// Register values a frame may hold once masked by the player
+static const uint8_t regMask[14] = {
+    0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0x1F, 0xFF,
+    0x0F, 0x0F, 0x0F, 0xFF, 0xFF, 0xFF
+};
+
+static uint8_t frameReg(uint32_t frame, uint8_t reg) {
+    if (reg == YM_REG_ENV_SHAPE) return 0xFF;   // Envelope left running
+    if (reg >= 14) return 0;                    // No effects
+    return (frame * (reg + 1) + reg * 17) & regMask[reg];
+}
+
+static uint8_t ym[34 + 3 + TEST_FRAMES * 16 + 4];
+static uint8_t packed[26 + sizeof(ym) + sizeof(ym) / 0xFFFF * 6 + 16];
+static uint32_t packedLen;
+static uint32_t bitBuf;
+static uint8_t bitCount;
+
+static void putBits(uint32_t value, uint8_t n) {
+    bitBuf = (bitBuf << n) | (value & ((1UL << n) - 1));
+    bitCount += n;
+    while (bitCount >= 8) {
+        bitCount -= 8;
+        packed[packedLen++] = bitBuf >> bitCount;
+    }
+}
+
+static void putBE(uint8_t* p, uint32_t value, uint8_t bytes) {
+    while (bytes--) p[bytes] = value, value >>= 8;
+}
+
+static bool writeTune() {
+    // YM6 header: frames, attributes, drums, clock, rate, loop frame, extra data
+    uint32_t len = 0;
+    memcpy(ym, "YM6!LeOnArD!", 12);
+    putBE(&ym[12], TEST_FRAMES, 4);
+    putBE(&ym[16], YM_ATTR_INTERLEAVED, 4);
+    putBE(&ym[22], YM_CLOCK_HZ, 4);
+    putBE(&ym[26], 50, 2);
+    putBE(&ym[28], TEST_LOOP_FRAME, 4);
+    len = 34 + 3;                               // Empty title, author and comment
+    for (uint8_t r = 0; r < 16; r++) {
+        for (uint32_t f = 0; f < TEST_FRAMES; f++) ym[len++] = frameReg(f, r);
+    }
+    memcpy(&ym[len], "End!", 4);
+    len += 4;
+
+    // Level 0 LHA header, the checksum and CRC are not checked
+    static const char name[] = "t.ym";
+    packedLen = 22 + 4 + 2;
+    for (uint32_t done = 0; done < len; ) {
+        // Blocks of one literal code, every byte in 8 bits
+        uint32_t n = len - done < 0xFFFF ? len - done : 0xFFFF;
+        putBits(n, 16);
+        putBits(0, 5);                          // Code length code: only length 8
+        putBits(8 + 2, 5);
+        putBits(256, 9);                        // 256 literals of 8 bits
+        putBits(0, 4);                          // One distance code, unused
+        putBits(0, 4);
+        for (uint32_t i = 0; i < n; i++) putBits(ym[done + i], 8);
+        done += n;
+    }
+    if (bitCount) putBits(0, 8 - bitCount);
+
+    packed[0] = 22 + 4 + 2 - 2;                 // Header bytes after the first two
+    memcpy(&packed[2], "-lh5-", 5);
+    uint32_t body = packedLen - 28;
+    for (uint8_t i = 0; i < 4; i++) {
+        packed[7 + i] = body >> (i * 8);
+        packed[11 + i] = len >> (i * 8);
+    }
+    packed[21] = 4;
+    memcpy(&packed[22], name, 4);
+
+    FILE* fp = fopen(TEST_TUNE, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(packed, 1, packedLen, fp) == packedLen;
+    return fclose(fp) == 0 && ok;
+}
+
+static uint8_t image[16];
+
+static void traceWrite(uint16_t addr, uint8_t value) {
+    uint16_t reg = addr - YMConfig::baseAddr;
+    if (reg < 16) image[reg] = value;
+}
+
+static int playTune(bool cache) {
+    int failures = 0;
+    YM2149 chip;
+    chip.begin();
+    YMPlayer player(chip);
+    player.setBlockSize(TEST_BLOCK_FRAMES * 16);
+    if (cache) player.setCacheFile(TEST_CACHE);
+    if (!player.loadFile(TEST_TUNE)) {
+        fprintf(stderr, "FAIL: test tune did not load\n");
+        return 1;
+    }
+
+    if (cache) {
+        // The first block comes with the whole cache, a few steps per call
+        player.cue();
+        uint32_t calls = 0;
+        while (!player.getBlockReads() && calls < TEST_FRAMES * 16) {
+            player.prefetch();
+            calls++;
+        }
+        uint32_t minCalls = TEST_FRAMES * 16 / (2 * YM_UNPACK_STEP);
+        if (calls < minCalls || !player.getBlockReads()) {
+            fprintf(stderr, "FAIL: first block after %u prefetch() calls, at least %u expected\n",
+                    calls, minCalls);
+            failures++;
+        }
+
+        // Whatever is read from the tune from now on is empty
+        fclose(fopen(TEST_TUNE, "wb"));
+    }
+
+    hostBusSetTrace(traceWrite);
+    player.play();
+    uint32_t frame = 0;
+    for (uint32_t i = 0; i < TEST_PLAYED; i++) {
+        player.update();
+        for (uint8_t r = 0; r < 14; r++) {
+            // Levels are scaled by the volume, R13 = 0xFF is not sent
+            if ((r >= YM_REG_LEVEL_A && r <= YM_REG_LEVEL_C) || r == YM_REG_ENV_SHAPE) continue;
+            if (image[r] != frameReg(frame, r) && failures++ < 5) {
+                fprintf(stderr, "FAIL: %s frame %u R%u is %02X, %02X expected\n", cache ? "cached" : "packed",
+                        frame, r, image[r], frameReg(frame, r));
+            }
+        }
+        if (++frame >= TEST_FRAMES) frame = TEST_LOOP_FRAME;
+    }
+    hostBusSetTrace(NULL);
+
+    uint32_t minReads = TEST_PLAYED / TEST_BLOCK_FRAMES;
+    if (player.getBlockReads() < minReads) {
+        fprintf(stderr, "FAIL: %u block reads, at least %u expected\n", player.getBlockReads(), minReads);
+        failures++;
+    }
+    printf("%s: %u frames from %u block reads\n", cache ? "cached" : "packed", TEST_PLAYED,
+           player.getBlockReads());
+    return failures;
+}
+
+int main() {
+    if (!writeTune()) {
+        fprintf(stderr, "FAIL: cannot write %s\n", TEST_TUNE);
+        return 1;
+    }
+
+    int failures = playTune(false) + playTune(true);
+    if (LittleFS.exists(TEST_CACHE)) {
+        fprintf(stderr, "FAIL: %s left behind\n", TEST_CACHE);
+        failures++;
+    }
+    remove(TEST_TUNE);
+
+    if (failures) return 1;
+    printf("ok: blocks filled in steps, the cache unpacked the song once\n");
+    return 0;
+}